@@ -1,6 +1,7 @@
 #include "cmd_attach.h"
 
 #include <stdio.h>
+#include <string.h>
 
 #include "command_processor_util.h"
 #include "tracelib/tracer_state_machine.h"
@@ -22,7 +23,86 @@ HRESULT HandleAttach(const char *command, char *response, uint32_t response_len,
   }
 
   if (CPGetUInt32("gsize", &val, &cp)) {
-    config.aux_circular_buffer_size = val;
+    for (uint32_t i = 0; i < AUX_DATA_TYPE_COUNT; ++i) {
+      config.aux_lane_sizes[i] = val;
+    }
+  }
+
+  for (uint32_t i = 0; i < AUX_DATA_TYPE_COUNT; ++i) {
+    char key[32];
+    snprintf(key, sizeof(key), "gsize_%s", AuxDataTypeName(i));
+    if (CPGetUInt32(key, &val, &cp)) {
+      config.aux_lane_sizes[i] = val;
+    }
+
+    snprintf(key, sizeof(key), "gweight_%s", AuxDataTypeName(i));
+    if (CPGetUInt32(key, &val, &cp)) {
+      config.aux_lane_weights[i] = val ? val : 1;
+    }
+  }
+
+  if (CPGetUInt32("gchunk", &val, &cp)) {
+    config.aux_chunk_size = val;
+  }
+
+  if (CPGetUInt32("spillsize", &val, &cp)) {
+    config.aux_spill_size = val;
+  }
+
+  const char *spill_path;
+  if (CPGetString("spillpath", &spill_path, &cp)) {
+    strncpy(config.aux_spill_path, spill_path,
+            sizeof(config.aux_spill_path) - 1);
+    config.aux_spill_path[sizeof(config.aux_spill_path) - 1] = 0;
+  }
+
+  if (CPGetUInt32("overwrite", &val, &cp)) {
+    config.overwrite_oldest = val != 0;
+  }
+
+  if (CPGetUInt32("stalltimeout", &val, &cp)) {
+    config.stall_timeout_milliseconds = val;
+  }
+
+  if (CPGetUInt32("queuedepth", &val, &cp)) {
+    config.max_queue_depth = val;
+  }
+
+  if (CPGetUInt32("queuelimit", &val, &cp)) {
+    config.max_queue_depth_limit = val;
+  }
+
+  if (CPGetUInt32("ffwd", &val, &cp) && val) {
+    config.max_queue_depth = 0;
+  }
+
+  if (CPGetUInt32("memlimit", &val, &cp)) {
+    config.memory_ceiling = val;
+  }
+
+  if (CPGetUInt32("segdedup", &val, &cp)) {
+    config.dedup_segments = val != 0;
+  }
+
+  if (CPGetUInt32("compact", &val, &cp)) {
+    config.compact_encoding = val != 0;
+  }
+
+  if (CPGetUInt32("coalesce", &val, &cp)) {
+    config.coalesce_repeats = val != 0;
+  }
+
+  const char *log_filter;
+  if (CPGetString("filter", &log_filter, &cp)) {
+    strncpy(config.log_filter, log_filter, sizeof(config.log_filter) - 1);
+    config.log_filter[sizeof(config.log_filter) - 1] = 0;
+  }
+
+  const char *parameter_policy;
+  if (CPGetString("ppolicy", &parameter_policy, &cp)) {
+    strncpy(config.parameter_policy, parameter_policy,
+            sizeof(config.parameter_policy) - 1);
+    config.parameter_policy[sizeof(config.parameter_policy) - 1] = 0;
   }
 
   if (CPGetUInt32("tcap", &val, &cp)) {
@@ -53,7 +133,8 @@ HRESULT HandleAttach(const char *command, char *response, uint32_t response_len,
 
   HRESULT ret = TracerCreate(&config);
   if (XBOX_SUCCESS(ret)) {
-    snprintf(response, response_len, "Tracer created");
+    snprintf(response, response_len, "Tracer created encoding=%s",
+             TracerUsesCompactEncoding() ? "compact" : "full");
   } else {
     snprintf(response, response_len, "Tracer creation failed");
   }
@@ -17,8 +17,73 @@
 //! Command string parameters:
 //!   psize - uint32 indicating the size in bytes to reserve for the pgraph
 //!           circular buffer.
-//!   gsize - uint32 indicating the size in bytes to reserve for the graphics
-//!           circular buffer.
+//!   gsize - uint32 indicating the size in bytes to reserve for each lane of
+//!           the graphics circular buffer. If `gchunk` is nonzero, this is the
+//!           maximum size to which each lane may grow.
+//!   gsize_<type> - uint32 overriding `gsize` for the lane carrying the given
+//!           type of data, where <type> is one of pgraph_dump, pfb_dump,
+//!           rdi_dump, surface, texture.
+//!   gweight_<type> - uint32 relative share of `read_aux` responses given to
+//!           the lane carrying the given type of data when several lanes have
+//!           data available. Defaults favor the small dump lanes over textures,
+//!           and textures over surfaces.
+//!   gchunk - uint32 indicating the size in bytes of the blocks in which each
+//!           lane of the graphics circular buffer is allocated on demand and
+//!           released once drained. Entries larger than a block are staged in
+//!           a temporary allocation before being copied into the lane, and each
+//!           `read_aux` response spans at most two blocks. 0 (the default)
+//!           allocates every lane up front.
+//!   spillsize - uint32 indicating the maximum number of bytes of graphics
+//!           entries to append to a file on the console when a lane of the
+//!           graphics circular buffer is full, rather than stalling. Spilled
+//!           entries are returned by `read_aux` after the lane has been
+//!           drained. 0 (the default) disables spilling.
+//!   spillpath - string path prefix of the per-lane spill files (default
+//!           "E:\ntrc_aux_spill", producing e.g.
+//!           "E:\ntrc_aux_spill_surface.bin").
+//!   overwrite - uint32 boolean indicating whether the oldest entries in the
+//!           circular buffers should be discarded when they are full instead
+//!           of stalling until they are read. See `stats` for drop counts.
+//!   stalltimeout - uint32 number of milliseconds to wait for a full circular
+//!           buffer to be read before re-sending the bytes available
+//!           notification.
+//!   queuedepth - uint32 maximum number of bytes of commands that may be
+//!           queued in the FIFO before it is run (default 200). Larger values
+//!           trace faster but give Direct3D more opportunity to perform
+//!           fixups that would not happen outside of tracing.
+//!   queuelimit - uint32 number of bytes up to which the queue depth may grow
+//!           as full queues are flushed without the title interfering with
+//!           the FIFO. The depth backs off sharply (to no less than
+//!           `queuedepth`) when the title moves PUT while the pusher is active
+//!           or the FIFO is not where the tracer expects. 0 (the default)
+//!           keeps the depth fixed. See `stats` for the depth in effect.
+//!   ffwd - uint32 boolean indicating whether the FIFO should only be run up to
+//!           hooks whose captures are enabled, flips, and the end of the
+//!           pushbuffer (equivalent to `queuedepth=0`). Every command is still
+//!           logged.
+//!   memlimit - uint32 maximum number of bytes the tracer may allocate across
+//!           its buffers, captures, and parameter copies. Captures that would
+//!           exceed the limit are skipped; see `memstats`. 0 (the default)
+//!           leaves allocations unbounded.
+//!   segdedup - uint32 boolean indicating whether pushbuffer subroutines that
+//!           repeat one already sent during the session should be sent as a
+//!           segment reference rather than in full. See `read_pgraph` for the
+//!           format. Ignored if `overwrite` is set.
+//!   compact - uint32 boolean indicating whether commands should be sent in
+//!           the compact encoding described in util/compact_command.h. The
+//!           encoding in effect is reported in the response as
+//!           "encoding=compact" or "encoding=full"; it is always full if
+//!           `overwrite` is set. Compact encoding disables `segdedup`.
+//!   coalesce - uint32 boolean indicating whether consecutive commands with
+//!           identical methods and parameters should be sent as a single
+//!           entry with a repeat count. See `read_pgraph` for the format.
+//!   filter - string of rules selecting the PGRAPH commands that are written
+//!           to the PGRAPH buffer, e.g., "-*,+97:1B00-1BFC". Commands that are
+//!           filtered out are still processed and hooked. See `filter`.
+//!   ppolicy - string of rules limiting the number of parameters of each
+//!           method that are sent, e.g., "97:1818=10,97:1800-1808=hash" (see
+//!           util/parameter_policy.h). Omitted parameters are replaced by a
+//!           hash; see `read_pgraph`. Hooks always see every parameter.
 //!   tcap - uint32 boolean indicating whether texture captures should be
 //!           performed.
 //!   dcap - uint32 boolean indicating whether depth buffer captures should be
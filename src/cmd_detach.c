@@ -2,11 +2,22 @@
 
 #include <stdio.h>
 
+#include "command_processor_util.h"
 #include "tracelib/tracer_state_machine.h"
 
 HRESULT HandleDetach(const char *command, char *response, uint32_t response_len,
                      CommandContext *ctx) {
-  TracerShutdown();
+  CommandParameters cp;
+  int32_t result = CPParseCommandParameters(command, &cp);
+  if (result < 0) {
+    return CPPrintError(result, response, response_len);
+  }
+
+  uint32_t release = 0;
+  CPGetUInt32("release", &release, &cp);
+  CPDelete(&cp);
+
+  TracerShutdown(release != 0);
   snprintf(response, response_len, "Tracer shutdown requested");
   return XBOX_S_OK;
 }
@@ -6,6 +6,13 @@
 #define CMD_DETACH "detach"
 
 // Exits the tracer and attempts to restore the xbox to a normal running state.
+//
+// The tracer thread and buffers are retained so that a subsequent `attach` with
+// the same buffer configuration can start immediately.
+//
+// Command string parameters:
+//   release - uint32 boolean indicating that the buffers should be freed
+//           rather than retained for the next session.
 HRESULT HandleDetach(const char *command, char *response, uint32_t response_len,
                      CommandContext *ctx);
 
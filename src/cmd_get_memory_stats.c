@@ -0,0 +1,30 @@
+#include "cmd_get_memory_stats.h"
+
+#include <stdio.h>
+
+#include "tracelib/tracer_memory.h"
+
+HRESULT HandleGetMemoryStats(const char *command, char *response,
+                             uint32_t response_len, CommandContext *ctx) {
+  MemoryBudgetStats stats;
+  TracerGetMemoryStats(&stats);
+
+  int written = snprintf(response, response_len,
+                         "ceiling=0x%X in_use=0x%X high_water=0x%X",
+                         stats.ceiling, stats.in_use, stats.high_water);
+  for (uint32_t i = 0;
+       i < MB_MAX_POOLS && written > 0 && written < response_len; ++i) {
+    const MemoryBudgetPoolStats *pool = &stats.pools[i];
+    if (!pool->tag) {
+      break;
+    }
+    char tag[5] = {(char)(pool->tag >> 24), (char)(pool->tag >> 16),
+                   (char)(pool->tag >> 8), (char)pool->tag, 0};
+    written += snprintf(response + written, response_len - written,
+                        " %s_in_use=0x%X %s_high_water=0x%X "
+                        "%s_over_budget=0x%X %s_failures=0x%X",
+                        tag, pool->in_use, tag, pool->high_water, tag,
+                        pool->over_budget, tag, pool->failures);
+  }
+  return XBOX_S_OK;
+}
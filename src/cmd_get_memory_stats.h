@@ -0,0 +1,24 @@
+#ifndef NV2A_TRACE_CMD_GET_MEMORY_STATS_H
+#define NV2A_TRACE_CMD_GET_MEMORY_STATS_H
+
+#include "xbdm.h"
+
+#define CMD_GET_MEMORY_STATS "memstats"
+
+// Returns statistics about the memory allocated by the tracer.
+//
+// The response is a list of space-separated key=value pairs:
+//   ceiling - The configured limit in bytes, or 0 if unbounded.
+//   in_use - The number of bytes currently allocated.
+//   high_water - The largest number of bytes ever allocated at once.
+//   <tag>_in_use, <tag>_high_water - As above, for the pool with the given
+//     four character tag (e.g., taxb for the aux buffers, ntCC for captures
+//     that were staged outside of the aux buffers).
+//   <tag>_over_budget - Number of allocations that were refused because they
+//     would have exceeded the ceiling. For ntCC this is the number of skipped
+//     captures, for ntPC the number of commands whose parameters were dropped.
+//   <tag>_failures - Number of allocations that the XBDM pool failed.
+HRESULT HandleGetMemoryStats(const char *command, char *response,
+                             uint32_t response_len, CommandContext *ctx);
+
+#endif  // NV2A_TRACE_CMD_GET_MEMORY_STATS_H
@@ -0,0 +1,64 @@
+#include "cmd_get_stats.h"
+
+#include <stdio.h>
+
+#include "tracelib/tracer_state_machine.h"
+
+HRESULT HandleGetStats(const char *command, char *response,
+                       uint32_t response_len, CommandContext *ctx) {
+  TracerStats stats;
+  TracerGetStats(&stats);
+
+  int written = snprintf(
+      response, response_len,
+      "pgraph_stalls=0x%X pgraph_stall_ms=0x%X pgraph_stall_timeouts=0x%X "
+      "aux_stalls=0x%X aux_stall_ms=0x%X aux_stall_timeouts=0x%X "
+      "pgraph_drops=0x%X pgraph_drop_bytes=0x%X aux_spills=0x%X "
+      "aux_spill_bytes=0x%X",
+      stats.pgraph.stalls, stats.pgraph.stalled_milliseconds,
+      stats.pgraph.stall_timeouts, stats.aux.stalls,
+      stats.aux.stalled_milliseconds, stats.aux.stall_timeouts,
+      stats.pgraph.dropped_records[0], stats.pgraph.dropped_bytes[0],
+      stats.aux.spilled_records, stats.aux.spilled_bytes);
+  for (uint32_t i = 0;
+       i < AUX_DATA_TYPE_COUNT && written > 0 && written < response_len; ++i) {
+    const char *name = AuxDataTypeName(i);
+    written += snprintf(response + written, response_len - written,
+                        " %s_drops=0x%X %s_drop_bytes=0x%X", name,
+                        stats.aux.dropped_records[i], name,
+                        stats.aux.dropped_bytes[i]);
+  }
+  if (written > 0 && written < response_len) {
+    written += snprintf(
+        response + written, response_len - written,
+        " param_arena_size=0x%X param_arena_high_water=0x%X "
+        "param_arena_allocs=0x%X param_arena_overflows=0x%X",
+        stats.parameter_arena.capacity, stats.parameter_arena.high_water,
+        stats.parameter_arena.allocations, stats.parameter_arena.overflows);
+  }
+  if (written > 0 && written < response_len) {
+    written += snprintf(response + written, response_len - written,
+                        " segments_defined=0x%X segments_referenced=0x%X "
+                        "segment_bytes_elided=0x%X",
+                        stats.segments_defined, stats.segments_referenced,
+                        stats.segment_bytes_elided);
+  }
+  if (written > 0 && written < response_len) {
+    written += snprintf(
+        response + written, response_len - written,
+        " pgraph_filtered=0x%X pgraph_coalesced=0x%X "
+        "pgraph_truncated=0x%X param_bytes_omitted=0x%X fifo_runs=0x%X "
+        "queue_depth=0x%X queue_depth_backoffs=0x%X",
+        stats.commands_filtered, stats.commands_coalesced,
+        stats.commands_truncated, stats.parameter_bytes_omitted,
+        stats.fifo_runs, stats.queue_depth, stats.queue_depth_backoffs);
+  }
+  if (written > 0 && written < response_len) {
+    snprintf(response + written, response_len - written,
+             " requests_started=0x%X request_latency_us=0x%X "
+             "request_latency_max_us=0x%X",
+             stats.requests_started, stats.request_latency_us,
+             stats.request_latency_max_us);
+  }
+  return XBOX_S_OK;
+}
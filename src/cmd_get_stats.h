@@ -0,0 +1,44 @@
+#ifndef NV2A_TRACE_CMD_GET_STATS_H
+#define NV2A_TRACE_CMD_GET_STATS_H
+
+#include "xbdm.h"
+
+#define CMD_GET_STATS "stats"
+
+// Returns statistics about the trace buffers.
+//
+// The response is a list of space-separated key=value pairs:
+//   <buffer>_stalls - Number of times the tracer waited for the remote to drain
+//     the buffer, where <buffer> is one of pgraph, aux.
+//   <buffer>_stall_ms - Total milliseconds spent waiting.
+//   <buffer>_stall_timeouts - Number of waits that timed out.
+//   pgraph_drops, pgraph_drop_bytes - Entries discarded from the PGRAPH buffer.
+//   aux_spills, aux_spill_bytes - Entries appended to the aux spill file.
+//   <type>_drops, <type>_drop_bytes - Entries discarded from the aux buffer,
+//     where <type> is one of pgraph_dump, pfb_dump, rdi_dump, surface, texture.
+//   param_arena_size - Number of bytes reserved for command parameters.
+//   param_arena_high_water - Largest number of parameter bytes held at once.
+//   param_arena_allocs - Parameter blocks placed in the arena.
+//   param_arena_overflows - Parameter blocks that did not fit in the arena and
+//     were allocated from the pool instead.
+//   segments_defined - Pushbuffer subroutines sent in full with a segment ID.
+//   segments_referenced - Subroutines sent as a reference to a segment.
+//   segment_bytes_elided - PGRAPH bytes saved by segment references.
+//   pgraph_filtered - Commands that were not logged due to the log filter.
+//   pgraph_coalesced - Commands logged as a repeat of the previous command.
+//   pgraph_truncated - Entries whose parameters were cut by the parameter
+//     policy.
+//   param_bytes_omitted - Parameter bytes omitted by the parameter policy.
+//   fifo_runs - Number of times the FIFO was stepped while tracing.
+//   queue_depth - Bytes that may currently be queued in the FIFO before it is
+//     run (see the `queuelimit` attach parameter).
+//   queue_depth_backoffs - Times the adaptive queue depth backed off.
+//   requests_started - Requests (e.g. waitstable, discard, trace) started by
+//     the tracer thread.
+//   request_latency_us - Microseconds between the last request being made and
+//     the tracer thread starting it.
+//   request_latency_max_us - Largest request_latency_us seen this session.
+HRESULT HandleGetStats(const char *command, char *response,
+                       uint32_t response_len, CommandContext *ctx);
+
+#endif  // NV2A_TRACE_CMD_GET_STATS_H
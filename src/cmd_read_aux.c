@@ -1,13 +1,69 @@
 #include "cmd_read_aux.h"
 
-#include <string.h>
-
 #include "command_processor_util.h"
 #include "tracelib/tracer_state_machine.h"
+#include "util/drain_scheduler.h"
 #include "xbdm_util.h"
 
 #define BUFFER_SIZE (1024 * 1024 + 4)
 
+//! The number of bytes credited to a lane for each unit of weight when it is
+//! visited by the drain scheduler.
+#define DRAIN_QUANTUM (1024 * 64)
+
+//! State of a single response, released once the response has been sent.
+typedef struct ReadAuxResponse {
+  //! Must be the first member, as the context frees itself on completion.
+  SendPrepopulatedBinaryDataContext send_context;
+  uint32_t size;
+  //! The lane from which the response is being sent.
+  AuxDataType lane;
+  //! The claim on the bytes being sent, which are consumed as XBDM sends them.
+  uint32_t claim;
+} ReadAuxResponse;
+
+//! Decides which lane each response is drained from. Protected by the aux
+//! buffer lock and reinitialized whenever the aux generation changes, as the
+//! lanes it describes have been recreated or emptied.
+static DrainScheduler scheduler;
+static uint32_t scheduler_generation;
+
+static void OnRegionBytesSent(uint32_t region_index, uint32_t bytes_sent,
+                              void* user_data);
+
+static uint32_t PeekLane(uint32_t lane, CBSpans* spans, uint32_t size,
+                         uint32_t* read_offset, void* user_data) {
+  *read_offset = TracerGetAuxLaneReadOffset(lane);
+  return TracerPeekAuxLane(lane, spans, size);
+}
+
+static uint32_t GetEntrySize(const void* header) {
+  return sizeof(AuxDataHeader) + ((const AuxDataHeader*)header)->len;
+}
+
+//! Reinitializes the scheduler if the aux lanes have changed since it was last
+//! used. Must be called while holding the aux buffer lock.
+static void SyncScheduler(void) {
+  uint32_t generation = TracerGetAuxGeneration();
+  if (generation == scheduler_generation) {
+    return;
+  }
+
+  DrainSchedulerConfig config = {
+      .lane_count = AUX_DATA_TYPE_COUNT,
+      .quantum = DRAIN_QUANTUM,
+      .header_size = sizeof(AuxDataHeader),
+      .entry_size = GetEntrySize,
+      .peek = PeekLane,
+  };
+  for (uint32_t i = 0; i < AUX_DATA_TYPE_COUNT; ++i) {
+    config.weights[i] = TracerGetAuxLaneWeight(i);
+    config.capacities[i] = TracerGetAuxLaneCapacity(i);
+  }
+  DSInit(&scheduler, &config);
+  scheduler_generation = generation;
+}
+
 HRESULT HandleReadAux(const char* command, char* response,
                       uint32_t response_len, CommandContext* ctx) {
   CommandParameters cp;
@@ -20,31 +76,55 @@ HRESULT HandleReadAux(const char* command, char* response,
   if (CPGetUInt32("maxsize", &max_size, &cp)) {
     max_size = max_size > BUFFER_SIZE ? BUFFER_SIZE : max_size;
   }
+  CPDelete(&cp);
+  if (max_size <= sizeof(uint32_t)) {
+    return XBOX_E_FAIL;
+  }
 
-  uint8_t* buffer = (uint8_t*)DmAllocatePoolWithTag(max_size, 'taxb');
-  if (!buffer) {
+  ReadAuxResponse* read_response =
+      (ReadAuxResponse*)DmAllocatePoolWithTag(sizeof(*read_response), 'taxc');
+  if (!read_response) {
     return XBOX_E_FAIL;
   }
 
+  // The lock is only held while the response is planned. The peeked bytes are
+  // claimed so that they remain valid while they are sent, without tying the
+  // lock to the remote (which may abandon the transfer at any time).
   TracerLockAuxBuffer();
-  uint32_t valid_bytes = TracerReadAuxBuffer(buffer + 4, max_size - 4);
+  SyncScheduler();
+  CBSpans spans;
+  uint32_t lane;
+  uint32_t valid_bytes = DSPlan(
+      &scheduler, max_size - sizeof(read_response->size), &lane, &spans);
+  if (valid_bytes) {
+    read_response->lane = lane;
+    read_response->claim = TracerClaimAuxLane(lane, valid_bytes);
+  }
   TracerUnlockAuxBuffer();
   if (!valid_bytes) {
-    DmFreePool(buffer);
+    DmFreePool(read_response);
     return XBOX_E_DATA_NOT_AVAILABLE;
   }
 
-  memcpy(buffer, &valid_bytes, 4);
+  read_response->size = valid_bytes;
+  SendPrepopulatedBinaryDataRegion regions[] = {
+      {&read_response->size, sizeof(read_response->size)},
+      {spans.first, spans.first_size},
+      {spans.second, spans.second_size},
+  };
+  InitializeSendPrepopulatedBinaryDataRegions(
+      ctx, &read_response->send_context, regions,
+      sizeof(regions) / sizeof(regions[0]), OnRegionBytesSent, NULL,
+      read_response, TRUE);
+  return XBOX_S_BINARY;
+}
 
-  SendPrepopulatedBinaryDataContext* send_context =
-      (SendPrepopulatedBinaryDataContext*)DmAllocatePoolWithTag(
-          sizeof(SendPrepopulatedBinaryDataContext), 'taxc');
-  if (!send_context) {
-    DmFreePool(buffer);
-    return XBOX_E_FAIL;
+static void OnRegionBytesSent(uint32_t region_index, uint32_t bytes_sent,
+                              void* user_data) {
+  // Region 0 is the size prefix, everything else is backed by the buffer.
+  if (region_index) {
+    ReadAuxResponse* read_response = (ReadAuxResponse*)user_data;
+    TracerConsumeAuxClaim(read_response->lane, read_response->claim,
+                          bytes_sent);
   }
-
-  InitializeSendPrepopulatedBinaryDataContexts(ctx, send_context, buffer,
-                                               valid_bytes + 4, TRUE, TRUE);
-  return XBOX_S_BINARY;
 }
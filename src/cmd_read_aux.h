@@ -10,6 +10,19 @@
 //! The response will be a size-prefixed binary (the first 4 bytes indicate the
 //! size, followed by data).
 //!
+//! Each type of entry is buffered in its own lane. Responses are drawn from a
+//! single lane at a time using a weighted round robin (see `gweight_<type>` in
+//! `attach`), so entries are always returned whole and in order within a type,
+//! but entries of different types may be returned out of order relative to one
+//! another; use the `packet_index` and `draw_index` of each AuxDataHeader to
+//! correlate them. An entry larger than `maxsize` is continued by subsequent
+//! responses before any other entry is returned.
+//!
+//! Entries are published to each lane atomically, so a lane never holds a
+//! partial entry unless that entry is larger than the lane's capacity.
+//! If spilling is enabled (see `attach`), spilled entries are returned once the
+//! lane has been drained.
+//!
 //! \param command - The command string received from the remote.
 //! \param response - Buffer into which an immediate response (e.g., an error
 //! message) may be written.
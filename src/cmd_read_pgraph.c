@@ -1,13 +1,23 @@
 #include "cmd_read_pgraph.h"
 
-#include <string.h>
-
 #include "command_processor_util.h"
 #include "tracelib/tracer_state_machine.h"
 #include "xbdm_util.h"
 
 #define READ_BUFFER_SIZE (1024 * 128 + 4)
 
+//! State of a single response, released once the response has been sent.
+typedef struct ReadPGRAPHResponse {
+  //! Must be the first member, as the context frees itself on completion.
+  SendPrepopulatedBinaryDataContext send_context;
+  uint32_t size;
+  //! The claim on the bytes being sent, which are consumed as XBDM sends them.
+  uint32_t claim;
+} ReadPGRAPHResponse;
+
+static void OnRegionBytesSent(uint32_t region_index, uint32_t bytes_sent,
+                              void* user_data);
+
 HRESULT HandleReadPGRAPH(const char* command, char* response,
                          uint32_t response_len, CommandContext* ctx) {
   CommandParameters cp;
@@ -20,31 +30,52 @@ HRESULT HandleReadPGRAPH(const char* command, char* response,
   if (CPGetUInt32("maxsize", &max_size, &cp)) {
     max_size = max_size > READ_BUFFER_SIZE ? READ_BUFFER_SIZE : max_size;
   }
+  CPDelete(&cp);
+  if (max_size <= sizeof(uint32_t)) {
+    return XBOX_E_FAIL;
+  }
 
-  uint8_t* buffer = (uint8_t*)DmAllocatePoolWithTag(max_size, 'tpgb');
-  if (!buffer) {
+  ReadPGRAPHResponse* read_response =
+      (ReadPGRAPHResponse*)DmAllocatePoolWithTag(sizeof(*read_response),
+                                                 'tpgc');
+  if (!read_response) {
     return XBOX_E_FAIL;
   }
 
+  // The lock is only held while the response is planned. The peeked bytes are
+  // claimed so that they remain valid while they are sent, without tying the
+  // lock to the remote (which may abandon the transfer at any time).
   TracerLockPGRAPHBuffer();
-  uint32_t valid_bytes = TracerReadPGRAPHBuffer(buffer + 4, max_size - 4);
+  CBSpans spans;
+  uint32_t valid_bytes =
+      TracerPeekPGRAPHBuffer(&spans, max_size - sizeof(read_response->size));
+  if (valid_bytes) {
+    read_response->claim = TracerClaimPGRAPHBuffer(valid_bytes);
+  }
   TracerUnlockPGRAPHBuffer();
   if (!valid_bytes) {
-    DmFreePool(buffer);
+    DmFreePool(read_response);
     return XBOX_E_DATA_NOT_AVAILABLE;
   }
 
-  memcpy(buffer, &valid_bytes, 4);
+  read_response->size = valid_bytes;
+  SendPrepopulatedBinaryDataRegion regions[] = {
+      {&read_response->size, sizeof(read_response->size)},
+      {spans.first, spans.first_size},
+      {spans.second, spans.second_size},
+  };
+  InitializeSendPrepopulatedBinaryDataRegions(
+      ctx, &read_response->send_context, regions,
+      sizeof(regions) / sizeof(regions[0]), OnRegionBytesSent, NULL,
+      read_response, TRUE);
+  return XBOX_S_BINARY;
+}
 
-  SendPrepopulatedBinaryDataContext* send_context =
-      (SendPrepopulatedBinaryDataContext*)DmAllocatePoolWithTag(
-          sizeof(SendPrepopulatedBinaryDataContext), 'tpgc');
-  if (!send_context) {
-    DmFreePool(buffer);
-    return XBOX_E_FAIL;
+static void OnRegionBytesSent(uint32_t region_index, uint32_t bytes_sent,
+                              void* user_data) {
+  // Region 0 is the size prefix, everything else is backed by the buffer.
+  if (region_index) {
+    ReadPGRAPHResponse* read_response = (ReadPGRAPHResponse*)user_data;
+    TracerConsumePGRAPHClaim(read_response->claim, bytes_sent);
   }
-
-  InitializeSendPrepopulatedBinaryDataContexts(ctx, send_context, buffer,
-                                               valid_bytes + 4, TRUE, TRUE);
-  return XBOX_S_BINARY;
 }
@@ -11,11 +11,35 @@
 //! size, followed by data).
 //!
 //! The PGRAPH stream consists of instances of PushBufferCommandTraceInfo
-//! structs (whose `data` member must be ignored), each optionally followed by
-//! some number of additional 4-byte "parameter" values. The presence and number
+//! structs (whose `data` member must be ignored other than as described below),
+//! each optionally followed by some number of additional 4-byte "parameter"
+//! values. The presence and number
 //! of these parameters is indicated by the `command.parameter_count` field (the
 //! data size will by 4 * command.parameter_count).
 //!
+//! If segment deduplication was requested when attaching, the stream may also
+//! contain PushBufferSegmentRecord structs, which are the same size as a
+//! PushBufferCommandTraceInfo and distinguished by their `type` (in place of
+//! `valid`). A definition is followed by the entries of a pushbuffer
+//! subroutine, which the remote should retain for the rest of the session. A
+//! reference stands in for the entries of a previous definition.
+//!
+//! If a parameter policy was given when attaching, entries whose
+//! `data.data_state` is PBCPDS_TRUNCATED are followed by only
+//! `data.data.truncated.kept_count` parameters, and carry a hash of the rest.
+//!
+//! If repeat coalescing was requested when attaching, a command entry may be
+//! followed by a PushBufferRepeatRecord (also distinguished by its `type`)
+//! giving the number of times it was repeated.
+//!
+//! If the compact encoding was negotiated when attaching, the stream instead
+//! consists of records in the format described in util/compact_command.h,
+//! which may be decoded via CCDecode. Repeats are given by
+//! CCCommand::repeat_count and truncation by CCCommand::truncated.
+//!
+//! Entries are published to the buffer atomically, so the buffer never holds a
+//! partial entry unless that entry is larger than the buffer's capacity.
+//!
 //! \param command - The command string received from the remote.
 //! \param response - Buffer into which an immediate response (e.g., an error
 //! message) may be written. \param response_len - Maximum length of `response`.
@@ -0,0 +1,25 @@
+#include "cmd_set_log_filter.h"
+
+#include <stdio.h>
+
+#include "command_processor_util.h"
+#include "tracelib/tracer_state_machine.h"
+
+HRESULT HandleSetLogFilter(const char *command, char *response,
+                           uint32_t response_len, CommandContext *ctx) {
+  CommandParameters cp;
+  int32_t result = CPParseCommandParameters(command, &cp);
+  if (result < 0) {
+    return CPPrintError(result, response, response_len);
+  }
+
+  const char *rules = "";
+  CPGetString("rules", &rules, &cp);
+  HRESULT ret = TracerSetLogFilter(rules);
+  CPDelete(&cp);
+
+  if (!XBOX_SUCCESS(ret)) {
+    snprintf(response, response_len, "Invalid filter rules");
+  }
+  return ret;
+}
@@ -0,0 +1,23 @@
+#ifndef NV2A_TRACE_CMD_SET_LOG_FILTER_H
+#define NV2A_TRACE_CMD_SET_LOG_FILTER_H
+
+#include "xbdm.h"
+
+#define CMD_SET_LOG_FILTER "filter"
+
+// Replaces the rules selecting the PGRAPH commands that are written to the
+// PGRAPH buffer. Commands that are filtered out are still processed and
+// hooked. The new rules apply from the next traced command onward.
+//
+// Command string parameters:
+//   rules - string of comma separated rules, applied in order:
+//     +<class>[:<method>[-<last_method>]] logs the given methods.
+//     -<class>[:<method>[-<last_method>]] suppresses the given methods.
+//     Values are hexadecimal, <class> may be `*` to match every class, and
+//     omitting the methods matches every method of the class. E.g.,
+//     "-*,+97:1B00-1BFC" only logs texture state of the 3D class. Omitting
+//     `rules` logs every command.
+HRESULT HandleSetLogFilter(const char *command, char *response,
+                           uint32_t response_len, CommandContext *ctx);
+
+#endif  // NV2A_TRACE_CMD_SET_LOG_FILTER_H
@@ -7,10 +7,13 @@
 #include "cmd_detach.h"
 #include "cmd_discard_until_flip.h"
 #include "cmd_get_dma_addrs.h"
+#include "cmd_get_memory_stats.h"
 #include "cmd_get_state.h"
+#include "cmd_get_stats.h"
 #include "cmd_hello.h"
 #include "cmd_read_aux.h"
 #include "cmd_read_pgraph.h"
+#include "cmd_set_log_filter.h"
 #include "cmd_trace_frame.h"
 #include "cmd_wait_for_stable_push_buffer_state.h"
 #include "nxdk_dxt_dll_main.h"
@@ -27,10 +30,13 @@ static const CommandTableEntry kCommandTableDef[] = {
     {CMD_DETACH, HandleDetach},
     {CMD_DISCARD_UNTIL_FLIP, HandleDiscardUntilFlip},
     {CMD_GET_DMA_ADDRS, HandleGetDMAAddrs},
+    {CMD_GET_MEMORY_STATS, HandleGetMemoryStats},
     {CMD_GET_STATE, HandleGetState},
+    {CMD_GET_STATS, HandleGetStats},
     {CMD_HELLO, HandleHello},
     {CMD_READ_AUX, HandleReadAux},
     {CMD_READ_PGRAPH, HandleReadPGRAPH},
+    {CMD_SET_LOG_FILTER, HandleSetLogFilter},
     {CMD_TRACE_FRAME, HandleTraceFrame},
     {CMD_WAIT_FOR_STABLE_PUSH_BUFFER, HandleWaitForStablePushBufferState},
 };
@@ -7,6 +7,7 @@
 #include "pushbuffer_command.h"
 #include "register_defs.h"
 #include "tracelib/configure.h"
+#include "tracer_memory.h"
 #include "xbdm.h"
 #include "xbox_helper.h"
 #include "xemu/hw/xbox/nv2a/nv2a_regs.h"
@@ -19,8 +20,6 @@
 #define NV_PGRAPH_CFG0_XBOX 0xFD4009A4
 #define NV_PGRAPH_CFG1_XBOX 0xFD4009A8
 
-static const uint32_t kTag = 0x6E744343;  // 'ntCC'
-
 //! Value that may be added to contiguous memory addresses to access as
 //! ADDR_AGPMEM, which is guaranteed to be linear (and thus may be slower than
 //! tiled ADDR_FBMEM but can be manipulated directly).
@@ -31,6 +30,12 @@ static const uint32_t kAGPMemoryBase = 0xF0000000;
 // static const uint32_t kFramebufferMemoryBase = 0x80000000;
 // #define FB_ADDR(a) (const uint8_t *)(kFramebufferMemoryBase | (a))
 
+static const char* kAuxDataTypeNames[AUX_DATA_TYPE_COUNT] = {
+    [ADT_PGRAPH_DUMP] = "pgraph_dump", [ADT_PFB_DUMP] = "pfb_dump",
+    [ADT_RDI_DUMP] = "rdi_dump",       [ADT_SURFACE] = "surface",
+    [ADT_TEXTURE] = "texture",
+};
+
 typedef struct TextureParameters {
   uint32_t width;
   uint32_t height;
@@ -49,6 +54,70 @@ typedef struct TextureParameters {
   BOOL swizzled;
 } TextureParameters;
 
+//! Tracks an auxiliary data entry that is being populated in place.
+typedef struct AuxEntry {
+  const PushBufferCommandTraceInfo* info;
+  const AuxDataWriter* writer;
+  AuxDataType type;
+  uint32_t len;
+
+  //! The region into which the remaining bytes of the entry should be written.
+  CBSpans spans;
+
+  //! Buffer used to stage the entry if it could not be reserved directly in
+  //! the auxiliary data stream.
+  uint8_t* staging_buffer;
+} AuxEntry;
+
+//! Prepares an entry of `len` bytes, reserving space in the auxiliary data
+//! stream if possible and falling back to a staging buffer otherwise.
+static BOOL BeginAuxEntry(AuxEntry* entry,
+                          const PushBufferCommandTraceInfo* info,
+                          const AuxDataWriter* writer, AuxDataType type,
+                          uint32_t len) {
+  entry->info = info;
+  entry->writer = writer;
+  entry->type = type;
+  entry->len = len;
+  entry->staging_buffer = NULL;
+
+  if (writer->reserve(info, type, len, &entry->spans)) {
+    return TRUE;
+  }
+
+  // Captures are optional, so they are skipped rather than allowed to exhaust
+  // memory shared with the title.
+  entry->staging_buffer = (uint8_t*)TracerAlloc(len, TRACER_TAG_CAPTURE);
+  if (!entry->staging_buffer) {
+    DbgPrint("Skipping %u byte %s capture: %s\n", len, AuxDataTypeName(type),
+             TracerMemoryHasHeadroom(len) ? "allocation failed"
+                                          : "memory budget exceeded");
+    return FALSE;
+  }
+  entry->spans.first = entry->staging_buffer;
+  entry->spans.first_size = len;
+  entry->spans.second = NULL;
+  entry->spans.second_size = 0;
+  return TRUE;
+}
+
+static void WriteAuxEntry(AuxEntry* entry, const void* data, uint32_t len) {
+  CBSpansWrite(&entry->spans, data, len);
+}
+
+//! Publishes the given entry, which must have been completely populated.
+static void EndAuxEntry(AuxEntry* entry) {
+  if (!entry->staging_buffer) {
+    entry->writer->commit();
+    return;
+  }
+
+  entry->writer->store(entry->info, entry->type, entry->staging_buffer,
+                       entry->len);
+  TracerFree(entry->staging_buffer);
+  entry->staging_buffer = NULL;
+}
+
 static void ApplyAntiAliasingFactor(uint32_t antialiasing_mode, uint32_t* x,
                                     uint32_t* y) {
   switch (antialiasing_mode) {
@@ -122,58 +191,57 @@ static void ReadTextureParameters(TextureParameters* params) {
 
 //! Stores the PGRAPH region.
 static void StorePGRAPH(const PushBufferCommandTraceInfo* info,
-                        StoreAuxData store) {
+                        const AuxDataWriter* writer) {
 #define PGRAPH_REGION 0xFD400000
 #define PGRAPH_REGION_SIZE 0x2000
-  uint8_t* buffer = (uint8_t*)DmAllocatePoolWithTag(PGRAPH_REGION_SIZE, kTag);
-  if (!buffer) {
+#define PGRAPH_UNREADABLE_SIZE 0x200
+  static const uint8_t kUnreadableFill[PGRAPH_UNREADABLE_SIZE] = {0};
+
+  AuxEntry entry;
+  if (!BeginAuxEntry(&entry, info, writer, ADT_PGRAPH_DUMP,
+                     PGRAPH_REGION_SIZE)) {
     DbgPrint("Error: Failed to allocate buffer when reading PGRAPH region.");
     return;
   }
 
   // 0xFD400200 hangs Xbox, but skipping 0x200 - 0x400 works.
   // TODO: Needs further testing which regions work.
-  uint8_t* write_ptr = buffer;
-  mmx_memcpy(write_ptr, (uint8_t*)PGRAPH_REGION, 0x200);
-  write_ptr += 0x200;
+  WriteAuxEntry(&entry, (uint8_t*)PGRAPH_REGION, 0x200);
 
   // Null out the unreadable bytes.
-  memset(write_ptr, 0, 0x200);
-  write_ptr += 0x200;
+  WriteAuxEntry(&entry, kUnreadableFill, PGRAPH_UNREADABLE_SIZE);
 
-  mmx_memcpy(write_ptr, (uint8_t*)(PGRAPH_REGION + 0x400),
-             PGRAPH_REGION_SIZE - 0x400);
+  WriteAuxEntry(&entry, (uint8_t*)(PGRAPH_REGION + 0x400),
+                PGRAPH_REGION_SIZE - 0x400);
 
-  store(info, ADT_PGRAPH_DUMP, buffer, 0x2000);
-  DmFreePool(buffer);
+  EndAuxEntry(&entry);
 }
 
 //! Stores the PFB region.
 static void StorePFB(const PushBufferCommandTraceInfo* info,
-                     StoreAuxData store) {
+                     const AuxDataWriter* writer) {
 #define PFB_REGION 0xFD100000
 #define PFB_REGION_SIZE 0x1000
-  uint8_t* buffer = (uint8_t*)DmAllocatePoolWithTag(PFB_REGION_SIZE, kTag);
-  if (!buffer) {
+  AuxEntry entry;
+  if (!BeginAuxEntry(&entry, info, writer, ADT_PFB_DUMP, PFB_REGION_SIZE)) {
     DbgPrint("Error: Failed to allocate buffer when reading PFB region.");
     return;
   }
 
-  mmx_memcpy(buffer, (uint8_t*)PFB_REGION, PFB_REGION_SIZE);
-
-  store(info, ADT_PFB_DUMP, buffer, 0x2000);
-  DmFreePool(buffer);
+  WriteAuxEntry(&entry, (uint8_t*)PFB_REGION, PFB_REGION_SIZE);
+  EndAuxEntry(&entry);
 }
 
 #define NV10_PGRAPH_RDI_INDEX 0xFD400750
 #define NV10_PGRAPH_RDI_DATA 0xFD400754
 
 //! Stores RDI data.
-static void StoreRDI(const PushBufferCommandTraceInfo* info, StoreAuxData store,
-                     uint32_t offset, uint32_t count) {
+static void StoreRDI(const PushBufferCommandTraceInfo* info,
+                     const AuxDataWriter* writer, uint32_t offset,
+                     uint32_t count) {
   uint32_t buffer_size = sizeof(RDIHeader) + 4 * count;
-  uint8_t* buffer = (uint8_t*)DmAllocatePoolWithTag(buffer_size, kTag);
-  if (!buffer) {
+  AuxEntry entry;
+  if (!BeginAuxEntry(&entry, info, writer, ADT_RDI_DUMP, buffer_size)) {
     DbgPrint(
         "Error: Failed to allocate buffer when reading %u RDI values from "
         "offset 0x%X.",
@@ -181,10 +249,8 @@ static void StoreRDI(const PushBufferCommandTraceInfo* info, StoreAuxData store,
     return;
   }
 
-  RDIHeader* header = (RDIHeader*)buffer;
-  header->offset = offset;
-  header->count = count;
-  uint32_t* write_ptr = (uint32_t*)(buffer + sizeof(*header));
+  RDIHeader header = {.offset = offset, .count = count};
+  WriteAuxEntry(&entry, &header, sizeof(header));
 
   // FIXME: Assert pusher access is disabled
   // FIXME: Assert PGRAPH idle
@@ -199,7 +265,8 @@ static void StoreRDI(const PushBufferCommandTraceInfo* info, StoreAuxData store,
   // It is not safe and likely incorrect to do a bulk read so this must be
   // done individually.
   for (uint32_t i = 0; i < count; ++i) {
-    *write_ptr++ = ReadDWORD(NV10_PGRAPH_RDI_DATA);
+    uint32_t value = ReadDWORD(NV10_PGRAPH_RDI_DATA);
+    WriteAuxEntry(&entry, &value, sizeof(value));
   }
 
   // FIXME: Restore original RDI?
@@ -209,12 +276,11 @@ static void StoreRDI(const PushBufferCommandTraceInfo* info, StoreAuxData store,
   //
   // FIXME: Assert the conditions from entry have not changed
 
-  store(info, ADT_RDI_DUMP, buffer, buffer_size);
-  DmFreePool(buffer);
+  EndAuxEntry(&entry);
 }
 
 static void StoreSurface(const PushBufferCommandTraceInfo* info,
-                         StoreAuxData store, SurfaceType type,
+                         const AuxDataWriter* writer, SurfaceType type,
                          uint32_t surface_format, uint32_t surface_offset,
                          uint32_t width, uint32_t height, uint32_t pitch,
                          uint32_t clip_x, uint32_t clip_y, uint32_t clip_w,
@@ -231,49 +297,54 @@ static void StoreSurface(const PushBufferCommandTraceInfo* info,
   uint32_t description_len = strlen(description);
   uint32_t buffer_size = sizeof(SurfaceHeader) + description_len + len;
 
-  uint8_t* buffer = (uint8_t*)DmAllocatePoolWithTag(buffer_size, kTag);
-  if (!buffer) {
+  AuxEntry entry;
+  if (!BeginAuxEntry(&entry, info, writer, ADT_SURFACE, buffer_size)) {
     DbgPrint("Error: Failed to allocate buffer when reading surface %d.", type);
     return;
   }
 
-  SurfaceHeader* header = (SurfaceHeader*)buffer;
-  header->type = type;
-  header->format = surface_format;
-  header->len = len;
-  header->width = width;
-  header->height = height;
-  header->pitch = pitch;
-  header->swizzle = swizzle;
-  header->clip_x = clip_x;
-  header->clip_y = clip_y;
-  header->clip_width = clip_w;
-  header->clip_height = clip_h;
-  header->swizzle_param = swizzle_param;
-  header->description_len = description_len;
-  header->save_context.provoking_command = info->command.method;
-  header->save_context.draw_index = info->draw_index;
-  header->save_context.surface_dump_index = info->surface_dump_index;
-
-  uint8_t* write_ptr = buffer + sizeof(*header);
+  SurfaceHeader header;
+  header.type = type;
+  header.format = surface_format;
+  header.len = len;
+  header.width = width;
+  header.height = height;
+  header.pitch = pitch;
+  header.swizzle = swizzle;
+  header.clip_x = clip_x;
+  header.clip_y = clip_y;
+  header.clip_width = clip_w;
+  header.clip_height = clip_h;
+  header.swizzle_param = swizzle_param;
+  header.description_len = description_len;
+  header.save_context.provoking_command = info->command.method;
+  header.save_context.draw_index = info->draw_index;
+  header.save_context.surface_dump_index = info->surface_dump_index;
+  WriteAuxEntry(&entry, &header, sizeof(header));
+
   // null terminator is intentionally omitted.
-  memcpy(write_ptr, description, description_len);  // NOLINT
-  write_ptr += description_len;
+  WriteAuxEntry(&entry, description, description_len);
 
   PROFILE_INIT();
   PROFILE_START();
   // TODO: Only read from AGP if needed, it is far slower than FB_ADDR reads.
-  mmx_memcpy(write_ptr, AGP_ADDR(surface_offset), len);
+  WriteAuxEntry(&entry, AGP_ADDR(surface_offset), len);
   PROFILE_SEND("StoreSurface - AGP memcpy");
 
   PROFILE_START();
-  store(info, ADT_SURFACE, buffer, buffer_size);
+  EndAuxEntry(&entry);
   PROFILE_SEND("StoreSurface - store");
-  DmFreePool(buffer);
+}
+
+const char* AuxDataTypeName(AuxDataType type) {
+  if (type >= AUX_DATA_TYPE_COUNT) {
+    return "unknown";
+  }
+  return kAuxDataTypeNames[type];
 }
 
 void TraceSurfaces(const PushBufferCommandTraceInfo* info, TraceContext* ctx,
-                   StoreAuxData store, const AuxConfig* config) {
+                   const AuxDataWriter* writer, const AuxConfig* config) {
   if (!config->surface_color_capture_enabled &&
       !config->surface_depth_capture_enabled) {
     return;
@@ -300,7 +371,7 @@ void TraceSurfaces(const PushBufferCommandTraceInfo* info, TraceContext* ctx,
              params.surface_type, params.swizzled ? "Y" : "N", params.clip_x,
              params.clip_y, params.clip_w, params.clip_h);
     PROFILE_START();
-    StoreSurface(info, store, ST_COLOR, params.format_color,
+    StoreSurface(info, writer, ST_COLOR, params.format_color,
                  params.color_offset, params.width, params.height,
                  params.color_pitch, params.clip_x, params.clip_y,
                  params.clip_w, params.clip_h, params.swizzled,
@@ -317,7 +388,7 @@ void TraceSurfaces(const PushBufferCommandTraceInfo* info, TraceContext* ctx,
              params.surface_type, params.swizzled ? "Y" : "N", params.clip_x,
              params.clip_y, params.clip_w, params.clip_h);
     PROFILE_START();
-    StoreSurface(info, store, ST_DEPTH, params.format_depth,
+    StoreSurface(info, writer, ST_DEPTH, params.format_depth,
                  params.depth_offset, params.width, params.height,
                  params.depth_pitch, params.clip_x, params.clip_y,
                  params.clip_w, params.clip_h, params.swizzled,
@@ -328,17 +399,17 @@ void TraceSurfaces(const PushBufferCommandTraceInfo* info, TraceContext* ctx,
   if (config->rdi_capture_enabled) {
     // Vertex shader instructions.
     PROFILE_START();
-    StoreRDI(info, store, 0x100000, 136 * 4);
+    StoreRDI(info, writer, 0x100000, 136 * 4);
     PROFILE_SEND("TraceSurfaces - StoreRDI - shader");
 
     // Vertex shader constants 0 (192 four-element vectors).
     PROFILE_START();
-    StoreRDI(info, store, 0x170000, 192 * 4);
+    StoreRDI(info, writer, 0x170000, 192 * 4);
     PROFILE_SEND("TraceSurfaces - StoreRDI - c0");
 
     // Vertex shader constants 1 (192 four-element vectors).
     PROFILE_START();
-    StoreRDI(info, store, 0xCC0000, 192 * 4);
+    StoreRDI(info, writer, 0xCC0000, 192 * 4);
     PROFILE_SEND("TraceSurfaces - StoreRDI - c1");
   }
 
@@ -436,7 +507,7 @@ static const struct TextureFormatInfo* GetFormatInfo(uint32_t texture_format) {
 }
 
 static void StoreTextureLayer(const PushBufferCommandTraceInfo* info,
-                              StoreAuxData store, uint32_t stage,
+                              const AuxDataWriter* writer, uint32_t stage,
                               uint32_t layer, uint32_t adjusted_offset,
                               uint32_t width, uint32_t height, uint32_t depth,
                               uint32_t pitch, uint32_t format_register,
@@ -485,41 +556,39 @@ static void StoreTextureLayer(const PushBufferCommandTraceInfo* info,
   }
   uint32_t buffer_size = sizeof(TextureHeader) + len;
 
-  uint8_t* buffer = (uint8_t*)DmAllocatePoolWithTag(buffer_size, kTag);
-  if (!buffer) {
+  AuxEntry entry;
+  if (!BeginAuxEntry(&entry, info, writer, ADT_TEXTURE, buffer_size)) {
     DbgPrint("Error: Failed to allocate buffer when reading texture %u:%u.",
              stage, layer);
     return;
   }
 
-  TextureHeader* header = (TextureHeader*)buffer;
-  header->stage = stage;
-  header->layer = layer;
-
-  header->save_context.provoking_command = info->command.method;
-  header->save_context.draw_index = info->draw_index;
-  header->save_context.surface_dump_index = info->surface_dump_index;
-
-  header->len = len;
-  header->format = format_register;
-  header->width = width;
-  header->height = height;
-  header->depth = depth;
-  header->pitch = pitch;
-  header->control0 = control0;
-  header->control1 = control1;
-  header->image_rect = image_rect;
-
-  uint8_t* write_ptr = buffer + sizeof(*header);
-  mmx_memcpy(write_ptr, AGP_ADDR(adjusted_offset), len);
-
-  store(info, ADT_TEXTURE, buffer, buffer_size);
-  DmFreePool(buffer);
+  TextureHeader header;
+  header.stage = stage;
+  header.layer = layer;
+
+  header.save_context.provoking_command = info->command.method;
+  header.save_context.draw_index = info->draw_index;
+  header.save_context.surface_dump_index = info->surface_dump_index;
+
+  header.len = len;
+  header.format = format_register;
+  header.width = width;
+  header.height = height;
+  header.depth = depth;
+  header.pitch = pitch;
+  header.control0 = control0;
+  header.control1 = control1;
+  header.image_rect = image_rect;
+  WriteAuxEntry(&entry, &header, sizeof(header));
+
+  WriteAuxEntry(&entry, AGP_ADDR(adjusted_offset), len);
+  EndAuxEntry(&entry);
 }
 
 #define TEXTURE_CTRL_ENABLE (1 << 30)
 static void StoreTextureStage(const PushBufferCommandTraceInfo* info,
-                              StoreAuxData store, uint32_t stage) {
+                              const AuxDataWriter* writer, uint32_t stage) {
   // Verify that the stage is enabled.
   uint32_t reg_offset = stage * 4;
   uint32_t control0 = ReadDWORD(PGRAPH_TEXCTL0_0 + reg_offset);
@@ -552,21 +621,22 @@ static void StoreTextureStage(const PushBufferCommandTraceInfo* info,
 
   uint32_t adjusted_offset = offset;
   for (uint32_t layer = 0; layer < depth; ++layer) {
-    StoreTextureLayer(info, store, stage, layer, adjusted_offset, width, height,
-                      depth, pitch, format, texture_type, control0, control1,
-                      image_rect, sampler_mode);
+    StoreTextureLayer(info, writer, stage, layer, adjusted_offset, width,
+                      height, depth, pitch, format, texture_type, control0,
+                      control1, image_rect, sampler_mode);
     adjusted_offset += pitch * height;
   }
 }
 
-void TraceTextures(const PushBufferCommandTraceInfo* info, StoreAuxData store) {
+void TraceTextures(const PushBufferCommandTraceInfo* info,
+                   const AuxDataWriter* writer) {
   for (uint32_t i = 0; i < 4; ++i) {
-    StoreTextureStage(info, store, i);
+    StoreTextureStage(info, writer, i);
   }
 }
 
 void TraceBegin(const PushBufferCommandTraceInfo* info, TraceContext* ctx,
-                StoreAuxData store, const AuxConfig* config) {
+                const AuxDataWriter* writer, const AuxConfig* config) {
   if (!config->texture_capture_enabled) {
     return;
   }
@@ -583,11 +653,11 @@ void TraceBegin(const PushBufferCommandTraceInfo* info, TraceContext* ctx,
 
   DbgPrint("BEGIN - Packet: %d Draw: %u Surface: %u\n", info->packet_index,
            info->draw_index, info->surface_dump_index);
-  TraceTextures(info, store);
+  TraceTextures(info, writer);
 }
 
 void TraceEnd(const PushBufferCommandTraceInfo* info, TraceContext* ctx,
-              StoreAuxData store, const AuxConfig* config) {
+              const AuxDataWriter* writer, const AuxConfig* config) {
   if (!config->surface_depth_capture_enabled &&
       !config->surface_color_capture_enabled &&
       !config->raw_pgraph_capture_enabled && !config->raw_pfb_capture_enabled) {
@@ -608,12 +678,12 @@ void TraceEnd(const PushBufferCommandTraceInfo* info, TraceContext* ctx,
   ++ctx->draw_index;
 
   if (config->raw_pgraph_capture_enabled) {
-    StorePGRAPH(info, store);
+    StorePGRAPH(info, writer);
   }
 
   if (config->raw_pfb_capture_enabled) {
-    StorePFB(info, store);
+    StorePFB(info, writer);
   }
 
-  TraceSurfaces(info, ctx, store, config);
+  TraceSurfaces(info, ctx, writer, config);
 }
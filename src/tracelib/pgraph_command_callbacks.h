@@ -4,6 +4,7 @@
 #include <stdint.h>
 
 #include "pushbuffer_command.h"
+#include "util/circular_buffer.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -23,6 +24,12 @@ typedef enum AuxDataType {
   ADT_TEXTURE,
 } AuxDataType;
 
+//! The number of distinct AuxDataType values.
+#define AUX_DATA_TYPE_COUNT (ADT_TEXTURE + 1)
+
+//! Returns a short, human readable name for the given AuxDataType.
+const char *AuxDataTypeName(AuxDataType type);
+
 //! Header describing an entry in the auxiliary data stream.
 typedef struct AuxDataHeader {
   //! The index of the PushBufferCommandTraceInfo packet with which this data is
@@ -163,17 +170,42 @@ typedef struct TraceContext {
 typedef void (*StoreAuxData)(const PushBufferCommandTraceInfo *trigger,
                              AuxDataType type, const void *data, uint32_t len);
 
+//! Callback that may be invoked to reserve space for auxiliary data so that it
+//! may be populated in place, avoiding an intermediate copy.
+//!
+//! \param trigger - The PushBufferCommandTraceInfo that this data is associated
+//!                  with.
+//! \param type - The type of the buffer.
+//! \param len - The length of the data that will be written.
+//! \param spans - Populated with the region into which exactly `len` bytes
+//!                must be written (e.g., via CBSpansWrite) before invoking
+//!                CommitAuxData.
+//! \return FALSE if the space could not be reserved, in which case the data
+//!         should be sent via StoreAuxData instead.
+typedef BOOL (*ReserveAuxData)(const PushBufferCommandTraceInfo *trigger,
+                               AuxDataType type, uint32_t len, CBSpans *spans);
+
+//! Callback that publishes the data written into a ReserveAuxData reservation.
+typedef void (*CommitAuxData)(void);
+
+//! Provides the methods through which callbacks send auxiliary data.
+typedef struct AuxDataWriter {
+  StoreAuxData store;
+  ReserveAuxData reserve;
+  CommitAuxData commit;
+} AuxDataWriter;
+
 //! Dump color/depth surfaces, shader data, etc...
 void TraceSurfaces(const PushBufferCommandTraceInfo *info, TraceContext *ctx,
-                   StoreAuxData store, const AuxConfig *config);
+                   const AuxDataWriter *writer, const AuxConfig *config);
 
 //! Dump textures.
 void TraceBegin(const PushBufferCommandTraceInfo *info, TraceContext *ctx,
-                StoreAuxData store, const AuxConfig *config);
+                const AuxDataWriter *writer, const AuxConfig *config);
 
 //! Dump surfaces.
 void TraceEnd(const PushBufferCommandTraceInfo *info, TraceContext *ctx,
-              StoreAuxData store, const AuxConfig *config);
+              const AuxDataWriter *writer, const AuxConfig *config);
 
 #ifdef __cplusplus
 }  // extern "C"
@@ -3,13 +3,12 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "tracer_memory.h"
 #include "xbdm.h"
 #include "xbox_helper.h"
 
 // #define VERBOSE_DEBUG
 
-static const uint32_t kTag = 0x6E745043;  // 'ntPC'
-
 // Offset that must be added to pushbuffer commands in order to read them.
 static const uint32_t kAccessibleAddrOffset = 0x80000000;
 #define PB_ADDR(a) (kAccessibleAddrOffset | (a))
@@ -122,7 +121,13 @@ uint32_t ParsePushBufferCommand(uint32_t addr, uint32_t command,
   return addr;
 }
 
-static BOOL ReadParameters(uint32_t pull_addr, uint32_t count,
+//! Copies the parameters of the command at `pull_addr` into `data`.
+//!
+//! Parameters that do not fit inline are placed in `arena` if possible, falling
+//! back to the tracer memory pool. They are dropped (leaving `data` invalid) if
+//! they cannot be allocated, so that an oversized command does not abort the
+//! trace.
+static void ReadParameters(uint32_t pull_addr, uint32_t count, Arena arena,
                            PushBufferCommandParameters *data) {
   uint32_t data_len = count * 4;
   const uint8_t *data_addr = (const uint8_t *)(PB_ADDR(pull_addr));
@@ -131,27 +136,35 @@ static BOOL ReadParameters(uint32_t pull_addr, uint32_t count,
   if (data_len <= sizeof(data->data.buffer)) {
     data->data_state = PBCPDS_SMALL_BUFFER;
     memcpy(data->data.buffer, data_addr, data_len);
-    return TRUE;
+    return;
+  }
+
+  data->data.heap_buffer = (uint8_t *)ArenaAlloc(arena, data_len);
+  if (data->data.heap_buffer) {
+    data->data_state = PBCPDS_BORROWED_BUFFER;
+    memcpy(data->data.heap_buffer, data_addr, data_len);
+    return;
   }
 
-  data->data.heap_buffer = (uint8_t *)DmAllocatePoolWithTag(data_len, kTag);
+  data->data.heap_buffer =
+      (uint8_t *)TracerAlloc(data_len, TRACER_TAG_PARAMETERS);
   if (!data->data.heap_buffer) {
-    DbgPrint(
-        "Allocation failed processing %d data bytes for command at 0x%08X\n",
-        data_len, pull_addr);
+    DbgPrint("Dropping %d data bytes for command at 0x%08X: %s\n", data_len,
+             pull_addr,
+             TracerMemoryHasHeadroom(data_len) ? "allocation failed"
+                                               : "memory budget exceeded");
     data->data_state = PBCPDS_INVALID;
-    return FALSE;
+    return;
   }
 
   data->data_state = PBCPDS_HEAP_BUFFER;
   memcpy(data->data.heap_buffer, data_addr, data_len);
-
-  return TRUE;
 }
 
 uint32_t ParsePushBufferCommandTraceInfo(uint32_t pull_addr,
                                          PushBufferCommandTraceInfo *info,
-                                         BOOL discard_parameters) {
+                                         BOOL discard_parameters,
+                                         Arena parameter_arena) {
   info->valid = FALSE;
   info->data.data_state = PBCPDS_INVALID;
 
@@ -180,11 +193,8 @@ uint32_t ParsePushBufferCommandTraceInfo(uint32_t pull_addr,
     // Note: Halo: CE has cases where `parameter_count` == 0 that must be
     // accounted for.
     if (info->command.parameter_count && !discard_parameters) {
-      if (!ReadParameters(pull_addr, info->command.parameter_count,
-                          &info->data)) {
-        info->valid = FALSE;
-        return 0;
-      }
+      ReadParameters(pull_addr, info->command.parameter_count,
+                     parameter_arena, &info->data);
     } else {
       info->data.data_state = PBCPDS_INVALID;
     }
@@ -205,9 +215,9 @@ BOOL GetParameter(const PushBufferCommandTraceInfo *info, uint32_t index,
     return FALSE;
   }
 
-  const uint32_t *data = info->data.data_state == PBCPDS_HEAP_BUFFER
-                             ? (const uint32_t *)info->data.data.heap_buffer
-                             : info->data.data.buffer;
+  const uint32_t *data = info->data.data_state == PBCPDS_SMALL_BUFFER
+                             ? info->data.data.buffer
+                             : (const uint32_t *)info->data.data.heap_buffer;
   *out = data[index];
 
   return TRUE;
@@ -218,7 +228,113 @@ void DeletePushBufferCommandTraceInfo(PushBufferCommandTraceInfo *info) {
     return;
   }
 
-  DmFreePool(info->data.data.heap_buffer);
+  TracerFree(info->data.data.heap_buffer);
   info->data.data_state = PBCPDS_INVALID;
   info->data.data.heap_buffer = NULL;
 }
+
+void ScanPushBuffer(uint32_t pull_addr, uint32_t push_addr, uint32_t max_size,
+                    const PBSQuery *query, PBSResult *result) {
+  uint32_t size = max_size;
+  if (push_addr >= pull_addr && push_addr - pull_addr < size) {
+    size = push_addr - pull_addr;
+  }
+  PBSScan((const uint32_t *)PB_ADDR(pull_addr), size, query, result);
+}
+
+//! Extends the snapshot of `range` (which holds `range->snapshot_size` bytes
+//! copied from `pull_addr`) to at least `size` bytes.
+static void ExtendSnapshot(PushBufferRange *range, uint32_t pull_addr,
+                           uint32_t size) {
+  uint32_t copied = range->snapshot_size;
+  if (size <= copied) {
+    return;
+  }
+  memcpy((uint8_t *)range->snapshot + copied,
+         (const void *)PB_ADDR(pull_addr + copied), size - copied);
+  range->snapshot_size = size;
+}
+
+uint32_t ParsePushBufferRange(PushBufferRange *range, uint32_t pull_addr,
+                              uint32_t push_addr) {
+  range->entry_count = 0;
+  range->next_entry = 0;
+  range->snapshot_size = 0;
+
+  // Everything up to the push address is known to be pushbuffer and may be
+  // copied at once. Otherwise (e.g., within a subroutine, or if the push
+  // address is behind a jump) the end of the pushbuffer is unknown, so each
+  // command is copied as it is decoded, stopping at the first jump, call, or
+  // return rather than reading past the pushbuffer.
+  uint32_t size = range->snapshot_capacity;
+  if (push_addr >= pull_addr) {
+    if (push_addr - pull_addr < size) {
+      size = push_addr - pull_addr;
+    }
+    ExtendSnapshot(range, pull_addr, size);
+  }
+
+  PushBufferCommandTraceInfo trace;
+  uint32_t offset = 0;
+  while (offset + 4 <= size && range->entry_count < range->entry_capacity) {
+    ExtendSnapshot(range, pull_addr, offset + 4);
+    uint32_t addr = pull_addr + offset;
+    trace.subroutine_return_address = range->subroutine_return_address;
+    uint32_t next_addr =
+        ParsePushBufferCommand(addr, range->snapshot[offset / 4], &trace);
+    if (!next_addr) {
+      break;
+    }
+
+    BOOL is_method = trace.command.valid;
+    if (is_method) {
+      if (trace.command.parameter_count * 4 > size - offset - 4) {
+        break;
+      }
+      ExtendSnapshot(range, pull_addr,
+                     offset + 4 + trace.command.parameter_count * 4);
+    }
+
+    PushBufferRangeEntry *entry = &range->entries[range->entry_count++];
+    entry->address = addr;
+    entry->next_address = next_addr;
+    entry->parameter_offset = offset + 4;
+    entry->command = trace.command;
+    entry->subroutine_return_address = trace.subroutine_return_address;
+    range->subroutine_return_address = trace.subroutine_return_address;
+
+    if (!is_method) {
+      break;
+    }
+    offset = next_addr - pull_addr;
+  }
+
+  return range->entry_count;
+}
+
+void GetPushBufferRangeTraceInfo(const PushBufferRange *range,
+                                 const PushBufferRangeEntry *entry,
+                                 PushBufferCommandTraceInfo *info,
+                                 BOOL discard_parameters) {
+  info->command = entry->command;
+  info->valid = entry->command.valid;
+  info->address = entry->address;
+  info->subroutine_return_address = entry->subroutine_return_address;
+  info->data.data_state = PBCPDS_INVALID;
+
+  uint32_t count = entry->command.parameter_count;
+  if (!info->valid || !count || discard_parameters) {
+    return;
+  }
+
+  const uint8_t *parameters =
+      (const uint8_t *)range->snapshot + entry->parameter_offset;
+  if (count * 4 <= sizeof(info->data.data.buffer)) {
+    info->data.data_state = PBCPDS_SMALL_BUFFER;
+    memcpy(info->data.data.buffer, parameters, count * 4);
+    return;
+  }
+
+  info->data.data_state = PBCPDS_BORROWED_BUFFER;
+  info->data.data.heap_buffer = (uint8_t *)parameters;
+}
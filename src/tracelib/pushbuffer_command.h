@@ -3,6 +3,9 @@
 
 #include <windows.h>
 
+#include "util/arena.h"
+#include "util/pushbuffer_scanner.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -32,6 +35,14 @@ typedef enum PBCPDataState {
   PBCPDS_INVALID = 0,
   PBCPDS_SMALL_BUFFER = 1,
   PBCPDS_HEAP_BUFFER = 2,
+  //! The parameters are referenced in a buffer owned by someone else (e.g., a
+  //! PushBufferRange snapshot or an Arena) and must not be freed. Never sent to
+  //! the remote; logged as PBCPDS_HEAP_BUFFER.
+  PBCPDS_BORROWED_BUFFER = 3,
+  //! Only some of the parameters were logged due to the parameter policy (see
+  //! util/parameter_policy.h), as described by `data.truncated`. Only sent to
+  //! the remote.
+  PBCPDS_TRUNCATED = 4,
 } PBCPDataState;
 
 //! Holds the parameter data for a PushBufferCommand.
@@ -42,8 +53,15 @@ typedef struct PushBufferCommandParameters {
   union {
     //! Contains the parameters inline.
     uint32_t buffer[4];
-    //! Pointer to a heap allocated buffer that contains the commands.
+    //! Pointer to a heap allocated (or borrowed) buffer that contains the
+    //! commands.
     uint8_t *heap_buffer;
+    struct {
+      //! The number of leading parameters that follow the command entry.
+      uint32_t kept_count;
+      //! 64-bit FNV-1a hash of the parameters that were omitted.
+      uint64_t omitted_hash;
+    } __attribute((packed)) truncated;
   } data;
 } __attribute((packed)) PushBufferCommandParameters;
 
@@ -82,6 +100,62 @@ typedef struct PushBufferCommandTraceInfo {
   uint32_t subroutine_return_address;
 } __attribute((packed)) PushBufferCommandTraceInfo;
 
+//! Value of PushBufferSegmentRecord::type for a segment that is sent in full.
+#define PB_SEGMENT_DEFINITION 0x44474553  // 'SEGD'
+//! Value of PushBufferSegmentRecord::type for a repeat of a defined segment.
+#define PB_SEGMENT_REFERENCE 0x52474553  // 'SEGR'
+
+//! Describes a pushbuffer subroutine in the PGRAPH stream. Segment records are
+//! the same size as a PushBufferCommandTraceInfo, with `type` in place of its
+//! `valid` member (which is always 1 for commands).
+//!
+//! A definition is immediately followed by `size` bytes of command entries
+//! that make up the body of the subroutine. A reference stands in for the same
+//! entries, whose `packet_index` values are offset such that the first matches
+//! the `packet_index` of the reference. The `subroutine_return_address` of the
+//! entries is that of the definition.
+typedef struct PushBufferSegmentRecord {
+  //! PB_SEGMENT_DEFINITION or PB_SEGMENT_REFERENCE.
+  uint32_t type;
+
+  //! The packet index of the first command entry in the segment.
+  uint32_t packet_index;
+
+  //! The ID of the segment, unique within a tracer session.
+  uint32_t segment_id;
+
+  //! The address of the subroutine.
+  uint32_t address;
+
+  //! The number of command entries in the segment.
+  uint32_t entry_count;
+
+  //! The number of bytes of command entries in the segment.
+  uint32_t size;
+
+  uint8_t reserved[sizeof(PushBufferCommandTraceInfo) - 6 * 4];
+} __attribute((packed)) PushBufferSegmentRecord;
+
+//! Value of PushBufferRepeatRecord::type.
+#define PB_COMMAND_REPEAT 0x54504552  // 'REPT'
+
+//! Follows a command entry (after its parameters, if any) that was immediately
+//! repeated with identical parameters. Like segment records, repeat records are
+//! the same size as a PushBufferCommandTraceInfo with `type` in place of its
+//! `valid` member.
+//!
+//! Each repeat has the `packet_index` and `address` following those of the
+//! previous one; all other fields are those of the command entry.
+typedef struct PushBufferRepeatRecord {
+  //! PB_COMMAND_REPEAT.
+  uint32_t type;
+
+  //! The number of times the command was repeated after the command entry.
+  uint32_t repeat_count;
+
+  uint8_t reserved[sizeof(PushBufferCommandTraceInfo) - 2 * 4];
+} __attribute((packed)) PushBufferRepeatRecord;
+
 //! Processes the given `command` uint32_t, populating the `command` element
 //! within the given `PushBufferCommandTraceInfo` with expanded details.
 //!
@@ -100,17 +174,23 @@ uint32_t ParsePushBufferCommand(uint32_t addr, uint32_t command,
 // the command. If the command is not processable, sets `info->valid` to FALSE;
 //
 // If `discard_parameters` is FALSE, copies any parameters to the method into
-// a newly allocated buffer in `info->data`. The caller is responsible for
-// freeing the buffer by calling `DeletePushBufferCommandTraceInfo`.
+// a buffer in `info->data`. Parameters that do not fit inline are allocated
+// from `parameter_arena` (which may be NULL) and remain valid until it is
+// reset, or from the tracer memory pool if the arena is full. The caller is
+// responsible for freeing the buffer by calling
+// `DeletePushBufferCommandTraceInfo`.
 //
 // If `discard_parameters` is TRUE, or the command has no parameters,
-// `info->data` will be set to NULL.
+// `info->data` will be set to NULL. Parameters that cannot be allocated within
+// the tracer memory budget are dropped in the same way, leaving the command
+// itself valid.
 //
 // Returns a uint32_t indicating the next command address after `pull_addr` or 0
 // to indicate a critical error.
 uint32_t ParsePushBufferCommandTraceInfo(uint32_t pull_addr,
                                          PushBufferCommandTraceInfo *info,
-                                         BOOL discard_parameters);
+                                         BOOL discard_parameters,
+                                         Arena parameter_arena);
 
 //! Fetches the parameter at the given index to the given command (e.g., 0 would
 //! be the first parameter). Returns FALSE on error (e.g., invalid data or an
@@ -121,6 +201,90 @@ BOOL GetParameter(const PushBufferCommandTraceInfo *info, uint32_t index,
 
 void DeletePushBufferCommandTraceInfo(PushBufferCommandTraceInfo *info);
 
+//! Scans the pushbuffer from `pull_addr` towards `push_addr` for the methods
+//! described by `query` without decoding the commands in between. At most
+//! `max_size` bytes are examined (e.g., if `push_addr` precedes `pull_addr`).
+//! See PBSScan.
+void ScanPushBuffer(uint32_t pull_addr, uint32_t push_addr, uint32_t max_size,
+                    const PBSQuery *query, PBSResult *result);
+
+//! The number of bytes of pushbuffer that a PushBufferRange must be able to
+//! hold. This is large enough for a command with the maximum number of
+//! parameters.
+#define PUSH_BUFFER_RANGE_MIN_SNAPSHOT_SIZE (4 + 0x7FF * 4)
+
+//! Describes a single command decoded by ParsePushBufferRange.
+typedef struct PushBufferRangeEntry {
+  //! The address from which the command was read.
+  uint32_t address;
+
+  //! The address of the command that follows once this one has been
+  //! processed (e.g., the target of a jump).
+  uint32_t next_address;
+
+  //! The offset of the first parameter of the command within the snapshot.
+  uint32_t parameter_offset;
+
+  //! The decoded command. Only methods are `valid`; jumps, calls, and returns
+  //! are not.
+  PushBufferCommand command;
+
+  //! The subroutine return address in effect once this command has been
+  //! processed (0 outside of a subroutine).
+  uint32_t subroutine_return_address;
+} PushBufferRangeEntry;
+
+//! Holds a copy of a span of the pushbuffer along with the commands decoded
+//! from it.
+typedef struct PushBufferRange {
+  //! Buffer into which the pushbuffer is copied, and its size in bytes.
+  uint32_t *snapshot;
+  uint32_t snapshot_capacity;
+  //! The number of valid bytes in `snapshot`.
+  uint32_t snapshot_size;
+
+  //! Buffer into which decoded commands are written, and its size in entries.
+  PushBufferRangeEntry *entries;
+  uint32_t entry_capacity;
+  //! The number of valid entries.
+  uint32_t entry_count;
+
+  //! The index of the next entry to be consumed by the caller.
+  uint32_t next_entry;
+
+  //! Address to return to in response to a DMA return command. Carried from
+  //! one range to the next; must be zeroed when starting at a new address.
+  uint32_t subroutine_return_address;
+} PushBufferRange;
+
+//! Copies the pushbuffer between `pull_addr` and `push_addr` into
+//! `range->snapshot` in a single pass and decodes as many commands as
+//! possible into `range->entries`, resetting `next_entry`. If `push_addr`
+//! precedes `pull_addr` the end of the pushbuffer is unknown, so up to
+//! `snapshot_capacity` bytes are copied one command at a time instead, never
+//! reading beyond the first jump, call, or return.
+//!
+//! Decoding stops after the first jump, call, or return (whose target lies
+//! outside of the snapshot), before a command whose parameters are not
+//! completely contained within the snapshot, and before any command that
+//! cannot be processed.
+//!
+//! Returns the number of decoded entries. 0 indicates a fatal error unless
+//! `pull_addr` == `push_addr`.
+uint32_t ParsePushBufferRange(PushBufferRange *range, uint32_t pull_addr,
+                              uint32_t push_addr);
+
+//! Populates the given `PushBufferCommandTraceInfo` from a decoded entry, as
+//! ParsePushBufferCommandTraceInfo would (except for `graphics_class`, which
+//! is left to the caller), including `subroutine_return_address`.
+//!
+//! Parameters that do not fit inline reference the snapshot of `range` and
+//! remain valid until the next call to ParsePushBufferRange.
+void GetPushBufferRangeTraceInfo(const PushBufferRange *range,
+                                 const PushBufferRangeEntry *entry,
+                                 PushBufferCommandTraceInfo *info,
+                                 BOOL discard_parameters);
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif
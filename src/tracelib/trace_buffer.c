@@ -0,0 +1,610 @@
+#include "trace_buffer.h"
+
+#include <string.h>
+
+#include "tracelib/configure.h"
+#include "tracer_memory.h"
+#include "util/profiler.h"
+#include "xbdm.h"
+
+static void* Allocator(size_t size) {
+  return TracerAlloc(size, TRACER_TAG_TRACE_BUFFER);
+}
+
+static void Free(void* block) { TracerFree(block); }
+
+static void LockSpill(TraceBuffer* buffer) {
+  while (InterlockedCompareExchange(&buffer->spill_lock, 1, 0)) {
+    Sleep(1);
+  }
+}
+
+static void UnlockSpill(TraceBuffer* buffer) {
+  InterlockedExchange(&buffer->spill_lock, 0);
+}
+
+static void Notify(TraceBuffer* buffer, uint32_t bytes_available) {
+  if (buffer->config.notify &&
+      bytes_available >= buffer->config.notify_threshold) {
+    buffer->config.notify(bytes_available);
+  }
+}
+
+static void SignalSpaceFreed(TraceBuffer* buffer) {
+  if (buffer->space_freed_event) {
+    SetEvent(buffer->space_freed_event);
+  }
+}
+
+static void CountDropped(TraceBuffer* buffer, uint32_t type, uint32_t size) {
+  if (type >= TRACE_BUFFER_MAX_RECORD_TYPES) {
+    type = TRACE_BUFFER_MAX_RECORD_TYPES - 1;
+  }
+  ++buffer->stats.dropped_records[type];
+  buffer->stats.dropped_bytes[type] += size;
+}
+
+//! Blocks until a reader frees space in the buffer, re-sending the bytes
+//! available notification each time the configured timeout elapses.
+static void WaitForSpace(TraceBuffer* buffer, uint32_t bytes_available) {
+  ++buffer->stats.stalls;
+  PROFILETOKEN start = ProfileStart();
+  DWORD result = WaitForSingleObject(buffer->space_freed_event,
+                                     buffer->config.stall_timeout_milliseconds);
+  buffer->stalled_milliseconds += ProfileStop(&start);
+  buffer->stats.stalled_milliseconds = (uint32_t)buffer->stalled_milliseconds;
+
+  if (result != WAIT_TIMEOUT) {
+    return;
+  }
+
+  ++buffer->stats.stall_timeouts;
+  if (!bytes_available) {
+    DbgPrint(
+        "ERROR - stalled %u ms on filled circular buffer but 0 bytes reported "
+        "available\n",
+        buffer->config.stall_timeout_milliseconds);
+  } else if (buffer->config.notify) {
+    EXTRA_VERBOSE_PRINT(
+        ("Stalled for %u ms, re-sending notification with %u bytes available "
+         "in buffer 0x%X\n",
+         buffer->config.stall_timeout_milliseconds, bytes_available,
+         buffer->ring));
+    buffer->config.notify(bytes_available);
+  }
+}
+
+//! Streams all of the given data through the buffer without regard for record
+//! boundaries.
+static void WriteStream(TraceBuffer* buffer, const void* data, uint32_t len) {
+  const uint8_t* cursor = (const uint8_t*)data;
+  while (len) {
+    uint32_t bytes_written = CBWriteAvailable(buffer->ring, cursor, len);
+    uint32_t bytes_available = CBAvailable(buffer->ring);
+
+    if (bytes_written) {
+      cursor += bytes_written;
+      len -= bytes_written;
+      buffer->bytes_committed += bytes_written;
+      Notify(buffer, bytes_available);
+    }
+    if (len) {
+      WaitForSpace(buffer, bytes_available);
+    }
+  }
+}
+
+static void PushRecord(TraceBuffer* buffer, uint32_t type, uint32_t size) {
+  if (!buffer->records) {
+    return;
+  }
+  uint32_t index =
+      (buffer->records_head + buffer->records_count) % buffer->records_capacity;
+  TraceBufferRecord* record = &buffer->records[index];
+  record->end = buffer->bytes_committed;
+  record->size = size;
+  record->type = type;
+  ++buffer->records_count;
+}
+
+static void PopRecord(TraceBuffer* buffer) {
+  buffer->records_head = (buffer->records_head + 1) % buffer->records_capacity;
+  --buffer->records_count;
+}
+
+//! Returns the offset of the next unread byte in the stream of all bytes ever
+//! committed to the buffer.
+static uint32_t GetReadOffset(TraceBuffer* buffer) {
+  return buffer->bytes_committed - CBAvailable(buffer->ring);
+}
+
+//! Drops log entries for records that have been fully consumed by a reader.
+static void RetireConsumedRecords(TraceBuffer* buffer) {
+  uint32_t read_offset = GetReadOffset(buffer);
+  while (buffer->records_count) {
+    const TraceBufferRecord* oldest = &buffer->records[buffer->records_head];
+    if ((int32_t)(oldest->end - read_offset) > 0) {
+      break;
+    }
+    PopRecord(buffer);
+  }
+}
+
+static BOOL HasRoom(TraceBuffer* buffer, uint32_t size) {
+  return CBFreeSpace(buffer->ring) >= size &&
+         buffer->records_count < buffer->records_capacity;
+}
+
+//! Discards the oldest records until a new record of `size` bytes fits.
+//!
+//! Records may only be discarded while no reader holds the read lock or a
+//! claim, and only if the oldest record has not been partially read.
+//!
+//! Returns TRUE if the new record may be written.
+static BOOL MakeRoom(TraceBuffer* buffer, uint32_t size) {
+  RetireConsumedRecords(buffer);
+  if (HasRoom(buffer, size)) {
+    return TRUE;
+  }
+
+  if (InterlockedCompareExchange(&buffer->read_lock, 1, 0)) {
+    return FALSE;
+  }
+  if (buffer->claimed_bytes) {
+    // The oldest record is being sent by a reader.
+    InterlockedExchange(&buffer->read_lock, 0);
+    return FALSE;
+  }
+
+  RetireConsumedRecords(buffer);
+  uint32_t read_offset = GetReadOffset(buffer);
+  while (!HasRoom(buffer, size) && buffer->records_count) {
+    const TraceBufferRecord* oldest = &buffer->records[buffer->records_head];
+    if (oldest->end - oldest->size != read_offset) {
+      break;
+    }
+    CBConsume(buffer->ring, oldest->size);
+    buffer->bytes_consumed += oldest->size;
+    read_offset += oldest->size;
+    CountDropped(buffer, oldest->type, oldest->size);
+    PopRecord(buffer);
+  }
+  BOOL ret = HasRoom(buffer, size);
+
+  InterlockedExchange(&buffer->read_lock, 0);
+  return ret;
+}
+
+//! Returns TRUE if a record of `size` bytes may be written to the ring without
+//! waiting or discarding older records.
+static BOOL Fits(TraceBuffer* buffer, uint32_t size) {
+  if (buffer->records) {
+    RetireConsumedRecords(buffer);
+    return HasRoom(buffer, size);
+  }
+  return CBFreeSpace(buffer->ring) >= size;
+}
+
+//! Appends the given record to the spill file if it does not fit in the ring or
+//! if earlier records have already been spilled.
+//!
+//! Returns TRUE if the record was handled (spilled or, in overwrite mode,
+//! discarded) and FALSE if it should be written to the ring instead.
+static BOOL SpillRecord(TraceBuffer* buffer, uint32_t type,
+                        const CBIOVec* vecs, uint32_t count, uint32_t size) {
+  while (1) {
+    if (!buffer->spill_active && Fits(buffer, size)) {
+      return FALSE;
+    }
+
+    LockSpill(buffer);
+    uint32_t spilled_bytes = SFAvailable(buffer->spill);
+    if (buffer->spill_active && !spilled_bytes) {
+      // The reader has caught up, so the ring may be used again.
+      buffer->spill_active = FALSE;
+      UnlockSpill(buffer);
+      continue;
+    }
+    BOOL written = SFWriteV(buffer->spill, vecs, count);
+    UnlockSpill(buffer);
+
+    if (written) {
+      buffer->spill_active = TRUE;
+      ++buffer->stats.spilled_records;
+      buffer->stats.spilled_bytes += size;
+      Notify(buffer, CBAvailable(buffer->ring) + spilled_bytes + size);
+      return TRUE;
+    }
+
+    if (!buffer->spill_active) {
+      return FALSE;
+    }
+
+    if (buffer->config.overwrite_oldest) {
+      CountDropped(buffer, type, size);
+      return TRUE;
+    }
+    WaitForSpace(buffer, CBAvailable(buffer->ring) + spilled_bytes);
+  }
+}
+
+HRESULT TraceBufferInit(TraceBuffer* buffer, const TraceBufferConfig* config) {
+  memset(buffer, 0, sizeof(*buffer));
+  buffer->config = *config;
+  if (!buffer->config.alloc_proc || !buffer->config.free_proc) {
+    buffer->config.alloc_proc = Allocator;
+    buffer->config.free_proc = Free;
+  }
+  CBAllocProc alloc_proc = buffer->config.alloc_proc;
+  CBFreeProc free_proc = buffer->config.free_proc;
+
+  if (config->chunk_size) {
+    uint32_t max_chunks =
+        (config->size + config->chunk_size - 1) / config->chunk_size;
+    if (max_chunks < 2) {
+      max_chunks = 2;
+    }
+    buffer->ring = CBCreateSegmented(config->chunk_size, max_chunks,
+                                     alloc_proc, free_proc);
+  } else {
+    buffer->ring = CBCreateEx(config->size, alloc_proc, free_proc);
+  }
+  if (!buffer->ring) {
+    return XBOX_E_ACCESS_DENIED;
+  }
+
+  if (config->overwrite_oldest) {
+    uint32_t min_record_size =
+        config->min_record_size ? config->min_record_size : 1;
+    buffer->records_capacity = config->size / min_record_size;
+    if (!buffer->records_capacity) {
+      buffer->records_capacity = 1;
+    }
+    buffer->records = (TraceBufferRecord*)alloc_proc(
+        buffer->records_capacity * sizeof(TraceBufferRecord));
+    if (!buffer->records) {
+      TraceBufferDestroy(buffer);
+      return XBOX_E_ACCESS_DENIED;
+    }
+  } else {
+    buffer->space_freed_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (!buffer->space_freed_event) {
+      TraceBufferDestroy(buffer);
+      return XBOX_E_FAIL;
+    }
+  }
+
+  if (config->spill_size) {
+    buffer->spill_read_buffer =
+        (uint8_t*)alloc_proc(TRACE_BUFFER_SPILL_READ_SIZE);
+    buffer->spill = SFCreate(config->spill_path, config->spill_size,
+                             config->spill_io, alloc_proc, free_proc);
+    if (!buffer->spill_read_buffer || !buffer->spill) {
+      DbgPrint("Failed to create spill file '%s'\n", config->spill_path);
+      TraceBufferDestroy(buffer);
+      return XBOX_E_FAIL;
+    }
+  }
+  buffer->config.spill_path = NULL;
+
+  return XBOX_S_OK;
+}
+
+static void InvalidateClaim(TraceBuffer* buffer) {
+  buffer->claimed_bytes = 0;
+  ++buffer->claim_id;
+}
+
+//! Acquires the read lock once any outstanding claim has been consumed, then
+//! invalidates the claim.
+//!
+//! The claim is held by a reader that is sending the claimed bytes to a remote,
+//! which may abandon the transfer at any time, so the wait is abandoned if no
+//! bytes are consumed for TRACE_BUFFER_CLAIM_TIMEOUT_MILLISECONDS.
+static void LockReadForReset(TraceBuffer* buffer) {
+  TraceBufferLockRead(buffer);
+  uint32_t claimed_bytes = buffer->claimed_bytes;
+  DWORD last_progress = GetTickCount();
+  while (buffer->claimed_bytes) {
+    if (buffer->claimed_bytes != claimed_bytes) {
+      claimed_bytes = buffer->claimed_bytes;
+      last_progress = GetTickCount();
+    } else if (GetTickCount() - last_progress >=
+               TRACE_BUFFER_CLAIM_TIMEOUT_MILLISECONDS) {
+      DbgPrint("Abandoning claim of %u bytes\n", claimed_bytes);
+      break;
+    }
+
+    TraceBufferUnlockRead(buffer);
+    Sleep(1);
+    TraceBufferLockRead(buffer);
+  }
+  InvalidateClaim(buffer);
+}
+
+void TraceBufferDestroy(TraceBuffer* buffer) {
+  LockReadForReset(buffer);
+  CBDestroy(buffer->ring);
+  if (buffer->records) {
+    buffer->config.free_proc(buffer->records);
+  }
+  if (buffer->space_freed_event) {
+    CloseHandle(buffer->space_freed_event);
+  }
+  if (buffer->spill) {
+    SFDestroy(buffer->spill);
+  }
+  if (buffer->spill_read_buffer) {
+    buffer->config.free_proc(buffer->spill_read_buffer);
+  }
+  memset(buffer, 0, sizeof(*buffer));
+}
+
+void TraceBufferReset(TraceBuffer* buffer) {
+  LockReadForReset(buffer);
+  CBClear(buffer->ring);
+  if (buffer->spill) {
+    LockSpill(buffer);
+    SFConsume(buffer->spill, SFAvailable(buffer->spill));
+    UnlockSpill(buffer);
+  }
+  buffer->spill_active = FALSE;
+  buffer->spill_peek_size = 0;
+  buffer->records_head = 0;
+  buffer->records_count = 0;
+  buffer->bytes_committed = 0;
+  buffer->bytes_consumed = 0;
+  buffer->reservation_type = 0;
+  buffer->reservation_size = 0;
+  buffer->stalled_milliseconds = 0;
+  memset(&buffer->stats, 0, sizeof(buffer->stats));
+  TraceBufferUnlockRead(buffer);
+}
+
+uint32_t TraceBufferAvailable(TraceBuffer* buffer) {
+  uint32_t ret = CBAvailable(buffer->ring);
+  if (buffer->spill) {
+    LockSpill(buffer);
+    ret += SFAvailable(buffer->spill);
+    UnlockSpill(buffer);
+  }
+  return ret;
+}
+
+uint32_t TraceBufferGetCapacity(const TraceBuffer* buffer) {
+  return buffer->ring ? CBCapacity(buffer->ring) : 0;
+}
+
+void TraceBufferWrite(TraceBuffer* buffer, uint32_t type, const CBIOVec* vecs,
+                      uint32_t count) {
+  if (!buffer->ring) {
+    return;
+  }
+
+  uint32_t total_size = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    total_size += vecs[i].size;
+  }
+
+  if (buffer->spill && SpillRecord(buffer, type, vecs, count, total_size)) {
+    return;
+  }
+
+  if (buffer->config.overwrite_oldest) {
+    if (total_size > CBCapacity(buffer->ring) ||
+        !MakeRoom(buffer, total_size)) {
+      CountDropped(buffer, type, total_size);
+      return;
+    }
+    CBWriteV(buffer->ring, vecs, count);
+    buffer->bytes_committed += total_size;
+    PushRecord(buffer, type, total_size);
+    Notify(buffer, CBAvailable(buffer->ring));
+    return;
+  }
+
+  if (total_size > CBCapacity(buffer->ring)) {
+    for (uint32_t i = 0; i < count; ++i) {
+      WriteStream(buffer, vecs[i].data, vecs[i].size);
+    }
+    return;
+  }
+
+  PROFILE_INIT();
+  PROFILE_START();
+  while (1) {
+    BOOL written = CBWriteV(buffer->ring, vecs, count);
+    uint32_t bytes_available = CBAvailable(buffer->ring);
+
+    if (written) {
+      buffer->bytes_committed += total_size;
+      Notify(buffer, bytes_available);
+      break;
+    }
+    WaitForSpace(buffer, bytes_available);
+  }
+  PROFILE_SEND("TraceBufferWrite");
+}
+
+BOOL TraceBufferReserve(TraceBuffer* buffer, uint32_t type, uint32_t size,
+                        CBSpans* spans) {
+  if (!buffer->ring || !size || size > CBMaxReservation(buffer->ring)) {
+    return FALSE;
+  }
+
+  if (buffer->spill && (buffer->spill_active || !Fits(buffer, size))) {
+    return FALSE;
+  }
+
+  if (buffer->config.overwrite_oldest) {
+    if (!MakeRoom(buffer, size)) {
+      return FALSE;
+    }
+    CBReserve(buffer->ring, size, spans);
+  } else {
+    PROFILE_INIT();
+    PROFILE_START();
+    while (!CBReserve(buffer->ring, size, spans)) {
+      WaitForSpace(buffer, CBAvailable(buffer->ring));
+    }
+    PROFILE_SEND("TraceBufferReserve");
+  }
+
+  buffer->reservation_type = type;
+  buffer->reservation_size = size;
+  return TRUE;
+}
+
+void TraceBufferCommit(TraceBuffer* buffer) {
+  if (!buffer->reservation_size) {
+    return;
+  }
+
+  CBCommit(buffer->ring, buffer->reservation_size);
+  buffer->bytes_committed += buffer->reservation_size;
+  PushRecord(buffer, buffer->reservation_type, buffer->reservation_size);
+  buffer->reservation_size = 0;
+
+  Notify(buffer, CBAvailable(buffer->ring));
+}
+
+uint32_t TraceBufferLockRead(TraceBuffer* buffer) {
+  while (InterlockedCompareExchange(&buffer->read_lock, 1, 0)) {
+    Sleep(1);
+  }
+  buffer->spill_peek_size = 0;
+  return TraceBufferAvailable(buffer);
+}
+
+//! Copies up to `size` spilled bytes into `out` without consuming them.
+//!
+//! The spill file only ever holds records that are newer than everything in the
+//! ring, so it may only be read once the ring is empty. The producer only
+//! spills while holding the spill lock, so checking the ring under the lock
+//! guarantees that no older record can be published to it afterwards.
+static uint32_t PeekSpill(TraceBuffer* buffer, void* out, uint32_t size) {
+  if (!buffer->spill) {
+    return 0;
+  }
+  LockSpill(buffer);
+  uint32_t ret = 0;
+  if (!CBAvailable(buffer->ring)) {
+    ret = SFPeek(buffer->spill, out, size);
+  }
+  UnlockSpill(buffer);
+  return ret;
+}
+
+static void ConsumeSpill(TraceBuffer* buffer, uint32_t size) {
+  LockSpill(buffer);
+  SFConsume(buffer->spill, size);
+  UnlockSpill(buffer);
+  buffer->bytes_consumed += size;
+}
+
+static BOOL ConsumeRing(TraceBuffer* buffer, uint32_t size) {
+  if (!CBConsume(buffer->ring, size)) {
+    return FALSE;
+  }
+  buffer->bytes_consumed += size;
+  return TRUE;
+}
+
+uint32_t TraceBufferRead(TraceBuffer* buffer, void* out, uint32_t size) {
+  InvalidateClaim(buffer);
+  uint32_t ret = CBReadAvailable(buffer->ring, out, size);
+  buffer->bytes_consumed += ret;
+  if (!ret) {
+    ret = PeekSpill(buffer, out, size);
+    if (ret) {
+      ConsumeSpill(buffer, ret);
+    }
+  }
+  if (ret) {
+    SignalSpaceFreed(buffer);
+  }
+  return ret;
+}
+
+uint32_t TraceBufferPeek(TraceBuffer* buffer, CBSpans* spans, uint32_t size) {
+  // Spilled bytes are peeked into the same buffer as any claimed ones.
+  InvalidateClaim(buffer);
+  buffer->spill_peek_size = 0;
+  uint32_t ret = CBPeekSpans(buffer->ring, size, spans);
+  if (ret) {
+    return ret;
+  }
+
+  uint32_t spill_size =
+      size > TRACE_BUFFER_SPILL_READ_SIZE ? TRACE_BUFFER_SPILL_READ_SIZE : size;
+  ret = PeekSpill(buffer, buffer->spill_read_buffer, spill_size);
+  if (!ret) {
+    // The ring may have been populated after it was peeked.
+    return CBPeekSpans(buffer->ring, size, spans);
+  }
+
+  spans->first = buffer->spill_read_buffer;
+  spans->first_size = ret;
+  spans->second = NULL;
+  spans->second_size = 0;
+  buffer->spill_peek_size = ret;
+  return ret;
+}
+
+void TraceBufferConsume(TraceBuffer* buffer, uint32_t size) {
+  if (!size) {
+    return;
+  }
+  InvalidateClaim(buffer);
+
+  if (buffer->spill_peek_size) {
+    if (size > buffer->spill_peek_size) {
+      size = buffer->spill_peek_size;
+    }
+    ConsumeSpill(buffer, size);
+    buffer->spill_peek_size -= size;
+    SignalSpaceFreed(buffer);
+    return;
+  }
+
+  if (ConsumeRing(buffer, size)) {
+    SignalSpaceFreed(buffer);
+  }
+}
+
+uint32_t TraceBufferClaim(TraceBuffer* buffer, uint32_t size) {
+  buffer->claimed_bytes = size;
+  buffer->claim_from_spill = buffer->spill_peek_size != 0;
+  return ++buffer->claim_id;
+}
+
+void TraceBufferConsumeClaim(TraceBuffer* buffer, uint32_t claim,
+                             uint32_t size) {
+  TraceBufferLockRead(buffer);
+  if (claim == buffer->claim_id && buffer->claimed_bytes) {
+    if (size > buffer->claimed_bytes) {
+      size = buffer->claimed_bytes;
+    }
+    if (buffer->claim_from_spill) {
+      ConsumeSpill(buffer, size);
+    } else {
+      ConsumeRing(buffer, size);
+    }
+    buffer->claimed_bytes -= size;
+  }
+  TraceBufferUnlockRead(buffer);
+}
+
+uint32_t TraceBufferGetBytesConsumed(const TraceBuffer* buffer) {
+  return buffer->bytes_consumed;
+}
+
+void TraceBufferUnlockRead(TraceBuffer* buffer) {
+  buffer->spill_peek_size = 0;
+  InterlockedExchange(&buffer->read_lock, 0);
+  SignalSpaceFreed(buffer);
+}
+
+void TraceBufferGetStats(const TraceBuffer* buffer, TraceBufferStats* stats) {
+  *stats = buffer->stats;
+}
@@ -0,0 +1,272 @@
+#ifndef NTRC_DYNDXT_SRC_TRACELIB_TRACE_BUFFER_H_
+#define NTRC_DYNDXT_SRC_TRACELIB_TRACE_BUFFER_H_
+
+#include <windows.h>
+
+#include "util/circular_buffer.h"
+#include "util/spill_file.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//! The maximum number of distinct record types tracked by TraceBufferStats.
+//! Records with larger type values are accounted for in the last slot.
+#define TRACE_BUFFER_MAX_RECORD_TYPES 8
+
+//! The maximum number of spilled bytes returned by a single TraceBufferPeek.
+#define TRACE_BUFFER_SPILL_READ_SIZE (1024 * 64)
+
+//! The number of milliseconds TraceBufferReset and TraceBufferDestroy wait for
+//! an outstanding claim to make progress before assuming that it has been
+//! abandoned.
+#define TRACE_BUFFER_CLAIM_TIMEOUT_MILLISECONDS 1000
+
+//! Callback invoked with the number of readable bytes after a record has been
+//! written to a TraceBuffer.
+typedef void (*TraceBufferNotifyProc)(uint32_t bytes_available);
+
+typedef struct TraceBufferConfig {
+  //! The capacity of the buffer in bytes.
+  uint32_t size;
+
+  //! If nonzero, the buffer is allocated on demand in blocks of this many
+  //! bytes, up to `size`, and blocks are released as they are drained.
+  //! Otherwise `size` bytes are allocated up front.
+  uint32_t chunk_size;
+
+  //! Whether the oldest records should be discarded to make room for new ones
+  //! instead of waiting for a reader to drain the buffer.
+  BOOL overwrite_oldest;
+
+  //! Approximate lower bound on the size of a record, used to size the record
+  //! log when `overwrite_oldest` is set.
+  uint32_t min_record_size;
+
+  //! Optional callback invoked when readable bytes are available.
+  TraceBufferNotifyProc notify;
+  //! The number of bytes that must be readable before `notify` is invoked.
+  uint32_t notify_threshold;
+
+  //! The maximum number of milliseconds to wait for a reader to free space
+  //! before re-sending the bytes available notification.
+  uint32_t stall_timeout_milliseconds;
+
+  //! If nonzero, records that do not fit in the buffer are appended to a file
+  //! of up to this many bytes instead of waiting for a reader (or being
+  //! discarded in overwrite mode).
+  uint32_t spill_size;
+  //! Path of the spill file. Only referenced during TraceBufferInit.
+  const char* spill_path;
+  //! File I/O implementation used by the spill file.
+  const SpillFileIO* spill_io;
+
+  //! Optional allocator used for all memory held by the buffer. Defaults to
+  //! the TRACER_TAG_TRACE_BUFFER pool of the tracer memory budget.
+  CBAllocProc alloc_proc;
+  CBFreeProc free_proc;
+} TraceBufferConfig;
+
+typedef struct TraceBufferStats {
+  //! The number of records that were discarded, by record type.
+  uint32_t dropped_records[TRACE_BUFFER_MAX_RECORD_TYPES];
+  //! The number of bytes that were discarded, by record type.
+  uint32_t dropped_bytes[TRACE_BUFFER_MAX_RECORD_TYPES];
+
+  //! The number of times the producer had to wait for a reader.
+  uint32_t stalls;
+  //! The number of stall waits that timed out without space being freed.
+  uint32_t stall_timeouts;
+  //! The total time the producer spent waiting for a reader.
+  uint32_t stalled_milliseconds;
+
+  //! The number of records that were appended to the spill file.
+  uint32_t spilled_records;
+  //! The number of bytes that were appended to the spill file.
+  uint32_t spilled_bytes;
+} TraceBufferStats;
+
+//! Describes a single record in a TraceBuffer.
+typedef struct TraceBufferRecord {
+  //! The offset just past the end of the record in the stream of all bytes
+  //! ever committed to the buffer (modulo 2^32).
+  uint32_t end;
+  uint32_t size;
+  uint32_t type;
+} TraceBufferRecord;
+
+//! A circular buffer of whole records that is written by the tracer thread and
+//! drained by XBDM command handlers.
+typedef struct TraceBuffer {
+  CircularBuffer ring;
+  TraceBufferConfig config;
+
+  //! Nonzero while a reader (or the producer, while discarding old records)
+  //! owns the read side of `ring`.
+  volatile LONG read_lock;
+
+  //! Auto-reset event signaled by readers whenever they free space in `ring`.
+  HANDLE space_freed_event;
+  //! Unrounded total of stats.stalled_milliseconds.
+  double stalled_milliseconds;
+
+  //! Producer-side FIFO describing the records currently in `ring`. Only
+  //! maintained if `overwrite_oldest` is set.
+  TraceBufferRecord* records;
+  uint32_t records_capacity;
+  uint32_t records_head;
+  uint32_t records_count;
+
+  //! The total number of bytes ever committed to `ring` (modulo 2^32).
+  uint32_t bytes_committed;
+  //! The total number of bytes ever removed from the front of the buffer, by
+  //! readers or by discarding old records, including spilled bytes (modulo
+  //! 2^32). Only modified while holding the read lock.
+  uint32_t bytes_consumed;
+
+  //! Overflow storage for records that do not fit in `ring`, if enabled.
+  SpillFile spill;
+  //! Nonzero while the producer or a reader is accessing `spill`.
+  volatile LONG spill_lock;
+  //! Producer-side flag indicating that `spill` may hold records. While set,
+  //! new records must also be spilled so that they are read in order.
+  BOOL spill_active;
+  //! Buffer into which spilled bytes are read by TraceBufferPeek.
+  uint8_t* spill_read_buffer;
+  //! The number of bytes of the last peek that came from `spill` and have not
+  //! yet been consumed.
+  uint32_t spill_peek_size;
+
+  //! The number of bytes at the front of the buffer that were claimed via
+  //! TraceBufferClaim and have not yet been consumed.
+  uint32_t claimed_bytes;
+  //! Whether the claimed bytes were peeked from `spill`.
+  BOOL claim_from_spill;
+  //! Identifies the current claim. Incremented whenever a claim is made or
+  //! invalidated, so that a superseded claim can no longer consume bytes.
+  uint32_t claim_id;
+
+  //! The type and size of the outstanding reservation, if any.
+  uint32_t reservation_type;
+  uint32_t reservation_size;
+
+  TraceBufferStats stats;
+} TraceBuffer;
+
+//! Initializes the given TraceBuffer.
+//!
+//! If `config->overwrite_oldest` is TRUE, writers never wait for readers.
+//! Instead the oldest records are discarded to make room for new ones, and new
+//! records are discarded if that is not possible (e.g., because a read is in
+//! progress). The buffer will retain at most `size / min_record_size` records
+//! in this mode.
+//!
+//! Otherwise writers block on an event until a reader frees enough space.
+//!
+//! If `config->spill_size` is set, records that do not fit are appended to a
+//! spill file instead, and readers receive them after the contents of the
+//! ring. The writer only waits (or discards records) once the spill file is
+//! full as well.
+HRESULT TraceBufferInit(TraceBuffer* buffer, const TraceBufferConfig* config);
+
+//! Releases the resources held by the given TraceBuffer, waiting for any
+//! in-progress read to complete. An outstanding claim is waited on for as long
+//! as it makes progress, up to TRACE_BUFFER_CLAIM_TIMEOUT_MILLISECONDS at a
+//! time.
+void TraceBufferDestroy(TraceBuffer* buffer);
+
+//! Discards the contents of the given TraceBuffer and resets its statistics,
+//! retaining its storage so that it may be reused. Must not be called while the
+//! producer is writing, and waits for any in-progress read or claim to complete
+//! as TraceBufferDestroy does.
+void TraceBufferReset(TraceBuffer* buffer);
+
+//! Returns the number of bytes available for reading.
+uint32_t TraceBufferAvailable(TraceBuffer* buffer);
+
+//! Returns the capacity of the buffer, excluding any spill file. Records that
+//! are no larger than this are always published atomically.
+uint32_t TraceBufferGetCapacity(const TraceBuffer* buffer);
+
+//! Writes the given pieces to the buffer as a single record of the given type.
+//! Must only be called by the producer.
+//!
+//! Unless the buffer is in overwrite mode, this blocks until the record fits.
+//! Records larger than the capacity of the buffer can never be published
+//! atomically; they are streamed through piecewise in blocking mode and
+//! discarded in overwrite mode.
+void TraceBufferWrite(TraceBuffer* buffer, uint32_t type, const CBIOVec* vecs,
+                      uint32_t count);
+
+//! Reserves `size` bytes for a record of the given type that will be populated
+//! in place and published via TraceBufferCommit.
+//! Must only be called by the producer.
+//!
+//! Returns FALSE if the record is larger than CBMaxReservation allows, if it
+//! must be spilled, or, in overwrite mode, if room could not be made for it.
+//! The caller should fall back to TraceBufferWrite in that case.
+BOOL TraceBufferReserve(TraceBuffer* buffer, uint32_t type, uint32_t size,
+                        CBSpans* spans);
+
+//! Publishes the record previously reserved via TraceBufferReserve.
+void TraceBufferCommit(TraceBuffer* buffer);
+
+//! Acquires exclusive read access to the buffer, returning the number of bytes
+//! available for reading. The producer is never blocked by a reader.
+uint32_t TraceBufferLockRead(TraceBuffer* buffer);
+
+//! Copies up to `size` bytes into `out`, returning the number of bytes copied.
+//! Must be called while holding the read lock.
+uint32_t TraceBufferRead(TraceBuffer* buffer, void* out, uint32_t size);
+
+//! Populates `spans` with up to `size` readable bytes without consuming them,
+//! returning the number of bytes described.
+//! Spilled bytes are only returned once the ring is empty, at most
+//! TRACE_BUFFER_SPILL_READ_SIZE at a time.
+//! Must be called while holding the read lock.
+uint32_t TraceBufferPeek(TraceBuffer* buffer, CBSpans* spans, uint32_t size);
+
+//! Consumes `size` bytes previously returned by TraceBufferPeek and wakes the
+//! producer if it is waiting for space.
+//! Must be called while holding the read lock.
+void TraceBufferConsume(TraceBuffer* buffer, uint32_t size);
+
+//! Claims the first `size` bytes returned by the last TraceBufferPeek so that
+//! they may be consumed via TraceBufferConsumeClaim after the read lock has
+//! been released, e.g., as they are sent over the network. Claimed bytes are
+//! neither discarded in overwrite mode nor released by the buffer until they
+//! are consumed.
+//!
+//! There is at most one claim at a time. Any subsequent peek or read
+//! invalidates the outstanding claim, as its reader is assumed to have finished
+//! with or abandoned it.
+//!
+//! Returns an identifier to be passed to TraceBufferConsumeClaim.
+//! Must be called while holding the read lock.
+uint32_t TraceBufferClaim(TraceBuffer* buffer, uint32_t size);
+
+//! Consumes up to `size` bytes of the given claim and wakes the producer if it
+//! is waiting for space. Does nothing if the claim has been superseded or
+//! invalidated.
+//! Must be called without holding the read lock, which is acquired internally.
+void TraceBufferConsumeClaim(TraceBuffer* buffer, uint32_t claim,
+                             uint32_t size);
+
+//! Returns the total number of bytes ever removed from the front of the buffer
+//! since it was initialized or reset (modulo 2^32), which identifies the
+//! position of the next readable byte in the stream of all records.
+//! Must be called while holding the read lock.
+uint32_t TraceBufferGetBytesConsumed(const TraceBuffer* buffer);
+
+//! Releases read access acquired via TraceBufferLockRead and wakes the producer
+//! if it is waiting for space.
+void TraceBufferUnlockRead(TraceBuffer* buffer);
+
+//! Retrieves a snapshot of the statistics for the given buffer.
+void TraceBufferGetStats(const TraceBuffer* buffer, TraceBufferStats* stats);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // NTRC_DYNDXT_SRC_TRACELIB_TRACE_BUFFER_H_
@@ -0,0 +1,29 @@
+#include "tracer_memory.h"
+
+#include "xbdm.h"
+
+static void *Allocate(size_t size, uint32_t tag) {
+  return DmAllocatePoolWithTag(size, tag);
+}
+
+static void Free(void *block) { DmFreePool(block); }
+
+static MemoryBudget budget = MB_INITIALIZER(Allocate, Free);
+
+void *TracerAlloc(uint32_t size, uint32_t tag) {
+  return MBAlloc(&budget, size, tag);
+}
+
+void TracerFree(void *block) { MBFree(&budget, block); }
+
+BOOL TracerMemoryHasHeadroom(uint32_t size) {
+  return MBHasHeadroom(&budget, size);
+}
+
+void TracerSetMemoryCeiling(uint32_t ceiling) {
+  MBSetCeiling(&budget, ceiling);
+}
+
+void TracerGetMemoryStats(MemoryBudgetStats *stats) {
+  MBGetStats(&budget, stats);
+}
@@ -0,0 +1,45 @@
+#ifndef NTRC_DYNDXT_SRC_TRACELIB_TRACER_MEMORY_H_
+#define NTRC_DYNDXT_SRC_TRACELIB_TRACER_MEMORY_H_
+
+#include <windows.h>
+
+#include "util/memory_budget.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//! Pool tags used for tracer allocations.
+#define TRACER_TAG_STATE_MACHINE 0x6E74534D  // 'ntSM'
+#define TRACER_TAG_CAPTURE 0x6E744343        // 'ntCC'
+#define TRACER_TAG_PARAMETERS 0x6E745043     // 'ntPC'
+#define TRACER_TAG_TRACE_BUFFER 0x6E745442   // 'ntTB'
+#define TRACER_TAG_PGRAPH_BUFFER 0x74706762  // 'tpgb'
+#define TRACER_TAG_AUX_BUFFER 0x74617862     // 'taxb'
+
+//! Allocates `size` bytes from the XBDM pool, charged to the pool identified by
+//! `tag` in the global tracer memory budget.
+//!
+//! Returns NULL if the allocation would exceed the budget ceiling or if the
+//! pool is exhausted. Callers should treat this as a reason to skip optional
+//! work (e.g., a capture) rather than as a fatal error.
+void *TracerAlloc(uint32_t size, uint32_t tag);
+
+//! Frees a block previously returned by TracerAlloc.
+void TracerFree(void *block);
+
+//! Returns TRUE if `size` additional bytes would fit within the budget ceiling.
+BOOL TracerMemoryHasHeadroom(uint32_t size);
+
+//! Sets the maximum number of bytes that may be allocated via TracerAlloc, or 0
+//! to leave allocations unbounded.
+void TracerSetMemoryCeiling(uint32_t ceiling);
+
+//! Retrieves a snapshot of the global tracer memory budget.
+void TracerGetMemoryStats(MemoryBudgetStats *stats);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // NTRC_DYNDXT_SRC_TRACELIB_TRACER_MEMORY_H_
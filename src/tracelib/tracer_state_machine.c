@@ -1,22 +1,90 @@
 #include "tracer_state_machine.h"
 
+#include <stdio.h>
+#include <string.h>
+
 #include "exchange_dword.h"
 #include "kick_fifo.h"
 #include "pgraph_command_callbacks.h"
 #include "pushbuffer_command.h"
 #include "register_defs.h"
+#include "trace_buffer.h"
 #include "tracelib/configure.h"
+#include "tracer_memory.h"
+#include "util/arena.h"
 #include "util/circular_buffer.h"
+#include "util/compact_command.h"
+#include "util/log_filter.h"
+#include "util/parameter_policy.h"
+#include "util/profiler.h"
+#include "util/segment_cache.h"
 #include "xbdm.h"
 #include "xbox_helper.h"
+#include "xbox_spill_file_io.h"
 
 #define DEFAULT_PGRAPH_BUFFER_SIZE (1024 * 512)
 #define MIN_PGRAPH_BUFFER_SIZE (1024)
 //! The percentage of the PGRAPH circular buffer that must be filled before a
 //! notification is sent.
 #define PGRAPH_NOTIFY_PERCENT 0.5f
-#define DEFAULT_AUX_BUFFER_SIZE (1024 * 1024 * 4)
-#define MIN_AUX_BUFFER_SIZE (1024 * 512)
+//! Default ceiling of the aux lanes that carry surfaces and textures.
+#define DEFAULT_AUX_BULK_LANE_SIZE (1024 * 1024 * 4)
+//! Default ceiling of the aux lanes that carry small register dumps.
+#define DEFAULT_AUX_SMALL_LANE_SIZE (1024 * 512)
+#define MIN_AUX_LANE_SIZE (1024 * 64)
+//! Default relative share of read_aux responses given to the small lanes.
+#define DEFAULT_AUX_SMALL_LANE_WEIGHT 4
+//! Lanes are allocated up front by default. A segmented lane can only reserve
+//! entries that fit in one chunk, so larger surfaces and textures would have to
+//! be staged and copied, and each read_aux response would be limited to two
+//! chunks.
+#define DEFAULT_AUX_CHUNK_SIZE 0
+#define MIN_AUX_CHUNK_SIZE (1024 * 16)
+#define DEFAULT_AUX_SPILL_PATH "E:\\ntrc_aux_spill"
+//! Milliseconds to wait for the remote to drain a full buffer before re-sending
+//! the bytes available notification.
+#define DEFAULT_STALL_TIMEOUT_MILLISECONDS 1000
+//! Default maximum number of bytes to leave in the FIFO before allowing it to
+//! be processed (see TracerConfig::max_queue_depth).
+#define DEFAULT_MAX_QUEUE_DEPTH 200
+//! Number of bytes by which the adaptive queue depth grows after each flush
+//! that the title did not interfere with.
+#define QUEUE_DEPTH_INCREASE 32
+//! Divisor applied to the adaptive queue depth when a flush conflicts with the
+//! title.
+#define QUEUE_DEPTH_BACKOFF_DIVISOR 4
+//! Approximate lower bound on the size of aux records, used to bound the number
+//! of records tracked when overwriting old records.
+#define AUX_RECORD_SIZE_ESTIMATE 256
+//! Milliseconds to wait for a previous session to finish shutting down before
+//! rejecting a new one.
+#define SESSION_END_TIMEOUT_MILLISECONDS 5000
+//! Milliseconds the idle tracer thread waits for a request before rechecking
+//! for shutdown. Requests wake the thread immediately.
+#define REQUEST_WAIT_TIMEOUT_MILLISECONDS 100
+//! Number of bytes of pushbuffer that are copied and decoded at once.
+#define PUSH_BUFFER_RANGE_SNAPSHOT_SIZE (1024 * 16)
+//! Maximum number of commands decoded at once.
+#define PUSH_BUFFER_RANGE_ENTRIES 1024
+//! The number of PGRAPH subchannels.
+#define NUM_SUBCHANNELS 8
+//! Maximum number of bytes of pushbuffer examined per scan for flip methods.
+#define FLIP_SCAN_WINDOW_SIZE (1024 * 4)
+//! Number of commands following a FLIP_INCREMENT_WRITE that are searched for a
+//! FLIP_STALL.
+#define FLIP_STALL_PEEK_COMMANDS 5
+//! Number of bytes reserved for the parameters of the commands in a batch. This
+//! is enough for a full batch followed by a command with the maximum number of
+//! parameters.
+#define PARAMETER_ARENA_SIZE (1024 * 16)
+//! Maximum number of bytes of command entries held back while a subroutine is
+//! traced. Longer subroutines are always sent in full.
+#define SEGMENT_STAGING_SIZE (1024 * 16)
+//! Number of slots in the cache of subroutines sent during a session.
+#define SEGMENT_CACHE_ENTRIES 1024
+//! Maximum number of parameters of a command that may be coalesced with
+//! identical commands that follow it.
+#define COMMAND_RUN_MAX_PARAMETERS 16
 
 // Maximum number of sleep/kick attempts before permanently failing FIFO
 // population.
@@ -31,13 +99,73 @@ typedef enum TracerRequest {
   REQ_TRACE_UNTIL_FLIP_FROM_ARBITRARY_STATE,
 } TracerRequest;
 
+//! Holds back the command entries of a subroutine until it returns, so that a
+//! repeat of a previously sent subroutine can be replaced by a reference.
+typedef struct SegmentRecorder {
+  //! Staging storage for command entries. NULL if deduplication is disabled.
+  uint8_t* buffer;
+  //! The number of bytes in `buffer`.
+  uint32_t size;
+
+  //! Whether the last command processed was inside of a subroutine.
+  BOOL in_subroutine;
+  //! Whether entries are being staged. Cleared if the subroutine cannot be
+  //! deduplicated, after which its entries are written directly.
+  BOOL active;
+
+  //! The address of the subroutine.
+  uint32_t address;
+  uint32_t first_packet_index;
+  uint32_t entry_count;
+  //! Hash of the staged entries, with packet indices relative to the first.
+  uint64_t hash;
+
+  //! Subroutines that have been defined during this session.
+  SegmentCache cache;
+
+  uint32_t segments_defined;
+  uint32_t segments_referenced;
+  uint32_t bytes_elided;
+} SegmentRecorder;
+
+//! Holds back a logged command to count the identical commands that
+//! immediately follow it.
+typedef struct CommandRun {
+  //! Whether `info` holds a command that has not been written yet.
+  BOOL pending;
+  //! The first command of the run. Parameters that do not fit inline are
+  //! borrowed from `parameters`.
+  PushBufferCommandTraceInfo info;
+  uint32_t parameters[COMMAND_RUN_MAX_PARAMETERS];
+  //! The number of commands identical to `info` that followed it.
+  uint32_t repeat_count;
+} CommandRun;
+
 typedef struct TracerStateMachine {
+  // The tracer thread is created by the first session and parked between
+  // sessions rather than exiting.
   HANDLE processor_thread;
   DWORD processor_thread_id;
+  // Auto-reset event signaled to start a session on the tracer thread.
+  HANDLE session_event;
+  // Auto-reset event signaled when a session has ended or parked buffers have
+  // been released.
+  HANDLE session_end_event;
+  // Auto-reset event signaled when a request is set or a shutdown is requested.
+  HANDLE request_event;
 
   CRITICAL_SECTION state_critical_section;
   TracerState state;
   TracerRequest request;
+  // Time at which `request` was set, and whether the tracer thread has yet to
+  // start processing it.
+  PROFILETOKEN request_time;
+  BOOL request_pending_start;
+  // Number of requests started during the session, and the latency between
+  // setting a request and the tracer thread starting it.
+  uint32_t requests_started;
+  uint32_t request_latency_us;
+  uint32_t request_latency_max_us;
 
   BOOL dma_addresses_valid;
   uint32_t real_dma_pull_addr;
@@ -50,46 +178,126 @@ typedef struct TracerStateMachine {
   NotifyBytesAvailableHandler on_aux_buffer_bytes_available;
 
   TracerConfig config;
-  CRITICAL_SECTION pgraph_critical_section;
-  CircularBuffer pgraph_buffer;
-  // The number of bytes that must be written to the pgraph_buffer before a
-  // notification is sent. This is used to reduce chatter as pgraph entries are
-  // very small and frequent.
-  uint32_t pgraph_buffer_notify_threshold;
-  CRITICAL_SECTION aux_critical_section;
-  CircularBuffer aux_buffer;
+  // The tracer thread is the sole producer for all buffers.
+  TraceBuffer pgraph_buffer;
+  // Aux data is split into independent lanes, indexed by AuxDataType.
+  TraceBuffer aux_buffers[AUX_DATA_TYPE_COUNT];
+  // The lane holding the outstanding aux reservation, if any.
+  AuxDataType aux_reservation_type;
+  // Incremented whenever the aux lanes are created, destroyed, or reset.
+  volatile LONG aux_generation;
+
+  // Commands decoded ahead of the trace loop. Unused if the storage could not
+  // be allocated.
+  PushBufferRange pushbuffer_range;
+  // Graphics class bound to each subchannel, fetched at most once per range
+  // and invalidated whenever the FIFO is run.
+  uint32_t graphics_classes[NUM_SUBCHANNELS];
+  // Bitmask of the valid `graphics_classes` entries.
+  uint32_t graphics_classes_valid;
+
+  // Holds the parameters of the commands decoded since the FIFO was last
+  // flushed. NULL if the storage could not be allocated, in which case
+  // parameters are allocated individually.
+  Arena parameter_arena;
+
+  SegmentRecorder segment_recorder;
+
+  // Filters are double buffered so that they may be replaced while tracing.
+  // The active filter is `log_filters[log_filter_generation & 1]`.
+  LogFilter log_filters[2];
+  uint32_t log_filter_generation;
+  // One more than the index of the filter being read by the tracer thread, or
+  // 0 if it is not reading either filter. Writers wait for the slot they are
+  // about to rebuild to be released.
+  volatile LONG log_filter_in_use;
+  // Serializes TracerSetLogFilter.
+  CRITICAL_SECTION log_filter_critical_section;
+  uint32_t commands_filtered;
+
+  CommandRun command_run;
+  uint32_t commands_coalesced;
+
+  ParameterPolicy parameter_policy;
+  uint32_t commands_truncated;
+  uint32_t parameter_bytes_omitted;
+
+  // Bitmask of the AuxDataTypes enabled by the config, selecting the hooks
+  // that are armed.
+  uint32_t armed_captures;
+  // Number of times the FIFO has been run during the session.
+  uint32_t fifo_runs;
+
+  // Maximum number of bytes to queue in the FIFO before running it, adjusted
+  // between TracerConfig::max_queue_depth and max_queue_depth_limit.
+  uint32_t queue_depth;
+  uint32_t queue_depth_backoffs;
+  // Whether the title moved the DMA push address while the pusher was active
+  // since the queue depth was last updated.
+  BOOL put_conflict;
+
+  // Values predicted for the next command written in the compact encoding.
+  CCState command_encoder;
+
+  // Whether the buffers hold storage that may be reused by the next session.
+  BOOL buffers_allocated;
+  // Whether the buffers should be freed when the current session ends instead
+  // of being retained for the next one.
+  BOOL release_on_shutdown;
+  // Whether parked buffers are being released outside of the state lock, in
+  // which case a new session may not be started yet.
+  BOOL releasing_buffers;
 } TracerStateMachine;
 
 //! Describes a callback that may be called before/after a PGRAPH command is
 //! processed.
 typedef void (*PGRAPHCommandCallback)(const PushBufferCommandTraceInfo* info,
-                                      TraceContext* state, StoreAuxData store,
+                                      TraceContext* state,
+                                      const AuxDataWriter* writer,
                                       const AuxConfig* config);
 
+//! Identifies an entry in kPGRAPHCommandHooks.
+typedef enum PGRAPHCommandHookID {
+  HOOK_NONE = 0,
+  HOOK_TRACE_SURFACES,
+  HOOK_TRACE_BEGIN,
+  HOOK_TRACE_END,
+  HOOK_COUNT,
+} PGRAPHCommandHookID;
+
+//! A callback that may be attached to a method.
+typedef struct PGRAPHCommandHook {
+  PGRAPHCommandCallback callback;
+  //! Bitmask of the AuxDataTypes captured by `callback`. The hook is only armed
+  //! (and the FIFO only stepped for it) if one of its types is enabled, as it
+  //! does nothing otherwise.
+  uint32_t captures;
+} PGRAPHCommandHook;
+
+//! Holds the hooks for a single method as PGRAPHCommandHookIDs, which keeps
+//! each per-class table (see NUM_METHOD_SLOTS) down to 4 KiB.
 typedef struct PGRAPHCommandProcessor {
-  //! Whether or not this struct is valid.
-  BOOL valid;
-
-  //! The method ID to be processed.
-  uint32_t command;
-
-  //! Optional callback to be invoked before processing the command.
-  PGRAPHCommandCallback pre_callback;
-  //! Optional callback to be invoked after processing the command.
-  PGRAPHCommandCallback post_callback;
+  //! Optional hook to be invoked before processing the command.
+  uint8_t pre_hook;
+  //! Optional hook to be invoked after processing the command.
+  uint8_t post_hook;
 } PGRAPHCommandProcessor;
 
-typedef struct PGRAPHClassProcessor {
-  uint32_t class;
-  PGRAPHCommandProcessor* processors;
-} PGRAPHClassProcessor;
+//! Converts an AuxDataType into a bit for PGRAPHCommandHook captures.
+#define AUX_BIT(type) (1 << (type))
 
-static const uint32_t kTag = 0x6E74534D;  // 'ntSM'
+//! The number of distinct method IDs. Methods are 4-byte aligned offsets below
+//! 0x2000, so each has its own slot in a per-class table indexed by
+//! `method >> 2`.
+#define NUM_METHOD_SLOTS (0x2000 / 4)
+//! The number of graphics classes that may be hooked. All NV2A object classes
+//! are below 0x100.
+#define NUM_CLASS_SLOTS 0x100
 
-// Maximum number of bytes to leave in the FIFO before allowing it to be
-// processed. A cap is necessary to prevent Direct3D from performing fixups that
-// would not happen outside of tracing conditions.
-static const uint32_t kMaxQueueDepthBeforeFlush = 200;
+static const PBSMethod kFlipMethods[] = {
+    {PBS_ANY_SUBCHANNEL, NV097_FLIP_STALL},
+    {PBS_ANY_SUBCHANNEL, NV097_FLIP_INCREMENT_WRITE},
+};
 
 static TracerStateMachine state_machine = {0};
 
@@ -99,36 +307,48 @@ static DWORD __attribute__((stdcall)) TracerThreadMain(
 static void SetState(TracerState new_state);
 static TracerRequest GetRequest(void);
 static BOOL SetRequest(TracerRequest new_request);
-static void Shutdown(void);
+static void RunSession(void);
+static void EndSession(void);
 
 static void WaitForStablePushBufferState(void);
 static void DiscardUntilFramebufferFlip(BOOL require_new_frame);
 static void TraceUntilFramebufferFlip(BOOL discard, BOOL allow_start_in_frame);
 
-#define HOOK_METHOD(cmd, pre_cb, post_cb) {TRUE, cmd, pre_cb, post_cb}
+#define SURFACE_CAPTURES AUX_BIT(ADT_SURFACE)
+#define DRAW_END_CAPTURES \
+  (AUX_BIT(ADT_SURFACE) | AUX_BIT(ADT_PGRAPH_DUMP) | AUX_BIT(ADT_PFB_DUMP))
 
-#define HOOK_END() {FALSE, 0, NULL, NULL}
+static const PGRAPHCommandHook kPGRAPHCommandHooks[HOOK_COUNT] = {
+    [HOOK_NONE] = {NULL, 0},
+    [HOOK_TRACE_SURFACES] = {TraceSurfaces, SURFACE_CAPTURES},
+    [HOOK_TRACE_BEGIN] = {TraceBegin, AUX_BIT(ADT_TEXTURE)},
+    [HOOK_TRACE_END] = {TraceEnd, DRAW_END_CAPTURES},
+};
 
-static PGRAPHCommandProcessor kClass97Processors[] = {
-    HOOK_METHOD(NV097_CLEAR_SURFACE, NULL, TraceSurfaces),
-    HOOK_METHOD(NV097_BACK_END_WRITE_SEMAPHORE_RELEASE, NULL, TraceSurfaces),
-    HOOK_METHOD(NV097_SET_BEGIN_END, TraceBegin, TraceEnd),
-    HOOK_END(),
+#undef DRAW_END_CAPTURES
+#undef SURFACE_CAPTURES
+
+#define HOOK_METHOD(cmd, pre_hook, post_hook) \
+  [(cmd) >> 2] = {pre_hook, post_hook}
+
+// Each hooked class has a table covering every method, so looking up the hooks
+// for a command costs a constant number of indexed loads regardless of the
+// number of hooks. The tables are read-only data rather than allocations, so
+// they are not charged to the tracer memory budget.
+static const PGRAPHCommandProcessor kClass97Processors[NUM_METHOD_SLOTS] = {
+    HOOK_METHOD(NV097_CLEAR_SURFACE, HOOK_NONE, HOOK_TRACE_SURFACES),
+    HOOK_METHOD(NV097_BACK_END_WRITE_SEMAPHORE_RELEASE, HOOK_NONE,
+                HOOK_TRACE_SURFACES),
+    HOOK_METHOD(NV097_SET_BEGIN_END, HOOK_TRACE_BEGIN, HOOK_TRACE_END),
 };
 
-static const PGRAPHClassProcessor kPGRAPHProcessorRegistry[] = {
-    {0x97, kClass97Processors},
-    {0, NULL},
+// Indexed by graphics class. Classes without hooks are NULL.
+static const PGRAPHCommandProcessor* const
+    kPGRAPHProcessorRegistry[NUM_CLASS_SLOTS] = {
+        [0x97] = kClass97Processors,
 };
 
 #undef HOOK_METHOD
-#undef HOOK_END
-
-static void* Allocator(size_t size) {
-  return DmAllocatePoolWithTag(size, kTag);
-}
-
-static void Free(void* block) { return DmFreePool(block); }
 
 HRESULT TracerInitialize(
     NotifyStateChangedHandler on_notify_state_changed,
@@ -146,16 +366,55 @@ HRESULT TracerInitialize(
       on_pgraph_buffer_bytes_available;
   state_machine.on_aux_buffer_bytes_available = on_aux_buffer_bytes_available;
 
+  state_machine.session_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+  if (!state_machine.session_event) {
+    DbgPrint("ERROR: Failed to create session event.");
+    return XBOX_E_FAIL;
+  }
+
+  state_machine.session_end_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+  if (!state_machine.session_end_event) {
+    DbgPrint("ERROR: Failed to create session end event.");
+    return XBOX_E_FAIL;
+  }
+
+  state_machine.request_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+  if (!state_machine.request_event) {
+    DbgPrint("ERROR: Failed to create request event.");
+    return XBOX_E_FAIL;
+  }
+
   state_machine.state = STATE_UNINITIALIZED;
   InitializeCriticalSection(&state_machine.state_critical_section);
-  InitializeCriticalSection(&state_machine.pgraph_critical_section);
-  InitializeCriticalSection(&state_machine.aux_critical_section);
+  InitializeCriticalSection(&state_machine.log_filter_critical_section);
+  LFReset(&state_machine.log_filters[0]);
 
   return XBOX_S_OK;
 }
 void TracerGetDefaultConfig(TracerConfig* config) {
   config->pgraph_circular_buffer_size = DEFAULT_PGRAPH_BUFFER_SIZE;
-  config->aux_circular_buffer_size = DEFAULT_AUX_BUFFER_SIZE;
+  for (uint32_t i = 0; i < AUX_DATA_TYPE_COUNT; ++i) {
+    config->aux_lane_sizes[i] = DEFAULT_AUX_SMALL_LANE_SIZE;
+    config->aux_lane_weights[i] = DEFAULT_AUX_SMALL_LANE_WEIGHT;
+  }
+  config->aux_lane_sizes[ADT_SURFACE] = DEFAULT_AUX_BULK_LANE_SIZE;
+  config->aux_lane_weights[ADT_SURFACE] = 1;
+  config->aux_lane_sizes[ADT_TEXTURE] = DEFAULT_AUX_BULK_LANE_SIZE;
+  config->aux_lane_weights[ADT_TEXTURE] = 2;
+  config->aux_chunk_size = DEFAULT_AUX_CHUNK_SIZE;
+  config->aux_spill_size = 0;
+  strncpy(config->aux_spill_path, DEFAULT_AUX_SPILL_PATH,
+          sizeof(config->aux_spill_path));
+  config->overwrite_oldest = FALSE;
+  config->stall_timeout_milliseconds = DEFAULT_STALL_TIMEOUT_MILLISECONDS;
+  config->max_queue_depth = DEFAULT_MAX_QUEUE_DEPTH;
+  config->max_queue_depth_limit = 0;
+  config->memory_ceiling = 0;
+  config->dedup_segments = FALSE;
+  config->log_filter[0] = 0;
+  config->compact_encoding = FALSE;
+  config->coalesce_repeats = FALSE;
+  config->parameter_policy[0] = 0;
 
   config->aux_tracing_config.raw_pgraph_capture_enabled = FALSE;
   config->aux_tracing_config.raw_pfb_capture_enabled = FALSE;
@@ -165,76 +424,401 @@ void TracerGetDefaultConfig(TracerConfig* config) {
   config->aux_tracing_config.texture_capture_enabled = TRUE;
 }
 
-static BOOL AuxCaptureEnabled(const AuxConfig* config) {
-  return config->raw_pgraph_capture_enabled ||
-         config->raw_pfb_capture_enabled || config->rdi_capture_enabled ||
-         config->surface_color_capture_enabled ||
-         config->surface_depth_capture_enabled ||
-         config->texture_capture_enabled;
+static BOOL AuxCaptureEnabled(const AuxConfig* config, AuxDataType type) {
+  switch (type) {
+    case ADT_PGRAPH_DUMP:
+      return config->raw_pgraph_capture_enabled;
+    case ADT_PFB_DUMP:
+      return config->raw_pfb_capture_enabled;
+    case ADT_RDI_DUMP:
+      return config->rdi_capture_enabled;
+    case ADT_SURFACE:
+      return config->surface_color_capture_enabled ||
+             config->surface_depth_capture_enabled;
+    case ADT_TEXTURE:
+      return config->texture_capture_enabled;
+  }
+  return FALSE;
+}
+
+static void* AllocatePGRAPHBuffer(size_t size) {
+  return TracerAlloc(size, TRACER_TAG_PGRAPH_BUFFER);
+}
+
+static void* AllocateAuxBuffer(size_t size) {
+  return TracerAlloc(size, TRACER_TAG_AUX_BUFFER);
+}
+
+static void DestroyAuxBuffers(void) {
+  for (uint32_t i = 0; i < AUX_DATA_TYPE_COUNT; ++i) {
+    TraceBufferDestroy(&state_machine.aux_buffers[i]);
+  }
+  InterlockedIncrement(&state_machine.aux_generation);
+}
+
+//! Creates a lane for each enabled type of aux data.
+static HRESULT InitAuxBuffers(const TracerConfig* config,
+                              TraceBufferConfig* buffer_config) {
+  memset(state_machine.aux_buffers, 0, sizeof(state_machine.aux_buffers));
+
+  buffer_config->chunk_size = config->aux_chunk_size;
+  if (buffer_config->chunk_size &&
+      buffer_config->chunk_size < MIN_AUX_CHUNK_SIZE) {
+    buffer_config->chunk_size = MIN_AUX_CHUNK_SIZE;
+  }
+  buffer_config->spill_size = config->aux_spill_size;
+  buffer_config->spill_io = &kXboxSpillFileIO;
+  buffer_config->min_record_size = AUX_RECORD_SIZE_ESTIMATE;
+  buffer_config->alloc_proc = AllocateAuxBuffer;
+  buffer_config->free_proc = TracerFree;
+  buffer_config->notify = state_machine.on_aux_buffer_bytes_available;
+  buffer_config->notify_threshold = 0;
+
+  char spill_path[TRACER_MAX_SPILL_PATH + 32];
+  buffer_config->spill_path = spill_path;
+
+  for (uint32_t i = 0; i < AUX_DATA_TYPE_COUNT; ++i) {
+    if (!AuxCaptureEnabled(&config->aux_tracing_config, i)) {
+      continue;
+    }
+
+    buffer_config->size = config->aux_lane_sizes[i];
+    if (buffer_config->size < MIN_AUX_LANE_SIZE) {
+      buffer_config->size = MIN_AUX_LANE_SIZE;
+    }
+    snprintf(spill_path, sizeof(spill_path), "%s_%s.bin",
+             config->aux_spill_path, AuxDataTypeName(i));
+
+    HRESULT ret = TraceBufferInit(&state_machine.aux_buffers[i], buffer_config);
+    if (!XBOX_SUCCESS(ret)) {
+      DestroyAuxBuffers();
+      return ret;
+    }
+  }
+
+  buffer_config->spill_path = NULL;
+  InterlockedIncrement(&state_machine.aux_generation);
+  return XBOX_S_OK;
+}
+
+static uint32_t AuxBytesAvailable(void) {
+  uint32_t ret = 0;
+  for (uint32_t i = 0; i < AUX_DATA_TYPE_COUNT; ++i) {
+    ret += TraceBufferAvailable(&state_machine.aux_buffers[i]);
+  }
+  return ret;
+}
+
+static void DestroyPushBufferRange(void) {
+  PushBufferRange* range = &state_machine.pushbuffer_range;
+  TracerFree(range->snapshot);
+  TracerFree(range->entries);
+  memset(range, 0, sizeof(*range));
+}
+
+//! Allocates the storage used to decode the pushbuffer in bulk. On failure the
+//! tracer falls back to decoding one command at a time.
+static void InitPushBufferRange(void) {
+  PushBufferRange* range = &state_machine.pushbuffer_range;
+  memset(range, 0, sizeof(*range));
+  range->snapshot = (uint32_t*)TracerAlloc(PUSH_BUFFER_RANGE_SNAPSHOT_SIZE,
+                                           TRACER_TAG_STATE_MACHINE);
+  range->entries = (PushBufferRangeEntry*)TracerAlloc(
+      PUSH_BUFFER_RANGE_ENTRIES * sizeof(PushBufferRangeEntry),
+      TRACER_TAG_STATE_MACHINE);
+  if (!range->snapshot || !range->entries) {
+    DbgPrint("WARNING: Failed to allocate pushbuffer range, decoding serially");
+    DestroyPushBufferRange();
+    return;
+  }
+  range->snapshot_capacity = PUSH_BUFFER_RANGE_SNAPSHOT_SIZE;
+  range->entry_capacity = PUSH_BUFFER_RANGE_ENTRIES;
+}
+
+static void DestroySegmentRecorder(void) {
+  SegmentRecorder* recorder = &state_machine.segment_recorder;
+  TracerFree(recorder->buffer);
+  TracerFree(recorder->cache.entries);
+  memset(recorder, 0, sizeof(*recorder));
+}
+
+//! Allocates the storage used to deduplicate subroutines. On failure every
+//! subroutine is sent in full.
+static void InitSegmentRecorder(const TracerConfig* config) {
+  SegmentRecorder* recorder = &state_machine.segment_recorder;
+  memset(recorder, 0, sizeof(*recorder));
+  if (!config->dedup_segments || config->overwrite_oldest ||
+      config->compact_encoding) {
+    return;
+  }
+
+  recorder->buffer =
+      (uint8_t*)TracerAlloc(SEGMENT_STAGING_SIZE, TRACER_TAG_STATE_MACHINE);
+  SegmentCacheEntry* entries = (SegmentCacheEntry*)TracerAlloc(
+      SEGMENT_CACHE_ENTRIES * sizeof(SegmentCacheEntry),
+      TRACER_TAG_STATE_MACHINE);
+  if (!recorder->buffer || !entries) {
+    DbgPrint("WARNING: Failed to allocate segment cache, not deduplicating");
+    TracerFree(entries);
+    DestroySegmentRecorder();
+    return;
+  }
+  SCInit(&recorder->cache, entries, SEGMENT_CACHE_ENTRIES);
+}
+
+static void ResetSegmentRecorder(void) {
+  SegmentRecorder* recorder = &state_machine.segment_recorder;
+  recorder->size = 0;
+  recorder->in_subroutine = FALSE;
+  recorder->active = FALSE;
+  recorder->segments_defined = 0;
+  recorder->segments_referenced = 0;
+  recorder->bytes_elided = 0;
+  if (recorder->buffer) {
+    SCReset(&recorder->cache);
+  }
+}
+
+static void* AllocateParameterArena(size_t size) {
+  return TracerAlloc(size, TRACER_TAG_PARAMETERS);
+}
+
+static void DestroyBuffers(void) {
+  DestroyAuxBuffers();
+  TraceBufferDestroy(&state_machine.pgraph_buffer);
+  DestroyPushBufferRange();
+  ArenaDestroy(state_machine.parameter_arena);
+  state_machine.parameter_arena = NULL;
+  DestroySegmentRecorder();
+  state_machine.buffers_allocated = FALSE;
+}
+
+static HRESULT InitBuffers(const TracerConfig* config) {
+  DestroyBuffers();
+
+  TraceBufferConfig buffer_config = {
+      .overwrite_oldest = config->overwrite_oldest,
+      .stall_timeout_milliseconds = config->stall_timeout_milliseconds,
+  };
+
+  HRESULT ret = InitAuxBuffers(config, &buffer_config);
+  if (!XBOX_SUCCESS(ret)) {
+    return ret;
+  }
+
+  buffer_config.size = config->pgraph_circular_buffer_size;
+  buffer_config.chunk_size = 0;
+  buffer_config.spill_size = 0;
+  if (buffer_config.size < MIN_PGRAPH_BUFFER_SIZE) {
+    buffer_config.size = MIN_PGRAPH_BUFFER_SIZE;
+  }
+  buffer_config.min_record_size = sizeof(PushBufferCommandTraceInfo);
+  buffer_config.alloc_proc = AllocatePGRAPHBuffer;
+  buffer_config.free_proc = TracerFree;
+  buffer_config.notify = state_machine.on_pgraph_buffer_bytes_available;
+  // PGRAPH entries are very small and frequent, so notifications are only sent
+  // once a significant portion of the buffer is filled to reduce chatter.
+  buffer_config.notify_threshold =
+      (uint32_t)((float)buffer_config.size * PGRAPH_NOTIFY_PERCENT);
+  ret = TraceBufferInit(&state_machine.pgraph_buffer, &buffer_config);
+  if (!XBOX_SUCCESS(ret)) {
+    DestroyAuxBuffers();
+    return ret;
+  }
+
+  InitPushBufferRange();
+  state_machine.parameter_arena = ArenaCreate(
+      PARAMETER_ARENA_SIZE, AllocateParameterArena, TracerFree);
+  if (!state_machine.parameter_arena) {
+    DbgPrint("WARNING: Failed to allocate parameter arena");
+  }
+  InitSegmentRecorder(config);
+  state_machine.buffers_allocated = TRUE;
+  return XBOX_S_OK;
+}
+
+static void ResetBuffers(void) {
+  TraceBufferReset(&state_machine.pgraph_buffer);
+  for (uint32_t i = 0; i < AUX_DATA_TYPE_COUNT; ++i) {
+    TraceBufferReset(&state_machine.aux_buffers[i]);
+  }
+  InterlockedIncrement(&state_machine.aux_generation);
+  ArenaReset(state_machine.parameter_arena);
+  ResetSegmentRecorder();
+}
+
+//! Returns TRUE if the buffers created for config `a` are identical to those
+//! that would be created for config `b`.
+static BOOL BuffersAreCompatible(const TracerConfig* a, const TracerConfig* b) {
+  if (a->pgraph_circular_buffer_size != b->pgraph_circular_buffer_size ||
+      a->aux_chunk_size != b->aux_chunk_size ||
+      a->aux_spill_size != b->aux_spill_size ||
+      !a->overwrite_oldest != !b->overwrite_oldest ||
+      !a->dedup_segments != !b->dedup_segments ||
+      !a->compact_encoding != !b->compact_encoding ||
+      a->stall_timeout_milliseconds != b->stall_timeout_milliseconds) {
+    return FALSE;
+  }
+  if (a->aux_spill_size && strcmp(a->aux_spill_path, b->aux_spill_path)) {
+    return FALSE;
+  }
+
+  for (uint32_t i = 0; i < AUX_DATA_TYPE_COUNT; ++i) {
+    BOOL enabled = AuxCaptureEnabled(&a->aux_tracing_config, i);
+    if (!enabled != !AuxCaptureEnabled(&b->aux_tracing_config, i)) {
+      return FALSE;
+    }
+    if (enabled && a->aux_lane_sizes[i] != b->aux_lane_sizes[i]) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+//! Waits for a previous session to be parked, returning TRUE if a new session
+//! may be started.
+static BOOL WaitForSessionEnd(void) {
+  DWORD start_time = GetTickCount();
+  while (1) {
+    EnterCriticalSection(&state_machine.state_critical_section);
+    TracerState state = state_machine.state;
+    BOOL releasing = state_machine.releasing_buffers;
+    LeaveCriticalSection(&state_machine.state_critical_section);
+
+    if ((state == STATE_UNINITIALIZED || state == STATE_SHUTDOWN) &&
+        !releasing) {
+      return TRUE;
+    }
+    if (state > STATE_UNINITIALIZED) {
+      return FALSE;
+    }
+
+    DWORD elapsed = GetTickCount() - start_time;
+    if (elapsed >= SESSION_END_TIMEOUT_MILLISECONDS) {
+      return FALSE;
+    }
+    WaitForSingleObject(state_machine.session_end_event,
+                        SESSION_END_TIMEOUT_MILLISECONDS - elapsed);
+  }
 }
 
 HRESULT TracerCreate(const TracerConfig* config) {
   DbgPrint("TracerCreate: %d", state_machine.state);
 
-  if (state_machine.state > STATE_UNINITIALIZED) {
+  if (!WaitForSessionEnd()) {
     DbgPrint("Unexpected state %d in TracerCreate", state_machine.state);
     return XBOX_E_EXISTS;
   }
 
+  HRESULT ret = TracerSetLogFilter(config->log_filter);
+  if (!XBOX_SUCCESS(ret)) {
+    DbgPrint("Invalid log filter \"%s\" in TracerCreate", config->log_filter);
+    return ret;
+  }
+  state_machine.commands_filtered = 0;
+  state_machine.commands_coalesced = 0;
+  state_machine.command_run.pending = FALSE;
+
+  // The tracer thread is parked, so the policy may be replaced in place.
+  PPReset(&state_machine.parameter_policy);
+  if (!PPApplyRules(&state_machine.parameter_policy,
+                    config->parameter_policy)) {
+    DbgPrint("Invalid parameter policy \"%s\" in TracerCreate",
+             config->parameter_policy);
+    PPReset(&state_machine.parameter_policy);
+    return XBOX_E_FAIL;
+  }
+  state_machine.commands_truncated = 0;
+  state_machine.parameter_bytes_omitted = 0;
+
+  TracerState parked_state = TracerGetState();
   SetState(STATE_INITIALIZING);
-  state_machine.config = *config;
-  state_machine.request = REQ_NONE;
 
-  if (AuxCaptureEnabled(&config->aux_tracing_config)) {
-    uint32_t buffer_size = config->aux_circular_buffer_size;
-    if (buffer_size < MIN_AUX_BUFFER_SIZE) {
-      buffer_size = MIN_AUX_BUFFER_SIZE;
-    }
-    state_machine.aux_buffer = CBCreateEx(buffer_size, Allocator, Free);
-    if (!state_machine.aux_buffer) {
-      return XBOX_E_ACCESS_DENIED;
-    }
-  } else {
-    state_machine.aux_buffer = NULL;
+  // Buffers from the previous session are reused as long as their layout is
+  // unchanged, avoiding repeated large allocations for back to back sessions.
+  BOOL reuse_buffers = state_machine.buffers_allocated &&
+                       BuffersAreCompatible(&state_machine.config, config);
+  state_machine.config = *config;
+  if (config->overwrite_oldest) {
+    state_machine.config.compact_encoding = FALSE;
   }
-
-  uint32_t buffer_size = config->pgraph_circular_buffer_size;
-  if (buffer_size < MIN_PGRAPH_BUFFER_SIZE) {
-    buffer_size = MIN_PGRAPH_BUFFER_SIZE;
+  CCInit(&state_machine.command_encoder);
+  state_machine.armed_captures = 0;
+  for (uint32_t i = 0; i < AUX_DATA_TYPE_COUNT; ++i) {
+    if (AuxCaptureEnabled(&config->aux_tracing_config, i)) {
+      state_machine.armed_captures |= AUX_BIT(i);
+    }
   }
-  state_machine.pgraph_buffer = CBCreateEx(buffer_size, Allocator, Free);
-  if (!state_machine.pgraph_buffer) {
-    CBDestroy(state_machine.aux_buffer);
-    return XBOX_E_ACCESS_DENIED;
+  state_machine.fifo_runs = 0;
+  state_machine.queue_depth = config->max_queue_depth;
+  state_machine.queue_depth_backoffs = 0;
+  state_machine.put_conflict = FALSE;
+  state_machine.request = REQ_NONE;
+  state_machine.request_pending_start = FALSE;
+  state_machine.requests_started = 0;
+  state_machine.request_latency_us = 0;
+  state_machine.request_latency_max_us = 0;
+  state_machine.release_on_shutdown = FALSE;
+  TracerSetMemoryCeiling(config->memory_ceiling);
+
+  if (reuse_buffers) {
+    ResetBuffers();
+  } else {
+    ret = InitBuffers(config);
+    if (!XBOX_SUCCESS(ret)) {
+      SetState(parked_state);
+      return ret;
+    }
   }
-  state_machine.pgraph_buffer_notify_threshold =
-      (uint32_t)((float)buffer_size * PGRAPH_NOTIFY_PERCENT);
 
-  state_machine.processor_thread = CreateThread(
-      NULL, 0, TracerThreadMain, NULL, 0, &state_machine.processor_thread_id);
   if (!state_machine.processor_thread) {
-    SetState(STATE_UNINITIALIZED);
-    CBDestroy(state_machine.aux_buffer);
-    CBDestroy(state_machine.pgraph_buffer);
-    return XBOX_E_FAIL;
+    state_machine.processor_thread = CreateThread(
+        NULL, 0, TracerThreadMain, NULL, 0, &state_machine.processor_thread_id);
+    if (!state_machine.processor_thread) {
+      SetState(parked_state);
+      DestroyBuffers();
+      return XBOX_E_FAIL;
+    }
   }
 
   SetState(STATE_INITIALIZED);
+  SetEvent(state_machine.session_event);
 
   return XBOX_S_OK;
 }
 
-void TracerShutdown(void) {
+void TracerShutdown(BOOL release_buffers) {
   if (state_machine.state == STATE_UNINITIALIZED) {
     return;
   }
 
-  TracerState state = TracerGetState();
+  EnterCriticalSection(&state_machine.state_critical_section);
+  TracerState state = state_machine.state;
   if (state == STATE_SHUTDOWN) {
+    // The session has already ended, so the parked buffers may be released
+    // directly. This is done outside of the lock as it waits for any reader of
+    // the buffers (e.g., an in-progress network send) to finish.
+    BOOL release = release_buffers && !state_machine.releasing_buffers;
+    state_machine.releasing_buffers |= release;
+    LeaveCriticalSection(&state_machine.state_critical_section);
+
+    if (release) {
+      DestroyBuffers();
+
+      EnterCriticalSection(&state_machine.state_critical_section);
+      state_machine.releasing_buffers = FALSE;
+      LeaveCriticalSection(&state_machine.state_critical_section);
+      SetEvent(state_machine.session_end_event);
+    }
     return;
   }
+  if (release_buffers) {
+    state_machine.release_on_shutdown = TRUE;
+  }
+  LeaveCriticalSection(&state_machine.state_critical_section);
 
   SetState(STATE_SHUTDOWN_REQUESTED);
+  SetEvent(state_machine.request_event);
 }
 
 TracerState TracerGetState(void) {
@@ -244,6 +828,34 @@ TracerState TracerGetState(void) {
   return ret;
 }
 
+HRESULT TracerSetLogFilter(const char* rules) {
+  EnterCriticalSection(&state_machine.log_filter_critical_section);
+  // The inactive filter is rebuilt and then published, so the tracer thread
+  // never observes a partially applied set of rules. The tracer thread may
+  // still be reading the inactive filter if it loaded the generation before
+  // the previous update was published, in which case it is waited on.
+  uint32_t generation = state_machine.log_filter_generation + 1;
+  LONG slot = (LONG)(generation & 1);
+  while (__atomic_load_n(&state_machine.log_filter_in_use, __ATOMIC_SEQ_CST) ==
+         slot + 1) {
+    Sleep(1);
+  }
+
+  LogFilter* filter = &state_machine.log_filters[slot];
+  LFReset(filter);
+  BOOL valid = LFApplyRules(filter, rules);
+  if (valid) {
+    __atomic_store_n(&state_machine.log_filter_generation, generation,
+                     __ATOMIC_SEQ_CST);
+  }
+  LeaveCriticalSection(&state_machine.log_filter_critical_section);
+  return valid ? XBOX_S_OK : XBOX_E_FAIL;
+}
+
+BOOL TracerUsesCompactEncoding(void) {
+  return state_machine.config.compact_encoding;
+}
+
 BOOL TracerGetDMAAddresses(uint32_t* push_addr, uint32_t* pull_addr) {
   EnterCriticalSection(&state_machine.state_critical_section);
   *push_addr = state_machine.real_dma_push_addr;
@@ -299,6 +911,10 @@ static BOOL SetRequest(TracerRequest new_request) {
   if (current != REQ_NONE && current != new_request) {
     ret = FALSE;
   } else {
+    if (current == REQ_NONE) {
+      state_machine.request_time = ProfileStart();
+      state_machine.request_pending_start = TRUE;
+    }
     state_machine.request = new_request;
     ret = TRUE;
   }
@@ -307,10 +923,29 @@ static BOOL SetRequest(TracerRequest new_request) {
   if (!ret) {
     DbgPrint("ERROR: Attempt to set request to %d but already %d", new_request,
              current);
+    return ret;
   }
+
+  SetEvent(state_machine.request_event);
   return ret;
 }
 
+//! Records the latency of the current request if it has not yet been started.
+static void StartRequest(void) {
+  EnterCriticalSection(&state_machine.state_critical_section);
+  if (state_machine.request_pending_start) {
+    state_machine.request_pending_start = FALSE;
+    uint32_t latency_us =
+        (uint32_t)(ProfileStop(&state_machine.request_time) * 1000.0);
+    state_machine.request_latency_us = latency_us;
+    if (latency_us > state_machine.request_latency_max_us) {
+      state_machine.request_latency_max_us = latency_us;
+    }
+    ++state_machine.requests_started;
+  }
+  LeaveCriticalSection(&state_machine.state_critical_section);
+}
+
 BOOL TracerIsProcessingRequest(void) {
   EnterCriticalSection(&state_machine.state_critical_section);
   BOOL ret = state_machine.request != REQ_NONE;
@@ -351,44 +986,134 @@ HRESULT TracerTraceCurrentFrame(BOOL allow_partial_frame) {
 }
 
 uint32_t TracerLockPGRAPHBuffer(void) {
-  EnterCriticalSection(&state_machine.pgraph_critical_section);
-  return CBAvailable(state_machine.pgraph_buffer);
+  return TraceBufferLockRead(&state_machine.pgraph_buffer);
 }
 
 uint32_t TracerReadPGRAPHBuffer(void* buffer, uint32_t size) {
-  return CBReadAvailable(state_machine.pgraph_buffer, buffer, size);
+  return TraceBufferRead(&state_machine.pgraph_buffer, buffer, size);
 }
-//! Releases the lock on the PGRAPH buffer.
+
+uint32_t TracerPeekPGRAPHBuffer(CBSpans* spans, uint32_t size) {
+  return TraceBufferPeek(&state_machine.pgraph_buffer, spans, size);
+}
+
+uint32_t TracerClaimPGRAPHBuffer(uint32_t size) {
+  return TraceBufferClaim(&state_machine.pgraph_buffer, size);
+}
+
+void TracerConsumePGRAPHClaim(uint32_t claim, uint32_t size) {
+  TraceBufferConsumeClaim(&state_machine.pgraph_buffer, claim, size);
+}
+
 void TracerUnlockPGRAPHBuffer(void) {
-  LeaveCriticalSection(&state_machine.pgraph_critical_section);
+  TraceBufferUnlockRead(&state_machine.pgraph_buffer);
 }
 
-//! Locks the auxiliary buffer to prevent writing, returning the bytes
-//! available in the buffer.
 uint32_t TracerLockAuxBuffer(void) {
-  EnterCriticalSection(&state_machine.aux_critical_section);
-  return CBAvailable(state_machine.aux_buffer);
+  // Lanes are always locked in the same order, so concurrent readers cannot
+  // deadlock.
+  uint32_t ret = 0;
+  for (uint32_t i = 0; i < AUX_DATA_TYPE_COUNT; ++i) {
+    ret += TraceBufferLockRead(&state_machine.aux_buffers[i]);
+  }
+  return ret;
 }
 
-uint32_t TracerReadAuxBuffer(void* buffer, uint32_t size) {
-  return CBReadAvailable(state_machine.aux_buffer, buffer, size);
+uint32_t TracerPeekAuxLane(AuxDataType lane, CBSpans* spans, uint32_t size) {
+  return TraceBufferPeek(&state_machine.aux_buffers[lane], spans, size);
+}
+
+uint32_t TracerClaimAuxLane(AuxDataType lane, uint32_t size) {
+  return TraceBufferClaim(&state_machine.aux_buffers[lane], size);
+}
+
+void TracerConsumeAuxClaim(AuxDataType lane, uint32_t claim, uint32_t size) {
+  TraceBufferConsumeClaim(&state_machine.aux_buffers[lane], claim, size);
+}
+
+uint32_t TracerGetAuxLaneReadOffset(AuxDataType lane) {
+  return TraceBufferGetBytesConsumed(&state_machine.aux_buffers[lane]);
+}
+
+uint32_t TracerGetAuxLaneCapacity(AuxDataType lane) {
+  return TraceBufferGetCapacity(&state_machine.aux_buffers[lane]);
+}
+
+uint32_t TracerGetAuxLaneWeight(AuxDataType lane) {
+  return state_machine.config.aux_lane_weights[lane];
+}
+
+uint32_t TracerGetAuxGeneration(void) {
+  return (uint32_t)state_machine.aux_generation;
 }
 
 void TracerUnlockAuxBuffer(void) {
-  LeaveCriticalSection(&state_machine.aux_critical_section);
+  for (uint32_t i = AUX_DATA_TYPE_COUNT; i > 0; --i) {
+    TraceBufferUnlockRead(&state_machine.aux_buffers[i - 1]);
+  }
+}
+
+static void AccumulateStats(TraceBufferStats* total,
+                            const TraceBufferStats* stats) {
+  for (uint32_t i = 0; i < TRACE_BUFFER_MAX_RECORD_TYPES; ++i) {
+    total->dropped_records[i] += stats->dropped_records[i];
+    total->dropped_bytes[i] += stats->dropped_bytes[i];
+  }
+  total->stalls += stats->stalls;
+  total->stall_timeouts += stats->stall_timeouts;
+  total->stalled_milliseconds += stats->stalled_milliseconds;
+  total->spilled_records += stats->spilled_records;
+  total->spilled_bytes += stats->spilled_bytes;
+}
+
+void TracerGetStats(TracerStats* stats) {
+  TraceBufferGetStats(&state_machine.pgraph_buffer, &stats->pgraph);
+
+  memset(&stats->aux, 0, sizeof(stats->aux));
+  for (uint32_t i = 0; i < AUX_DATA_TYPE_COUNT; ++i) {
+    TraceBufferStats lane_stats;
+    TraceBufferGetStats(&state_machine.aux_buffers[i], &lane_stats);
+    AccumulateStats(&stats->aux, &lane_stats);
+  }
+
+  ArenaGetStats(state_machine.parameter_arena, &stats->parameter_arena);
+
+  const SegmentRecorder* recorder = &state_machine.segment_recorder;
+  stats->segments_defined = recorder->segments_defined;
+  stats->segments_referenced = recorder->segments_referenced;
+  stats->segment_bytes_elided = recorder->bytes_elided;
+  stats->commands_filtered = state_machine.commands_filtered;
+  stats->commands_coalesced = state_machine.commands_coalesced;
+  stats->commands_truncated = state_machine.commands_truncated;
+  stats->fifo_runs = state_machine.fifo_runs;
+  stats->queue_depth = state_machine.queue_depth;
+  stats->queue_depth_backoffs = state_machine.queue_depth_backoffs;
+  stats->parameter_bytes_omitted = state_machine.parameter_bytes_omitted;
+
+  EnterCriticalSection(&state_machine.state_critical_section);
+  stats->requests_started = state_machine.requests_started;
+  stats->request_latency_us = state_machine.request_latency_us;
+  stats->request_latency_max_us = state_machine.request_latency_max_us;
+  LeaveCriticalSection(&state_machine.state_critical_section);
 }
 
 static DWORD __attribute__((stdcall)) TracerThreadMain(
     LPVOID lpThreadParameter) {
-  while (TracerGetState() == STATE_INITIALIZING) {
-    Sleep(1);
+  // The thread is parked between sessions so that it need not be recreated for
+  // every attach.
+  while (1) {
+    WaitForSingleObject(state_machine.session_event, INFINITE);
+    RunSession();
+    EndSession();
   }
+  return 0;
+}
 
-  // Check for any failures between the time the thread was created and the time
-  // it started running.
+static void RunSession(void) {
+  // Check for any shutdown requests between the time the session was created
+  // and the time the thread started running it.
   if (TracerGetState() != STATE_INITIALIZED) {
-    Shutdown();
-    return 0;
+    return;
   }
 
   SetState(STATE_IDLE);
@@ -400,6 +1125,15 @@ static DWORD __attribute__((stdcall)) TracerThreadMain(
     }
 
     TracerRequest request = GetRequest();
+    if (request == REQ_NONE) {
+      // Requests and shutdowns both signal the event; the timeout is only a
+      // safeguard against a missed shutdown.
+      WaitForSingleObject(state_machine.request_event,
+                          REQUEST_WAIT_TIMEOUT_MILLISECONDS);
+      continue;
+    }
+
+    StartRequest();
     BOOL allow_start_in_frame = FALSE;
     switch (request) {
       case REQ_WAIT_FOR_STABLE_PUSH_BUFFER:
@@ -423,17 +1157,14 @@ static DWORD __attribute__((stdcall)) TracerThreadMain(
       case REQ_TRACE_UNTIL_FLIP: {
         TraceUntilFramebufferFlip(FALSE, allow_start_in_frame);
 
-        EnterCriticalSection(&state_machine.pgraph_critical_section);
-        uint32_t bytes_available = CBAvailable(state_machine.pgraph_buffer);
-        LeaveCriticalSection(&state_machine.pgraph_critical_section);
+        uint32_t bytes_available =
+            TraceBufferAvailable(&state_machine.pgraph_buffer);
 
         if (bytes_available) {
           state_machine.on_pgraph_buffer_bytes_available(bytes_available);
         }
 
-        EnterCriticalSection(&state_machine.aux_critical_section);
-        bytes_available = CBAvailable(state_machine.aux_buffer);
-        LeaveCriticalSection(&state_machine.aux_critical_section);
+        bytes_available = AuxBytesAvailable();
 
         if (bytes_available) {
           state_machine.on_aux_buffer_bytes_available(bytes_available);
@@ -444,15 +1175,10 @@ static DWORD __attribute__((stdcall)) TracerThreadMain(
       case REQ_NONE:
         break;
     }
-
-    Sleep(10);
   }
-
-  Shutdown();
-  return 0;
 }
 
-static void Shutdown(void) {
+static void EndSession(void) {
   if (state_machine.dma_addresses_valid) {
     // Recover the real address
     SetDMAPutAddress(state_machine.real_dma_push_addr);
@@ -462,14 +1188,22 @@ static void Shutdown(void) {
   // We can continue the cache updates now.
   ResumeFIFOPusher();
 
-  CBDestroy(state_machine.aux_buffer);
-  CBDestroy(state_machine.pgraph_buffer);
+  // The buffers are retained (along with any unread data) for reuse by the
+  // next session unless the remote asked for them to be released.
+  EnterCriticalSection(&state_machine.state_critical_section);
+  BOOL release = state_machine.release_on_shutdown;
+  state_machine.release_on_shutdown = FALSE;
+  LeaveCriticalSection(&state_machine.state_critical_section);
 
-  SetState(STATE_SHUTDOWN);
+  // Releasing waits for any reader of the buffers, so it must not be done
+  // while holding the state lock. The state is not yet STATE_SHUTDOWN, so a
+  // new session cannot start until this has finished.
+  if (release) {
+    DestroyBuffers();
+  }
 
-  DeleteCriticalSection(&state_machine.state_critical_section);
-  DeleteCriticalSection(&state_machine.pgraph_critical_section);
-  DeleteCriticalSection(&state_machine.aux_critical_section);
+  SetState(STATE_SHUTDOWN);
+  SetEvent(state_machine.session_end_event);
 }
 
 //! Allows execution to proceed until any pending DMA->CACHE1 operation is
@@ -579,6 +1313,7 @@ static void ExchangeDMAPushAddress(uint32_t target) {
     uint32_t push_state = ReadDWORD(CACHE1_DMA_PUSH);
     if (push_state & 0x01) {
       DbgPrint("WARNING: PUT was modified and pusher was already active!\n");
+      state_machine.put_conflict = TRUE;
       Sleep(60 * 1000);
     }
 
@@ -589,6 +1324,7 @@ static void ExchangeDMAPushAddress(uint32_t target) {
 
 // Runs the PFIFO until the DMA_PULL_ADDR equals the given address.
 static void RunFIFO(uint32_t pull_addr_target) {
+  ++state_machine.fifo_runs;
   // Mark the pushbuffer as empty by setting the push address to the target pull
   // address.
   ExchangeDMAPushAddress(pull_addr_target);
@@ -661,6 +1397,10 @@ static void RunFIFO(uint32_t pull_addr_target) {
 
   // This is just to confirm that nothing was modified in the final chunk.
   ExchangeDMAPushAddress(pull_addr_target);
+
+  // Any binds that were just executed may have changed the subchannel classes,
+  // which must not be served from a cache filled before they ran.
+  state_machine.graphics_classes_valid = 0;
 }
 
 // Looks up any registered processors for the given PushBufferCommandTraceInfo.
@@ -673,86 +1413,26 @@ static void GetMethodProcessors(const PushBufferCommandTraceInfo* method_info,
     return;
   }
 
-  const PGRAPHClassProcessor* class_registry = kPGRAPHProcessorRegistry;
-  while (class_registry->processors &&
-         class_registry->class != method_info->graphics_class) {
-    ++class_registry;
+  if (method_info->graphics_class >= NUM_CLASS_SLOTS) {
+    return;
   }
-
-  if (!class_registry->processors) {
+  const PGRAPHCommandProcessor* processors =
+      kPGRAPHProcessorRegistry[method_info->graphics_class];
+  if (!processors) {
     return;
   }
 
-  const PGRAPHCommandProcessor* entry = class_registry->processors;
-  while (entry->valid) {
-    if (entry->command == method_info->command.method) {
-      *pre_callback = entry->pre_callback;
-      *post_callback = entry->post_callback;
-      return;
-    }
-    ++entry;
+  const PGRAPHCommandProcessor* entry =
+      &processors[(method_info->command.method >> 2) & (NUM_METHOD_SLOTS - 1)];
+  const PGRAPHCommandHook* pre_hook = &kPGRAPHCommandHooks[entry->pre_hook];
+  const PGRAPHCommandHook* post_hook = &kPGRAPHCommandHooks[entry->post_hook];
+  uint32_t armed = state_machine.armed_captures;
+  if (pre_hook->captures & armed) {
+    *pre_callback = pre_hook->callback;
   }
-}
-
-#define VERBOSE_STALL_MESSAGE_DELAY_LOOPS (8 * 1024 * 1024)
-#define RESEND_NOTIFICATION_DELAY_LOOPS (16 * 1024 * 1024)
-//! Write all of the given data to the given circular buffer.
-static void WriteBuffer(NotifyBytesAvailableHandler notify_bytes_available,
-                        CRITICAL_SECTION* critical_section, CircularBuffer cb,
-                        const void* data, uint32_t len,
-                        uint32_t notify_threshold) {
-  PROFILE_INIT();
-  PROFILE_START();
-  uint32_t consecutive_sleeps = 0;
-  while (len) {
-    EnterCriticalSection(critical_section);
-    uint32_t bytes_written = CBWriteAvailable(cb, data, len);
-    uint32_t bytes_available = CBAvailable(cb);
-    LeaveCriticalSection(critical_section);
-
-    if (bytes_written) {
-#ifdef ENABLE_EXTRA_VERBOSE_DEBUG
-      if (consecutive_sleeps) {
-        EXTRA_VERBOSE_PRINT(
-            ("Circular buffer wrote %u bytes after stalling %d times. %u bytes "
-             "available in buffer 0x%X\n",
-             bytes_written, consecutive_sleeps, bytes_available, cb));
-      }
-#endif
-      consecutive_sleeps = 0;
-      data += bytes_written;
-      len -= bytes_written;
-      if (bytes_available >= notify_threshold) {
-        notify_bytes_available(bytes_available);
-      }
-    }
-    if (len) {
-#ifdef ENABLE_EXTRA_VERBOSE_DEBUG
-      if (!(consecutive_sleeps % VERBOSE_STALL_MESSAGE_DELAY_LOOPS)) {
-        EXTRA_VERBOSE_PRINT(
-            ("WriteBuffer: Circular buffer full, sleeping... [%u consecutive "
-             "stalls for buffer 0x%X]\n",
-             consecutive_sleeps, cb));
-      }
-#endif
-      if (!(++consecutive_sleeps % RESEND_NOTIFICATION_DELAY_LOOPS)) {
-        if (!bytes_available) {
-          DbgPrint(
-              "ERROR - stalled %u loops on filled circular buffer but 0 bytes "
-              "reported available\n",
-              consecutive_sleeps - 1);
-        } else {
-          EXTRA_VERBOSE_PRINT(
-              ("Stalled for %u loops, re-sending notification with %u bytes "
-               "available in buffer 0x%X\n",
-               consecutive_sleeps - 1, bytes_available, cb));
-          notify_bytes_available(bytes_available);
-        }
-      }
-      SwitchToThread();
-    }
+  if (post_hook->captures & armed) {
+    *post_callback = post_hook->callback;
   }
-  PROFILE_SEND("WriteBuffer");
 }
 
 static void LogAuxData(const PushBufferCommandTraceInfo* trigger,
@@ -765,17 +1445,118 @@ static void LogAuxData(const PushBufferCommandTraceInfo* trigger,
                           .draw_index = trigger->draw_index,
                           .data_type = type,
                           .len = len};
-  WriteBuffer(state_machine.on_aux_buffer_bytes_available,
-              &state_machine.aux_critical_section, state_machine.aux_buffer,
-              &header, sizeof(header), 0);
-  WriteBuffer(state_machine.on_aux_buffer_bytes_available,
-              &state_machine.aux_critical_section, state_machine.aux_buffer,
-              data, len, 0);
+  CBIOVec vecs[] = {{&header, sizeof(header)}, {data, len}};
+  TraceBufferWrite(&state_machine.aux_buffers[type], type, vecs,
+                   sizeof(vecs) / sizeof(vecs[0]));
+}
+
+static BOOL ReserveAuxDataEntry(const PushBufferCommandTraceInfo* trigger,
+                                AuxDataType type, uint32_t len,
+                                CBSpans* spans) {
+  if (!trigger || !len) {
+    return FALSE;
+  }
+
+  // Entries that cannot be reserved (e.g., because they are larger than a
+  // buffer chunk or must be spilled) are staged and written via LogAuxData
+  // instead.
+  uint32_t entry_size = sizeof(AuxDataHeader) + len;
+  if (entry_size < len ||
+      !TraceBufferReserve(&state_machine.aux_buffers[type], type, entry_size,
+                          spans)) {
+    return FALSE;
+  }
+  state_machine.aux_reservation_type = type;
+
+  AuxDataHeader header = {.packet_index = trigger->packet_index,
+                          .draw_index = trigger->draw_index,
+                          .data_type = type,
+                          .len = len};
+  CBSpansWrite(spans, &header, sizeof(header));
+  return TRUE;
+}
+
+static void CommitAuxDataEntry(void) {
+  TraceBufferCommit(
+      &state_machine.aux_buffers[state_machine.aux_reservation_type]);
+}
+
+static const AuxDataWriter kAuxDataWriter = {
+    LogAuxData,
+    ReserveAuxDataEntry,
+    CommitAuxDataEntry,
+};
+
+//! Discards any commands decoded ahead of the trace loop, which must be done
+//! whenever tracing resumes at an arbitrary address.
+static void ResetPushBufferRange(void) {
+  state_machine.pushbuffer_range.entry_count = 0;
+  state_machine.pushbuffer_range.next_entry = 0;
+  state_machine.pushbuffer_range.subroutine_return_address = 0;
+}
+
+static uint32_t FetchCachedGraphicsClass(uint32_t subchannel) {
+  uint32_t mask = 1 << subchannel;
+  if (!(state_machine.graphics_classes_valid & mask)) {
+    state_machine.graphics_classes[subchannel] =
+        FetchGraphicsClassForSubchannel(subchannel);
+    state_machine.graphics_classes_valid |= mask;
+  }
+  return state_machine.graphics_classes[subchannel];
+}
+
+//! Ensures that the next unconsumed entry of the pushbuffer range is the
+//! command at `pull_addr`, decoding the span from `pull_addr` to the real push
+//! address if the previously decoded span has been exhausted or does not
+//! continue at `pull_addr` (e.g., after a jump). Returns FALSE if nothing could
+//! be decoded.
+static BOOL FillPushBufferRange(uint32_t pull_addr) {
+  PushBufferRange* range = &state_machine.pushbuffer_range;
+  if (range->next_entry < range->entry_count &&
+      range->entries[range->next_entry].address == pull_addr) {
+    return TRUE;
+  }
+
+  // The bound subchannel classes may have been changed by the commands that
+  // were just consumed.
+  state_machine.graphics_classes_valid = 0;
+  return ParsePushBufferRange(range, pull_addr,
+                              state_machine.real_dma_push_addr) != 0;
+}
+
+//! Equivalent to ParsePushBufferCommandTraceInfo, but consumes commands that
+//! were decoded in bulk (see FillPushBufferRange).
+static uint32_t ParseNextPushBufferCommand(uint32_t pull_addr,
+                                           PushBufferCommandTraceInfo* info,
+                                           BOOL discard_parameters) {
+  PushBufferRange* range = &state_machine.pushbuffer_range;
+  if (!FillPushBufferRange(pull_addr)) {
+    // Fall back to decoding in place, e.g., for a command that extends past
+    // the known push address.
+    info->subroutine_return_address = range->subroutine_return_address;
+    uint32_t next_addr = ParsePushBufferCommandTraceInfo(
+        pull_addr, info, discard_parameters, state_machine.parameter_arena);
+    range->subroutine_return_address = info->subroutine_return_address;
+    return next_addr;
+  }
+
+  const PushBufferRangeEntry* entry = &range->entries[range->next_entry++];
+  GetPushBufferRangeTraceInfo(range, entry, info, discard_parameters);
+  if (info->valid) {
+    info->graphics_class = FetchCachedGraphicsClass(info->command.subchannel);
+    // Binding an object to a subchannel changes its class once the bind has
+    // been run by the FIFO. The bind itself is reported with the class that is
+    // currently bound, and the class is fetched again for subsequent commands.
+    if (!info->command.method) {
+      state_machine.graphics_classes_valid &= ~(1 << info->command.subchannel);
+    }
+  }
+  return entry->next_address;
 }
 
 static uint32_t ProcessPushBufferCommand(
     uint32_t* dma_pull_addr, PushBufferCommandTraceInfo* method_info,
-    TraceContext* ctx, BOOL discard, BOOL skip_hooks) {
+    TraceContext* ctx, BOOL discard, BOOL skip_hooks, BOOL use_range) {
   method_info->valid = FALSE;
   uint32_t unprocessed_bytes = 0;
 
@@ -783,8 +1564,14 @@ static uint32_t ProcessPushBufferCommand(
     return 0;
   }
 
-  uint32_t post_addr =
-      ParsePushBufferCommandTraceInfo(*dma_pull_addr, method_info, discard);
+  uint32_t post_addr;
+  if (use_range) {
+    post_addr =
+        ParseNextPushBufferCommand(*dma_pull_addr, method_info, discard);
+  } else {
+    post_addr = ParsePushBufferCommandTraceInfo(
+        *dma_pull_addr, method_info, discard, state_machine.parameter_arena);
+  }
   if (!post_addr) {
     DeletePushBufferCommandTraceInfo(method_info);
     return 0xFFFFFFFF;
@@ -814,7 +1601,7 @@ static uint32_t ProcessPushBufferCommand(
       // Do the pre callback before running the command
       // FIXME: assert we are where we wanted to be
       PROFILE_START();
-      pre_callback(method_info, ctx, LogAuxData,
+      pre_callback(method_info, ctx, &kAuxDataWriter,
                    &state_machine.config.aux_tracing_config);
       PROFILE_SEND("PreCallback invocation:");
     }
@@ -838,7 +1625,7 @@ static uint32_t ProcessPushBufferCommand(
       unprocessed_bytes = 0;
 
       PROFILE_START();
-      post_callback(method_info, ctx, LogAuxData,
+      post_callback(method_info, ctx, &kAuxDataWriter,
                     &state_machine.config.aux_tracing_config);
       PROFILE_SEND("PostCallback invocation");
     }
@@ -851,42 +1638,458 @@ static uint32_t ProcessPushBufferCommand(
   return unprocessed_bytes;
 }
 
+//! Writes any staged subroutine entries in full and stops staging the rest of
+//! the subroutine.
+static void AbandonSegment(void) {
+  SegmentRecorder* recorder = &state_machine.segment_recorder;
+  if (recorder->size) {
+    CBIOVec vec = {recorder->buffer, recorder->size};
+    TraceBufferWrite(&state_machine.pgraph_buffer, 0, &vec, 1);
+    recorder->size = 0;
+  }
+  recorder->active = FALSE;
+}
+
+//! Appends the pieces of a command entry to the staged subroutine. Returns
+//! FALSE if the entry must be written directly instead.
+static BOOL StageSegmentEntry(const CBIOVec* vecs, uint32_t count) {
+  SegmentRecorder* recorder = &state_machine.segment_recorder;
+  uint32_t size = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    size += vecs[i].size;
+  }
+  if (size > SEGMENT_STAGING_SIZE - recorder->size) {
+    AbandonSegment();
+    return FALSE;
+  }
+
+  // Packet indices are hashed relative to the start of the subroutine, and
+  // fields that vary with the call site or with the location of the parameters
+  // are ignored, so that identical subroutines hash identically wherever they
+  // are called.
+  PushBufferCommandTraceInfo header;
+  memcpy(&header, vecs[0].data, sizeof(header));
+  if (!recorder->entry_count) {
+    recorder->first_packet_index = header.packet_index;
+  }
+  header.packet_index -= recorder->first_packet_index;
+  header.subroutine_return_address = 0;
+  if (header.data.data_state != PBCPDS_SMALL_BUFFER &&
+      header.data.data_state != PBCPDS_TRUNCATED) {
+    memset(&header.data.data, 0, sizeof(header.data.data));
+  }
+  recorder->hash = SCHash(recorder->hash, &header, sizeof(header));
+
+  for (uint32_t i = 0; i < count; ++i) {
+    memcpy(recorder->buffer + recorder->size, vecs[i].data, vecs[i].size);
+    recorder->size += vecs[i].size;
+    if (i) {
+      recorder->hash = SCHash(recorder->hash, vecs[i].data, vecs[i].size);
+    }
+  }
+  ++recorder->entry_count;
+  return TRUE;
+}
+
+//! Sends the staged subroutine, either in full as a new segment or as a
+//! reference to an identical segment that has already been sent.
+static void EndSegment(void) {
+  SegmentRecorder* recorder = &state_machine.segment_recorder;
+  if (!recorder->active || !recorder->entry_count) {
+    recorder->active = FALSE;
+    return;
+  }
+
+  PushBufferSegmentRecord record = {0};
+  record.packet_index = recorder->first_packet_index;
+  record.address = recorder->address;
+  record.entry_count = recorder->entry_count;
+  record.size = recorder->size;
+  record.segment_id = SCFind(&recorder->cache, recorder->address,
+                             recorder->size, recorder->hash);
+
+  CBIOVec vecs[2] = {{&record, sizeof(record)},
+                     {recorder->buffer, recorder->size}};
+  uint32_t count;
+  if (record.segment_id) {
+    record.type = PB_SEGMENT_REFERENCE;
+    count = 1;
+    ++recorder->segments_referenced;
+    recorder->bytes_elided += recorder->size;
+  } else {
+    record.segment_id = SCInsert(&recorder->cache, recorder->address,
+                                 recorder->size, recorder->hash);
+    if (!record.segment_id) {
+      // The cache is full, so the subroutine can never be referenced.
+      AbandonSegment();
+      return;
+    }
+    record.type = PB_SEGMENT_DEFINITION;
+    count = 2;
+    ++recorder->segments_defined;
+  }
+
+  TraceBufferWrite(&state_machine.pgraph_buffer, 0, vecs, count);
+  recorder->size = 0;
+  recorder->active = FALSE;
+}
+
+static void FlushCommandRun(void);
+
+//! Starts or finishes staging a subroutine as the given command enters or
+//! returns from one. `pull_addr` is the address following the command.
+static void TrackSubroutine(const PushBufferCommandTraceInfo* info,
+                            uint32_t pull_addr) {
+  SegmentRecorder* recorder = &state_machine.segment_recorder;
+  if (!recorder->buffer) {
+    return;
+  }
+
+  BOOL in_subroutine = info->subroutine_return_address != 0;
+  if (in_subroutine == recorder->in_subroutine) {
+    return;
+  }
+  recorder->in_subroutine = in_subroutine;
+  // Runs never span the boundary of a segment.
+  FlushCommandRun();
+
+  if (!in_subroutine) {
+    EndSegment();
+    return;
+  }
+
+  recorder->active = TRUE;
+  recorder->address = pull_addr;
+  recorder->size = 0;
+  recorder->entry_count = 0;
+  // The entries of a segment depend on the log filter in effect, so segments
+  // defined under different filters must never match.
+  uint32_t generation =
+      __atomic_load_n(&state_machine.log_filter_generation, __ATOMIC_ACQUIRE);
+  recorder->hash = SCHash(SC_HASH_INIT, &generation, sizeof(generation));
+}
+
+//! Returns the parameters of the given command, or NULL if they were not
+//! captured.
+static const void* GetLoggedParameters(
+    const PushBufferCommandTraceInfo* info) {
+  switch (info->data.data_state) {
+    case PBCPDS_SMALL_BUFFER:
+      return info->data.data.buffer;
+    case PBCPDS_HEAP_BUFFER:
+    case PBCPDS_BORROWED_BUFFER:
+      return info->data.data.heap_buffer;
+    default:
+      return NULL;
+  }
+}
+
+//! Applies the parameter policy to the given command. Returns TRUE if only the
+//! first `kept_count` parameters should be logged, populating `omitted_hash`.
+static BOOL TruncateParameters(const PushBufferCommandTraceInfo* info,
+                               uint32_t* kept_count, uint64_t* omitted_hash) {
+  // Parameters that fit inline cost nothing extra to send.
+  if (PPIsEmpty(&state_machine.parameter_policy) ||
+      (info->data.data_state != PBCPDS_HEAP_BUFFER &&
+       info->data.data_state != PBCPDS_BORROWED_BUFFER)) {
+    return FALSE;
+  }
+
+  uint32_t count = info->command.parameter_count;
+  uint32_t keep = PPGetKeepCount(&state_machine.parameter_policy,
+                                 info->graphics_class, info->command.method);
+  if (keep >= count) {
+    return FALSE;
+  }
+
+  uint32_t omitted_size = (count - keep) * 4;
+  *kept_count = keep;
+  *omitted_hash =
+      SCHash(SC_HASH_INIT, info->data.data.heap_buffer + keep * 4,
+             omitted_size);
+  ++state_machine.commands_truncated;
+  state_machine.parameter_bytes_omitted += omitted_size;
+  return TRUE;
+}
+
+static void LogCompactCommand(const PushBufferCommandTraceInfo* info,
+                              uint32_t repeat_count) {
+  CCCommand command = {
+      .packet_index = info->packet_index,
+      .draw_index = info->draw_index,
+      .surface_dump_index = info->surface_dump_index,
+      .address = info->address,
+      .graphics_class = info->graphics_class,
+      .method = info->command.method,
+      .subchannel = info->command.subchannel,
+      .parameter_count = info->command.parameter_count,
+      .non_increasing = info->command.non_increasing != 0,
+      .repeat_count = repeat_count,
+  };
+
+  const void* parameters = GetLoggedParameters(info);
+  command.has_parameters = parameters && command.parameter_count;
+  uint32_t parameter_count = command.parameter_count;
+  command.truncated = TruncateParameters(info, &command.kept_count,
+                                         &command.omitted_hash);
+  if (command.truncated) {
+    parameter_count = command.kept_count;
+  }
+
+  uint8_t header[CC_MAX_HEADER_SIZE];
+  CBIOVec vecs[2] = {
+      {header, CCEncode(&state_machine.command_encoder, &command, header)},
+      {parameters, parameter_count * 4},
+  };
+  TraceBufferWrite(&state_machine.pgraph_buffer, 0, vecs,
+                   command.has_parameters && parameter_count ? 2 : 1);
+}
+
+//! Writes a command entry, followed by a PushBufferRepeatRecord if
+//! `repeat_count` is nonzero.
+static void WriteCommand(const PushBufferCommandTraceInfo* info,
+                         uint32_t repeat_count) {
+  if (state_machine.config.compact_encoding) {
+    LogCompactCommand(info, repeat_count);
+    return;
+  }
+  CBIOVec vecs[3] = {{info, sizeof(*info)}};
+  uint32_t count = 1;
+  uint32_t parameter_count = info->command.parameter_count;
+
+  PushBufferCommandTraceInfo header;
+  uint32_t kept_count;
+  uint64_t omitted_hash;
+  if (TruncateParameters(info, &kept_count, &omitted_hash)) {
+    header = *info;
+    header.data.data_state = PBCPDS_TRUNCATED;
+    header.data.data.truncated.kept_count = kept_count;
+    header.data.data.truncated.omitted_hash = omitted_hash;
+    vecs[0].data = &header;
+    parameter_count = kept_count;
+  } else if (info->data.data_state == PBCPDS_BORROWED_BUFFER) {
+    // Borrowed parameters are indistinguishable from heap parameters as far as
+    // the remote is concerned.
+    header = *info;
+    header.data.data_state = PBCPDS_HEAP_BUFFER;
+    vecs[0].data = &header;
+  }
+
+  if ((info->data.data_state == PBCPDS_HEAP_BUFFER ||
+       info->data.data_state == PBCPDS_BORROWED_BUFFER) &&
+      parameter_count) {
+    vecs[count].data = info->data.data.heap_buffer;
+    vecs[count].size = parameter_count * 4;
+    ++count;
+  }
+
+  PushBufferRepeatRecord repeat = {0};
+  if (repeat_count) {
+    repeat.type = PB_COMMAND_REPEAT;
+    repeat.repeat_count = repeat_count;
+    vecs[count].data = &repeat;
+    vecs[count].size = sizeof(repeat);
+    ++count;
+  }
+
+  if (state_machine.segment_recorder.active &&
+      StageSegmentEntry(vecs, count)) {
+    return;
+  }
+  TraceBufferWrite(&state_machine.pgraph_buffer, 0, vecs, count);
+}
+
+//! Writes the held back command run, if any.
+static void FlushCommandRun(void) {
+  CommandRun* run = &state_machine.command_run;
+  if (run->pending) {
+    run->pending = FALSE;
+    WriteCommand(&run->info, run->repeat_count);
+  }
+}
+
+//! Returns TRUE if `info` is identical to the first command of the pending run
+//! and immediately follows its last repeat.
+static BOOL ExtendsCommandRun(const PushBufferCommandTraceInfo* info) {
+  const CommandRun* run = &state_machine.command_run;
+  const PushBufferCommandTraceInfo* first = &run->info;
+  if (!run->pending || info->graphics_class != first->graphics_class ||
+      info->draw_index != first->draw_index ||
+      info->surface_dump_index != first->surface_dump_index ||
+      info->subroutine_return_address != first->subroutine_return_address ||
+      memcmp(&info->command, &first->command, sizeof(info->command))) {
+    return FALSE;
+  }
+
+  uint32_t count = info->command.parameter_count;
+  uint32_t index = run->repeat_count + 1;
+  if (info->packet_index != first->packet_index + index ||
+      info->address != first->address + index * (4 + count * 4)) {
+    return FALSE;
+  }
+
+  if (!count) {
+    return TRUE;
+  }
+  const void* parameters = GetLoggedParameters(info);
+  return parameters &&
+         !memcmp(parameters, GetLoggedParameters(first), count * 4);
+}
+
+//! Holds back `info` to be coalesced with identical commands that follow it.
+//! Returns FALSE if it must be written immediately instead.
+static BOOL StartCommandRun(const PushBufferCommandTraceInfo* info) {
+  uint32_t count = info->command.parameter_count;
+  const void* parameters = GetLoggedParameters(info);
+  if (count > COMMAND_RUN_MAX_PARAMETERS || (count && !parameters)) {
+    return FALSE;
+  }
+
+  CommandRun* run = &state_machine.command_run;
+  run->info = *info;
+  if (count && info->data.data_state != PBCPDS_SMALL_BUFFER) {
+    memcpy(run->parameters, parameters, count * 4);
+    run->info.data.data_state = PBCPDS_BORROWED_BUFFER;
+    run->info.data.data.heap_buffer = (uint8_t*)run->parameters;
+  }
+  run->repeat_count = 0;
+  run->pending = TRUE;
+  return TRUE;
+}
+
+//! Returns the active log filter, marking it as in use so that
+//! TracerSetLogFilter does not rebuild it until ReleaseLogFilter is called.
+static const LogFilter* AcquireLogFilter(void) {
+  while (1) {
+    uint32_t generation = __atomic_load_n(&state_machine.log_filter_generation,
+                                          __ATOMIC_SEQ_CST);
+    __atomic_store_n(&state_machine.log_filter_in_use,
+                     (LONG)(generation & 1) + 1, __ATOMIC_SEQ_CST);
+    // A writer that checked the mark before it was set may be rebuilding this
+    // filter, which is only possible once a newer generation was published.
+    if (__atomic_load_n(&state_machine.log_filter_generation,
+                        __ATOMIC_SEQ_CST) == generation) {
+      return &state_machine.log_filters[generation & 1];
+    }
+  }
+}
+
+static void ReleaseLogFilter(void) {
+  __atomic_store_n(&state_machine.log_filter_in_use, 0, __ATOMIC_RELEASE);
+}
+
 static void LogCommand(const PushBufferCommandTraceInfo* info) {
   if (!info->valid) {
     return;
   }
-  WriteBuffer(state_machine.on_pgraph_buffer_bytes_available,
-              &state_machine.pgraph_critical_section,
-              state_machine.pgraph_buffer, info, sizeof(*info),
-              state_machine.pgraph_buffer_notify_threshold);
-  if (info->data.data_state == PBCPDS_HEAP_BUFFER &&
-      info->command.parameter_count) {
-    uint32_t data_size = info->command.parameter_count * 4;
-    WriteBuffer(state_machine.on_pgraph_buffer_bytes_available,
-                &state_machine.pgraph_critical_section,
-                state_machine.pgraph_buffer, info->data.data.heap_buffer,
-                data_size, state_machine.pgraph_buffer_notify_threshold);
+
+  BOOL allowed = LFAllows(AcquireLogFilter(), info->graphics_class,
+                          info->command.method);
+  ReleaseLogFilter();
+  if (!allowed) {
+    ++state_machine.commands_filtered;
+    return;
+  }
+
+  if (state_machine.config.coalesce_repeats) {
+    if (ExtendsCommandRun(info)) {
+      ++state_machine.command_run.repeat_count;
+      ++state_machine.commands_coalesced;
+      return;
+    }
+    FlushCommandRun();
+    if (StartCommandRun(info)) {
+      return;
+    }
   }
+  WriteCommand(info, 0);
+}
+
+//! Writes any entries held back by LogCommand.
+static void FlushLog(void) {
+  FlushCommandRun();
+  AbandonSegment();
+}
+
+//! Examines up to `max_commands` commands starting at `*pull_addr` that have
+//! been decoded into the pushbuffer range, without consuming them, advancing
+//! `pull_addr` past them. Stops at the end of the decoded span (which ends at
+//! the first jump). Returns the number of commands examined.
+static uint32_t PeekPushBufferRangeForFlipStall(BOOL* found,
+                                                uint32_t* pull_addr,
+                                                uint32_t max_commands) {
+  if (!FillPushBufferRange(*pull_addr)) {
+    return 0;
+  }
+
+  const PushBufferRange* range = &state_machine.pushbuffer_range;
+  uint32_t examined = 0;
+  for (uint32_t i = range->next_entry;
+       i < range->entry_count && examined < max_commands; ++i) {
+    const PushBufferRangeEntry* entry = &range->entries[i];
+    ++examined;
+    *pull_addr = entry->next_address;
+    if (entry->command.valid && entry->command.method == NV097_FLIP_STALL &&
+        FetchCachedGraphicsClass(entry->command.subchannel) == 0x97) {
+      *found = TRUE;
+      break;
+    }
+  }
+  return examined;
 }
 
 //! Attempts to find a FLIP_STALL in the FIFO buffer, setting the `found`
-//! parameter to `TRUE` if one is found.
+//! parameter to `TRUE` if one is found. If `use_range` is TRUE, commands that
+//! have been decoded into the pushbuffer range are examined in place, and any
+//! that are decoded while peeking are left there for the trace loop to
+//! consume.
 //!
 //! \return FALSE on fatal error, otherwise TRUE.
 static BOOL PeekAheadForFlipStall(BOOL* found, uint32_t dma_pull_addr,
-                                  uint32_t real_dma_push_addr) {
+                                  uint32_t real_dma_push_addr,
+                                  BOOL use_range) {
   // TODO: Handle the case where an inc happens near the end of the
   // buffer.
   //   Hold off on detecting the flip and force an additional read.
   *found = FALSE;
 
+  // Only the first entry of kFlipMethods is of interest.
+  PBSQuery query = {kFlipMethods, 1, 0, 0};
+
   uint32_t peek_dma_pull_addr = dma_pull_addr;
-  for (uint32_t i = 0; i < 5 && peek_dma_pull_addr != real_dma_push_addr; ++i) {
+  uint32_t i = 0;
+  if (use_range && peek_dma_pull_addr != real_dma_push_addr) {
+    i = PeekPushBufferRangeForFlipStall(found, &peek_dma_pull_addr,
+                                        FLIP_STALL_PEEK_COMMANDS);
+    if (*found) {
+      VERBOSE_PRINT(
+          ("Found FLIP_STALL after FLIP_INC after peeking %d decoded "
+           "commands.\n",
+           i));
+      return TRUE;
+    }
+  }
+
+  while (i < FLIP_STALL_PEEK_COMMANDS &&
+         peek_dma_pull_addr != real_dma_push_addr) {
+    // Skip over methods that cannot be a FLIP_STALL without decoding them.
+    PBSResult scan;
+    query.max_headers = FLIP_STALL_PEEK_COMMANDS - i;
+    ScanPushBuffer(peek_dma_pull_addr, real_dma_push_addr,
+                   FLIP_SCAN_WINDOW_SIZE, &query, &scan);
+    peek_dma_pull_addr += scan.offset;
+    i += scan.headers_skipped;
+    if (scan.reason == PBSSR_END || scan.reason == PBSSR_LIMIT) {
+      continue;
+    }
+
+    // Candidates and anything the scanner cannot skip are fully parsed.
     PushBufferCommandTraceInfo info;
     TraceContext ctx;
     info.subroutine_return_address = 0;
-    uint32_t peek_unprocessed_bytes =
-        ProcessPushBufferCommand(&peek_dma_pull_addr, &info, &ctx, TRUE, TRUE);
+    uint32_t peek_unprocessed_bytes = ProcessPushBufferCommand(
+        &peek_dma_pull_addr, &info, &ctx, TRUE, TRUE, FALSE);
+    ++i;
 
     if (peek_unprocessed_bytes == 0xFFFFFFFF) {
       DbgPrint("ERROR: Failed to process pbuffer command during seek.\n");
@@ -900,7 +2103,7 @@ static BOOL PeekAheadForFlipStall(BOOL* found, uint32_t dma_pull_addr,
       VERBOSE_PRINT(
           ("Found FLIP_STALL after FLIP_INC after peeking %d "
            "commands.\n",
-           i + 1));
+           i));
       *found = TRUE;
       return TRUE;
     }
@@ -912,6 +2115,57 @@ static BOOL PeekAheadForFlipStall(BOOL* found, uint32_t dma_pull_addr,
   return TRUE;
 }
 
+//! Adjusts the queue depth once the FIFO has been drained up to the parser,
+//! after `bytes_flushed` bytes of queued commands were run. The depth backs off
+//! sharply if the title moved the push address while the pusher was active or
+//! if `corrupt` is TRUE (the hardware is not where the parser expects), and
+//! otherwise only grows after a flush that reached the current depth without
+//! interference. Empty polls and hook steps leave it unchanged.
+static void UpdateQueueDepth(uint32_t bytes_flushed, BOOL corrupt) {
+  BOOL conflict = corrupt || state_machine.put_conflict;
+  state_machine.put_conflict = FALSE;
+
+  const TracerConfig* config = &state_machine.config;
+  if (!config->max_queue_depth ||
+      config->max_queue_depth_limit <= config->max_queue_depth) {
+    return;
+  }
+
+  uint32_t depth = state_machine.queue_depth;
+  if (conflict) {
+    depth /= QUEUE_DEPTH_BACKOFF_DIVISOR;
+    ++state_machine.queue_depth_backoffs;
+  } else if (bytes_flushed && bytes_flushed >= depth) {
+    depth += QUEUE_DEPTH_INCREASE;
+  } else {
+    return;
+  }
+
+  if (depth < config->max_queue_depth) {
+    depth = config->max_queue_depth;
+  } else if (depth > config->max_queue_depth_limit) {
+    depth = config->max_queue_depth_limit;
+  }
+  state_machine.queue_depth = depth;
+}
+
+//! Advances `pull_addr` past commands that cannot end a discard (i.e., are not
+//! flips), without decoding them, stopping at the first header at or beyond
+//! `max_bytes`. Returns the number of bytes skipped.
+static uint32_t SkipToFlipCandidate(uint32_t* pull_addr, uint32_t max_bytes) {
+  PBSQuery query = {
+      kFlipMethods,
+      sizeof(kFlipMethods) / sizeof(kFlipMethods[0]),
+      0,
+      max_bytes,
+  };
+  PBSResult scan;
+  ScanPushBuffer(*pull_addr, state_machine.real_dma_push_addr,
+                 FLIP_SCAN_WINDOW_SIZE, &query, &scan);
+  *pull_addr += scan.offset;
+  return scan.offset;
+}
+
 static void TraceUntilFramebufferFlip(BOOL discard, BOOL allow_start_in_frame) {
   TracerState current_state = TracerGetState();
   if (!discard && !allow_start_in_frame &&
@@ -933,6 +2187,13 @@ static void TraceUntilFramebufferFlip(BOOL discard, BOOL allow_start_in_frame) {
   uint32_t last_push_addr = 0;
   uint32_t sleep_calls = 0;
   uint32_t stall_workarounds = 0;
+  // Discarding skips ahead via SkipToFlipCandidate instead of decoding every
+  // command.
+  BOOL use_range =
+      !discard && state_machine.pushbuffer_range.entry_capacity != 0;
+  ResetPushBufferRange();
+  ArenaReset(state_machine.parameter_arena);
+  state_machine.segment_recorder.in_subroutine = FALSE;
 
 #ifdef VERBOSE_DEBUG
   uint32_t commands_discarded = 0;
@@ -941,6 +2202,13 @@ static void TraceUntilFramebufferFlip(BOOL discard, BOOL allow_start_in_frame) {
   PROFILE_INIT();
 
   while (TracerGetState() == working_state) {
+    // 0 if the FIFO is only run at hooks, flips, and the end of the pushbuffer.
+    uint32_t max_queue_depth = state_machine.queue_depth;
+    if (discard) {
+      bytes_queued += SkipToFlipCandidate(
+          &dma_pull_addr, max_queue_depth ? max_queue_depth - bytes_queued : 0);
+    }
+
     PushBufferCommandTraceInfo info = {0};
     info.subroutine_return_address = 0;
     info.packet_index = command_index++;
@@ -948,12 +2216,13 @@ static void TraceUntilFramebufferFlip(BOOL discard, BOOL allow_start_in_frame) {
     info.surface_dump_index = ctx.surface_dump_index;
 
     PROFILE_START();
-    uint32_t unprocessed_bytes =
-        ProcessPushBufferCommand(&dma_pull_addr, &info, &ctx, discard, discard);
+    uint32_t unprocessed_bytes = ProcessPushBufferCommand(
+        &dma_pull_addr, &info, &ctx, discard, discard, use_range);
     PROFILE_SEND("ProcessPushBufferCommand");
 
     if (unprocessed_bytes == 0xFFFFFFFF) {
       SetState(STATE_FATAL_PROCESS_PUSH_BUFFER_COMMAND_FAILED);
+      FlushLog();
       CompleteRequest();
       DeletePushBufferCommandTraceInfo(&info);
       return;
@@ -984,7 +2253,8 @@ static void TraceUntilFramebufferFlip(BOOL discard, BOOL allow_start_in_frame) {
         VERBOSE_PRINT(("Found FLIP_INC, seeking FLIP_STALL!\n"));
         BOOL flip_found = FALSE;
         if (!PeekAheadForFlipStall(&flip_found, dma_pull_addr,
-                                   real_dma_push_addr)) {
+                                   real_dma_push_addr, use_range)) {
+          FlushLog();
           CompleteRequest();
           DeletePushBufferCommandTraceInfo(&info);
           return;
@@ -1005,7 +2275,9 @@ static void TraceUntilFramebufferFlip(BOOL discard, BOOL allow_start_in_frame) {
 
     // Avoid queuing up too many bytes: while the buffer is being processed,
     // D3D might fixup the buffer if GET is still too far away.
-    if (is_empty || is_flip || bytes_queued >= kMaxQueueDepthBeforeFlush) {
+    uint32_t bytes_flushed = 0;
+    if (is_empty || is_flip ||
+        (max_queue_depth && bytes_queued >= max_queue_depth)) {
       if (!is_empty) {
         VERBOSE_PRINT(
             ("Tracer: Flushing buffer until (0x%08X): real_put 0x%X; "
@@ -1021,6 +2293,7 @@ static void TraceUntilFramebufferFlip(BOOL discard, BOOL allow_start_in_frame) {
       PROFILE_START();
       RunFIFO(dma_pull_addr);
       PROFILE_SEND("Flush buffer - RunFIFO");
+      bytes_flushed = bytes_queued;
       bytes_queued = 0;
     }
 
@@ -1031,19 +2304,26 @@ static void TraceUntilFramebufferFlip(BOOL discard, BOOL allow_start_in_frame) {
         DbgPrint(
             "ERROR: Corrupt state. HW (0x%08X) is not at parser (0x%08X)\n",
             dma_pull_addr_real, dma_pull_addr);
+        UpdateQueueDepth(bytes_flushed, TRUE);
         SetState(STATE_FATAL_DISCARDING_FAILED);
+        FlushLog();
         CompleteRequest();
         DeletePushBufferCommandTraceInfo(&info);
         return;
       }
+      UpdateQueueDepth(bytes_flushed, FALSE);
     }
 
     if (!discard) {
       LogCommand(&info);
+      if (use_range) {
+        TrackSubroutine(&info, dma_pull_addr);
+      }
     }
 
     if (is_flip) {
       SetState(STATE_IDLE_NEW_FRAME);
+      FlushLog();
       CompleteRequest();
       DeletePushBufferCommandTraceInfo(&info);
       return;
@@ -1056,6 +2336,7 @@ static void TraceUntilFramebufferFlip(BOOL discard, BOOL allow_start_in_frame) {
           if (++stall_workarounds > MAX_STALL_WORKAROUNDS) {
             DbgPrint("Permanent stall detected, aborting...\n");
             SetState(STATE_FATAL_PERMANENT_STALL);
+            FlushLog();
             CompleteRequest();
             DeletePushBufferCommandTraceInfo(&info);
             return;
@@ -1104,7 +2385,15 @@ static void TraceUntilFramebufferFlip(BOOL discard, BOOL allow_start_in_frame) {
 #endif
     }
     DeletePushBufferCommandTraceInfo(&info);
+
+    // Parameters only need to outlive the command that was just logged, so the
+    // arena is recycled once per batch rather than per command. Batches are
+    // unbounded when fast-forwarding, so it is recycled every command instead.
+    if (!bytes_queued || !max_queue_depth) {
+      ArenaReset(state_machine.parameter_arena);
+    }
   }
+  FlushLog();
 }
 
 static void DiscardUntilFramebufferFlip(BOOL require_new_frame) {
@@ -4,22 +4,153 @@
 #include <windows.h>
 
 #include "pgraph_command_callbacks.h"
+#include "trace_buffer.h"
 #include "tracelib/ntrc_dyndxt.h"
+#include "util/arena.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+//! The maximum length of TracerConfig::aux_spill_path, including the
+//! terminator.
+#define TRACER_MAX_SPILL_PATH 128
+
+//! The maximum length of TracerConfig::log_filter, including the terminator.
+#define TRACER_MAX_LOG_FILTER 256
+
+//! The maximum length of TracerConfig::parameter_policy, including the
+//! terminator.
+#define TRACER_MAX_PARAMETER_POLICY 256
+
 typedef struct TracerConfig {
   // Number of bytes to reserve for pgraph command capture.
   uint32_t pgraph_circular_buffer_size;
 
-  // Number of bytes to reserve for color/depth buffer/etc... capture.
-  uint32_t aux_circular_buffer_size;
+  // Number of bytes to reserve for color/depth buffer/etc... capture, indexed
+  // by AuxDataType. Each type of aux data is buffered in an independent lane
+  // so that bulky entries do not hold up small ones. If `aux_chunk_size` is
+  // nonzero these are the ceilings to which each lane may grow.
+  uint32_t aux_lane_sizes[AUX_DATA_TYPE_COUNT];
+
+  // Relative share of the aux stream given to each lane when more than one
+  // has data available, indexed by AuxDataType.
+  uint32_t aux_lane_weights[AUX_DATA_TYPE_COUNT];
+
+  // Size of the blocks in which the aux buffer is allocated and released as it
+  // fills and drains. Entries larger than a block cannot be reserved in place
+  // and are staged instead. 0 allocates the entire buffer up front.
+  uint32_t aux_chunk_size;
+
+  // Maximum number of bytes of aux records to append to a file on the console
+  // when the aux buffer is full instead of stalling. 0 disables spilling.
+  uint32_t aux_spill_size;
+  // Path prefix of the aux spill files. Each lane spills to
+  // "<aux_spill_path>_<AuxDataTypeName>.bin".
+  char aux_spill_path[TRACER_MAX_SPILL_PATH];
+
+  // Whether the oldest records should be discarded when a circular buffer is
+  // full rather than blocking the tracer until the remote reads them.
+  BOOL overwrite_oldest;
+
+  // Number of milliseconds to wait for the remote to drain a full circular
+  // buffer before re-sending the bytes available notification.
+  uint32_t stall_timeout_milliseconds;
+
+  // Maximum number of bytes of commands to leave in the FIFO before running it,
+  // even if no hook or flip has been reached. Direct3D may perform fixups that
+  // would not happen outside of tracing conditions if too much is queued. 0
+  // fast-forwards, running the FIFO only to reach an armed hook, a flip, or
+  // the end of the pushbuffer.
+  uint32_t max_queue_depth;
+
+  // If greater than `max_queue_depth`, the queue depth adapts at runtime: it
+  // grows towards this limit each time a full queue is flushed without the
+  // title interfering with the FIFO, and backs off sharply (but never below
+  // `max_queue_depth`) when a conflict is detected.
+  uint32_t max_queue_depth_limit;
+
+  // Maximum number of bytes that may be allocated by the tracer across all of
+  // its pools (see tracer_memory.h). Optional captures are skipped once the
+  // ceiling is reached. 0 leaves allocations unbounded.
+  uint32_t memory_ceiling;
+
+  // Whether pushbuffer subroutines that repeat one already sent during the
+  // session should be replaced by a PushBufferSegmentRecord reference. Ignored
+  // if `overwrite_oldest` is set, as the definition may have been discarded.
+  BOOL dedup_segments;
+
+  // Rules selecting the PGRAPH commands that are written to the PGRAPH buffer
+  // (see util/log_filter.h). Commands that are filtered out are still
+  // processed and hooked. Empty to log every command.
+  char log_filter[TRACER_MAX_LOG_FILTER];
+
+  // Whether commands should be written to the PGRAPH buffer in the compact
+  // encoding of util/compact_command.h rather than as complete
+  // PushBufferCommandTraceInfo structs. Ignored if `overwrite_oldest` is set,
+  // as the encoding cannot tolerate dropped records. Disables
+  // `dedup_segments`.
+  BOOL compact_encoding;
+
+  // Whether consecutive commands with identical methods and parameters should
+  // be written as a single entry with a repeat count (a PushBufferRepeatRecord,
+  // or CCCommand::repeat_count in the compact encoding). Hooks still run for
+  // every command.
+  BOOL coalesce_repeats;
+
+  // Rules limiting the number of parameters of each method that are written to
+  // the PGRAPH buffer (see util/parameter_policy.h). Omitted parameters are
+  // replaced by a hash and the entry is marked PBCPDS_TRUNCATED. Hooks always
+  // see every parameter. Empty to log every parameter.
+  char parameter_policy[TRACER_MAX_PARAMETER_POLICY];
 
   AuxConfig aux_tracing_config;
 } TracerConfig;
 
+typedef struct TracerStats {
+  // Statistics for the PGRAPH buffer. All records are of type 0.
+  TraceBufferStats pgraph;
+
+  // Statistics for the aux buffer, indexed by AuxDataType.
+  TraceBufferStats aux;
+
+  // Usage of the arena holding the parameters of traced commands.
+  ArenaStats parameter_arena;
+
+  // Number of subroutines sent in full and tagged with a segment ID.
+  uint32_t segments_defined;
+  // Number of subroutines replaced by a reference to a defined segment.
+  uint32_t segments_referenced;
+  // Number of bytes of command entries omitted by segment references.
+  uint32_t segment_bytes_elided;
+
+  // Number of commands that were not logged due to the log filter.
+  uint32_t commands_filtered;
+
+  // Number of commands that were written as repeats of the previous command.
+  uint32_t commands_coalesced;
+
+  // Number of commands whose parameters were truncated by the parameter
+  // policy, and the number of parameter bytes that were omitted.
+  uint32_t commands_truncated;
+  uint32_t parameter_bytes_omitted;
+
+  // Number of times the FIFO was run up to a traced command.
+  uint32_t fifo_runs;
+
+  // The queue depth currently in effect (see TracerConfig::max_queue_depth),
+  // and the number of times the adaptive depth has backed off.
+  uint32_t queue_depth;
+  uint32_t queue_depth_backoffs;
+
+  // Number of requests started by the tracer thread, and the microseconds
+  // between the most recent (and the slowest) request being made and the
+  // tracer thread starting it.
+  uint32_t requests_started;
+  uint32_t request_latency_us;
+  uint32_t request_latency_max_us;
+} TracerStats;
+
 // Callback to be invoked when the tracer state changes.
 typedef void (*NotifyStateChangedHandler)(TracerState);
 
@@ -42,10 +173,31 @@ HRESULT TracerInitialize(
 void TracerGetDefaultConfig(TracerConfig* config);
 
 //! Creates a tracer instance with the given config.
+//!
+//! The tracer thread and buffers of a previous instance are reused if
+//! possible; the buffers are only reallocated if their configuration differs.
+//! Waits briefly for a previous instance that is still shutting down.
 HRESULT TracerCreate(const TracerConfig* config);
 
 //! Requests that the tracer shutdown.
-void TracerShutdown(void);
+//!
+//! If `release_buffers` is FALSE the buffers are retained so that they may be
+//! reused by the next TracerCreate, otherwise they are freed once the tracer
+//! has stopped.
+void TracerShutdown(BOOL release_buffers);
+
+//! Replaces the rules selecting the PGRAPH commands that are logged (see
+//! TracerConfig::log_filter). May be called at any time from any thread other
+//! than the tracer thread; the new rules apply to the next command that is
+//! traced. Concurrent calls are serialized, and each waits for the tracer
+//! thread to stop reading the inactive filter before rebuilding it.
+//!
+//! \return XBOX_E_FAIL if the rules are malformed.
+HRESULT TracerSetLogFilter(const char* rules);
+
+//! Returns TRUE if the current tracer instance writes commands in the compact
+//! encoding (see TracerConfig::compact_encoding).
+BOOL TracerUsesCompactEncoding(void);
 
 TracerState TracerGetState(void);
 
@@ -59,24 +211,62 @@ HRESULT TracerBeginWaitForStablePushBufferState(void);
 HRESULT TracerBeginDiscardUntilFlip(BOOL require_new_frame);
 HRESULT TracerTraceCurrentFrame(BOOL allow_partial_frame);
 
-//! Locks the PGRAPH buffer to prevent writing, returning the bytes available in
-//! the buffer.
+//! Locks the PGRAPH buffer to prevent concurrent reads, returning the bytes
+//! available in the buffer. Writes by the tracer are never blocked.
 uint32_t TracerLockPGRAPHBuffer(void);
 //! Copies up to `size` bytes from the PGRAPH buffer into `buffer`, returning
 //! the number of bytes actually copied.
 uint32_t TracerReadPGRAPHBuffer(void* buffer, uint32_t size);
+//! Populates `spans` with up to `size` readable bytes from the PGRAPH buffer
+//! without consuming them, returning the number of bytes described.
+//! Must be called while holding the PGRAPH buffer lock.
+uint32_t TracerPeekPGRAPHBuffer(CBSpans* spans, uint32_t size);
+//! Claims the first `size` bytes previously returned by TracerPeekPGRAPHBuffer
+//! so that they may be sent after the lock is released, returning an
+//! identifier for TracerConsumePGRAPHClaim. See TraceBufferClaim.
+//! Must be called while holding the PGRAPH buffer lock.
+uint32_t TracerClaimPGRAPHBuffer(uint32_t size);
+//! Consumes `size` bytes of a claim made via TracerClaimPGRAPHBuffer.
+//! Must be called without holding the PGRAPH buffer lock.
+void TracerConsumePGRAPHClaim(uint32_t claim, uint32_t size);
 //! Releases the lock on the PGRAPH buffer.
 void TracerUnlockPGRAPHBuffer(void);
 
-//! Locks the Graphics buffer to prevent writing, returning the bytes available
-//! in the buffer.
+//! Locks every lane of the Graphics buffer to prevent concurrent reads,
+//! returning the total bytes available. Writes by the tracer are never blocked.
 uint32_t TracerLockAuxBuffer(void);
-//! Copies up to `size` bytes from the Graphics buffer into `buffer`, returning
-//! the number of bytes actually copied.
-uint32_t TracerReadAuxBuffer(void* buffer, uint32_t size);
+//! Populates `spans` with up to `size` readable bytes from the given lane of
+//! the Graphics buffer without consuming them, returning the number of bytes
+//! described. Each lane holds whole AuxDataHeader-prefixed entries of a single
+//! AuxDataType.
+//! Must be called while holding the Graphics buffer lock.
+uint32_t TracerPeekAuxLane(AuxDataType lane, CBSpans* spans, uint32_t size);
+//! Claims the first `size` bytes previously returned by TracerPeekAuxLane so
+//! that they may be sent after the lock is released, returning an identifier
+//! for TracerConsumeAuxClaim. See TraceBufferClaim.
+//! Must be called while holding the Graphics buffer lock.
+uint32_t TracerClaimAuxLane(AuxDataType lane, uint32_t size);
+//! Consumes `size` bytes of a claim made via TracerClaimAuxLane.
+//! Must be called without holding the Graphics buffer lock.
+void TracerConsumeAuxClaim(AuxDataType lane, uint32_t claim, uint32_t size);
+//! Returns the total number of bytes ever consumed from the given lane since
+//! it was created or reset (modulo 2^32). See TraceBufferGetBytesConsumed.
+//! Must be called while holding the Graphics buffer lock.
+uint32_t TracerGetAuxLaneReadOffset(AuxDataType lane);
+//! Returns the capacity of the given lane, or 0 if it is disabled.
+uint32_t TracerGetAuxLaneCapacity(AuxDataType lane);
+//! Returns the configured drain weight of the given lane.
+uint32_t TracerGetAuxLaneWeight(AuxDataType lane);
+//! Returns a value that changes whenever the lanes of the Graphics buffer are
+//! created, destroyed, or reset (e.g., when the tracer is attached or
+//! detached), so that readers can discard any state describing their contents.
+uint32_t TracerGetAuxGeneration(void);
 //! Releases the lock on the Graphics buffer.
 void TracerUnlockAuxBuffer(void);
 
+//! Retrieves a snapshot of the tracer statistics.
+void TracerGetStats(TracerStats* stats);
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif
@@ -0,0 +1,36 @@
+#include "xbox_spill_file_io.h"
+
+#include <windows.h>
+
+static void *Open(const char *path) {
+  HANDLE file = CreateFile(path, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                           CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return NULL;
+  }
+  return file;
+}
+
+static void Close(void *file) { CloseHandle((HANDLE)file); }
+
+static bool Seek(HANDLE file, uint32_t offset) {
+  return SetFilePointer(file, (LONG)offset, NULL, FILE_BEGIN) !=
+         INVALID_SET_FILE_POINTER;
+}
+
+static bool Write(void *file, uint32_t offset, const void *data,
+                  uint32_t size) {
+  DWORD bytes_written = 0;
+  return Seek((HANDLE)file, offset) &&
+         WriteFile((HANDLE)file, data, size, &bytes_written, NULL) &&
+         bytes_written == size;
+}
+
+static bool Read(void *file, uint32_t offset, void *buffer, uint32_t size) {
+  DWORD bytes_read = 0;
+  return Seek((HANDLE)file, offset) &&
+         ReadFile((HANDLE)file, buffer, size, &bytes_read, NULL) &&
+         bytes_read == size;
+}
+
+const SpillFileIO kXboxSpillFileIO = {Open, Close, Write, Read};
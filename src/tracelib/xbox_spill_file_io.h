@@ -0,0 +1,17 @@
+#ifndef NTRC_DYNDXT_SRC_TRACELIB_XBOX_SPILL_FILE_IO_H_
+#define NTRC_DYNDXT_SRC_TRACELIB_XBOX_SPILL_FILE_IO_H_
+
+#include "util/spill_file.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//! SpillFileIO implementation backed by the Win32 file API.
+extern const SpillFileIO kXboxSpillFileIO;
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // NTRC_DYNDXT_SRC_TRACELIB_XBOX_SPILL_FILE_IO_H_
@@ -0,0 +1,83 @@
+#include "arena.h"
+
+#include <string.h>
+
+#define ARENA_ALIGNMENT 8
+
+typedef struct ArenaImpl {
+  uint8_t *storage;
+  CBFreeProc free_proc;
+  ArenaStats stats;
+} ArenaImpl;
+
+Arena ArenaCreate(uint32_t capacity, CBAllocProc alloc_proc,
+                  CBFreeProc free_proc) {
+  if (!capacity) {
+    return NULL;
+  }
+
+  ArenaImpl *ret = (ArenaImpl *)alloc_proc(sizeof(ArenaImpl));
+  if (!ret) {
+    return NULL;
+  }
+  memset(ret, 0, sizeof(*ret));
+
+  ret->storage = (uint8_t *)alloc_proc(capacity);
+  if (!ret->storage) {
+    free_proc(ret);
+    return NULL;
+  }
+  ret->free_proc = free_proc;
+  ret->stats.capacity = capacity;
+
+  return ret;
+}
+
+void ArenaDestroy(Arena handle) {
+  ArenaImpl *arena = (ArenaImpl *)handle;
+  if (!arena) {
+    return;
+  }
+  arena->free_proc(arena->storage);
+  arena->free_proc(arena);
+}
+
+void *ArenaAlloc(Arena handle, uint32_t size) {
+  ArenaImpl *arena = (ArenaImpl *)handle;
+  if (!arena) {
+    return NULL;
+  }
+
+  uint32_t offset =
+      (arena->stats.used + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+  if (offset > arena->stats.capacity ||
+      size > arena->stats.capacity - offset) {
+    ++arena->stats.overflows;
+    return NULL;
+  }
+
+  arena->stats.used = offset + size;
+  if (arena->stats.used > arena->stats.high_water) {
+    arena->stats.high_water = arena->stats.used;
+  }
+  ++arena->stats.allocations;
+  return arena->storage + offset;
+}
+
+void ArenaReset(Arena handle) {
+  ArenaImpl *arena = (ArenaImpl *)handle;
+  if (!arena) {
+    return;
+  }
+  arena->stats.used = 0;
+  ++arena->stats.resets;
+}
+
+void ArenaGetStats(Arena handle, ArenaStats *stats) {
+  ArenaImpl *arena = (ArenaImpl *)handle;
+  if (!arena) {
+    memset(stats, 0, sizeof(*stats));
+    return;
+  }
+  *stats = arena->stats;
+}
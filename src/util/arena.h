@@ -0,0 +1,58 @@
+#ifndef NXDK_NTRC_DYNDXT_ARENA_H_
+#define NXDK_NTRC_DYNDXT_ARENA_H_
+
+// Provides a fixed-size bump pointer allocator whose allocations are all
+// released at once via ArenaReset.
+//
+// An Arena is not thread safe; callers must provide synchronization.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "circular_buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void *Arena;
+
+typedef struct ArenaStats {
+  // The total number of bytes that may be allocated between resets.
+  uint32_t capacity;
+  // The number of bytes currently allocated.
+  uint32_t used;
+  // The largest value `used` has ever reached.
+  uint32_t high_water;
+  // The number of successful allocations.
+  uint32_t allocations;
+  // The number of allocations that did not fit.
+  uint32_t overflows;
+  // The number of times the arena has been reset.
+  uint32_t resets;
+} ArenaStats;
+
+// Creates a new arena with the given capacity.
+// The given allocator and free methods are used to create/destroy the arena
+// and its contents.
+Arena ArenaCreate(uint32_t capacity, CBAllocProc alloc_proc,
+                  CBFreeProc free_proc);
+
+// Destroys the given arena and frees allocated resources.
+void ArenaDestroy(Arena handle);
+
+// Allocates `size` bytes, aligned to 8 bytes. Returns NULL if the allocation
+// does not fit in the remaining capacity.
+void *ArenaAlloc(Arena handle, uint32_t size);
+
+// Releases every allocation made since the last reset.
+void ArenaReset(Arena handle);
+
+// Retrieves the statistics for the given arena.
+void ArenaGetStats(Arena handle, ArenaStats *stats);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // NXDK_NTRC_DYNDXT_ARENA_H_
@@ -6,8 +6,25 @@
 #include "circular_buffer_impl.h"
 #include "fastmemcpy/fastmemcpy.h"
 
+// The read index is only ever modified by the consumer and the write index
+// only by the producer. Each side publishes its own index with release
+// semantics after touching the underlying storage and observes the other's
+// with acquire semantics, which makes the buffer safe for a single producer
+// thread and a single consumer thread without further locking.
+#define LOAD_INDEX(index) __atomic_load_n(&(index), __ATOMIC_ACQUIRE)
+#define PUBLISH_INDEX(index, value) \
+  __atomic_store_n(&(index), (value), __ATOMIC_RELEASE)
+
+static size_t CopyIn(CircularBufferImpl* cb, size_t write, const void* data,
+                     uint32_t data_size);
 static void Write(CircularBufferImpl* cb, const void* data, uint32_t data_size);
 static void Read(CircularBufferImpl* cb, void* buffer, uint32_t size);
+static uint32_t Advance(const CircularBufferImpl* cb, size_t index,
+                        uint32_t bytes);
+
+static inline bool IsSegmented(CircularBuffer handle) {
+  return *(const CBKind*)handle == CB_KIND_SEGMENTED;
+}
 
 // Creates a new circular buffer with the given capacity.
 CircularBuffer CBCreate(uint32_t size) {
@@ -32,6 +49,7 @@ CircularBuffer CBCreateEx(uint32_t size, CBAllocProc alloc_proc,
     return NULL;
   }
 
+  ret->kind = CB_KIND_CONTIGUOUS;
   ret->size = size + 1;
   ret->read = 0;
   ret->write = 0;
@@ -44,6 +62,10 @@ void CBDestroy(CircularBuffer handle) {
   if (!handle) {
     return;
   }
+  if (IsSegmented(handle)) {
+    SCBDestroy(handle);
+    return;
+  }
   CircularBufferImpl* cb = (CircularBufferImpl*)handle;
   cb->free_proc(cb->buffer);
   cb->free_proc(cb);
@@ -54,20 +76,38 @@ uint32_t CBCapacity(CircularBuffer handle) {
   if (!cb) {
     return 0;
   }
+  if (IsSegmented(handle)) {
+    return SCBCapacity(handle);
+  }
 
   return cb->size - 1;
 }
 
+uint32_t CBMaxReservation(CircularBuffer handle) {
+  if (!handle) {
+    return 0;
+  }
+  if (IsSegmented(handle)) {
+    return SCBMaxReservation(handle);
+  }
+  return CBCapacity(handle);
+}
+
 uint32_t CBAvailable(CircularBuffer handle) {
   CircularBufferImpl* cb = (CircularBufferImpl*)handle;
   if (!cb) {
     return 0;
   }
+  if (IsSegmented(handle)) {
+    return SCBAvailable(handle);
+  }
 
-  if (cb->write >= cb->read) {
-    return cb->write - cb->read;
+  size_t read = LOAD_INDEX(cb->read);
+  size_t write = LOAD_INDEX(cb->write);
+  if (write >= read) {
+    return write - read;
   }
-  return cb->size + cb->write - cb->read;
+  return cb->size + write - read;
 }
 
 uint32_t CBFreeSpace(CircularBuffer handle) {
@@ -75,12 +115,17 @@ uint32_t CBFreeSpace(CircularBuffer handle) {
   if (!cb) {
     return 0;
   }
+  if (IsSegmented(handle)) {
+    return SCBFreeSpace(handle);
+  }
 
-  if (cb->read > cb->write) {
-    return (cb->read - 1) - cb->write;
+  size_t read = LOAD_INDEX(cb->read);
+  size_t write = LOAD_INDEX(cb->write);
+  if (read > write) {
+    return (read - 1) - write;
   }
 
-  return (cb->size - 1) - (cb->write - cb->read);
+  return (cb->size - 1) - (write - read);
 }
 
 uint32_t CBDiscard(CircularBuffer handle, uint32_t bytes) {
@@ -94,27 +139,34 @@ uint32_t CBDiscard(CircularBuffer handle, uint32_t bytes) {
     bytes = available;
   }
 
-  size_t bytes_to_end = cb->size - cb->read;
-  if (bytes < bytes_to_end) {
-    cb->read += bytes;
-  } else {
-    cb->read = bytes - bytes_to_end;
+  if (IsSegmented(handle)) {
+    SCBRead(handle, NULL, bytes);
+    return bytes;
   }
-
+  PUBLISH_INDEX(cb->read, Advance(cb, cb->read, bytes));
   return bytes;
 }
 
 void CBClear(CircularBuffer handle) {
   CircularBufferImpl* cb = (CircularBufferImpl*)handle;
-  if (cb) {
-    cb->read = cb->write;
+  if (!cb) {
+    return;
   }
+  if (IsSegmented(handle)) {
+    SCBRead(handle, NULL, SCBAvailable(handle));
+    return;
+  }
+  PUBLISH_INDEX(cb->read, LOAD_INDEX(cb->write));
 }
 
 bool CBWrite(CircularBuffer handle, const void* data, uint32_t data_size) {
   if (!handle) {
     return false;
   }
+  if (IsSegmented(handle)) {
+    CBIOVec vec = {data, data_size};
+    return SCBWriteV(handle, &vec, 1);
+  }
   uint32_t free_space = CBFreeSpace(handle);
   if (free_space < data_size) {
     return false;
@@ -129,6 +181,9 @@ uint32_t CBWriteAvailable(CircularBuffer handle, const void* data,
   if (!max_size || !cb) {
     return 0;
   }
+  if (IsSegmented(handle)) {
+    return SCBWriteAvailable(handle, data, max_size);
+  }
   uint32_t free_space = CBFreeSpace(handle);
   if (free_space < max_size) {
     max_size = free_space;
@@ -139,6 +194,170 @@ uint32_t CBWriteAvailable(CircularBuffer handle, const void* data,
   return max_size;
 }
 
+bool CBWriteV(CircularBuffer handle, const CBIOVec* vecs, uint32_t count) {
+  CircularBufferImpl* cb = (CircularBufferImpl*)handle;
+  if (!cb || (count && !vecs)) {
+    return false;
+  }
+
+  uint32_t total_size = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    if (total_size + vecs[i].size < total_size) {
+      return false;
+    }
+    total_size += vecs[i].size;
+  }
+  if (IsSegmented(handle)) {
+    return SCBWriteV(handle, vecs, count);
+  }
+  if (CBFreeSpace(handle) < total_size) {
+    return false;
+  }
+
+  // Nothing becomes visible to the reader until every piece has been copied.
+  size_t write = cb->write;
+  for (uint32_t i = 0; i < count; ++i) {
+    if (vecs[i].size) {
+      write = CopyIn(cb, write, vecs[i].data, vecs[i].size);
+    }
+  }
+  PUBLISH_INDEX(cb->write, write);
+  return true;
+}
+
+bool CBReserve(CircularBuffer handle, uint32_t size, CBSpans* spans) {
+  CircularBufferImpl* cb = (CircularBufferImpl*)handle;
+  if (!cb || !spans) {
+    return false;
+  }
+  if (IsSegmented(handle)) {
+    return SCBReserve(handle, size, spans);
+  }
+  if (CBFreeSpace(handle) < size) {
+    return false;
+  }
+
+  // size will have already been validated against the read pointer, so the
+  // only test is against the underlying buffer end.
+  uint32_t bytes_to_end = cb->size - cb->write;
+  spans->first = cb->buffer + cb->write;
+  if (bytes_to_end < size) {
+    spans->first_size = bytes_to_end;
+    spans->second = cb->buffer;
+    spans->second_size = size - bytes_to_end;
+  } else {
+    spans->first_size = size;
+    spans->second = NULL;
+    spans->second_size = 0;
+  }
+  return true;
+}
+
+bool CBCommit(CircularBuffer handle, uint32_t size) {
+  CircularBufferImpl* cb = (CircularBufferImpl*)handle;
+  if (!cb) {
+    return false;
+  }
+  if (IsSegmented(handle)) {
+    return SCBCommit(handle, size);
+  }
+  if (CBFreeSpace(handle) < size) {
+    return false;
+  }
+
+  PUBLISH_INDEX(cb->write, Advance(cb, cb->write, size));
+  return true;
+}
+
+uint32_t CBSpansWrite(CBSpans* spans, const void* data, uint32_t size) {
+  if (!spans) {
+    return 0;
+  }
+
+  const uint8_t* data_ptr = (const uint8_t*)data;
+  uint32_t bytes_written = 0;
+  if (spans->first_size) {
+    uint32_t chunk = spans->first_size < size ? spans->first_size : size;
+    mmx_memcpy(spans->first, data_ptr, chunk);
+    spans->first += chunk;
+    spans->first_size -= chunk;
+    data_ptr += chunk;
+    size -= chunk;
+    bytes_written += chunk;
+  }
+
+  if (size && spans->second_size) {
+    uint32_t chunk = spans->second_size < size ? spans->second_size : size;
+    mmx_memcpy(spans->second, data_ptr, chunk);
+    spans->second += chunk;
+    spans->second_size -= chunk;
+    bytes_written += chunk;
+  }
+
+  // Promote the second span once the first is exhausted so that callers only
+  // ever need to inspect `first`.
+  if (!spans->first_size && spans->second_size) {
+    spans->first = spans->second;
+    spans->first_size = spans->second_size;
+    spans->second = NULL;
+    spans->second_size = 0;
+  }
+
+  return bytes_written;
+}
+
+uint32_t CBPeekSpans(CircularBuffer handle, uint32_t max_size,
+                     CBSpans* spans) {
+  CircularBufferImpl* cb = (CircularBufferImpl*)handle;
+  if (!spans) {
+    return 0;
+  }
+
+  uint32_t available = CBAvailable(handle);
+  if (available < max_size) {
+    max_size = available;
+  }
+  if (!cb || !max_size) {
+    spans->first = NULL;
+    spans->first_size = 0;
+    spans->second = NULL;
+    spans->second_size = 0;
+    return 0;
+  }
+  if (IsSegmented(handle)) {
+    return SCBPeekSpans(handle, max_size, spans);
+  }
+
+  // max_size will have already been validated against the write pointer, so
+  // the only test is against the underlying buffer end.
+  uint32_t bytes_to_end = cb->size - cb->read;
+  spans->first = cb->buffer + cb->read;
+  if (bytes_to_end < max_size) {
+    spans->first_size = bytes_to_end;
+    spans->second = cb->buffer;
+    spans->second_size = max_size - bytes_to_end;
+  } else {
+    spans->first_size = max_size;
+    spans->second = NULL;
+    spans->second_size = 0;
+  }
+  return max_size;
+}
+
+bool CBConsume(CircularBuffer handle, uint32_t size) {
+  CircularBufferImpl* cb = (CircularBufferImpl*)handle;
+  if (!cb || CBAvailable(handle) < size) {
+    return false;
+  }
+  if (IsSegmented(handle)) {
+    SCBRead(handle, NULL, size);
+    return true;
+  }
+
+  PUBLISH_INDEX(cb->read, Advance(cb, cb->read, size));
+  return true;
+}
+
 uint32_t CBReadAvailable(CircularBuffer handle, void* buffer,
                          uint32_t max_size) {
   CircularBufferImpl* cb = (CircularBufferImpl*)handle;
@@ -149,6 +368,10 @@ uint32_t CBReadAvailable(CircularBuffer handle, void* buffer,
   if (available < max_size) {
     max_size = available;
   }
+  if (IsSegmented(handle)) {
+    SCBRead(handle, buffer, max_size);
+    return max_size;
+  }
   Read(cb, buffer, max_size);
   return max_size;
 }
@@ -157,41 +380,67 @@ bool CBRead(CircularBuffer handle, void* buffer, uint32_t size) {
   if (!handle || !size || CBAvailable(handle) < size) {
     return false;
   }
+  if (IsSegmented(handle)) {
+    SCBRead(handle, buffer, size);
+    return true;
+  }
   Read((CircularBufferImpl*)handle, buffer, size);
   return true;
 }
 
-static void Write(CircularBufferImpl* cb, const void* data,
-                  uint32_t data_size) {
+static uint32_t Advance(const CircularBufferImpl* cb, size_t index,
+                        uint32_t bytes) {
+  // bytes will have already been validated against the opposing index, so the
+  // only test is against the underlying buffer end.
+  size_t bytes_to_end = cb->size - index;
+  if (bytes_to_end <= bytes) {
+    return bytes - bytes_to_end;
+  }
+  return index + bytes;
+}
+
+static size_t CopyIn(CircularBufferImpl* cb, size_t write, const void* data,
+                     uint32_t data_size) {
   // data_size will have already been adjusted if the read pointer is ahead of
   // the write, so the only test is against the underlying buffer end.
   const uint8_t* data_ptr = (const uint8_t*)data;
-  uint32_t bytes_to_end = cb->size - cb->write;
-  if (bytes_to_end < data_size) {
-    mmx_memcpy(cb->buffer + cb->write, data_ptr, bytes_to_end);
+  uint32_t bytes_to_end = cb->size - write;
+  if (bytes_to_end <= data_size) {
+    mmx_memcpy(cb->buffer + write, data_ptr, bytes_to_end);
     data_ptr += bytes_to_end;
-    cb->write = 0;
+    write = 0;
     data_size -= bytes_to_end;
   }
 
   if (data_size) {
-    mmx_memcpy(cb->buffer + cb->write, data_ptr, data_size);
-    cb->write += data_size;
+    mmx_memcpy(cb->buffer + write, data_ptr, data_size);
+    write += data_size;
   }
+  return write;
+}
+
+static void Write(CircularBufferImpl* cb, const void* data,
+                  uint32_t data_size) {
+  PUBLISH_INDEX(cb->write, CopyIn(cb, cb->write, data, data_size));
 }
 
 static void Read(CircularBufferImpl* cb, void* buffer, uint32_t size) {
   // size will have already been adjusted if the write pointer is ahead of the
   // read, so the only test is against the underlying buffer end.
   uint8_t* buffer_ptr = (uint8_t*)buffer;
-  uint32_t bytes_to_end = cb->size - cb->read;
-  if (bytes_to_end < size) {
-    mmx_memcpy(buffer_ptr, cb->buffer + cb->read, bytes_to_end);
+  size_t read = cb->read;
+  uint32_t bytes_to_end = cb->size - read;
+  uint32_t remaining = size;
+  if (bytes_to_end <= remaining) {
+    mmx_memcpy(buffer_ptr, cb->buffer + read, bytes_to_end);
     buffer_ptr += bytes_to_end;
-    cb->read = 0;
-    size -= bytes_to_end;
+    read = 0;
+    remaining -= bytes_to_end;
+  }
+
+  if (remaining) {
+    mmx_memcpy(buffer_ptr, cb->buffer + read, remaining);
   }
 
-  mmx_memcpy(buffer_ptr, cb->buffer + cb->read, size);
-  cb->read += size;
+  PUBLISH_INDEX(cb->read, Advance(cb, cb->read, size));
 }
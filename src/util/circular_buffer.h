@@ -3,7 +3,11 @@
 
 // Provides circular buffer functionality.
 //
-// No concurrency protection is provided.
+// A buffer may be safely shared between exactly one producer thread (which
+// may call the write/reserve/commit methods) and exactly one consumer thread
+// (which may call the read/discard/clear methods) without external locking.
+// CBAvailable and CBFreeSpace may be called from either side and return a
+// conservative snapshot. Any other sharing requires external synchronization.
 
 #include <stdbool.h>
 #include <stddef.h>
@@ -18,6 +22,21 @@ typedef void *CircularBuffer;
 typedef void *(*CBAllocProc)(size_t);
 typedef void (*CBFreeProc)(void *);
 
+// Describes up to two contiguous regions within a circular buffer. `second` is
+// only populated if the region wraps around the end of the underlying storage.
+typedef struct CBSpans {
+  uint8_t *first;
+  uint32_t first_size;
+  uint8_t *second;
+  uint32_t second_size;
+} CBSpans;
+
+// Describes one piece of a vectored write.
+typedef struct CBIOVec {
+  const void *data;
+  uint32_t size;
+} CBIOVec;
+
 // Creates a new circular buffer with the given capacity using the default
 // malloc/free.
 CircularBuffer CBCreate(uint32_t size);
@@ -28,12 +47,26 @@ CircularBuffer CBCreate(uint32_t size);
 CircularBuffer CBCreateEx(uint32_t size, CBAllocProc alloc_proc,
                           CBFreeProc free_proc);
 
+// Creates a new circular buffer that grows and shrinks on demand in blocks of
+// `chunk_size` bytes, up to a ceiling of `max_chunks` blocks. A single drained
+// block is retained for reuse; any others are returned via `free_proc` as soon
+// as the reader has consumed them.
+// `max_chunks` must be at least 2.
+CircularBuffer CBCreateSegmented(uint32_t chunk_size, uint32_t max_chunks,
+                                 CBAllocProc alloc_proc, CBFreeProc free_proc);
+
 // Destroys the given circular buffer and frees allocated resources.
 void CBDestroy(CircularBuffer handle);
 
-// Returns the maximum size of the given buffer.
+// Returns the maximum size of the given buffer. Segmented buffers are
+// guaranteed to be able to hold this many bytes, but may hold slightly more.
 uint32_t CBCapacity(CircularBuffer handle);
 
+// Returns the largest reservation that may be made via CBReserve. This is the
+// capacity for buffers created via CBCreate/CBCreateEx and the block size for
+// buffers created via CBCreateSegmented.
+uint32_t CBMaxReservation(CircularBuffer handle);
+
 // Returns the number of bytes available for reading.
 uint32_t CBAvailable(CircularBuffer handle);
 
@@ -56,6 +89,40 @@ bool CBWrite(CircularBuffer handle, const void *data, uint32_t data_size);
 uint32_t CBWriteAvailable(CircularBuffer handle, const void *data,
                           uint32_t max_size);
 
+// Attempts to write all of the given pieces to the buffer, in order, as a
+// single unit. Either every piece is written or nothing is, and none of the
+// bytes become readable until all of them have been copied.
+// Returns true if the data was written successfully.
+bool CBWriteV(CircularBuffer handle, const CBIOVec *vecs, uint32_t count);
+
+// Reserves exactly `size` bytes of free space so that they may be populated in
+// place, populating `spans` with the writable region(s).
+// The reserved bytes do not become readable until they are committed via
+// CBCommit. Only one reservation may be outstanding at a time and no other
+// write may be performed until it has been committed.
+// Returns true if the space was reserved successfully.
+bool CBReserve(CircularBuffer handle, uint32_t size, CBSpans *spans);
+
+// Makes `size` bytes of a previous CBReserve call available for reading.
+// Returns false if `size` exceeds the free space in the buffer.
+bool CBCommit(CircularBuffer handle, uint32_t size);
+
+// Copies up to `size` bytes from `data` into the front of the given spans and
+// advances them past the copied bytes.
+// Returns the actual number of bytes copied.
+uint32_t CBSpansWrite(CBSpans *spans, const void *data, uint32_t size);
+
+// Populates `spans` with the readable region(s) of up to `max_size` bytes
+// without consuming them. The regions remain valid until they are consumed via
+// CBConsume, CBDiscard, or CBClear.
+// Returns the total number of bytes described by `spans`.
+uint32_t CBPeekSpans(CircularBuffer handle, uint32_t max_size, CBSpans *spans);
+
+// Consumes exactly `size` bytes from the buffer, typically after a CBPeekSpans
+// call.
+// Returns false if fewer than `size` bytes are available.
+bool CBConsume(CircularBuffer handle, uint32_t size);
+
 // Attempts to read exactly `size` bytes from the buffer.
 // Returns true if the data was read successfully.
 bool CBRead(CircularBuffer handle, void *buffer, uint32_t size);
@@ -5,7 +5,16 @@
 extern "C" {
 #endif
 
+// Identifies the concrete implementation behind a CircularBuffer handle. Must
+// be the first member of every implementation struct.
+typedef enum CBKind {
+  CB_KIND_CONTIGUOUS = 0,
+  CB_KIND_SEGMENTED = 1,
+} CBKind;
+
 typedef struct CircularBufferImpl {
+  CBKind kind;
+
   uint8_t *buffer;
   size_t size;
 
@@ -15,6 +24,59 @@ typedef struct CircularBufferImpl {
   CBFreeProc free_proc;
 } CircularBufferImpl;
 
+// A fixed size block of storage within a segmented buffer.
+typedef struct CBChunk {
+  struct CBChunk *next;
+  uint8_t data[];
+} CBChunk;
+
+typedef struct SegmentedCircularBufferImpl {
+  CBKind kind;
+
+  uint32_t chunk_size;
+  uint32_t max_chunks;
+  CBAllocProc alloc_proc;
+  CBFreeProc free_proc;
+
+  // Producer state. `tail` is the chunk currently being written.
+  CBChunk *tail;
+  uint32_t tail_write;
+  // Chunks obtained by the producer that have not yet been linked into the
+  // list.
+  CBChunk *pending;
+  uint32_t pending_count;
+
+  // Consumer state. `head` is the chunk currently being read.
+  CBChunk *head;
+  uint32_t head_read;
+
+  // Shared state, accessed atomically.
+  uint32_t bytes_written;
+  uint32_t bytes_read;
+  // The number of chunks that are either linked or pending.
+  uint32_t chunks;
+  // A drained chunk retained by the consumer for reuse by the producer.
+  CBChunk *spare;
+} SegmentedCircularBufferImpl;
+
+// Segmented implementations of the public API. Read sizes will have already
+// been validated against the available data; write sizes are validated by the
+// segmented implementation since it may need to allocate chunks.
+void SCBDestroy(CircularBuffer handle);
+uint32_t SCBCapacity(CircularBuffer handle);
+uint32_t SCBMaxReservation(CircularBuffer handle);
+uint32_t SCBAvailable(CircularBuffer handle);
+uint32_t SCBFreeSpace(CircularBuffer handle);
+uint32_t SCBWriteAvailable(CircularBuffer handle, const void *data,
+                           uint32_t max_size);
+bool SCBWriteV(CircularBuffer handle, const CBIOVec *vecs, uint32_t count);
+bool SCBReserve(CircularBuffer handle, uint32_t size, CBSpans *spans);
+bool SCBCommit(CircularBuffer handle, uint32_t size);
+uint32_t SCBPeekSpans(CircularBuffer handle, uint32_t max_size,
+                      CBSpans *spans);
+// Consumes `size` bytes, copying them into `buffer` if it is not NULL.
+void SCBRead(CircularBuffer handle, void *buffer, uint32_t size);
+
 #ifdef __cplusplus
 }  //  extern "C"
 #endif
@@ -0,0 +1,287 @@
+#include <string.h>
+
+#include "circular_buffer.h"
+#include "circular_buffer_impl.h"
+#include "fastmemcpy/fastmemcpy.h"
+
+// The producer only ever links new chunks after the tail and the consumer only
+// ever releases chunks from the head once the producer has linked a successor,
+// so neither side touches a chunk that the other may release.
+#define LOAD_SHARED(value) __atomic_load_n(&(value), __ATOMIC_ACQUIRE)
+#define PUBLISH_SHARED(value, new_value) \
+  __atomic_store_n(&(value), (new_value), __ATOMIC_RELEASE)
+
+static inline uint32_t min(uint32_t a, uint32_t b) { return a < b ? a : b; }
+
+CircularBuffer CBCreateSegmented(uint32_t chunk_size, uint32_t max_chunks,
+                                 CBAllocProc alloc_proc, CBFreeProc free_proc) {
+  if (!chunk_size || max_chunks < 2 || max_chunks > UINT32_MAX / chunk_size) {
+    return NULL;
+  }
+
+  SegmentedCircularBufferImpl* ret = (SegmentedCircularBufferImpl*)alloc_proc(
+      sizeof(SegmentedCircularBufferImpl));
+  if (!ret) {
+    return ret;
+  }
+  memset(ret, 0, sizeof(*ret));
+
+  CBChunk* chunk = (CBChunk*)alloc_proc(sizeof(CBChunk) + chunk_size);
+  if (!chunk) {
+    free_proc(ret);
+    return NULL;
+  }
+  chunk->next = NULL;
+
+  ret->kind = CB_KIND_SEGMENTED;
+  ret->chunk_size = chunk_size;
+  ret->max_chunks = max_chunks;
+  ret->alloc_proc = alloc_proc;
+  ret->free_proc = free_proc;
+  ret->tail = chunk;
+  ret->head = chunk;
+  ret->chunks = 1;
+
+  return ret;
+}
+
+static void FreeChunkList(SegmentedCircularBufferImpl* cb, CBChunk* chunk) {
+  while (chunk) {
+    CBChunk* next = chunk->next;
+    cb->free_proc(chunk);
+    chunk = next;
+  }
+}
+
+void SCBDestroy(CircularBuffer handle) {
+  SegmentedCircularBufferImpl* cb = (SegmentedCircularBufferImpl*)handle;
+  FreeChunkList(cb, cb->head);
+  FreeChunkList(cb, cb->pending);
+  if (cb->spare) {
+    cb->free_proc(cb->spare);
+  }
+  cb->free_proc(cb);
+}
+
+uint32_t SCBCapacity(CircularBuffer handle) {
+  SegmentedCircularBufferImpl* cb = (SegmentedCircularBufferImpl*)handle;
+  // The chunk that the read cursor is in may be partially consumed, so only
+  // the remaining chunks are guaranteed to be usable.
+  return (cb->max_chunks - 1) * cb->chunk_size;
+}
+
+uint32_t SCBMaxReservation(CircularBuffer handle) {
+  SegmentedCircularBufferImpl* cb = (SegmentedCircularBufferImpl*)handle;
+  return cb->chunk_size;
+}
+
+uint32_t SCBAvailable(CircularBuffer handle) {
+  SegmentedCircularBufferImpl* cb = (SegmentedCircularBufferImpl*)handle;
+  return LOAD_SHARED(cb->bytes_written) - LOAD_SHARED(cb->bytes_read);
+}
+
+uint32_t SCBFreeSpace(CircularBuffer handle) {
+  SegmentedCircularBufferImpl* cb = (SegmentedCircularBufferImpl*)handle;
+  uint32_t unallocated_chunks =
+      cb->max_chunks - LOAD_SHARED(cb->chunks) + cb->pending_count;
+  return unallocated_chunks * cb->chunk_size +
+         (cb->chunk_size - cb->tail_write);
+}
+
+// Producer ------------------------------------------------------------------
+
+static CBChunk* ObtainChunk(SegmentedCircularBufferImpl* cb) {
+  if (LOAD_SHARED(cb->chunks) >= cb->max_chunks) {
+    return NULL;
+  }
+
+  CBChunk* chunk = __atomic_exchange_n(&cb->spare, NULL, __ATOMIC_ACQ_REL);
+  if (!chunk) {
+    chunk = (CBChunk*)cb->alloc_proc(sizeof(CBChunk) + cb->chunk_size);
+    if (!chunk) {
+      return NULL;
+    }
+  }
+  __atomic_fetch_add(&cb->chunks, 1, __ATOMIC_ACQ_REL);
+  return chunk;
+}
+
+// Obtains pending chunks until up to `size` bytes may be written, returning
+// the number of bytes that may actually be written.
+static uint32_t EnsureWritable(SegmentedCircularBufferImpl* cb, uint32_t size) {
+  uint32_t writable =
+      (cb->chunk_size - cb->tail_write) + cb->pending_count * cb->chunk_size;
+  while (writable < size) {
+    CBChunk* chunk = ObtainChunk(cb);
+    if (!chunk) {
+      return writable;
+    }
+    chunk->next = cb->pending;
+    cb->pending = chunk;
+    ++cb->pending_count;
+    writable += cb->chunk_size;
+  }
+  return size;
+}
+
+// Advances the write cursor by `size` bytes, copying from `data` if it is not
+// NULL. EnsureWritable must have been called for at least `size` bytes.
+static void Produce(SegmentedCircularBufferImpl* cb, const uint8_t* data,
+                    uint32_t size) {
+  while (size) {
+    if (cb->tail_write == cb->chunk_size) {
+      CBChunk* chunk = cb->pending;
+      cb->pending = chunk->next;
+      --cb->pending_count;
+      chunk->next = NULL;
+
+      // The consumer may release the old tail as soon as it observes the new
+      // link, so it must not be accessed afterwards.
+      PUBLISH_SHARED(cb->tail->next, chunk);
+      cb->tail = chunk;
+      cb->tail_write = 0;
+    }
+
+    uint32_t bytes = min(size, cb->chunk_size - cb->tail_write);
+    if (data) {
+      mmx_memcpy(cb->tail->data + cb->tail_write, data, bytes);
+      data += bytes;
+    }
+    cb->tail_write += bytes;
+    size -= bytes;
+  }
+}
+
+static void PublishWritten(SegmentedCircularBufferImpl* cb, uint32_t size) {
+  PUBLISH_SHARED(cb->bytes_written, cb->bytes_written + size);
+}
+
+uint32_t SCBWriteAvailable(CircularBuffer handle, const void* data,
+                           uint32_t max_size) {
+  SegmentedCircularBufferImpl* cb = (SegmentedCircularBufferImpl*)handle;
+  uint32_t size = EnsureWritable(cb, max_size);
+  Produce(cb, (const uint8_t*)data, size);
+  PublishWritten(cb, size);
+  return size;
+}
+
+bool SCBWriteV(CircularBuffer handle, const CBIOVec* vecs, uint32_t count) {
+  SegmentedCircularBufferImpl* cb = (SegmentedCircularBufferImpl*)handle;
+  uint32_t total_size = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    total_size += vecs[i].size;
+  }
+  if (EnsureWritable(cb, total_size) < total_size) {
+    return false;
+  }
+
+  for (uint32_t i = 0; i < count; ++i) {
+    Produce(cb, (const uint8_t*)vecs[i].data, vecs[i].size);
+  }
+  PublishWritten(cb, total_size);
+  return true;
+}
+
+bool SCBReserve(CircularBuffer handle, uint32_t size, CBSpans* spans) {
+  SegmentedCircularBufferImpl* cb = (SegmentedCircularBufferImpl*)handle;
+  if (size > cb->chunk_size || EnsureWritable(cb, size) < size) {
+    return false;
+  }
+
+  // Produce() links pending chunks in order, so the next chunk to be written
+  // after the tail is the head of the pending list.
+  uint32_t tail_remaining = cb->chunk_size - cb->tail_write;
+  if (!tail_remaining) {
+    spans->first = cb->pending->data;
+    spans->first_size = size;
+    spans->second = NULL;
+    spans->second_size = 0;
+  } else if (tail_remaining >= size) {
+    spans->first = cb->tail->data + cb->tail_write;
+    spans->first_size = size;
+    spans->second = NULL;
+    spans->second_size = 0;
+  } else {
+    spans->first = cb->tail->data + cb->tail_write;
+    spans->first_size = tail_remaining;
+    spans->second = cb->pending->data;
+    spans->second_size = size - tail_remaining;
+  }
+  return true;
+}
+
+bool SCBCommit(CircularBuffer handle, uint32_t size) {
+  SegmentedCircularBufferImpl* cb = (SegmentedCircularBufferImpl*)handle;
+  if (EnsureWritable(cb, size) < size) {
+    return false;
+  }
+  Produce(cb, NULL, size);
+  PublishWritten(cb, size);
+  return true;
+}
+
+// Consumer ------------------------------------------------------------------
+
+// Moves the read cursor past fully consumed chunks, retaining one for reuse and
+// freeing the rest.
+static void ReleaseDrainedChunks(SegmentedCircularBufferImpl* cb) {
+  while (cb->head_read == cb->chunk_size) {
+    CBChunk* next = LOAD_SHARED(cb->head->next);
+    if (!next) {
+      return;
+    }
+
+    CBChunk* drained = cb->head;
+    cb->head = next;
+    cb->head_read = 0;
+
+    CBChunk* expected = NULL;
+    if (!__atomic_compare_exchange_n(&cb->spare, &expected, drained, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      cb->free_proc(drained);
+    }
+    __atomic_fetch_sub(&cb->chunks, 1, __ATOMIC_ACQ_REL);
+  }
+}
+
+uint32_t SCBPeekSpans(CircularBuffer handle, uint32_t max_size,
+                      CBSpans* spans) {
+  SegmentedCircularBufferImpl* cb = (SegmentedCircularBufferImpl*)handle;
+  uint32_t size = min(max_size, SCBAvailable(handle));
+  ReleaseDrainedChunks(cb);
+
+  spans->second = NULL;
+  spans->second_size = 0;
+  if (!size) {
+    spans->first = NULL;
+    spans->first_size = 0;
+    return 0;
+  }
+
+  spans->first = cb->head->data + cb->head_read;
+  spans->first_size = min(size, cb->chunk_size - cb->head_read);
+  if (size > spans->first_size) {
+    CBChunk* next = LOAD_SHARED(cb->head->next);
+    spans->second = next->data;
+    spans->second_size = min(size - spans->first_size, cb->chunk_size);
+  }
+  return spans->first_size + spans->second_size;
+}
+
+void SCBRead(CircularBuffer handle, void* buffer, uint32_t size) {
+  SegmentedCircularBufferImpl* cb = (SegmentedCircularBufferImpl*)handle;
+  uint8_t* buffer_ptr = (uint8_t*)buffer;
+  uint32_t total_size = size;
+  while (size) {
+    ReleaseDrainedChunks(cb);
+    uint32_t bytes = min(size, cb->chunk_size - cb->head_read);
+    if (buffer_ptr) {
+      mmx_memcpy(buffer_ptr, cb->head->data + cb->head_read, bytes);
+      buffer_ptr += bytes;
+    }
+    cb->head_read += bytes;
+    size -= bytes;
+  }
+  ReleaseDrainedChunks(cb);
+  PUBLISH_SHARED(cb->bytes_read, cb->bytes_read + total_size);
+}
@@ -0,0 +1,214 @@
+#include "compact_command.h"
+
+#include <string.h>
+
+#define UNKNOWN_VALUE 0xFFFFFFFF
+
+static uint8_t *WriteVarint(uint8_t *out, uint32_t value) {
+  while (value >= 0x80) {
+    *out++ = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = (uint8_t)value;
+  return out;
+}
+
+static uint8_t *WriteDelta(uint8_t *out, uint32_t value, uint32_t expected) {
+  int32_t delta = (int32_t)(value - expected);
+  return WriteVarint(out, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+}
+
+// Reads a varint from [*in, end), advancing `in`. Returns false if the varint
+// is truncated or too long.
+static bool ReadVarint(const uint8_t **in, const uint8_t *end,
+                       uint32_t *value) {
+  uint32_t ret = 0;
+  for (uint32_t shift = 0; shift < 35; shift += 7) {
+    if (*in >= end) {
+      return false;
+    }
+    uint8_t byte = *(*in)++;
+    ret |= (uint32_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      *value = ret;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool ReadDelta(const uint8_t **in, const uint8_t *end,
+                      uint32_t expected, uint32_t *value) {
+  uint32_t zigzag;
+  if (!ReadVarint(in, end, &zigzag)) {
+    return false;
+  }
+  *value = expected + ((zigzag >> 1) ^ (0 - (zigzag & 1)));
+  return true;
+}
+
+void CCInit(CCState *state) {
+  state->packet_index = 0;
+  state->draw_index = 0;
+  state->surface_dump_index = 0;
+  state->next_address = 0;
+  state->method = UNKNOWN_VALUE;
+  state->subchannel = UNKNOWN_VALUE;
+  state->parameter_count = UNKNOWN_VALUE;
+  memset(state->graphics_classes, 0xFF, sizeof(state->graphics_classes));
+}
+
+// Advances `state` past the given command and its repeats.
+static void Update(CCState *state, const CCCommand *command) {
+  uint32_t count = 1 + command->repeat_count;
+  state->packet_index = command->packet_index + count;
+  state->draw_index = command->draw_index;
+  state->surface_dump_index = command->surface_dump_index;
+  state->next_address =
+      command->address + count * (4 + command->parameter_count * 4);
+  state->method = command->method;
+  state->subchannel = command->subchannel;
+  state->parameter_count = command->parameter_count;
+  state->graphics_classes[command->subchannel & (CC_NUM_SUBCHANNELS - 1)] =
+      command->graphics_class;
+}
+
+uint32_t CCEncode(CCState *state, const CCCommand *command, uint8_t *out) {
+  uint32_t flags = 0;
+  // The fields are staged until the flags (and thus their size) are known.
+  uint8_t fields[CC_MAX_HEADER_SIZE];
+  uint8_t *cursor = fields;
+
+  if (command->method == state->method &&
+      command->subchannel == state->subchannel &&
+      command->parameter_count == state->parameter_count) {
+    flags |= CCF_SAME_METHOD;
+  } else {
+    cursor = WriteVarint(cursor, (command->method >> 2) << 3 |
+                                     (command->subchannel & 7));
+    cursor = WriteVarint(cursor, command->parameter_count);
+  }
+  if (command->packet_index != state->packet_index) {
+    flags |= CCF_PACKET_INDEX;
+    cursor = WriteDelta(cursor, command->packet_index, state->packet_index);
+  }
+  if (command->address != state->next_address) {
+    flags |= CCF_ADDRESS;
+    cursor = WriteDelta(cursor, command->address, state->next_address);
+  }
+  if (command->draw_index != state->draw_index) {
+    flags |= CCF_DRAW_INDEX;
+    cursor = WriteDelta(cursor, command->draw_index, state->draw_index);
+  }
+  if (command->surface_dump_index != state->surface_dump_index) {
+    flags |= CCF_SURFACE_DUMP_INDEX;
+    cursor = WriteDelta(cursor, command->surface_dump_index,
+                        state->surface_dump_index);
+  }
+  if (command->graphics_class !=
+      state->graphics_classes[command->subchannel & 7]) {
+    flags |= CCF_GRAPHICS_CLASS;
+    cursor = WriteVarint(cursor, command->graphics_class);
+  }
+  if (command->non_increasing) {
+    flags |= CCF_NON_INCREASING;
+  }
+  if (command->repeat_count) {
+    flags |= CCF_REPEAT;
+    cursor = WriteVarint(cursor, command->repeat_count);
+  }
+  if (command->truncated) {
+    flags |= CCF_TRUNCATED;
+    cursor = WriteVarint(cursor, command->kept_count);
+    for (uint32_t i = 0; i < 8; ++i) {
+      *cursor++ = (uint8_t)(command->omitted_hash >> (i * 8));
+    }
+  }
+  if (command->has_parameters && command->parameter_count) {
+    flags |= CCF_PARAMETERS;
+  }
+
+  uint8_t *header_end = WriteVarint(out, flags);
+  uint32_t fields_size = (uint32_t)(cursor - fields);
+  memcpy(header_end, fields, fields_size);
+  Update(state, command);
+  return (uint32_t)(header_end - out) + fields_size;
+}
+
+uint32_t CCDecode(CCState *state, const uint8_t *in, uint32_t size,
+                  CCCommand *command, const uint8_t **parameters) {
+  const uint8_t *cursor = in;
+  const uint8_t *end = in + size;
+  uint32_t flags;
+  if (!ReadVarint(&cursor, end, &flags)) {
+    return 0;
+  }
+
+  if (flags & CCF_SAME_METHOD) {
+    if (state->method == UNKNOWN_VALUE) {
+      return 0;
+    }
+    command->method = state->method;
+    command->subchannel = state->subchannel;
+    command->parameter_count = state->parameter_count;
+  } else {
+    uint32_t packed;
+    if (!ReadVarint(&cursor, end, &packed) ||
+        !ReadVarint(&cursor, end, &command->parameter_count)) {
+      return 0;
+    }
+    command->method = (packed >> 3) << 2;
+    command->subchannel = packed & 7;
+  }
+
+  command->packet_index = state->packet_index;
+  command->address = state->next_address;
+  command->draw_index = state->draw_index;
+  command->surface_dump_index = state->surface_dump_index;
+  command->graphics_class = state->graphics_classes[command->subchannel];
+  if (((flags & CCF_PACKET_INDEX) &&
+       !ReadDelta(&cursor, end, state->packet_index, &command->packet_index)) ||
+      ((flags & CCF_ADDRESS) &&
+       !ReadDelta(&cursor, end, state->next_address, &command->address)) ||
+      ((flags & CCF_DRAW_INDEX) &&
+       !ReadDelta(&cursor, end, state->draw_index, &command->draw_index)) ||
+      ((flags & CCF_SURFACE_DUMP_INDEX) &&
+       !ReadDelta(&cursor, end, state->surface_dump_index,
+                  &command->surface_dump_index)) ||
+      ((flags & CCF_GRAPHICS_CLASS) &&
+       !ReadVarint(&cursor, end, &command->graphics_class))) {
+    return 0;
+  }
+  command->repeat_count = 0;
+  if ((flags & CCF_REPEAT) &&
+      !ReadVarint(&cursor, end, &command->repeat_count)) {
+    return 0;
+  }
+  command->truncated = (flags & CCF_TRUNCATED) != 0;
+  command->kept_count = command->parameter_count;
+  command->omitted_hash = 0;
+  if (command->truncated) {
+    if (!ReadVarint(&cursor, end, &command->kept_count) ||
+        command->kept_count > command->parameter_count || end - cursor < 8) {
+      return 0;
+    }
+    for (uint32_t i = 0; i < 8; ++i) {
+      command->omitted_hash |= (uint64_t)*cursor++ << (i * 8);
+    }
+  }
+  command->non_increasing = (flags & CCF_NON_INCREASING) != 0;
+  command->has_parameters = (flags & CCF_PARAMETERS) != 0;
+
+  *parameters = NULL;
+  if (command->has_parameters) {
+    uint32_t parameter_size = command->kept_count * 4;
+    if (parameter_size > (uint32_t)(end - cursor)) {
+      return 0;
+    }
+    *parameters = cursor;
+    cursor += parameter_size;
+  }
+
+  Update(state, command);
+  return (uint32_t)(cursor - in);
+}
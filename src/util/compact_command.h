@@ -0,0 +1,122 @@
+#ifndef NXDK_NTRC_DYNDXT_COMPACT_COMMAND_H_
+#define NXDK_NTRC_DYNDXT_COMPACT_COMMAND_H_
+
+// Provides a compact, variable length encoding of PGRAPH command records.
+//
+// Each record starts with a varint of flags (a combination of CCFlags, ordered
+// such that the common ones fit in a single byte), followed by the method and
+// parameter count (unless CCF_SAME_METHOD is set), then by the remaining fields
+// indicated by the flags in the order they are declared, and finally by any
+// parameters as raw 4-byte words. Fields that can be predicted
+// from the previous record are omitted:
+//   - `packet_index` is expected to be one more than the previous index.
+//   - `address` is expected to follow the parameters of the previous command.
+//   - `draw_index` and `surface_dump_index` are expected to be unchanged.
+//   - `graphics_class` is only sent when the class bound to the subchannel
+//     differs from the last class sent for that subchannel.
+//   - The method, subchannel and parameter count are omitted if they match
+//     the previous record.
+// Deltas are sent as zigzag LEB128 varints and other values as LEB128
+// varints.
+//
+// The encoder and decoder must process the same sequence of records starting
+// from a freshly initialized CCState, so records must never be dropped.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The maximum number of bytes written by CCEncode.
+#define CC_MAX_HEADER_SIZE 56
+
+// The number of PGRAPH subchannels.
+#define CC_NUM_SUBCHANNELS 8
+
+typedef enum CCFlags {
+  // The method, subchannel, and parameter count are unchanged and omitted.
+  // Otherwise varints of `(method >> 2) << 3 | subchannel` and
+  // `parameter_count` follow.
+  CCF_SAME_METHOD = 1 << 0,
+  // `parameter_count` parameters follow the header.
+  CCF_PARAMETERS = 1 << 1,
+  // A zigzag varint delta from the expected `packet_index` follows.
+  CCF_PACKET_INDEX = 1 << 2,
+  // A zigzag varint delta from the expected `address` follows.
+  CCF_ADDRESS = 1 << 3,
+  // A zigzag varint delta from the previous `draw_index` follows.
+  CCF_DRAW_INDEX = 1 << 4,
+  // A zigzag varint delta from the previous `surface_dump_index` follows.
+  CCF_SURFACE_DUMP_INDEX = 1 << 5,
+  // The varint `graphics_class` of the subchannel follows.
+  CCF_GRAPHICS_CLASS = 1 << 6,
+  // The method is non-increasing.
+  CCF_NON_INCREASING = 1 << 7,
+  // The varint `repeat_count` follows.
+  CCF_REPEAT = 1 << 8,
+  // The varint `kept_count` and the 8-byte little endian `omitted_hash`
+  // follow, and only `kept_count` parameters follow the header.
+  CCF_TRUNCATED = 1 << 9,
+} CCFlags;
+
+// Describes a single PGRAPH command.
+typedef struct CCCommand {
+  uint32_t packet_index;
+  uint32_t draw_index;
+  uint32_t surface_dump_index;
+  uint32_t address;
+  uint32_t graphics_class;
+  uint32_t method;
+  uint32_t subchannel;
+  uint32_t parameter_count;
+  bool non_increasing;
+  // The number of times the command is repeated (with identical parameters)
+  // immediately after the first, at consecutive addresses and packet indices.
+  uint32_t repeat_count;
+  // Whether the parameters are part of the record. Parameters may be missing
+  // (e.g., if they could not be captured) even if `parameter_count` is
+  // nonzero.
+  bool has_parameters;
+  // Whether only the first `kept_count` parameters are part of the record, in
+  // which case `omitted_hash` is the 64-bit FNV-1a hash of the rest.
+  bool truncated;
+  uint32_t kept_count;
+  uint64_t omitted_hash;
+} CCCommand;
+
+// Holds the values predicted for the next record. Members should be treated
+// as private.
+typedef struct CCState {
+  uint32_t packet_index;
+  uint32_t draw_index;
+  uint32_t surface_dump_index;
+  uint32_t next_address;
+  uint32_t method;
+  uint32_t subchannel;
+  uint32_t parameter_count;
+  uint32_t graphics_classes[CC_NUM_SUBCHANNELS];
+} CCState;
+
+// Initializes the given state for the start of a stream.
+void CCInit(CCState *state);
+
+// Encodes the header of the given command into `out`, which must have room for
+// CC_MAX_HEADER_SIZE bytes, and returns the number of bytes written. If
+// `command->has_parameters` is set, the caller must append the
+// `parameter_count` parameter words to the header.
+uint32_t CCEncode(CCState *state, const CCCommand *command, uint8_t *out);
+
+// Decodes a record from the `size` bytes at `in`. On success, populates
+// `command`, sets `parameters` to the first parameter within `in` (or NULL),
+// and returns the total size of the record. Returns 0 if `in` does not hold a
+// complete record, in which case `state` is unmodified.
+uint32_t CCDecode(CCState *state, const uint8_t *in, uint32_t size,
+                  CCCommand *command, const uint8_t **parameters);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // NXDK_NTRC_DYNDXT_COMPACT_COMMAND_H_
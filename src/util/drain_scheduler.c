@@ -0,0 +1,204 @@
+#include "drain_scheduler.h"
+
+#include <string.h>
+
+// Upper bound on the number of times each lane is visited while selecting a
+// lane, to guarantee termination if a lane's next entry is pathologically
+// large.
+#define MAX_VISITS_PER_LANE 1024
+
+// Copies `size` bytes starting at `offset` within `spans` into `out`.
+static bool CopyFromSpans(const CBSpans *spans, uint32_t offset, void *out,
+                          uint32_t size) {
+  if (offset + size > spans->first_size + spans->second_size) {
+    return false;
+  }
+
+  uint8_t *out_ptr = (uint8_t *)out;
+  if (offset < spans->first_size) {
+    uint32_t bytes = spans->first_size - offset;
+    bytes = bytes < size ? bytes : size;
+    memcpy(out_ptr, spans->first + offset, bytes);
+    out_ptr += bytes;
+    size -= bytes;
+    offset = 0;
+  } else {
+    offset -= spans->first_size;
+  }
+  memcpy(out_ptr, spans->second + offset, size);
+  return true;
+}
+
+static void TrimSpans(CBSpans *spans, uint32_t size) {
+  if (size <= spans->first_size) {
+    spans->first_size = size;
+    spans->second_size = 0;
+  } else {
+    spans->second_size = size - spans->first_size;
+  }
+}
+
+static uint32_t Peek(const DrainScheduler *scheduler, uint32_t lane,
+                     CBSpans *spans, uint32_t size, uint32_t *read_offset) {
+  return scheduler->config.peek(lane, spans, size, read_offset,
+                                scheduler->config.user_data);
+}
+
+// Retrieves the total size of the entry starting at `offset` within `spans`.
+static bool GetEntrySize(const DrainScheduler *scheduler, const CBSpans *spans,
+                         uint32_t offset, uint32_t *entry_size) {
+  uint8_t header[DS_MAX_HEADER_SIZE];
+  if (!CopyFromSpans(spans, offset, header, scheduler->config.header_size)) {
+    return false;
+  }
+  *entry_size = scheduler->config.entry_size(header);
+  return *entry_size >= scheduler->config.header_size;
+}
+
+static bool PeekNextEntrySize(const DrainScheduler *scheduler, uint32_t lane,
+                              uint32_t *entry_size) {
+  CBSpans spans;
+  uint32_t read_offset;
+  if (Peek(scheduler, lane, &spans, scheduler->config.header_size,
+           &read_offset) < scheduler->config.header_size) {
+    return false;
+  }
+  return GetEntrySize(scheduler, &spans, 0, entry_size);
+}
+
+static void AdvanceLane(DrainScheduler *scheduler) {
+  scheduler->current_lane =
+      (scheduler->current_lane + 1) % scheduler->config.lane_count;
+  scheduler->current_lane_credited = false;
+}
+
+// Selects the lane from which the next entries should be sent, retrieving the
+// size of the entry at its front.
+static bool SelectLane(DrainScheduler *scheduler, uint32_t *entry_size) {
+  uint32_t lane_count = scheduler->config.lane_count;
+  uint32_t idle_lanes = 0;
+  for (uint32_t i = 0;
+       i < lane_count * MAX_VISITS_PER_LANE && idle_lanes < lane_count; ++i) {
+    uint32_t lane = scheduler->current_lane;
+    if (!PeekNextEntrySize(scheduler, lane, entry_size)) {
+      scheduler->deficits[lane] = 0;
+      ++idle_lanes;
+      AdvanceLane(scheduler);
+      continue;
+    }
+    idle_lanes = 0;
+
+    if (!scheduler->current_lane_credited) {
+      scheduler->deficits[lane] +=
+          scheduler->config.weights[lane] * scheduler->config.quantum;
+      scheduler->current_lane_credited = true;
+    }
+    if (scheduler->deficits[lane] >= *entry_size) {
+      return true;
+    }
+    AdvanceLane(scheduler);
+  }
+  return false;
+}
+
+// Plans the rest of the entries started by a previous response, clearing
+// `in_progress` if they have been consumed or can no longer be continued.
+static uint32_t PlanContinuation(DrainScheduler *scheduler, uint32_t max_size,
+                                 CBSpans *spans) {
+  uint32_t read_offset;
+  uint32_t valid_bytes = Peek(scheduler, scheduler->current_lane, spans,
+                              max_size, &read_offset);
+
+  // A read offset outside of the started entries means that they have been
+  // fully consumed, or that the lane has been reset.
+  uint32_t started = scheduler->entries_end - scheduler->entries_start;
+  uint32_t consumed = read_offset - scheduler->entries_start;
+  if (consumed >= started) {
+    scheduler->in_progress = false;
+    return 0;
+  }
+
+  if (!valid_bytes) {
+    // Only an entry that is larger than its lane is written piecewise, so any
+    // other entry can only go missing if the lane was emptied (e.g., because
+    // the tracer was detached).
+    if (!scheduler->streamed || consumed >= scheduler->first_entry_size) {
+      scheduler->in_progress = false;
+    }
+    return 0;
+  }
+
+  uint32_t remaining = started - consumed;
+  return valid_bytes < remaining ? valid_bytes : remaining;
+}
+
+void DSInit(DrainScheduler *scheduler, const DrainSchedulerConfig *config) {
+  memset(scheduler, 0, sizeof(*scheduler));
+  scheduler->config = *config;
+  if (scheduler->config.lane_count > DS_MAX_LANES) {
+    scheduler->config.lane_count = DS_MAX_LANES;
+  }
+  if (scheduler->config.header_size > DS_MAX_HEADER_SIZE) {
+    scheduler->config.header_size = DS_MAX_HEADER_SIZE;
+  }
+}
+
+uint32_t DSPlan(DrainScheduler *scheduler, uint32_t max_size, uint32_t *lane,
+                CBSpans *spans) {
+  if (!scheduler->config.lane_count || !max_size) {
+    return 0;
+  }
+
+  uint32_t ret = 0;
+  if (scheduler->in_progress) {
+    ret = PlanContinuation(scheduler, max_size, spans);
+    if (scheduler->in_progress) {
+      *lane = scheduler->current_lane;
+      TrimSpans(spans, ret);
+      return ret;
+    }
+  }
+
+  uint32_t first_entry_size;
+  if (!SelectLane(scheduler, &first_entry_size)) {
+    return 0;
+  }
+
+  uint32_t current_lane = scheduler->current_lane;
+  uint32_t read_offset;
+  uint32_t valid_bytes =
+      Peek(scheduler, current_lane, spans, max_size, &read_offset);
+  if (!valid_bytes) {
+    return 0;
+  }
+
+  // The first entry was validated by SelectLane and is always started, even if
+  // it does not fit in a single response.
+  scheduler->deficits[current_lane] -= first_entry_size;
+  uint32_t end = first_entry_size;
+  if (first_entry_size > valid_bytes) {
+    ret = valid_bytes;
+  } else {
+    // Subsequent entries are only included if they are complete.
+    uint32_t entry_size;
+    while (end < valid_bytes &&
+           GetEntrySize(scheduler, spans, end, &entry_size) &&
+           scheduler->deficits[current_lane] >= entry_size &&
+           entry_size <= valid_bytes - end) {
+      scheduler->deficits[current_lane] -= entry_size;
+      end += entry_size;
+    }
+    ret = end;
+  }
+
+  scheduler->in_progress = true;
+  scheduler->entries_start = read_offset;
+  scheduler->entries_end = read_offset + end;
+  scheduler->first_entry_size = first_entry_size;
+  scheduler->streamed =
+      first_entry_size > scheduler->config.capacities[current_lane];
+
+  *lane = current_lane;
+  TrimSpans(spans, ret);
+  return ret;
+}
@@ -0,0 +1,94 @@
+#ifndef NXDK_NTRC_DYNDXT_DRAIN_SCHEDULER_H_
+#define NXDK_NTRC_DYNDXT_DRAIN_SCHEDULER_H_
+
+// Decides which of several lanes of length-prefixed entries each response
+// should be drained from, using deficit round robin: a lane that has data is
+// credited `quantum * weight` bytes each time it is visited, and entries are
+// sent from it while its credit lasts.
+//
+// Entries from different lanes are only interleaved at entry boundaries, so
+// once a response has started an entry, its lane is drained exclusively until
+// the entry has been consumed. Progress is tracked via the read offset of the
+// lane rather than the bytes that were planned, so a response that is only
+// partially sent is resumed from wherever its lane was actually consumed.
+//
+// A DrainScheduler is not thread safe; callers must provide synchronization.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "circular_buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The maximum number of lanes that may be drained by a single scheduler.
+#define DS_MAX_LANES 8
+
+// The maximum size of the header at the front of each entry.
+#define DS_MAX_HEADER_SIZE 32
+
+// Populates `spans` with up to `size` readable bytes from the front of `lane`
+// without consuming them, returning the number of bytes described.
+// `read_offset` receives the total number of bytes ever consumed from the lane
+// (modulo 2^32).
+typedef uint32_t (*DSPeekProc)(uint32_t lane, CBSpans *spans, uint32_t size,
+                               uint32_t *read_offset, void *user_data);
+
+// Returns the total size of the entry with the given header, including the
+// header itself.
+typedef uint32_t (*DSEntrySizeProc)(const void *header);
+
+typedef struct DrainSchedulerConfig {
+  uint32_t lane_count;
+  // The number of bytes credited to a lane per unit of weight.
+  uint32_t quantum;
+  uint32_t weights[DS_MAX_LANES];
+  // The capacity of each lane. Entries that fit are assumed to be published
+  // atomically, while larger ones may be streamed through the lane piecewise.
+  uint32_t capacities[DS_MAX_LANES];
+
+  uint32_t header_size;
+  DSEntrySizeProc entry_size;
+  DSPeekProc peek;
+  void *user_data;
+} DrainSchedulerConfig;
+
+// Holds the state of a scheduler. Members should be treated as private.
+typedef struct DrainScheduler {
+  DrainSchedulerConfig config;
+  uint32_t deficits[DS_MAX_LANES];
+  uint32_t current_lane;
+  bool current_lane_credited;
+
+  // Whether entries from `current_lane` have been started and not yet
+  // consumed.
+  bool in_progress;
+  // The read offsets of the current lane at the start of the first started
+  // entry and the end of the last one.
+  uint32_t entries_start;
+  uint32_t entries_end;
+  uint32_t first_entry_size;
+  // Whether the first started entry may be streamed through its lane.
+  bool streamed;
+} DrainScheduler;
+
+// Initializes the given scheduler, forgetting any started entries. Must be
+// called again whenever the lanes are reinitialized or reset.
+void DSInit(DrainScheduler *scheduler, const DrainSchedulerConfig *config);
+
+// Plans the next response of up to `max_size` bytes, returning the number of
+// bytes at the front of `*lane` that should be sent and populating `spans`
+// with exactly those bytes. Returns 0 if nothing should be sent.
+//
+// The planned bytes are expected to be consumed from the lane as they are
+// sent. Any that are not are planned again by the next call.
+uint32_t DSPlan(DrainScheduler *scheduler, uint32_t max_size, uint32_t *lane,
+                CBSpans *spans);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // NXDK_NTRC_DYNDXT_DRAIN_SCHEDULER_H_
@@ -0,0 +1,91 @@
+#include "log_filter.h"
+
+#include <string.h>
+
+#include "method_selector.h"
+
+void LFReset(LogFilter *filter) {
+  memset(filter->class_tables, 0, sizeof(filter->class_tables));
+  filter->table_count = 1;
+  memset(filter->tables[0], 0xFF, sizeof(filter->tables[0]));
+}
+
+static void SetMethods(uint8_t *table, uint32_t first, uint32_t last,
+                       bool allow) {
+  for (uint32_t i = first / 4; i <= last / 4; ++i) {
+    uint8_t mask = (uint8_t)(1 << (i & 7));
+    if (allow) {
+      table[i >> 3] |= mask;
+    } else {
+      table[i >> 3] &= (uint8_t)~mask;
+    }
+  }
+}
+
+static bool ApplyRule(LogFilter *filter, const char **cursor) {
+  const char *c = *cursor;
+  bool allow;
+  if (*c == '+') {
+    allow = true;
+  } else if (*c == '-') {
+    allow = false;
+  } else {
+    return false;
+  }
+  ++c;
+
+  MethodSelector selector;
+  if (!MSParse(&c, &selector)) {
+    return false;
+  }
+
+  if (*c && *c != ',') {
+    return false;
+  }
+  *cursor = c;
+
+  uint32_t first = selector.first_method;
+  uint32_t last = selector.last_method;
+  if (selector.all_classes) {
+    for (uint32_t i = 0; i < filter->table_count; ++i) {
+      SetMethods(filter->tables[i], first, last, allow);
+    }
+    return true;
+  }
+
+  uint8_t table = filter->class_tables[selector.graphics_class];
+  if (!table) {
+    if (filter->table_count > LF_MAX_CLASS_TABLES) {
+      return false;
+    }
+    // The class starts out with the rules applied to every class so far.
+    table = (uint8_t)filter->table_count++;
+    memcpy(filter->tables[table], filter->tables[0], sizeof(filter->tables[0]));
+    filter->class_tables[selector.graphics_class] = table;
+  }
+  SetMethods(filter->tables[table], first, last, allow);
+  return true;
+}
+
+bool LFApplyRules(LogFilter *filter, const char *rules) {
+  const char *cursor = rules;
+  while (*cursor) {
+    if (!ApplyRule(filter, &cursor)) {
+      return false;
+    }
+    if (*cursor == ',') {
+      ++cursor;
+    }
+  }
+  return true;
+}
+
+bool LFAllows(const LogFilter *filter, uint32_t graphics_class,
+              uint32_t method) {
+  uint32_t table = 0;
+  if (graphics_class < LF_NUM_CLASSES) {
+    table = filter->class_tables[graphics_class];
+  }
+  uint32_t index = (method >> 2) & (LF_NUM_METHODS - 1);
+  return (filter->tables[table][index >> 3] >> (index & 7)) & 1;
+}
@@ -0,0 +1,59 @@
+#ifndef NXDK_NTRC_DYNDXT_LOG_FILTER_H_
+#define NXDK_NTRC_DYNDXT_LOG_FILTER_H_
+
+// Decides whether a PGRAPH method should be logged based on its graphics class
+// and method ID.
+//
+// Filters are described by a comma separated list of rules that are applied in
+// order, each later rule overriding earlier ones for the methods it covers:
+//   +<selector>  Logs the given methods.
+//   -<selector>  Suppresses the given methods.
+// where <selector> names a set of methods as described in
+// util/method_selector.h. For example, "-*,+97:1B00-1BFC" only logs texture
+// state of the 3D class.
+//
+// A LogFilter is not thread safe; callers must provide synchronization.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The number of distinct method IDs (methods are 4-byte aligned offsets below
+// 0x2000).
+#define LF_NUM_METHODS (0x2000 / 4)
+// The number of graphics classes that may be filtered individually.
+#define LF_NUM_CLASSES 0x100
+// The maximum number of classes that may have rules of their own. All other
+// classes share the rules applied to `*`.
+#define LF_MAX_CLASS_TABLES 7
+
+// Holds the state of a filter. Members should be treated as private.
+typedef struct LogFilter {
+  // Index into `tables` for each class. Classes without rules of their own use
+  // table 0.
+  uint8_t class_tables[LF_NUM_CLASSES];
+  uint32_t table_count;
+  // Bitmaps with a set bit for each method that should be logged.
+  uint8_t tables[LF_MAX_CLASS_TABLES + 1][LF_NUM_METHODS / 8];
+} LogFilter;
+
+// Resets the given filter to log every method.
+void LFReset(LogFilter *filter);
+
+// Applies the given rules to the filter. Returns false if the rules are
+// malformed or name too many classes, in which case the filter is left in an
+// undefined state.
+bool LFApplyRules(LogFilter *filter, const char *rules);
+
+// Returns true if the given method should be logged.
+bool LFAllows(const LogFilter *filter, uint32_t graphics_class,
+              uint32_t method);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // NXDK_NTRC_DYNDXT_LOG_FILTER_H_
@@ -0,0 +1,133 @@
+#include "memory_budget.h"
+
+#include <string.h>
+
+#define LOAD(value) __atomic_load_n(&(value), __ATOMIC_ACQUIRE)
+
+// Prefixes every block so that it may be uncharged when freed. The header is
+// padded to preserve the alignment guaranteed by the underlying allocator.
+typedef struct MBBlockHeader {
+  uint32_t size;
+  uint32_t pool;
+  uint32_t reserved[2];
+} MBBlockHeader;
+
+static void UpdateHighWater(uint32_t *high_water, uint32_t value) {
+  uint32_t current = LOAD(*high_water);
+  while (value > current &&
+         !__atomic_compare_exchange_n(high_water, &current, value, false,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+  }
+}
+
+static uint32_t FindPool(MemoryBudget *budget, uint32_t tag) {
+  for (uint32_t i = 0; i < MB_MAX_POOLS; ++i) {
+    uint32_t current = LOAD(budget->pools[i].tag);
+    if (current == tag) {
+      return i;
+    }
+    if (!current) {
+      if (__atomic_compare_exchange_n(&budget->pools[i].tag, &current, tag,
+                                      false, __ATOMIC_ACQ_REL,
+                                      __ATOMIC_ACQUIRE) ||
+          current == tag) {
+        return i;
+      }
+    }
+  }
+  return MB_MAX_POOLS - 1;
+}
+
+// Attempts to add `size` bytes to the total without exceeding the ceiling.
+static bool Charge(MemoryBudget *budget, uint32_t size) {
+  uint32_t current = LOAD(budget->in_use);
+  uint32_t updated;
+  do {
+    uint32_t ceiling = LOAD(budget->ceiling);
+    if (ceiling && (current > ceiling || size > ceiling - current)) {
+      return false;
+    }
+    updated = current + size;
+    if (updated < current) {
+      return false;
+    }
+  } while (!__atomic_compare_exchange_n(&budget->in_use, &current, updated,
+                                        false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE));
+
+  UpdateHighWater(&budget->high_water, updated);
+  return true;
+}
+
+void MBInit(MemoryBudget *budget, uint32_t ceiling, MBAllocProc alloc_proc,
+            MBFreeProc free_proc) {
+  memset(budget, 0, sizeof(*budget));
+  budget->ceiling = ceiling;
+  budget->alloc_proc = alloc_proc;
+  budget->free_proc = free_proc;
+}
+
+void MBSetCeiling(MemoryBudget *budget, uint32_t ceiling) {
+  __atomic_store_n(&budget->ceiling, ceiling, __ATOMIC_RELEASE);
+}
+
+void *MBAlloc(MemoryBudget *budget, uint32_t size, uint32_t tag) {
+  uint32_t pool_index = FindPool(budget, tag);
+  MemoryBudgetPoolStats *pool = &budget->pools[pool_index];
+
+  if (size > UINT32_MAX - sizeof(MBBlockHeader) || !Charge(budget, size)) {
+    __atomic_fetch_add(&pool->over_budget, 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+
+  MBBlockHeader *header =
+      (MBBlockHeader *)budget->alloc_proc(sizeof(*header) + size, tag);
+  if (!header) {
+    __atomic_fetch_sub(&budget->in_use, size, __ATOMIC_ACQ_REL);
+    __atomic_fetch_add(&pool->failures, 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+  header->size = size;
+  header->pool = pool_index;
+
+  uint32_t pool_in_use =
+      __atomic_add_fetch(&pool->in_use, size, __ATOMIC_ACQ_REL);
+  UpdateHighWater(&pool->high_water, pool_in_use);
+
+  return header + 1;
+}
+
+void MBFree(MemoryBudget *budget, void *block) {
+  if (!block) {
+    return;
+  }
+
+  MBBlockHeader *header = (MBBlockHeader *)block - 1;
+  __atomic_fetch_sub(&budget->pools[header->pool].in_use, header->size,
+                     __ATOMIC_ACQ_REL);
+  __atomic_fetch_sub(&budget->in_use, header->size, __ATOMIC_ACQ_REL);
+  budget->free_proc(header);
+}
+
+bool MBHasHeadroom(const MemoryBudget *budget, uint32_t size) {
+  uint32_t ceiling = LOAD(budget->ceiling);
+  if (!ceiling) {
+    return true;
+  }
+  uint32_t in_use = LOAD(budget->in_use);
+  return in_use <= ceiling && size <= ceiling - in_use;
+}
+
+void MBGetStats(const MemoryBudget *budget, MemoryBudgetStats *stats) {
+  stats->ceiling = LOAD(budget->ceiling);
+  stats->in_use = LOAD(budget->in_use);
+  stats->high_water = LOAD(budget->high_water);
+  for (uint32_t i = 0; i < MB_MAX_POOLS; ++i) {
+    const MemoryBudgetPoolStats *pool = &budget->pools[i];
+    stats->pools[i].tag = LOAD(pool->tag);
+    stats->pools[i].in_use = LOAD(pool->in_use);
+    stats->pools[i].high_water = LOAD(pool->high_water);
+    stats->pools[i].over_budget = LOAD(pool->over_budget);
+    stats->pools[i].failures = LOAD(pool->failures);
+  }
+}
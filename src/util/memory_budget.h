@@ -0,0 +1,98 @@
+#ifndef NXDK_NTRC_DYNDXT_MEMORY_BUDGET_H_
+#define NXDK_NTRC_DYNDXT_MEMORY_BUDGET_H_
+
+// Tracks and bounds the memory allocated through a shared allocator.
+//
+// Every allocation is charged to a pool identified by a 32-bit tag (e.g., the
+// tag passed to DmAllocatePoolWithTag). Allocations that would push the total
+// across the configured ceiling are refused without invoking the underlying
+// allocator, allowing callers to skip optional work instead of exhausting
+// memory that is shared with the title.
+//
+// All methods may be called concurrently from any thread.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The maximum number of distinct pool tags that are tracked individually.
+// Allocations with additional tags are accounted for in the last pool.
+#define MB_MAX_POOLS 8
+
+typedef void *(*MBAllocProc)(size_t size, uint32_t tag);
+typedef void (*MBFreeProc)(void *block);
+
+typedef struct MemoryBudgetPoolStats {
+  // The tag identifying this pool, or 0 if the slot is unused.
+  uint32_t tag;
+  // The number of bytes currently allocated.
+  uint32_t in_use;
+  // The largest value `in_use` has ever reached.
+  uint32_t high_water;
+  // The number of allocations that were refused because they would have
+  // exceeded the ceiling.
+  uint32_t over_budget;
+  // The number of allocations that were refused by the underlying allocator.
+  uint32_t failures;
+} MemoryBudgetPoolStats;
+
+typedef struct MemoryBudgetStats {
+  // The configured ceiling, or 0 if allocations are unbounded.
+  uint32_t ceiling;
+  // The number of bytes currently allocated across all pools.
+  uint32_t in_use;
+  // The largest value `in_use` has ever reached.
+  uint32_t high_water;
+  MemoryBudgetPoolStats pools[MB_MAX_POOLS];
+} MemoryBudgetStats;
+
+// Holds the state of a budget. Members should be treated as private; a budget
+// may be statically initialized via MB_INITIALIZER.
+typedef struct MemoryBudget {
+  MBAllocProc alloc_proc;
+  MBFreeProc free_proc;
+  uint32_t ceiling;
+  uint32_t in_use;
+  uint32_t high_water;
+  MemoryBudgetPoolStats pools[MB_MAX_POOLS];
+} MemoryBudget;
+
+#define MB_INITIALIZER(alloc, free)                                        \
+  {                                                                        \
+    .alloc_proc = (alloc), .free_proc = (free), .ceiling = 0, .in_use = 0, \
+        .high_water = 0, .pools = {}                                       \
+  }
+
+// Initializes the given budget with the given ceiling, which may be 0 to
+// leave allocations unbounded.
+void MBInit(MemoryBudget *budget, uint32_t ceiling, MBAllocProc alloc_proc,
+            MBFreeProc free_proc);
+
+// Changes the ceiling of the given budget. Existing allocations are not
+// affected, even if they exceed the new ceiling.
+void MBSetCeiling(MemoryBudget *budget, uint32_t ceiling);
+
+// Allocates `size` bytes charged to the pool with the given (nonzero) tag.
+// Returns NULL if the allocation would exceed the ceiling or if the underlying
+// allocator fails.
+void *MBAlloc(MemoryBudget *budget, uint32_t size, uint32_t tag);
+
+// Frees a block previously returned by MBAlloc. NULL is ignored.
+void MBFree(MemoryBudget *budget, void *block);
+
+// Returns true if `size` additional bytes would currently fit within the
+// ceiling. The result is only advisory if other threads are allocating.
+bool MBHasHeadroom(const MemoryBudget *budget, uint32_t size);
+
+// Retrieves a snapshot of the statistics of the given budget.
+void MBGetStats(const MemoryBudget *budget, MemoryBudgetStats *stats);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // NXDK_NTRC_DYNDXT_MEMORY_BUDGET_H_
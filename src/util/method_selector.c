@@ -0,0 +1,58 @@
+#include "method_selector.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+
+bool MSParseHex(const char **cursor, uint32_t max, uint32_t *out) {
+  // strtoul would otherwise accept leading whitespace and signs.
+  if (!isxdigit((unsigned char)**cursor)) {
+    return false;
+  }
+  char *end;
+  unsigned long value = strtoul(*cursor, &end, 16);
+  if (value > max) {
+    return false;
+  }
+  *cursor = end;
+  *out = (uint32_t)value;
+  return true;
+}
+
+bool MSParse(const char **cursor, MethodSelector *selector) {
+  const char *c = *cursor;
+  selector->all_classes = false;
+  selector->graphics_class = 0;
+  if (*c == '*') {
+    selector->all_classes = true;
+    ++c;
+  } else if (!MSParseHex(&c, MS_MAX_CLASS, &selector->graphics_class)) {
+    return false;
+  }
+
+  selector->first_method = 0;
+  selector->last_method = MS_MAX_METHOD;
+  if (*c == ':') {
+    ++c;
+    if (!MSParseHex(&c, MS_MAX_METHOD, &selector->first_method)) {
+      return false;
+    }
+    selector->last_method = selector->first_method;
+    if (*c == '-') {
+      ++c;
+      if (!MSParseHex(&c, MS_MAX_METHOD, &selector->last_method) ||
+          selector->last_method < selector->first_method) {
+        return false;
+      }
+    }
+  }
+
+  *cursor = c;
+  return true;
+}
+
+bool MSMatches(const MethodSelector *selector, uint32_t graphics_class,
+               uint32_t method) {
+  return (selector->all_classes ||
+          selector->graphics_class == graphics_class) &&
+         method >= selector->first_method && method <= selector->last_method;
+}
@@ -0,0 +1,48 @@
+#ifndef NXDK_NTRC_DYNDXT_METHOD_SELECTOR_H_
+#define NXDK_NTRC_DYNDXT_METHOD_SELECTOR_H_
+
+// Parses the selectors used by rule lists (e.g., util/log_filter.h and
+// util/parameter_policy.h) to name a set of PGRAPH methods:
+//   <class>[:<method>[-<last_method>]]
+// All values are hexadecimal, without a sign or leading whitespace. <class> may
+// be `*` to match every class, and omitting the methods matches every method of
+// the class.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The largest graphics class that may be named by a selector.
+#define MS_MAX_CLASS 0xFF
+// The largest method ID (methods are 4-byte aligned offsets below 0x2000).
+#define MS_MAX_METHOD 0x1FFC
+
+typedef struct MethodSelector {
+  // Whether the selector matches every class, in which case `graphics_class`
+  // is unused.
+  bool all_classes;
+  uint32_t graphics_class;
+  uint32_t first_method;
+  uint32_t last_method;
+} MethodSelector;
+
+// Parses a hexadecimal value no greater than `max` at `*cursor`, advancing
+// `cursor` past it. Returns false if there is no such value.
+bool MSParseHex(const char **cursor, uint32_t max, uint32_t *out);
+
+// Parses a selector at `*cursor`, advancing `cursor` past it. Returns false if
+// the selector is malformed, in which case `cursor` is left unchanged.
+bool MSParse(const char **cursor, MethodSelector *selector);
+
+// Returns true if the selector matches the given method.
+bool MSMatches(const MethodSelector *selector, uint32_t graphics_class,
+               uint32_t method);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // NXDK_NTRC_DYNDXT_METHOD_SELECTOR_H_
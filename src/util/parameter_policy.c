@@ -0,0 +1,67 @@
+#include "parameter_policy.h"
+
+#include <string.h>
+
+// PGRAPH methods take at most 2047 parameters.
+#define MAX_KEEP_COUNT 0x7FF
+
+void PPReset(ParameterPolicy *policy) { policy->rule_count = 0; }
+
+static bool ApplyRule(ParameterPolicy *policy, const char **cursor) {
+  if (policy->rule_count >= PP_MAX_RULES) {
+    return false;
+  }
+  ParameterPolicyRule *rule = &policy->rules[policy->rule_count];
+
+  const char *c = *cursor;
+  if (!MSParse(&c, &rule->selector)) {
+    return false;
+  }
+
+  if (*c++ != '=') {
+    return false;
+  }
+  if (!strncmp(c, "all", 3)) {
+    rule->keep_count = PP_KEEP_ALL;
+    c += 3;
+  } else if (!strncmp(c, "hash", 4)) {
+    rule->keep_count = 0;
+    c += 4;
+  } else if (!MSParseHex(&c, MAX_KEEP_COUNT, &rule->keep_count)) {
+    return false;
+  }
+
+  if (*c && *c != ',') {
+    return false;
+  }
+  *cursor = c;
+  ++policy->rule_count;
+  return true;
+}
+
+bool PPApplyRules(ParameterPolicy *policy, const char *rules) {
+  const char *cursor = rules;
+  while (*cursor) {
+    if (!ApplyRule(policy, &cursor)) {
+      return false;
+    }
+    if (*cursor == ',') {
+      ++cursor;
+    }
+  }
+  return true;
+}
+
+bool PPIsEmpty(const ParameterPolicy *policy) { return !policy->rule_count; }
+
+uint32_t PPGetKeepCount(const ParameterPolicy *policy, uint32_t graphics_class,
+                        uint32_t method) {
+  // Later rules take precedence.
+  for (uint32_t i = policy->rule_count; i > 0; --i) {
+    const ParameterPolicyRule *rule = &policy->rules[i - 1];
+    if (MSMatches(&rule->selector, graphics_class, method)) {
+      return rule->keep_count;
+    }
+  }
+  return PP_KEEP_ALL;
+}
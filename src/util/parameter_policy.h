@@ -0,0 +1,64 @@
+#ifndef NXDK_NTRC_DYNDXT_PARAMETER_POLICY_H_
+#define NXDK_NTRC_DYNDXT_PARAMETER_POLICY_H_
+
+// Decides how many of the parameters of a PGRAPH method should be logged based
+// on its graphics class and method ID.
+//
+// Policies are described by a comma separated list of rules that are applied
+// in order, each later rule overriding earlier ones for the methods it covers:
+//   <selector>=all   Keeps every parameter.
+//   <selector>=hash  Keeps none of the parameters.
+//   <selector>=<n>   Keeps the first <n> (hexadecimal) parameters.
+// where <selector> names a set of methods as described in
+// util/method_selector.h. For example, "97:1818=10,97:1800-1808=hash" keeps the
+// first 16 dwords of INLINE_ARRAY and none of the ARRAY_ELEMENT methods.
+// Methods without a rule keep every parameter.
+//
+// A ParameterPolicy is not thread safe; callers must provide synchronization.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "method_selector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The maximum number of rules in a policy.
+#define PP_MAX_RULES 16
+// Value returned by PPGetKeepCount for methods whose parameters are all kept.
+#define PP_KEEP_ALL 0xFFFFFFFF
+
+typedef struct ParameterPolicyRule {
+  MethodSelector selector;
+  uint32_t keep_count;
+} ParameterPolicyRule;
+
+// Holds the state of a policy. Members should be treated as private.
+typedef struct ParameterPolicy {
+  uint32_t rule_count;
+  ParameterPolicyRule rules[PP_MAX_RULES];
+} ParameterPolicy;
+
+// Resets the given policy to keep every parameter of every method.
+void PPReset(ParameterPolicy *policy);
+
+// Appends the given rules to the policy. Returns false if the rules are
+// malformed or too numerous, in which case the policy is left in an undefined
+// state.
+bool PPApplyRules(ParameterPolicy *policy, const char *rules);
+
+// Returns true if the policy keeps every parameter of every method.
+bool PPIsEmpty(const ParameterPolicy *policy);
+
+// Returns the maximum number of parameters of the given method that should be
+// kept, or PP_KEEP_ALL.
+uint32_t PPGetKeepCount(const ParameterPolicy *policy, uint32_t graphics_class,
+                        uint32_t method);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // NXDK_NTRC_DYNDXT_PARAMETER_POLICY_H_
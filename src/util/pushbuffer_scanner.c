@@ -0,0 +1,68 @@
+#include "pushbuffer_scanner.h"
+
+#include <stdbool.h>
+
+// Bits that must be clear in an increasing method header; a non-increasing
+// header additionally sets bit 30.
+#define METHOD_HEADER_MASK 0xE0030003
+#define NON_INCREASING_METHOD_HEADER 0x40000000
+
+static bool Matches(const PBSQuery *query, uint32_t subchannel,
+                    uint32_t method) {
+  const PBSMethod *candidate = query->methods;
+  for (uint32_t i = 0; i < query->method_count; ++i, ++candidate) {
+    if (candidate->method == method &&
+        (candidate->subchannel == PBS_ANY_SUBCHANNEL ||
+         candidate->subchannel == subchannel)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void PBSScan(const uint32_t *words, uint32_t size, const PBSQuery *query,
+             PBSResult *result) {
+  uint32_t word_count = size / 4;
+  uint32_t index = 0;
+  uint32_t headers_skipped = 0;
+  PBSStopReason reason = PBSSR_END;
+
+  while (index < word_count) {
+    if ((query->max_headers && headers_skipped >= query->max_headers) ||
+        (query->max_bytes && index * 4 >= query->max_bytes)) {
+      reason = PBSSR_LIMIT;
+      break;
+    }
+
+    uint32_t header = words[index];
+    uint32_t masked = header & METHOD_HEADER_MASK;
+    if (masked && masked != NON_INCREASING_METHOD_HEADER) {
+      // Old jumps set bit 29, jumps and calls set the low bits, and returns
+      // set bit 17.
+      reason = ((header & 0xE0000003) == 0x20000000 || (header & 3) == 1 ||
+                (header & 3) == 2 || header == 0x00020000)
+                   ? PBSSR_CONTROL_FLOW
+                   : PBSSR_UNKNOWN;
+      break;
+    }
+
+    uint32_t method = header & 0x1FFF;
+    uint32_t subchannel = (header >> 13) & 7;
+    if (Matches(query, subchannel, method)) {
+      reason = PBSSR_MATCH;
+      break;
+    }
+
+    uint32_t parameter_count = (header >> 18) & 0x7FF;
+    if (parameter_count >= word_count - index) {
+      reason = PBSSR_INCOMPLETE;
+      break;
+    }
+    index += 1 + parameter_count;
+    ++headers_skipped;
+  }
+
+  result->offset = index * 4;
+  result->headers_skipped = headers_skipped;
+  result->reason = reason;
+}
@@ -0,0 +1,74 @@
+#ifndef NXDK_NTRC_DYNDXT_PUSHBUFFER_SCANNER_H_
+#define NXDK_NTRC_DYNDXT_PUSHBUFFER_SCANNER_H_
+
+// Locates method headers of interest in a window of pushbuffer memory without
+// fully decoding the commands in between.
+//
+// The scan walks from header to header using the parameter count of each
+// method, so parameter words are never mistaken for headers. It stops at
+// anything that it cannot skip over safely (jumps, calls, returns, and
+// unrecognized words), leaving those for a full parser to handle.
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Matches a method on any subchannel.
+#define PBS_ANY_SUBCHANNEL 0xFFFFFFFF
+
+// Describes a method of interest.
+typedef struct PBSMethod {
+  // The subchannel of the method, or PBS_ANY_SUBCHANNEL.
+  uint32_t subchannel;
+  // The method ID (e.g., NV097_FLIP_STALL).
+  uint32_t method;
+} PBSMethod;
+
+typedef struct PBSQuery {
+  // The methods to search for. Only the first method of each header is
+  // compared.
+  const PBSMethod *methods;
+  uint32_t method_count;
+
+  // If nonzero, the scan stops before skipping more than this many headers.
+  uint32_t max_headers;
+  // If nonzero, the scan stops at the first header at or beyond this offset.
+  uint32_t max_bytes;
+} PBSQuery;
+
+typedef enum PBSStopReason {
+  // The header at `offset` matches one of the query methods.
+  PBSSR_MATCH,
+  // The end of the window was reached.
+  PBSSR_END,
+  // The `max_headers` or `max_bytes` limit was reached.
+  PBSSR_LIMIT,
+  // The word at `offset` is a jump, call, or return.
+  PBSSR_CONTROL_FLOW,
+  // The parameters of the method at `offset` extend past the window.
+  PBSSR_INCOMPLETE,
+  // The word at `offset` is not a recognized command.
+  PBSSR_UNKNOWN,
+} PBSStopReason;
+
+typedef struct PBSResult {
+  // The offset in bytes of the word at which the scan stopped. Every command
+  // before this offset was skipped.
+  uint32_t offset;
+  // The number of method headers that were skipped.
+  uint32_t headers_skipped;
+  PBSStopReason reason;
+} PBSResult;
+
+// Scans `size` bytes of pushbuffer starting at `words` for the methods
+// described by `query`.
+void PBSScan(const uint32_t *words, uint32_t size, const PBSQuery *query,
+             PBSResult *result);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // NXDK_NTRC_DYNDXT_PUSHBUFFER_SCANNER_H_
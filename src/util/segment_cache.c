@@ -0,0 +1,88 @@
+#include "segment_cache.h"
+
+#include <string.h>
+
+#define FNV_PRIME 0x100000001B3ULL
+
+// The cache is considered full once this fraction of its slots are used, to
+// keep probe sequences short.
+#define MAX_LOAD_NUMERATOR 3
+#define MAX_LOAD_DENOMINATOR 4
+
+uint64_t SCHash(uint64_t hash, const void *data, uint32_t size) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  for (uint32_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+void SCInit(SegmentCache *cache, SegmentCacheEntry *storage,
+            uint32_t capacity) {
+  uint32_t pow2 = 0;
+  if (capacity) {
+    pow2 = 1;
+    while (pow2 <= capacity / 2) {
+      pow2 <<= 1;
+    }
+  }
+  cache->entries = storage;
+  cache->capacity = pow2;
+  SCReset(cache);
+}
+
+void SCReset(SegmentCache *cache) {
+  if (cache->entries) {
+    memset(cache->entries, 0, cache->capacity * sizeof(*cache->entries));
+  }
+  cache->count = 0;
+  cache->next_id = 1;
+}
+
+static uint32_t Slot(const SegmentCache *cache, uint32_t address,
+                     uint64_t hash) {
+  return ((uint32_t)hash ^ (address >> 2)) & (cache->capacity - 1);
+}
+
+uint32_t SCFind(const SegmentCache *cache, uint32_t address, uint32_t size,
+                uint64_t hash) {
+  if (!cache->capacity) {
+    return 0;
+  }
+
+  uint32_t slot = Slot(cache, address, hash);
+  for (uint32_t i = 0; i < cache->capacity; ++i) {
+    const SegmentCacheEntry *entry = &cache->entries[slot];
+    if (!entry->id) {
+      return 0;
+    }
+    if (entry->address == address && entry->size == size &&
+        entry->hash == hash) {
+      return entry->id;
+    }
+    slot = (slot + 1) & (cache->capacity - 1);
+  }
+  return 0;
+}
+
+uint32_t SCInsert(SegmentCache *cache, uint32_t address, uint32_t size,
+                  uint64_t hash) {
+  if ((cache->count + 1) * MAX_LOAD_DENOMINATOR >
+      cache->capacity * MAX_LOAD_NUMERATOR) {
+    return 0;
+  }
+
+  uint32_t slot = Slot(cache, address, hash);
+  while (cache->entries[slot].id) {
+    slot = (slot + 1) & (cache->capacity - 1);
+  }
+
+  SegmentCacheEntry *entry = &cache->entries[slot];
+  entry->address = address;
+  entry->size = size;
+  entry->hash = hash;
+  entry->id = cache->next_id++;
+  ++cache->count;
+  return entry->id;
+}
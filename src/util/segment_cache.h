@@ -0,0 +1,63 @@
+#ifndef NXDK_NTRC_DYNDXT_SEGMENT_CACHE_H_
+#define NXDK_NTRC_DYNDXT_SEGMENT_CACHE_H_
+
+// Remembers spans of data (e.g., pushbuffer subroutines) that have already
+// been sent to the remote, so that repeats can be replaced by a reference.
+//
+// Segments are identified by their address, size, and a 64-bit FNV-1a hash of
+// their content, and are assigned sequential IDs starting at 1.
+//
+// A SegmentCache is not thread safe; callers must provide synchronization.
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The initial value to be passed to SCHash.
+#define SC_HASH_INIT 0xCBF29CE484222325ULL
+
+typedef struct SegmentCacheEntry {
+  uint32_t address;
+  uint32_t size;
+  uint64_t hash;
+  // The ID assigned to the segment, or 0 if the slot is unused.
+  uint32_t id;
+} SegmentCacheEntry;
+
+// Holds the state of a cache. Members should be treated as private.
+typedef struct SegmentCache {
+  SegmentCacheEntry *entries;
+  // The number of slots in `entries`; always a power of two.
+  uint32_t capacity;
+  uint32_t count;
+  uint32_t next_id;
+} SegmentCache;
+
+// Accumulates `size` bytes of `data` into the given FNV-1a hash, returning the
+// new hash.
+uint64_t SCHash(uint64_t hash, const void *data, uint32_t size);
+
+// Initializes the given cache to use `storage`, which must hold `capacity`
+// entries. `capacity` is rounded down to a power of two.
+void SCInit(SegmentCache *cache, SegmentCacheEntry *storage,
+            uint32_t capacity);
+
+// Forgets every segment and restarts ID assignment.
+void SCReset(SegmentCache *cache);
+
+// Returns the ID of the matching segment, or 0 if it has not been inserted.
+uint32_t SCFind(const SegmentCache *cache, uint32_t address, uint32_t size,
+                uint64_t hash);
+
+// Inserts a segment that is not already in the cache, returning its new ID.
+// Returns 0 if the cache is full.
+uint32_t SCInsert(SegmentCache *cache, uint32_t address, uint32_t size,
+                  uint64_t hash);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // NXDK_NTRC_DYNDXT_SEGMENT_CACHE_H_
@@ -0,0 +1,126 @@
+#include "spill_file.h"
+
+typedef struct SpillFileImpl {
+  const SpillFileIO *io;
+  void *file;
+  uint32_t max_size;
+
+  uint32_t read;
+  uint32_t write;
+
+  CBFreeProc free_proc;
+} SpillFileImpl;
+
+SpillFile SFCreate(const char *path, uint32_t max_size, const SpillFileIO *io,
+                   CBAllocProc alloc_proc, CBFreeProc free_proc) {
+  if (!path || !max_size || !io) {
+    return NULL;
+  }
+
+  SpillFileImpl *ret = (SpillFileImpl *)alloc_proc(sizeof(SpillFileImpl));
+  if (!ret) {
+    return ret;
+  }
+
+  ret->file = io->open(path);
+  if (!ret->file) {
+    free_proc(ret);
+    return NULL;
+  }
+
+  ret->io = io;
+  ret->max_size = max_size;
+  ret->read = 0;
+  ret->write = 0;
+  ret->free_proc = free_proc;
+
+  return ret;
+}
+
+void SFDestroy(SpillFile handle) {
+  if (!handle) {
+    return;
+  }
+  SpillFileImpl *sf = (SpillFileImpl *)handle;
+  sf->io->close(sf->file);
+  sf->free_proc(sf);
+}
+
+uint32_t SFAvailable(SpillFile handle) {
+  SpillFileImpl *sf = (SpillFileImpl *)handle;
+  if (!sf) {
+    return 0;
+  }
+  return sf->write - sf->read;
+}
+
+uint32_t SFFreeSpace(SpillFile handle) {
+  SpillFileImpl *sf = (SpillFileImpl *)handle;
+  if (!sf) {
+    return 0;
+  }
+  return sf->max_size - sf->write;
+}
+
+bool SFWriteV(SpillFile handle, const CBIOVec *vecs, uint32_t count) {
+  SpillFileImpl *sf = (SpillFileImpl *)handle;
+  if (!sf || (count && !vecs)) {
+    return false;
+  }
+
+  uint32_t total_size = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    if (total_size + vecs[i].size < total_size) {
+      return false;
+    }
+    total_size += vecs[i].size;
+  }
+  if (SFFreeSpace(handle) < total_size) {
+    return false;
+  }
+
+  // The write offset is only advanced once every piece has been written, so a
+  // failure part way through leaves no partial data visible to the reader.
+  uint32_t write = sf->write;
+  for (uint32_t i = 0; i < count; ++i) {
+    if (!vecs[i].size) {
+      continue;
+    }
+    if (!sf->io->write(sf->file, write, vecs[i].data, vecs[i].size)) {
+      return false;
+    }
+    write += vecs[i].size;
+  }
+  sf->write = write;
+  return true;
+}
+
+uint32_t SFPeek(SpillFile handle, void *buffer, uint32_t max_size) {
+  SpillFileImpl *sf = (SpillFileImpl *)handle;
+  if (!sf || !buffer) {
+    return 0;
+  }
+
+  uint32_t available = SFAvailable(handle);
+  if (available < max_size) {
+    max_size = available;
+  }
+  if (!max_size || !sf->io->read(sf->file, sf->read, buffer, max_size)) {
+    return 0;
+  }
+  return max_size;
+}
+
+bool SFConsume(SpillFile handle, uint32_t size) {
+  SpillFileImpl *sf = (SpillFileImpl *)handle;
+  if (!sf || SFAvailable(handle) < size) {
+    return false;
+  }
+
+  sf->read += size;
+  if (sf->read == sf->write) {
+    sf->read = 0;
+    sf->write = 0;
+  }
+  return true;
+}
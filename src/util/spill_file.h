@@ -0,0 +1,76 @@
+#ifndef NXDK_NTRC_DYNDXT_SPILL_FILE_H_
+#define NXDK_NTRC_DYNDXT_SPILL_FILE_H_
+
+// Provides a FIFO of bytes backed by a file.
+//
+// Data is always appended sequentially and read back in the order in which it
+// was written. The file is rewound whenever it has been fully drained, so it
+// only grows while it is continuously non-empty.
+//
+// A SpillFile is not thread safe; callers must provide synchronization.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "circular_buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void *SpillFile;
+
+// Minimal file I/O interface used by a SpillFile.
+typedef struct SpillFileIO {
+  // Creates (or truncates) the file at `path` for reading and writing.
+  // Returns NULL on failure.
+  void *(*open)(const char *path);
+
+  // Closes a file previously returned by `open`.
+  void (*close)(void *file);
+
+  // Writes exactly `size` bytes at the given offset.
+  // Returns true on success.
+  bool (*write)(void *file, uint32_t offset, const void *data, uint32_t size);
+
+  // Reads exactly `size` bytes from the given offset.
+  // Returns true on success.
+  bool (*read)(void *file, uint32_t offset, void *buffer, uint32_t size);
+} SpillFileIO;
+
+// Creates a new SpillFile at `path` that may grow to at most `max_size` bytes.
+// The given allocator and free methods are used to create/destroy the
+// SpillFile itself. `io` must remain valid until the SpillFile is destroyed.
+SpillFile SFCreate(const char *path, uint32_t max_size, const SpillFileIO *io,
+                   CBAllocProc alloc_proc, CBFreeProc free_proc);
+
+// Closes the underlying file and frees allocated resources.
+void SFDestroy(SpillFile handle);
+
+// Returns the number of bytes available for reading.
+uint32_t SFAvailable(SpillFile handle);
+
+// Returns the number of bytes that may be appended before the file reaches its
+// maximum size.
+uint32_t SFFreeSpace(SpillFile handle);
+
+// Attempts to append all of the given pieces to the file, in order, as a
+// single unit. Either every piece is written or nothing is.
+// Returns true if the data was written successfully.
+bool SFWriteV(SpillFile handle, const CBIOVec *vecs, uint32_t count);
+
+// Copies up to `max_size` bytes from the front of the file into `buffer`
+// without consuming them.
+// Returns the actual number of bytes copied, which is 0 on I/O failure.
+uint32_t SFPeek(SpillFile handle, void *buffer, uint32_t max_size);
+
+// Consumes exactly `size` bytes from the front of the file.
+// Returns false if fewer than `size` bytes are available.
+bool SFConsume(SpillFile handle, uint32_t size);
+
+#ifdef __cplusplus
+};  // extern "C"
+#endif
+
+#endif  // NXDK_NTRC_DYNDXT_SPILL_FILE_H_
@@ -9,16 +9,41 @@ void InitializeSendPrepopulatedBinaryDataContexts(
     CommandContext *ctx, SendPrepopulatedBinaryDataContext *send_context,
     void *buffer, uint32_t buffer_size, BOOL free_buffer_on_complete,
     BOOL free_context_on_complete) {
-  send_context->buffer = buffer;
+  SendPrepopulatedBinaryDataRegion region = {buffer, buffer_size};
+  InitializeSendPrepopulatedBinaryDataRegions(ctx, send_context, &region, 1,
+                                              NULL, NULL, NULL,
+                                              free_context_on_complete);
+  send_context->owned_buffer = free_buffer_on_complete ? buffer : NULL;
+}
+
+void InitializeSendPrepopulatedBinaryDataRegions(
+    CommandContext *ctx, SendPrepopulatedBinaryDataContext *send_context,
+    const SendPrepopulatedBinaryDataRegion *regions, uint32_t num_regions,
+    OnRegionBytesSentProc on_region_bytes_sent, OnSendCompleteProc on_complete,
+    void *callback_user_data, BOOL free_context_on_complete) {
+  num_regions = min(num_regions, SEND_PREPOPULATED_MAX_REGIONS);
+
+  uint32_t total_size = 0;
+  for (uint32_t i = 0; i < num_regions; ++i) {
+    send_context->regions[i] = regions[i];
+    total_size += regions[i].size;
+  }
+  send_context->num_regions = num_regions;
+  send_context->current_region = 0;
   send_context->read_offset = 0;
-  send_context->free_buffer_on_complete = free_buffer_on_complete;
+  send_context->pending_region = 0;
+  send_context->pending_bytes = 0;
+  send_context->on_region_bytes_sent = on_region_bytes_sent;
+  send_context->on_complete = on_complete;
+  send_context->callback_user_data = callback_user_data;
+  send_context->owned_buffer = NULL;
   send_context->free_self_on_complete = free_context_on_complete;
 
-  ctx->buffer = buffer;
+  ctx->buffer = num_regions ? (void *)regions[0].data : NULL;
   ctx->user_data = send_context;
-  ctx->buffer_size = buffer_size;
+  ctx->buffer_size = total_size;
   ctx->handler = SendPrepopulatedBufferBinaryData;
-  ctx->bytes_remaining = buffer_size;
+  ctx->bytes_remaining = total_size;
 }
 
 static HRESULT_API SendPrepopulatedBufferBinaryData(CommandContext *ctx,
@@ -27,10 +52,37 @@ static HRESULT_API SendPrepopulatedBufferBinaryData(CommandContext *ctx,
   SendPrepopulatedBinaryDataContext *send_context =
       (SendPrepopulatedBinaryDataContext *)ctx->user_data;
 
-  uint32_t bytes_to_send = min(ctx->buffer_size, ctx->bytes_remaining);
+  // Being called again means that the previously provided chunk was sent.
+  if (send_context->pending_bytes) {
+    if (send_context->on_region_bytes_sent) {
+      send_context->on_region_bytes_sent(send_context->pending_region,
+                                         send_context->pending_bytes,
+                                         send_context->callback_user_data);
+    }
+    send_context->pending_bytes = 0;
+  }
+
+  while (send_context->current_region < send_context->num_regions &&
+         send_context->read_offset >=
+             send_context->regions[send_context->current_region].size) {
+    ++send_context->current_region;
+    send_context->read_offset = 0;
+  }
+
+  uint32_t bytes_to_send = 0;
+  const SendPrepopulatedBinaryDataRegion *region = NULL;
+  if (send_context->current_region < send_context->num_regions) {
+    region = &send_context->regions[send_context->current_region];
+    bytes_to_send = min(ctx->buffer_size, ctx->bytes_remaining);
+    bytes_to_send = min(bytes_to_send, region->size - send_context->read_offset);
+  }
+
   if (!bytes_to_send) {
-    if (send_context->free_buffer_on_complete) {
-      DmFreePool(send_context->buffer);
+    if (send_context->on_complete) {
+      send_context->on_complete(send_context->callback_user_data);
+    }
+    if (send_context->owned_buffer) {
+      DmFreePool(send_context->owned_buffer);
     }
     if (send_context->free_self_on_complete) {
       DmFreePool(send_context);
@@ -38,8 +90,10 @@ static HRESULT_API SendPrepopulatedBufferBinaryData(CommandContext *ctx,
     return XBOX_S_NO_MORE_DATA;
   }
 
-  ctx->buffer = send_context->buffer + send_context->read_offset;
+  ctx->buffer = (uint8_t *)region->data + send_context->read_offset;
   ctx->data_size = bytes_to_send;
+  send_context->pending_region = send_context->current_region;
+  send_context->pending_bytes = bytes_to_send;
   send_context->read_offset += bytes_to_send;
   ctx->bytes_remaining -= bytes_to_send;
 
@@ -3,16 +3,48 @@
 
 #include "xbdm.h"
 
+//! The maximum number of discontiguous regions that may be sent as a single
+//! binary response.
+#define SEND_PREPOPULATED_MAX_REGIONS 3
+
+//! Describes a contiguous block of memory to be sent.
+typedef struct SendPrepopulatedBinaryDataRegion {
+  const void *data;
+  uint32_t size;
+} SendPrepopulatedBinaryDataRegion;
+
+//! Callback invoked once XBDM has finished sending `bytes_sent` bytes from the
+//! region at `region_index`.
+typedef void (*OnRegionBytesSentProc)(uint32_t region_index,
+                                      uint32_t bytes_sent, void *user_data);
+
+//! Callback invoked after the last byte of a response has been sent.
+typedef void (*OnSendCompleteProc)(void *user_data);
+
 typedef struct SendPrepopulatedBinaryDataContext {
-  //! The data to send.
-  void *buffer;
+  //! The regions to send, in order.
+  SendPrepopulatedBinaryDataRegion regions[SEND_PREPOPULATED_MAX_REGIONS];
+  uint32_t num_regions;
+
+  //! The index of the region from which the next byte should be copied.
+  uint32_t current_region;
 
-  //! The offset into `buffer` from which the next valid byte should be copied.
-  //! Must be initialized to zero.
+  //! The offset into the current region from which the next valid byte should
+  //! be copied.
   uint32_t read_offset;
 
-  //! Whether or not to DmFreePool `buffer` after sending the last byte.
-  BOOL free_buffer_on_complete;
+  //! The region and number of bytes handed to XBDM in the previous call, which
+  //! are known to have been sent once XBDM requests more data.
+  uint32_t pending_region;
+  uint32_t pending_bytes;
+
+  //! Optional callbacks used to track the progress of the transfer.
+  OnRegionBytesSentProc on_region_bytes_sent;
+  OnSendCompleteProc on_complete;
+  void *callback_user_data;
+
+  //! Buffer to DmFreePool after sending the last byte, if any.
+  void *owned_buffer;
 
   //! Whether or not to DmFreePool `this` after sending the last byte.
   BOOL free_self_on_complete;
@@ -25,4 +57,17 @@ void InitializeSendPrepopulatedBinaryDataContexts(
     void *buffer, uint32_t buffer_size, BOOL free_buffer_on_complete,
     BOOL free_context_on_complete);
 
+//! Initializes the given CommandContext and SendPrepopulatedBinaryDataContext
+//! for a binary data transfer of up to SEND_PREPOPULATED_MAX_REGIONS
+//! discontiguous regions, sent back to back.
+//!
+//! The regions must remain valid until `on_complete` is invoked.
+//! `on_region_bytes_sent` is invoked only after XBDM has actually sent the
+//! bytes, allowing the caller to release them incrementally.
+void InitializeSendPrepopulatedBinaryDataRegions(
+    CommandContext *ctx, SendPrepopulatedBinaryDataContext *send_context,
+    const SendPrepopulatedBinaryDataRegion *regions, uint32_t num_regions,
+    OnRegionBytesSentProc on_region_bytes_sent, OnSendCompleteProc on_complete,
+    void *callback_user_data, BOOL free_context_on_complete);
+
 #endif  // NTRC_DYNDXT_SRC_XBDM_UTIL_H_
@@ -0,0 +1,14 @@
+// Stands in for the configure.h generated from src/tracelib/configure.h.in,
+// with every debugging option disabled.
+
+#ifndef NTRC_TRACELIB_CONFIGURE_H_IN_H_
+#define NTRC_TRACELIB_CONFIGURE_H_IN_H_
+
+#define VERBOSE_PRINT(c)
+#define EXTRA_VERBOSE_PRINT(c)
+
+#define PROFILE_INIT()
+#define PROFILE_START()
+#define PROFILE_SEND(msg)
+
+#endif  // NTRC_TRACELIB_CONFIGURE_H_IN_H_
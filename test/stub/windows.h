@@ -0,0 +1,86 @@
+// Minimal host implementation of the parts of the Windows API used by the
+// tracelib sources under test.
+//
+// Events never block: waiting on an unsignaled event times out immediately, so
+// tests must not exercise paths that would wait indefinitely for a reader.
+
+#ifndef WINDOWS_H
+#define WINDOWS_H
+
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef int BOOL;
+#define TRUE 1
+#define FALSE 0
+
+typedef int32_t LONG;
+typedef uint32_t DWORD;
+typedef uint64_t ULONGLONG;
+typedef int32_t HRESULT;
+typedef void *HANDLE;
+typedef void *LPSECURITY_ATTRIBUTES;
+
+#define INFINITE 0xFFFFFFFF
+#define WAIT_OBJECT_0 0
+#define WAIT_TIMEOUT 258
+
+static inline LONG InterlockedCompareExchange(volatile LONG *target,
+                                              LONG exchange, LONG comparand) {
+  __atomic_compare_exchange_n(target, &comparand, exchange, 0,
+                              __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  return comparand;
+}
+
+static inline LONG InterlockedExchange(volatile LONG *target, LONG value) {
+  return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+static inline void Sleep(DWORD milliseconds) {
+  (void)milliseconds;
+  sched_yield();
+}
+
+static inline HANDLE CreateEvent(LPSECURITY_ATTRIBUTES attributes,
+                                 BOOL manual_reset, BOOL initial_state,
+                                 const char *name) {
+  (void)attributes;
+  (void)manual_reset;
+  (void)name;
+  LONG *event = (LONG *)malloc(sizeof(LONG));
+  if (event) {
+    *event = initial_state;
+  }
+  return event;
+}
+
+static inline BOOL SetEvent(HANDLE event) {
+  InterlockedExchange((volatile LONG *)event, 1);
+  return TRUE;
+}
+
+static inline BOOL CloseHandle(HANDLE handle) {
+  free(handle);
+  return TRUE;
+}
+
+static inline DWORD WaitForSingleObject(HANDLE event, DWORD milliseconds) {
+  (void)milliseconds;
+  return InterlockedExchange((volatile LONG *)event, 0) ? WAIT_OBJECT_0
+                                                         : WAIT_TIMEOUT;
+}
+
+static inline DWORD GetTickCount(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (DWORD)(now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+static inline ULONGLONG KeQueryPerformanceCounter(void) { return 0; }
+
+static inline ULONGLONG KeQueryPerformanceFrequency(void) { return 1000; }
+
+#endif  // WINDOWS_H
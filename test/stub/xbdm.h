@@ -0,0 +1,16 @@
+// Minimal host implementation of the parts of the XBDM API used by the
+// tracelib sources under test.
+
+#ifndef XBDM_H
+#define XBDM_H
+
+#include <windows.h>
+
+#define XBOX_S_OK 0
+#define XBOX_E_FAIL ((HRESULT)0x82DB0000)
+#define XBOX_E_ACCESS_DENIED ((HRESULT)0x82DB0002)
+#define XBOX_SUCCESS(x) ((x) >= 0)
+
+static inline void DbgPrint(const char *format, ...) { (void)format; }
+
+#endif  // XBDM_H
@@ -0,0 +1,456 @@
+#define BOOST_TEST_MODULE TraceBufferTests
+
+#include <boost/test/unit_test.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "tracelib/trace_buffer.h"
+#include "tracelib/tracer_memory.h"
+#include "xbdm.h"
+
+extern "C" {
+// trace_buffer.c falls back to the tracer memory pools, which are not available
+// on the host. Every buffer under test provides its own allocator instead.
+void *TracerAlloc(uint32_t size, uint32_t) { return malloc(size); }
+void TracerFree(void *block) { free(block); }
+}
+
+static constexpr uint32_t kRecordSize = 16;
+// Holds exactly four records.
+static constexpr uint32_t kRingSize = kRecordSize * 4;
+
+static void *AllocProc(size_t size) { return malloc(size); }
+
+static void FreeProc(void *block) { free(block); }
+
+// A spill file backed by a single in-memory vector.
+static std::vector<uint8_t> spill_contents;
+
+static void *MemoryOpen(const char *) {
+  spill_contents.clear();
+  return &spill_contents;
+}
+
+static void MemoryClose(void *) {}
+
+static bool MemoryWrite(void *, uint32_t offset, const void *data,
+                        uint32_t size) {
+  if (spill_contents.size() < offset + size) {
+    spill_contents.resize(offset + size);
+  }
+  memcpy(spill_contents.data() + offset, data, size);
+  return true;
+}
+
+static bool MemoryRead(void *, uint32_t offset, void *buffer, uint32_t size) {
+  if (offset + size > spill_contents.size()) {
+    return false;
+  }
+  memcpy(buffer, spill_contents.data() + offset, size);
+  return true;
+}
+
+static const SpillFileIO kMemoryIO = {MemoryOpen, MemoryClose, MemoryWrite,
+                                      MemoryRead};
+
+static TraceBufferConfig Config(bool overwrite_oldest) {
+  TraceBufferConfig config{};
+  config.size = kRingSize;
+  config.overwrite_oldest = overwrite_oldest;
+  config.min_record_size = kRecordSize;
+  config.alloc_proc = AllocProc;
+  config.free_proc = FreeProc;
+  return config;
+}
+
+// Writes a record whose first dword is `id`.
+static void WriteRecord(TraceBuffer *buffer, uint32_t type, uint32_t id,
+                        uint32_t size = kRecordSize) {
+  std::vector<uint8_t> record(size);
+  memcpy(record.data(), &id, sizeof(id));
+  CBIOVec vec = {record.data(), size};
+  TraceBufferWrite(buffer, type, &vec, 1);
+}
+
+// Reads everything from the buffer, returning the IDs of the whole
+// kRecordSize records that were read.
+static std::vector<uint32_t> ReadIDs(TraceBuffer *buffer) {
+  std::vector<uint8_t> bytes;
+  TraceBufferLockRead(buffer);
+  CBSpans spans;
+  while (uint32_t size = TraceBufferPeek(buffer, &spans, 0xFFFF)) {
+    auto first = static_cast<const uint8_t *>(spans.first);
+    bytes.insert(bytes.end(), first, first + spans.first_size);
+    if (spans.second_size) {
+      auto second = static_cast<const uint8_t *>(spans.second);
+      bytes.insert(bytes.end(), second, second + spans.second_size);
+    }
+    TraceBufferConsume(buffer, size);
+  }
+  TraceBufferUnlockRead(buffer);
+
+  BOOST_TEST(bytes.size() % kRecordSize == 0);
+  std::vector<uint32_t> ret;
+  for (size_t i = 0; i + kRecordSize <= bytes.size(); i += kRecordSize) {
+    uint32_t id;
+    memcpy(&id, bytes.data() + i, sizeof(id));
+    ret.push_back(id);
+  }
+  return ret;
+}
+
+struct OverwriteFixture {
+  OverwriteFixture() {
+    TraceBufferConfig config = Config(true);
+    BOOST_REQUIRE(TraceBufferInit(&buffer, &config) == XBOX_S_OK);
+  }
+  ~OverwriteFixture() { TraceBufferDestroy(&buffer); }
+
+  TraceBufferStats Stats() {
+    TraceBufferStats stats;
+    TraceBufferGetStats(&buffer, &stats);
+    return stats;
+  }
+
+  TraceBuffer buffer;
+};
+
+BOOST_FIXTURE_TEST_SUITE(overwrite_suite, OverwriteFixture)
+
+BOOST_AUTO_TEST_CASE(oldest_records_are_dropped) {
+  for (uint32_t i = 0; i < 6; ++i) {
+    WriteRecord(&buffer, i & 1, i);
+  }
+
+  auto stats = Stats();
+  BOOST_TEST(stats.dropped_records[0] == 1);
+  BOOST_TEST(stats.dropped_records[1] == 1);
+  BOOST_TEST(stats.dropped_bytes[0] == kRecordSize);
+  BOOST_TEST(stats.dropped_bytes[1] == kRecordSize);
+  BOOST_TEST(ReadIDs(&buffer) == std::vector<uint32_t>({2, 3, 4, 5}));
+}
+
+BOOST_AUTO_TEST_CASE(dropped_records_count_as_consumed) {
+  for (uint32_t i = 0; i < 6; ++i) {
+    WriteRecord(&buffer, 0, i);
+  }
+  BOOST_TEST(TraceBufferGetBytesConsumed(&buffer) == kRecordSize * 2);
+}
+
+BOOST_AUTO_TEST_CASE(consumed_records_are_retired) {
+  // The record log holds four entries, so this fails if consumed records are
+  // not removed from it.
+  for (uint32_t i = 0; i < 16; ++i) {
+    WriteRecord(&buffer, 0, i);
+    BOOST_TEST(ReadIDs(&buffer) == std::vector<uint32_t>({i}));
+  }
+  BOOST_TEST(Stats().dropped_records[0] == 0);
+}
+
+BOOST_AUTO_TEST_CASE(large_record_drops_several_records) {
+  for (uint32_t i = 0; i < 4; ++i) {
+    WriteRecord(&buffer, 0, i);
+  }
+  WriteRecord(&buffer, 2, 4, kRecordSize * 3);
+
+  auto stats = Stats();
+  BOOST_TEST(stats.dropped_records[0] == 3);
+  BOOST_TEST(stats.dropped_records[2] == 0);
+  auto ids = ReadIDs(&buffer);
+  BOOST_TEST_REQUIRE(ids.size() == 4);
+  BOOST_TEST(ids[0] == 3);
+  BOOST_TEST(ids[1] == 4);
+}
+
+BOOST_AUTO_TEST_CASE(oversized_record_is_dropped) {
+  WriteRecord(&buffer, 0, 0);
+  WriteRecord(&buffer, 3, 1, kRingSize + 1);
+
+  auto stats = Stats();
+  BOOST_TEST(stats.dropped_records[3] == 1);
+  BOOST_TEST(stats.dropped_bytes[3] == kRingSize + 1);
+  BOOST_TEST(ReadIDs(&buffer) == std::vector<uint32_t>({0}));
+}
+
+BOOST_AUTO_TEST_CASE(large_types_are_counted_in_last_slot) {
+  WriteRecord(&buffer, 100, 0, kRingSize + 1);
+  BOOST_TEST(Stats().dropped_records[TRACE_BUFFER_MAX_RECORD_TYPES - 1] == 1);
+}
+
+BOOST_AUTO_TEST_CASE(new_record_is_dropped_while_read_locked) {
+  for (uint32_t i = 0; i < 4; ++i) {
+    WriteRecord(&buffer, 0, i);
+  }
+
+  TraceBufferLockRead(&buffer);
+  WriteRecord(&buffer, 1, 4);
+  TraceBufferUnlockRead(&buffer);
+
+  auto stats = Stats();
+  BOOST_TEST(stats.dropped_records[0] == 0);
+  BOOST_TEST(stats.dropped_records[1] == 1);
+  BOOST_TEST(ReadIDs(&buffer) == std::vector<uint32_t>({0, 1, 2, 3}));
+}
+
+BOOST_AUTO_TEST_CASE(partially_read_oldest_record_is_kept) {
+  for (uint32_t i = 0; i < 4; ++i) {
+    WriteRecord(&buffer, 0, i);
+  }
+
+  TraceBufferLockRead(&buffer);
+  CBSpans spans;
+  BOOST_TEST_REQUIRE(TraceBufferPeek(&buffer, &spans, 4) == 4);
+  TraceBufferConsume(&buffer, 4);
+  TraceBufferUnlockRead(&buffer);
+
+  // The remainder of record 0 may still be read, so it cannot be dropped.
+  WriteRecord(&buffer, 1, 4);
+  BOOST_TEST(Stats().dropped_records[0] == 0);
+  BOOST_TEST(Stats().dropped_records[1] == 1);
+
+  // Once it has been read, record 1 is the oldest and may be dropped.
+  TraceBufferLockRead(&buffer);
+  BOOST_TEST_REQUIRE(TraceBufferPeek(&buffer, &spans, kRecordSize - 4) ==
+                     kRecordSize - 4);
+  TraceBufferConsume(&buffer, kRecordSize - 4);
+  TraceBufferUnlockRead(&buffer);
+
+  WriteRecord(&buffer, 1, 5);
+  WriteRecord(&buffer, 1, 6);
+  BOOST_TEST(Stats().dropped_records[0] == 1);
+  BOOST_TEST(ReadIDs(&buffer) == std::vector<uint32_t>({2, 3, 5, 6}));
+}
+
+BOOST_AUTO_TEST_CASE(claimed_record_is_kept_after_unlock) {
+  for (uint32_t i = 0; i < 4; ++i) {
+    WriteRecord(&buffer, 0, i);
+  }
+
+  TraceBufferLockRead(&buffer);
+  CBSpans spans;
+  BOOST_TEST_REQUIRE(TraceBufferPeek(&buffer, &spans, kRecordSize) ==
+                     kRecordSize);
+  uint32_t claim = TraceBufferClaim(&buffer, kRecordSize);
+  TraceBufferUnlockRead(&buffer);
+
+  // The claimed record is still being sent, so it cannot be dropped.
+  WriteRecord(&buffer, 1, 4);
+  BOOST_TEST(Stats().dropped_records[0] == 0);
+  BOOST_TEST(Stats().dropped_records[1] == 1);
+
+  TraceBufferConsumeClaim(&buffer, claim, kRecordSize);
+  WriteRecord(&buffer, 1, 5);
+  WriteRecord(&buffer, 1, 6);
+  BOOST_TEST(Stats().dropped_records[0] == 1);
+  BOOST_TEST(ReadIDs(&buffer) == std::vector<uint32_t>({2, 3, 5, 6}));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+struct ClaimFixture {
+  ClaimFixture() {
+    TraceBufferConfig config = Config(false);
+    BOOST_REQUIRE(TraceBufferInit(&buffer, &config) == XBOX_S_OK);
+    for (uint32_t i = 0; i < 3; ++i) {
+      WriteRecord(&buffer, 0, i);
+    }
+  }
+  ~ClaimFixture() { TraceBufferDestroy(&buffer); }
+
+  // Claims the first `size` readable bytes and releases the read lock.
+  uint32_t Claim(uint32_t size) {
+    TraceBufferLockRead(&buffer);
+    CBSpans spans;
+    BOOST_TEST_REQUIRE(TraceBufferPeek(&buffer, &spans, size) == size);
+    uint32_t ret = TraceBufferClaim(&buffer, size);
+    TraceBufferUnlockRead(&buffer);
+    return ret;
+  }
+
+  TraceBuffer buffer;
+};
+
+BOOST_FIXTURE_TEST_SUITE(claim_suite, ClaimFixture)
+
+BOOST_AUTO_TEST_CASE(claim_is_consumed_incrementally) {
+  uint32_t claim = Claim(kRecordSize * 2);
+  BOOST_TEST(buffer.read_lock == 0);
+
+  TraceBufferConsumeClaim(&buffer, claim, kRecordSize);
+  BOOST_TEST(TraceBufferAvailable(&buffer) == kRecordSize * 2);
+  TraceBufferConsumeClaim(&buffer, claim, kRecordSize * 2);
+  BOOST_TEST(TraceBufferAvailable(&buffer) == kRecordSize);
+  BOOST_TEST(ReadIDs(&buffer) == std::vector<uint32_t>({2}));
+}
+
+BOOST_AUTO_TEST_CASE(superseded_claim_consumes_nothing) {
+  uint32_t stale = Claim(kRecordSize);
+  uint32_t claim = Claim(kRecordSize * 2);
+
+  TraceBufferConsumeClaim(&buffer, stale, kRecordSize);
+  BOOST_TEST(TraceBufferAvailable(&buffer) == kRecordSize * 3);
+  TraceBufferConsumeClaim(&buffer, claim, kRecordSize * 2);
+  BOOST_TEST(ReadIDs(&buffer) == std::vector<uint32_t>({2}));
+}
+
+BOOST_AUTO_TEST_CASE(consumed_bytes_track_claims_and_reset) {
+  uint32_t claim = Claim(kRecordSize * 2);
+  TraceBufferConsumeClaim(&buffer, claim, kRecordSize + 4);
+  TraceBufferLockRead(&buffer);
+  BOOST_TEST(TraceBufferGetBytesConsumed(&buffer) == kRecordSize + 4);
+  TraceBufferUnlockRead(&buffer);
+
+  TraceBufferReset(&buffer);
+  TraceBufferLockRead(&buffer);
+  BOOST_TEST(TraceBufferGetBytesConsumed(&buffer) == 0);
+  TraceBufferUnlockRead(&buffer);
+}
+
+BOOST_AUTO_TEST_CASE(reset_abandons_stalled_claim) {
+  uint32_t claim = Claim(kRecordSize);
+  TraceBufferReset(&buffer);
+  BOOST_TEST(TraceBufferAvailable(&buffer) == 0);
+
+  // The abandoned claim must not consume bytes written after the reset.
+  WriteRecord(&buffer, 0, 3);
+  TraceBufferConsumeClaim(&buffer, claim, kRecordSize);
+  BOOST_TEST(ReadIDs(&buffer) == std::vector<uint32_t>({3}));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+struct SpillFixture {
+  SpillFixture() {
+    TraceBufferConfig config = Config(false);
+    config.spill_size = 1024;
+    config.spill_path = "spill";
+    config.spill_io = &kMemoryIO;
+    BOOST_REQUIRE(TraceBufferInit(&buffer, &config) == XBOX_S_OK);
+  }
+  ~SpillFixture() { TraceBufferDestroy(&buffer); }
+
+  TraceBuffer buffer;
+};
+
+BOOST_FIXTURE_TEST_SUITE(spill_suite, SpillFixture)
+
+BOOST_AUTO_TEST_CASE(ring_is_read_before_spill) {
+  for (uint32_t i = 0; i < 6; ++i) {
+    WriteRecord(&buffer, 0, i);
+  }
+
+  TraceBufferStats stats;
+  TraceBufferGetStats(&buffer, &stats);
+  BOOST_TEST(stats.spilled_records == 2);
+  BOOST_TEST(stats.spilled_bytes == 2 * kRecordSize);
+  BOOST_TEST(stats.stalls == 0);
+  BOOST_TEST(TraceBufferAvailable(&buffer) == 6 * kRecordSize);
+
+  TraceBufferLockRead(&buffer);
+  CBSpans spans;
+  // Spilled bytes are only returned once the ring has been drained.
+  BOOST_TEST(TraceBufferPeek(&buffer, &spans, 0xFFFF) == 4 * kRecordSize);
+  TraceBufferUnlockRead(&buffer);
+
+  BOOST_TEST(ReadIDs(&buffer) ==
+             std::vector<uint32_t>({0, 1, 2, 3, 4, 5}));
+}
+
+BOOST_AUTO_TEST_CASE(records_follow_spill_until_it_drains) {
+  for (uint32_t i = 0; i < 5; ++i) {
+    WriteRecord(&buffer, 0, i);
+  }
+
+  // Drain part of the ring. Record 4 is still spilled, so the next record must
+  // be spilled after it even though it would fit in the ring.
+  TraceBufferLockRead(&buffer);
+  CBSpans spans;
+  TraceBufferPeek(&buffer, &spans, kRecordSize);
+  TraceBufferConsume(&buffer, kRecordSize);
+  TraceBufferUnlockRead(&buffer);
+  WriteRecord(&buffer, 0, 5);
+
+  TraceBufferStats stats;
+  TraceBufferGetStats(&buffer, &stats);
+  BOOST_TEST(stats.spilled_records == 2);
+  BOOST_TEST(ReadIDs(&buffer) == std::vector<uint32_t>({1, 2, 3, 4, 5}));
+
+  // The spill has drained, so the ring is used again.
+  WriteRecord(&buffer, 0, 6);
+  TraceBufferGetStats(&buffer, &stats);
+  BOOST_TEST(stats.spilled_records == 2);
+  BOOST_TEST(ReadIDs(&buffer) == std::vector<uint32_t>({6}));
+}
+
+BOOST_AUTO_TEST_CASE(claimed_spill_bytes_are_consumed_from_spill) {
+  for (uint32_t i = 0; i < 6; ++i) {
+    WriteRecord(&buffer, 0, i);
+  }
+
+  TraceBufferLockRead(&buffer);
+  CBSpans spans;
+  BOOST_TEST_REQUIRE(TraceBufferPeek(&buffer, &spans, 0xFFFF) ==
+                     4 * kRecordSize);
+  TraceBufferConsume(&buffer, 4 * kRecordSize);
+  BOOST_TEST_REQUIRE(TraceBufferPeek(&buffer, &spans, 0xFFFF) ==
+                     2 * kRecordSize);
+  uint32_t claim = TraceBufferClaim(&buffer, 2 * kRecordSize);
+  TraceBufferUnlockRead(&buffer);
+
+  TraceBufferConsumeClaim(&buffer, claim, 2 * kRecordSize);
+  BOOST_TEST(TraceBufferAvailable(&buffer) == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(reserve_suite)
+
+static constexpr uint32_t kChunkSize = kRecordSize * 2;
+
+// Reserves a record of `size` bytes, populating it with `id` in place.
+static bool ReserveRecord(TraceBuffer *buffer, uint32_t id, uint32_t size) {
+  CBSpans spans;
+  if (!TraceBufferReserve(buffer, 0, size, &spans)) {
+    return false;
+  }
+  std::vector<uint8_t> record(size);
+  memcpy(record.data(), &id, sizeof(id));
+  CBSpansWrite(&spans, record.data(), size);
+  TraceBufferCommit(buffer);
+  return true;
+}
+
+BOOST_AUTO_TEST_CASE(contiguous_buffer_reserves_record_larger_than_a_chunk) {
+  TraceBuffer buffer;
+  TraceBufferConfig config = Config(false);
+  BOOST_REQUIRE(TraceBufferInit(&buffer, &config) == XBOX_S_OK);
+
+  BOOST_TEST(ReserveRecord(&buffer, 0, kChunkSize + kRecordSize));
+  BOOST_TEST(TraceBufferAvailable(&buffer) == kChunkSize + kRecordSize);
+  TraceBufferDestroy(&buffer);
+}
+
+BOOST_AUTO_TEST_CASE(segmented_buffer_stages_record_larger_than_a_chunk) {
+  TraceBuffer buffer;
+  TraceBufferConfig config = Config(false);
+  config.size = kChunkSize * 4;
+  config.chunk_size = kChunkSize;
+  BOOST_REQUIRE(TraceBufferInit(&buffer, &config) == XBOX_S_OK);
+
+  // The reservation cannot span chunks, so the caller must fall back to a
+  // write, which is split across chunks.
+  BOOST_TEST(!ReserveRecord(&buffer, 0, kChunkSize + kRecordSize));
+  BOOST_TEST(TraceBufferAvailable(&buffer) == 0);
+  BOOST_TEST(ReserveRecord(&buffer, 0, kChunkSize));
+  WriteRecord(&buffer, 0, 2, kChunkSize + kRecordSize);
+
+  auto ids = ReadIDs(&buffer);
+  BOOST_TEST_REQUIRE(ids.size() == 5);
+  BOOST_TEST(ids[0] == 0);
+  BOOST_TEST(ids[2] == 2);
+  TraceBufferDestroy(&buffer);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
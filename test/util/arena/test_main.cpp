@@ -0,0 +1,95 @@
+#define BOOST_TEST_MODULE ArenaTests
+
+#include <boost/test/unit_test.hpp>
+#include <cstdint>
+#include <cstdlib>
+
+#include "util/arena.h"
+
+struct ArenaFixture {
+  ArenaFixture() { arena = ArenaCreate(64, malloc, free); }
+  ~ArenaFixture() { ArenaDestroy(arena); }
+
+  Arena arena;
+};
+
+BOOST_AUTO_TEST_CASE(create_with_zero_capacity_fails) {
+  BOOST_TEST(!ArenaCreate(0, malloc, free));
+}
+
+BOOST_FIXTURE_TEST_SUITE(arena_suite, ArenaFixture)
+
+BOOST_AUTO_TEST_CASE(alloc_is_aligned) {
+  auto first = static_cast<uint8_t *>(ArenaAlloc(arena, 3));
+  auto second = static_cast<uint8_t *>(ArenaAlloc(arena, 4));
+
+  BOOST_TEST(first);
+  BOOST_TEST(second);
+  BOOST_TEST(reinterpret_cast<uintptr_t>(second) % 8 == 0);
+  BOOST_TEST(second - first == 8);
+
+  ArenaStats stats;
+  ArenaGetStats(arena, &stats);
+  BOOST_TEST(stats.used == 12);
+  BOOST_TEST(stats.allocations == 2);
+}
+
+BOOST_AUTO_TEST_CASE(alloc_exactly_capacity_succeeds) {
+  BOOST_TEST(ArenaAlloc(arena, 64));
+
+  ArenaStats stats;
+  ArenaGetStats(arena, &stats);
+  BOOST_TEST(stats.used == 64);
+  BOOST_TEST(stats.overflows == 0);
+}
+
+BOOST_AUTO_TEST_CASE(alloc_past_capacity_fails) {
+  BOOST_TEST(ArenaAlloc(arena, 60));
+  BOOST_TEST(!ArenaAlloc(arena, 1));
+  BOOST_TEST(!ArenaAlloc(arena, 128));
+
+  ArenaStats stats;
+  ArenaGetStats(arena, &stats);
+  BOOST_TEST(stats.used == 60);
+  BOOST_TEST(stats.allocations == 1);
+  BOOST_TEST(stats.overflows == 2);
+}
+
+BOOST_AUTO_TEST_CASE(reset_reuses_storage) {
+  void *first = ArenaAlloc(arena, 40);
+  BOOST_TEST(!ArenaAlloc(arena, 40));
+
+  ArenaReset(arena);
+  void *second = ArenaAlloc(arena, 40);
+
+  BOOST_TEST(second == first);
+
+  ArenaStats stats;
+  ArenaGetStats(arena, &stats);
+  BOOST_TEST(stats.used == 40);
+  BOOST_TEST(stats.resets == 1);
+}
+
+BOOST_AUTO_TEST_CASE(high_water_survives_reset) {
+  ArenaAlloc(arena, 48);
+  ArenaReset(arena);
+  ArenaAlloc(arena, 8);
+
+  ArenaStats stats;
+  ArenaGetStats(arena, &stats);
+  BOOST_TEST(stats.capacity == 64);
+  BOOST_TEST(stats.used == 8);
+  BOOST_TEST(stats.high_water == 48);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_CASE(null_arena_is_inert) {
+  BOOST_TEST(!ArenaAlloc(nullptr, 4));
+  ArenaReset(nullptr);
+
+  ArenaStats stats;
+  ArenaGetStats(nullptr, &stats);
+  BOOST_TEST(stats.capacity == 0);
+  ArenaDestroy(nullptr);
+}
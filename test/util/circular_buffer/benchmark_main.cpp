@@ -0,0 +1,278 @@
+// Measures CircularBuffer throughput and emits the results as JSON.
+//
+// Usage: circular_buffer_benchmark [--bytes=<bytes per case>] [output.json]
+//
+// Results are written to stdout if no output path is given.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "util/circular_buffer.h"
+
+namespace {
+
+constexpr uint64_t kDefaultBytesPerCase = 64ull * 1024 * 1024;
+
+constexpr uint32_t kRecordSizes[] = {
+    16,         64,          256,         1024,           4096,
+    16 * 1024,  64 * 1024,   256 * 1024,  1024 * 1024,    4 * 1024 * 1024,
+};
+
+struct Result {
+  std::string name;
+  std::string pattern;
+  uint32_t record_size;
+  uint32_t capacity;
+  uint32_t threads;
+  uint64_t bytes;
+  uint64_t operations;
+  double seconds;
+};
+
+using Clock = std::chrono::steady_clock;
+
+double SecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+uint64_t IterationsFor(uint64_t bytes_per_case, uint32_t record_size) {
+  return std::max<uint64_t>(1, bytes_per_case / record_size);
+}
+
+// Returns a capacity for `record_size` records. "aligned" buffers hold an
+// exact multiple of the record size so that wraps always land on a record
+// boundary; "wrapping" buffers are deliberately misaligned so that most writes
+// and reads are split across the end of the underlying storage.
+uint32_t CapacityFor(uint32_t record_size, bool wrapping) {
+  if (wrapping) {
+    return record_size * 2 + record_size / 3 + 7;
+  }
+  return record_size * 4;
+}
+
+// CBWrite followed immediately by CBReadAvailable of the same record.
+Result BenchWriteRead(uint32_t record_size, bool wrapping,
+                      uint64_t bytes_per_case) {
+  uint32_t capacity = CapacityFor(record_size, wrapping);
+  CircularBuffer cb = CBCreate(capacity);
+  std::vector<uint8_t> in(record_size, 0xA5);
+  std::vector<uint8_t> out(record_size);
+  uint64_t iterations = IterationsFor(bytes_per_case, record_size);
+
+  // Offset the cursors so that every record straddles the end of the buffer
+  // when wrapping.
+  if (wrapping) {
+    CBWriteAvailable(cb, in.data(), record_size / 2 + 1);
+  }
+
+  auto start = Clock::now();
+  for (uint64_t i = 0; i < iterations; ++i) {
+    CBWrite(cb, in.data(), record_size);
+    CBReadAvailable(cb, out.data(), record_size);
+  }
+  double seconds = SecondsSince(start);
+  CBDestroy(cb);
+
+  return {"write_read",
+          wrapping ? "wrapping" : "aligned",
+          record_size,
+          capacity,
+          1,
+          iterations * record_size * 2,
+          iterations * 2,
+          seconds};
+}
+
+// CBWriteAvailable followed by CBDiscard, isolating the producer-side copy.
+Result BenchWriteAvailableDiscard(uint32_t record_size, bool wrapping,
+                                  uint64_t bytes_per_case) {
+  uint32_t capacity = CapacityFor(record_size, wrapping);
+  CircularBuffer cb = CBCreate(capacity);
+  std::vector<uint8_t> in(record_size, 0x5A);
+  uint64_t iterations = IterationsFor(bytes_per_case, record_size);
+
+  auto start = Clock::now();
+  uint64_t bytes = 0;
+  for (uint64_t i = 0; i < iterations; ++i) {
+    uint32_t written = CBWriteAvailable(cb, in.data(), record_size);
+    bytes += written;
+    CBDiscard(cb, written);
+  }
+  double seconds = SecondsSince(start);
+  CBDestroy(cb);
+
+  return {"write_available_discard",
+          wrapping ? "wrapping" : "aligned",
+          record_size,
+          capacity,
+          1,
+          bytes,
+          iterations * 2,
+          seconds};
+}
+
+// Fills the buffer and then drains it via CBReadAvailable, isolating the
+// consumer-side copy.
+Result BenchFillDrain(uint32_t record_size, bool wrapping,
+                      uint64_t bytes_per_case) {
+  uint32_t capacity = CapacityFor(record_size, wrapping);
+  CircularBuffer cb = CBCreate(capacity);
+  std::vector<uint8_t> in(record_size, 0x3C);
+  std::vector<uint8_t> out(record_size);
+  uint64_t iterations = IterationsFor(bytes_per_case, record_size);
+
+  double seconds = 0.0;
+  uint64_t bytes = 0;
+  uint64_t operations = 0;
+  uint64_t records_read = 0;
+  while (records_read < iterations) {
+    while (CBWrite(cb, in.data(), record_size)) {
+    }
+
+    auto start = Clock::now();
+    uint32_t read;
+    while ((read = CBReadAvailable(cb, out.data(), record_size)) != 0) {
+      bytes += read;
+      ++operations;
+      ++records_read;
+    }
+    seconds += SecondsSince(start);
+  }
+  CBDestroy(cb);
+
+  return {"read_available",
+          wrapping ? "wrapping" : "aligned",
+          record_size,
+          capacity,
+          1,
+          bytes,
+          operations,
+          seconds};
+}
+
+// Streams records from a producer thread using CBWriteAvailable to a consumer
+// thread using CBReadAvailable.
+Result BenchThreaded(uint32_t record_size, bool wrapping,
+                     uint64_t bytes_per_case) {
+  uint32_t capacity = CapacityFor(record_size, wrapping);
+  CircularBuffer cb = CBCreate(capacity);
+  uint64_t total_bytes = IterationsFor(bytes_per_case, record_size) *
+                         static_cast<uint64_t>(record_size);
+  std::atomic<uint64_t> producer_operations{0};
+
+  auto start = Clock::now();
+  std::thread producer([&]() {
+    std::vector<uint8_t> in(record_size, 0xC3);
+    uint64_t remaining = total_bytes;
+    uint64_t operations = 0;
+    while (remaining) {
+      uint32_t len = std::min<uint64_t>(record_size, remaining);
+      uint32_t written = CBWriteAvailable(cb, in.data(), len);
+      remaining -= written;
+      ++operations;
+      if (!written) {
+        std::this_thread::yield();
+      }
+    }
+    producer_operations = operations;
+  });
+
+  std::vector<uint8_t> out(record_size);
+  uint64_t received = 0;
+  uint64_t consumer_operations = 0;
+  while (received < total_bytes) {
+    uint32_t read = CBReadAvailable(cb, out.data(), record_size);
+    received += read;
+    ++consumer_operations;
+    if (!read) {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  double seconds = SecondsSince(start);
+  CBDestroy(cb);
+
+  return {"threaded",
+          wrapping ? "wrapping" : "aligned",
+          record_size,
+          capacity,
+          2,
+          total_bytes,
+          producer_operations + consumer_operations,
+          seconds};
+}
+
+void PrintResults(FILE* out, const std::vector<Result>& results,
+                  uint64_t bytes_per_case) {
+  fprintf(out, "{\n");
+  fprintf(out, "  \"benchmark\": \"circular_buffer\",\n");
+  fprintf(out, "  \"bytes_per_case\": %llu,\n",
+          static_cast<unsigned long long>(bytes_per_case));
+  fprintf(out, "  \"results\": [\n");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    double mb_per_second =
+        r.seconds > 0.0 ? (r.bytes / (1024.0 * 1024.0)) / r.seconds : 0.0;
+    double ns_per_operation =
+        r.operations ? (r.seconds * 1e9) / r.operations : 0.0;
+    fprintf(out,
+            "    {\"name\": \"%s\", \"pattern\": \"%s\", \"record_size\": %u, "
+            "\"capacity\": %u, \"threads\": %u, \"bytes\": %llu, "
+            "\"operations\": %llu, \"seconds\": %.6f, "
+            "\"mb_per_second\": %.2f, \"ns_per_operation\": %.2f}%s\n",
+            r.name.c_str(), r.pattern.c_str(), r.record_size, r.capacity,
+            r.threads, static_cast<unsigned long long>(r.bytes),
+            static_cast<unsigned long long>(r.operations), r.seconds,
+            mb_per_second, ns_per_operation,
+            i + 1 < results.size() ? "," : "");
+  }
+  fprintf(out, "  ]\n");
+  fprintf(out, "}\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint64_t bytes_per_case = kDefaultBytesPerCase;
+  const char* output_path = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "--bytes=", 8)) {
+      bytes_per_case = strtoull(argv[i] + 8, nullptr, 0);
+    } else {
+      output_path = argv[i];
+    }
+  }
+
+  std::vector<Result> results;
+  for (uint32_t record_size : kRecordSizes) {
+    for (bool wrapping : {false, true}) {
+      results.push_back(BenchWriteRead(record_size, wrapping, bytes_per_case));
+      results.push_back(
+          BenchWriteAvailableDiscard(record_size, wrapping, bytes_per_case));
+      results.push_back(BenchFillDrain(record_size, wrapping, bytes_per_case));
+      results.push_back(BenchThreaded(record_size, wrapping, bytes_per_case));
+    }
+  }
+
+  FILE* out = stdout;
+  if (output_path) {
+    out = fopen(output_path, "w");
+    if (!out) {
+      fprintf(stderr, "Failed to open %s\n", output_path);
+      return 1;
+    }
+  }
+  PrintResults(out, results, bytes_per_case);
+  if (out != stdout) {
+    fclose(out);
+  }
+  return 0;
+}
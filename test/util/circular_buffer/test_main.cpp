@@ -1,9 +1,12 @@
 #define BOOST_TEST_MODULE CircularBufferTests
 
+#include <algorithm>
 #include <boost/test/unit_test.hpp>
 #include <cstdint>
 #include <set>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "util/circular_buffer.h"
 static uint8_t test_buffer[1024] = {0};
@@ -32,7 +35,7 @@ static void FreeProc(void* buf) {
 }
 
 static void PopulateBuffer(uint8_t* buf, size_t len) {
-  for (auto i = 0; i < len; ++i) {
+  for (size_t i = 0; i < len; ++i) {
     buf[i] = i & 0xFF;
   }
 }
@@ -521,4 +524,446 @@ BOOST_AUTO_TEST_CASE(create_with_max_uint32_fails) {
   BOOST_TEST(sut == nullptr);
 }
 
+BOOST_AUTO_TEST_CASE(write_ending_at_buffer_end_wraps_cursor) {
+  auto sut = CBCreateEx(10, AllocProc, FreeProc);
+  uint8_t buf[10];
+  PopulateBuffer(buf, sizeof(buf));
+  CBWrite(sut, buf, 10);
+  CBDiscard(sut, 10);
+
+  // Write index 10 -> 11 (the end of the underlying storage).
+  CBWrite(sut, buf, 1);
+  BOOST_TEST(CBDiscard(sut, 1) == 1);
+
+  BOOST_TEST(CBAvailable(sut) == 0);
+  BOOST_TEST(CBFreeSpace(sut) == 10);
+}
+
+BOOST_AUTO_TEST_CASE(reserve_with_insufficient_space_returns_false) {
+  auto sut = CBCreateEx(16, AllocProc, FreeProc);
+  CBSpans spans;
+
+  BOOST_TEST(CBReserve(sut, 17, &spans) == false);
+}
+
+BOOST_AUTO_TEST_CASE(reserve_does_not_make_bytes_available) {
+  auto sut = CBCreateEx(16, AllocProc, FreeProc);
+  CBSpans spans;
+
+  BOOST_REQUIRE(CBReserve(sut, 8, &spans));
+
+  BOOST_TEST(CBAvailable(sut) == 0);
+  BOOST_TEST(CBFreeSpace(sut) == 16);
+}
+
+BOOST_AUTO_TEST_CASE(reserve_without_wrap_returns_single_span) {
+  auto sut = CBCreateEx(16, AllocProc, FreeProc);
+  CBSpans spans;
+
+  BOOST_REQUIRE(CBReserve(sut, 8, &spans));
+
+  BOOST_TEST(spans.first != nullptr);
+  BOOST_TEST(spans.first_size == 8);
+  BOOST_TEST(spans.second == nullptr);
+  BOOST_TEST(spans.second_size == 0);
+}
+
+BOOST_AUTO_TEST_CASE(reserve_across_boundary_returns_split_spans) {
+  auto sut = CBCreateEx(10, AllocProc, FreeProc);
+  uint8_t buf[8] = {0};
+  CBWrite(sut, buf, sizeof(buf));
+  CBDiscard(sut, sizeof(buf));
+  CBSpans spans;
+
+  // Write index is 8 with 3 bytes to the end of the underlying storage.
+  BOOST_REQUIRE(CBReserve(sut, 5, &spans));
+
+  BOOST_TEST(spans.first_size == 3);
+  BOOST_TEST(spans.second_size == 2);
+}
+
+BOOST_AUTO_TEST_CASE(commit_makes_reserved_bytes_readable) {
+  auto sut = CBCreateEx(10, AllocProc, FreeProc);
+  uint8_t buf[8] = {0};
+  CBWrite(sut, buf, sizeof(buf));
+  CBDiscard(sut, sizeof(buf));
+  uint8_t input[5] = {0xAA, 0xBB, 0xCC, 0xDD, 0xEE};
+  CBSpans spans;
+  BOOST_REQUIRE(CBReserve(sut, sizeof(input), &spans));
+  BOOST_TEST(CBSpansWrite(&spans, input, 2) == 2);
+  BOOST_TEST(CBSpansWrite(&spans, input + 2, 3) == 3);
+
+  BOOST_REQUIRE(CBCommit(sut, sizeof(input)));
+
+  uint8_t output[5] = {0};
+  BOOST_TEST(CBAvailable(sut) == sizeof(input));
+  BOOST_REQUIRE(CBRead(sut, output, sizeof(output)));
+  BOOST_TEST(memcmp(input, output, sizeof(input)) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(commit_more_than_free_space_returns_false) {
+  auto sut = CBCreateEx(10, AllocProc, FreeProc);
+
+  BOOST_TEST(CBCommit(sut, 11) == false);
+  BOOST_TEST(CBAvailable(sut) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(commit_to_buffer_end_wraps_cursor) {
+  auto sut = CBCreateEx(10, AllocProc, FreeProc);
+  uint8_t buf[8] = {0};
+  CBWrite(sut, buf, sizeof(buf));
+  CBDiscard(sut, sizeof(buf));
+  CBSpans spans;
+  BOOST_REQUIRE(CBReserve(sut, 3, &spans));
+  BOOST_REQUIRE(CBCommit(sut, 3));
+  BOOST_REQUIRE(CBDiscard(sut, 3) == 3);
+
+  uint8_t input[4] = {1, 2, 3, 4};
+  BOOST_REQUIRE(CBWrite(sut, input, sizeof(input)));
+
+  uint8_t output[4] = {0};
+  BOOST_REQUIRE(CBRead(sut, output, sizeof(output)));
+  BOOST_TEST(memcmp(input, output, sizeof(input)) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(spans_write_is_clamped_to_span_size) {
+  uint8_t storage[4] = {0};
+  CBSpans spans = {storage, 2, storage + 2, 1};
+  uint8_t input[4] = {1, 2, 3, 4};
+
+  auto value = CBSpansWrite(&spans, input, sizeof(input));
+
+  BOOST_TEST(value == 3);
+  BOOST_TEST(spans.first_size == 0);
+  BOOST_TEST(spans.second_size == 0);
+  BOOST_TEST(storage[3] == 0);
+}
+
+BOOST_AUTO_TEST_CASE(write_v_writes_all_pieces_in_order) {
+  auto sut = CBCreateEx(10, AllocProc, FreeProc);
+  uint8_t header[2] = {1, 2};
+  uint8_t body[3] = {3, 4, 5};
+  CBIOVec vecs[] = {{header, sizeof(header)}, {body, sizeof(body)}};
+
+  BOOST_TEST(CBWriteV(sut, vecs, 2) == true);
+  BOOST_TEST(CBAvailable(sut) == 5);
+  uint8_t output[5] = {0};
+  CBRead(sut, output, sizeof(output));
+  uint8_t expected[5] = {1, 2, 3, 4, 5};
+  BOOST_TEST(memcmp(output, expected, sizeof(expected)) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(write_v_with_insufficient_space_writes_nothing) {
+  auto sut = CBCreateEx(10, AllocProc, FreeProc);
+  uint8_t header[4] = {1, 2, 3, 4};
+  uint8_t body[8] = {0};
+  CBIOVec vecs[] = {{header, sizeof(header)}, {body, sizeof(body)}};
+
+  BOOST_TEST(CBWriteV(sut, vecs, 2) == false);
+  BOOST_TEST(CBAvailable(sut) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(write_v_across_boundary_works) {
+  auto sut = CBCreateEx(10, AllocProc, FreeProc);
+  uint8_t buf[8] = {0};
+  CBWrite(sut, buf, sizeof(buf));
+  CBDiscard(sut, sizeof(buf));
+  uint8_t header[2] = {1, 2};
+  uint8_t body[5] = {3, 4, 5, 6, 7};
+  CBIOVec vecs[] = {{header, sizeof(header)}, {body, sizeof(body)}};
+
+  BOOST_TEST(CBWriteV(sut, vecs, 2) == true);
+  uint8_t output[7] = {0};
+  BOOST_TEST(CBRead(sut, output, sizeof(output)) == true);
+  uint8_t expected[7] = {1, 2, 3, 4, 5, 6, 7};
+  BOOST_TEST(memcmp(output, expected, sizeof(expected)) == 0);
+  BOOST_TEST(CBFreeSpace(sut) == 10);
+}
+
+BOOST_AUTO_TEST_CASE(peek_spans_when_empty_returns_zero) {
+  auto sut = CBCreateEx(10, AllocProc, FreeProc);
+  CBSpans spans;
+
+  BOOST_TEST(CBPeekSpans(sut, 10, &spans) == 0);
+  BOOST_TEST(spans.first_size == 0);
+  BOOST_TEST(spans.second_size == 0);
+}
+
+BOOST_AUTO_TEST_CASE(peek_spans_does_not_consume) {
+  auto sut = CBCreateEx(10, AllocProc, FreeProc);
+  uint8_t input[4] = {1, 2, 3, 4};
+  CBWrite(sut, input, sizeof(input));
+  CBSpans spans;
+
+  BOOST_TEST(CBPeekSpans(sut, 10, &spans) == 4);
+  BOOST_TEST(CBAvailable(sut) == 4);
+  BOOST_TEST(spans.first_size == 4);
+  BOOST_TEST(spans.second == nullptr);
+  BOOST_TEST(memcmp(spans.first, input, sizeof(input)) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(peek_spans_is_clamped_to_max_size) {
+  auto sut = CBCreateEx(10, AllocProc, FreeProc);
+  uint8_t input[4] = {1, 2, 3, 4};
+  CBWrite(sut, input, sizeof(input));
+  CBSpans spans;
+
+  BOOST_TEST(CBPeekSpans(sut, 3, &spans) == 3);
+  BOOST_TEST(spans.first_size == 3);
+}
+
+BOOST_AUTO_TEST_CASE(peek_spans_across_boundary_returns_split_spans) {
+  auto sut = CBCreateEx(10, AllocProc, FreeProc);
+  uint8_t buf[8] = {0};
+  CBWrite(sut, buf, sizeof(buf));
+  CBDiscard(sut, sizeof(buf));
+  uint8_t input[6] = {1, 2, 3, 4, 5, 6};
+  CBWrite(sut, input, sizeof(input));
+  CBSpans spans;
+
+  BOOST_TEST(CBPeekSpans(sut, 10, &spans) == 6);
+  BOOST_TEST(spans.first_size == 3);
+  BOOST_TEST(spans.second_size == 3);
+  BOOST_TEST(memcmp(spans.first, input, 3) == 0);
+  BOOST_TEST(memcmp(spans.second, input + 3, 3) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(consume_removes_bytes) {
+  auto sut = CBCreateEx(10, AllocProc, FreeProc);
+  uint8_t input[4] = {1, 2, 3, 4};
+  CBWrite(sut, input, sizeof(input));
+
+  BOOST_TEST(CBConsume(sut, 3) == true);
+  BOOST_TEST(CBAvailable(sut) == 1);
+  uint8_t output = 0;
+  CBRead(sut, &output, 1);
+  BOOST_TEST(output == 4);
+}
+
+BOOST_AUTO_TEST_CASE(consume_more_than_available_returns_false) {
+  auto sut = CBCreateEx(10, AllocProc, FreeProc);
+  uint8_t input[4] = {1, 2, 3, 4};
+  CBWrite(sut, input, sizeof(input));
+
+  BOOST_TEST(CBConsume(sut, 5) == false);
+  BOOST_TEST(CBAvailable(sut) == 4);
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_producer_and_consumer_preserve_order) {
+  auto sut = CBCreate(97);
+  static constexpr uint32_t kTotalBytes = 1024 * 1024;
+
+  std::thread producer([sut]() {
+    uint8_t chunk[31];
+    uint32_t next = 0;
+    while (next < kTotalBytes) {
+      uint32_t len = std::min<uint32_t>(sizeof(chunk), kTotalBytes - next);
+      for (uint32_t i = 0; i < len; ++i) {
+        chunk[i] = (next + i) & 0xFF;
+      }
+      next += CBWriteAvailable(sut, chunk, len);
+      std::this_thread::yield();
+    }
+  });
+
+  std::vector<uint8_t> received;
+  received.reserve(kTotalBytes);
+  uint8_t chunk[53];
+  while (received.size() < kTotalBytes) {
+    uint32_t len = CBReadAvailable(sut, chunk, sizeof(chunk));
+    received.insert(received.end(), chunk, chunk + len);
+    if (!len) {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+
+  BOOST_TEST(CBAvailable(sut) == 0);
+  bool in_order = true;
+  for (uint32_t i = 0; i < kTotalBytes && in_order; ++i) {
+    in_order = received[i] == (i & 0xFF);
+  }
+  BOOST_TEST(in_order);
+  CBDestroy(sut);
+}
+
+BOOST_AUTO_TEST_CASE(segmented_with_too_few_chunks_returns_null) {
+  auto sut = CBCreateSegmented(16, 1, AllocProc, FreeProc);
+
+  BOOST_TEST(sut == nullptr);
+  BOOST_TEST(allocations.empty());
+}
+
+BOOST_AUTO_TEST_CASE(segmented_starts_with_single_chunk) {
+  auto sut = CBCreateSegmented(16, 4, AllocProc, FreeProc);
+
+  BOOST_TEST(allocations.size() == 2);
+  BOOST_TEST(CBCapacity(sut) == 48);
+  BOOST_TEST(CBMaxReservation(sut) == 16);
+  BOOST_TEST(CBFreeSpace(sut) == 64);
+  BOOST_TEST(CBAvailable(sut) == 0);
+  CBDestroy(sut);
+  BOOST_TEST(allocations.empty());
+}
+
+BOOST_AUTO_TEST_CASE(segmented_write_across_chunks_grows_buffer) {
+  auto sut = CBCreateSegmented(16, 4, AllocProc, FreeProc);
+  uint8_t input[40];
+  PopulateBuffer(input, sizeof(input));
+
+  BOOST_TEST(CBWrite(sut, input, sizeof(input)));
+
+  BOOST_TEST(allocations.size() == 4);
+  BOOST_TEST(CBAvailable(sut) == 40);
+  uint8_t output[40] = {0};
+  BOOST_TEST(CBRead(sut, output, sizeof(output)));
+  BOOST_TEST(memcmp(input, output, sizeof(input)) == 0);
+  CBDestroy(sut);
+  BOOST_TEST(allocations.empty());
+}
+
+BOOST_AUTO_TEST_CASE(segmented_write_beyond_ceiling_writes_nothing) {
+  auto sut = CBCreateSegmented(16, 2, AllocProc, FreeProc);
+  uint8_t input[33] = {0};
+
+  BOOST_TEST(CBWrite(sut, input, sizeof(input)) == false);
+  BOOST_TEST(CBAvailable(sut) == 0);
+  BOOST_TEST(CBWriteAvailable(sut, input, sizeof(input)) == 32);
+  BOOST_TEST(CBFreeSpace(sut) == 0);
+  CBDestroy(sut);
+}
+
+BOOST_AUTO_TEST_CASE(segmented_read_releases_drained_chunks_keeping_spare) {
+  auto sut = CBCreateSegmented(16, 4, AllocProc, FreeProc);
+  uint8_t input[64];
+  PopulateBuffer(input, sizeof(input));
+  CBWrite(sut, input, sizeof(input));
+  BOOST_TEST(allocations.size() == 5);
+
+  uint8_t output[64] = {0};
+  BOOST_TEST(CBRead(sut, output, 48));
+
+  // Three chunks were drained, one is retained as a spare.
+  BOOST_TEST(allocations.size() == 3);
+  BOOST_TEST(CBAvailable(sut) == 16);
+
+  // The spare is reused before anything new is allocated.
+  CBWrite(sut, input, 16);
+  BOOST_TEST(allocations.size() == 3);
+  BOOST_TEST(CBRead(sut, output, 32));
+  BOOST_TEST(memcmp(input + 48, output, 16) == 0);
+  BOOST_TEST(memcmp(input, output + 16, 16) == 0);
+  CBDestroy(sut);
+  BOOST_TEST(allocations.empty());
+}
+
+BOOST_AUTO_TEST_CASE(segmented_reserve_larger_than_chunk_returns_false) {
+  auto sut = CBCreateSegmented(16, 4, AllocProc, FreeProc);
+  CBSpans spans;
+
+  BOOST_TEST(CBReserve(sut, 17, &spans) == false);
+  CBDestroy(sut);
+}
+
+BOOST_AUTO_TEST_CASE(segmented_reserve_across_chunks_returns_split_spans) {
+  auto sut = CBCreateSegmented(16, 4, AllocProc, FreeProc);
+  uint8_t input[10];
+  PopulateBuffer(input, sizeof(input));
+  CBWrite(sut, input, sizeof(input));
+
+  CBSpans spans;
+  BOOST_TEST(CBReserve(sut, 12, &spans));
+  BOOST_TEST(spans.first_size == 6);
+  BOOST_TEST(spans.second_size == 6);
+  BOOST_TEST(CBAvailable(sut) == 10);
+
+  uint8_t record[12];
+  PopulateBuffer(record, sizeof(record));
+  BOOST_TEST(CBSpansWrite(&spans, record, sizeof(record)) == 12);
+  BOOST_TEST(CBCommit(sut, 12));
+
+  BOOST_TEST(CBAvailable(sut) == 22);
+  uint8_t output[22] = {0};
+  BOOST_TEST(CBRead(sut, output, sizeof(output)));
+  BOOST_TEST(memcmp(input, output, sizeof(input)) == 0);
+  BOOST_TEST(memcmp(record, output + 10, sizeof(record)) == 0);
+  CBDestroy(sut);
+}
+
+BOOST_AUTO_TEST_CASE(segmented_peek_spans_across_chunks_and_consume) {
+  auto sut = CBCreateSegmented(16, 4, AllocProc, FreeProc);
+  uint8_t input[40];
+  PopulateBuffer(input, sizeof(input));
+  CBWrite(sut, input, sizeof(input));
+  CBDiscard(sut, 10);
+
+  CBSpans spans;
+  BOOST_TEST(CBPeekSpans(sut, 30, &spans) == 22);
+  BOOST_TEST(spans.first_size == 6);
+  BOOST_TEST(memcmp(spans.first, input + 10, 6) == 0);
+  BOOST_TEST(spans.second_size == 16);
+  BOOST_TEST(memcmp(spans.second, input + 16, 16) == 0);
+
+  BOOST_TEST(CBConsume(sut, 22));
+  BOOST_TEST(CBAvailable(sut) == 8);
+  BOOST_TEST(CBPeekSpans(sut, 30, &spans) == 8);
+  BOOST_TEST(memcmp(spans.first, input + 32, 8) == 0);
+  BOOST_TEST(spans.second_size == 0);
+  CBDestroy(sut);
+}
+
+BOOST_AUTO_TEST_CASE(segmented_clear_empties_buffer) {
+  auto sut = CBCreateSegmented(16, 4, AllocProc, FreeProc);
+  uint8_t input[40] = {0};
+  CBWrite(sut, input, sizeof(input));
+
+  CBClear(sut);
+
+  BOOST_TEST(CBAvailable(sut) == 0);
+  BOOST_TEST(allocations.size() == 3);
+  CBDestroy(sut);
+}
+
+BOOST_AUTO_TEST_CASE(segmented_concurrent_producer_and_consumer_preserve_order) {
+  auto sut = CBCreateSegmented(61, 3, malloc, free);
+  static constexpr uint32_t kTotalBytes = 1024 * 1024;
+
+  std::thread producer([sut]() {
+    uint8_t chunk[31];
+    uint32_t next = 0;
+    while (next < kTotalBytes) {
+      uint32_t len = std::min<uint32_t>(sizeof(chunk), kTotalBytes - next);
+      for (uint32_t i = 0; i < len; ++i) {
+        chunk[i] = (next + i) & 0xFF;
+      }
+      next += CBWriteAvailable(sut, chunk, len);
+      std::this_thread::yield();
+    }
+  });
+
+  std::vector<uint8_t> received;
+  received.reserve(kTotalBytes);
+  while (received.size() < kTotalBytes) {
+    CBSpans spans;
+    uint32_t len = CBPeekSpans(sut, 53, &spans);
+    received.insert(received.end(), spans.first,
+                    spans.first + spans.first_size);
+    received.insert(received.end(), spans.second,
+                    spans.second + spans.second_size);
+    CBConsume(sut, len);
+    if (!len) {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+
+  BOOST_TEST(CBAvailable(sut) == 0);
+  bool in_order = true;
+  for (uint32_t i = 0; i < kTotalBytes && in_order; ++i) {
+    in_order = received[i] == (i & 0xFF);
+  }
+  BOOST_TEST(in_order);
+  CBDestroy(sut);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
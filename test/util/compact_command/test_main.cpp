@@ -0,0 +1,225 @@
+#define BOOST_TEST_MODULE CompactCommandTests
+
+#include <boost/test/unit_test.hpp>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "util/compact_command.h"
+
+static constexpr uint32_t kKelvin = 0x97;
+static constexpr uint32_t kSetVertexData4UB = 0x1940;
+static constexpr uint32_t kSetBeginEnd = 0x17FC;
+
+static CCCommand Command(uint32_t packet_index, uint32_t address,
+                         uint32_t method, uint32_t parameter_count) {
+  CCCommand ret{};
+  ret.packet_index = packet_index;
+  ret.address = address;
+  ret.graphics_class = kKelvin;
+  ret.method = method;
+  ret.subchannel = 0;
+  ret.parameter_count = parameter_count;
+  ret.has_parameters = parameter_count != 0;
+  return ret;
+}
+
+// Encodes the given commands, each followed by `parameter_count` (or
+// `kept_count`) copies of its packet index.
+static std::vector<uint8_t> Encode(const std::vector<CCCommand> &commands) {
+  CCState state;
+  CCInit(&state);
+
+  std::vector<uint8_t> ret;
+  for (auto &command : commands) {
+    uint8_t header[CC_MAX_HEADER_SIZE];
+    uint32_t size = CCEncode(&state, &command, header);
+    BOOST_TEST(size <= CC_MAX_HEADER_SIZE);
+    ret.insert(ret.end(), header, header + size);
+    if (command.has_parameters) {
+      uint32_t count =
+          command.truncated ? command.kept_count : command.parameter_count;
+      for (uint32_t i = 0; i < count; ++i) {
+        auto bytes = reinterpret_cast<const uint8_t *>(&command.packet_index);
+        ret.insert(ret.end(), bytes, bytes + 4);
+      }
+    }
+  }
+  return ret;
+}
+
+static void CheckEqual(const CCCommand &actual, const CCCommand &expected) {
+  BOOST_TEST(actual.packet_index == expected.packet_index);
+  BOOST_TEST(actual.draw_index == expected.draw_index);
+  BOOST_TEST(actual.surface_dump_index == expected.surface_dump_index);
+  BOOST_TEST(actual.address == expected.address);
+  BOOST_TEST(actual.graphics_class == expected.graphics_class);
+  BOOST_TEST(actual.method == expected.method);
+  BOOST_TEST(actual.subchannel == expected.subchannel);
+  BOOST_TEST(actual.parameter_count == expected.parameter_count);
+  BOOST_TEST(actual.non_increasing == expected.non_increasing);
+  BOOST_TEST(actual.repeat_count == expected.repeat_count);
+  BOOST_TEST(actual.truncated == expected.truncated);
+  if (expected.truncated) {
+    BOOST_TEST(actual.kept_count == expected.kept_count);
+    BOOST_TEST(actual.omitted_hash == expected.omitted_hash);
+  }
+  BOOST_TEST(actual.has_parameters ==
+             (expected.has_parameters && expected.parameter_count != 0));
+}
+
+static void CheckRoundTrip(const std::vector<CCCommand> &commands) {
+  std::vector<uint8_t> encoded = Encode(commands);
+
+  CCState state;
+  CCInit(&state);
+  uint32_t offset = 0;
+  for (auto &expected : commands) {
+    CCCommand actual;
+    const uint8_t *parameters;
+    uint32_t size = CCDecode(&state, encoded.data() + offset,
+                             encoded.size() - offset, &actual, &parameters);
+    BOOST_TEST_REQUIRE(size != 0);
+    CheckEqual(actual, expected);
+
+    if (actual.has_parameters) {
+      BOOST_TEST_REQUIRE(parameters != nullptr);
+      for (uint32_t i = 0; i < actual.kept_count; ++i) {
+        uint32_t value;
+        memcpy(&value, parameters + i * 4, 4);
+        BOOST_TEST(value == expected.packet_index);
+      }
+    } else {
+      BOOST_TEST(parameters == nullptr);
+    }
+    offset += size;
+  }
+  BOOST_TEST(offset == encoded.size());
+}
+
+BOOST_AUTO_TEST_CASE(single_command_round_trips) {
+  CheckRoundTrip({Command(1, 0x1000, kSetBeginEnd, 1)});
+}
+
+BOOST_AUTO_TEST_CASE(sequential_commands_round_trip) {
+  CheckRoundTrip({
+      Command(1, 0x1000, kSetBeginEnd, 1),
+      Command(2, 0x1008, kSetVertexData4UB, 1),
+      Command(3, 0x1010, kSetVertexData4UB, 1),
+      Command(4, 0x1018, kSetBeginEnd, 1),
+  });
+}
+
+BOOST_AUTO_TEST_CASE(unpredictable_fields_round_trip) {
+  CCCommand jumped = Command(9, 0x800, kSetBeginEnd, 0);
+  jumped.draw_index = 4;
+  jumped.surface_dump_index = 2;
+
+  CCCommand other_class = Command(10, 0x804, 0x300, 2);
+  other_class.subchannel = 3;
+  other_class.graphics_class = 0x62;
+  other_class.non_increasing = true;
+
+  CCCommand rewound = Command(11, 0x80C, 0x300, 2);
+  rewound.subchannel = 3;
+  rewound.graphics_class = 0x62;
+  rewound.has_parameters = false;
+
+  CheckRoundTrip({
+      Command(1, 0x1000, kSetBeginEnd, 1),
+      jumped,
+      other_class,
+      rewound,
+      Command(12, 0x814, kSetBeginEnd, 1),
+  });
+}
+
+BOOST_AUTO_TEST_CASE(large_values_round_trip) {
+  CCCommand command = Command(0xFFFFFFF0, 0x03FFFFFC, 0x1FFC, 0x7FF);
+  command.subchannel = 7;
+  command.graphics_class = 0xFFFFFFFF;
+  command.draw_index = 0x80000000;
+  CheckRoundTrip({Command(0, 0, 0, 0), command});
+}
+
+BOOST_AUTO_TEST_CASE(repeated_commands_are_small) {
+  std::vector<CCCommand> commands;
+  for (uint32_t i = 0; i < 16; ++i) {
+    CCCommand command = Command(i + 1, 0x1000 + i * 8, kSetVertexData4UB, 1);
+    command.has_parameters = false;
+    commands.push_back(command);
+  }
+
+  std::vector<uint8_t> encoded = Encode(commands);
+  // The first command sends the method, count, address, and class, every
+  // following one is just a flags byte.
+  BOOST_TEST(encoded.size() == 9 + 15);
+  CheckRoundTrip(commands);
+}
+
+BOOST_AUTO_TEST_CASE(repeat_count_advances_predictions) {
+  CCCommand run = Command(1, 0x1000, kSetVertexData4UB, 1);
+  run.repeat_count = 200;
+
+  CCCommand next = Command(202, 0x1000 + 201 * 8, kSetBeginEnd, 1);
+
+  std::vector<uint8_t> encoded = Encode({run, next});
+  // The run needs a two byte flags varint and a two byte repeat count; the
+  // command after it is fully predicted apart from its method.
+  BOOST_TEST(encoded.size() == (12 + 4) + (4 + 4));
+  CheckRoundTrip({run, next});
+}
+
+BOOST_AUTO_TEST_CASE(truncated_parameters_round_trip) {
+  CCCommand partial = Command(1, 0x1000, 0x1818, 0x200);
+  partial.truncated = true;
+  partial.kept_count = 4;
+  partial.omitted_hash = 0x0123456789ABCDEFULL;
+
+  CCCommand hashed = Command(2, 0x1804, 0x1818, 0x200);
+  hashed.truncated = true;
+  hashed.kept_count = 0;
+  hashed.omitted_hash = 0xFEDCBA9876543210ULL;
+
+  std::vector<uint8_t> encoded = Encode({partial, hashed});
+  // Only the kept parameters are sent.
+  BOOST_TEST(encoded.size() < 64);
+  CheckRoundTrip({partial, hashed, Command(3, 0x2008, kSetBeginEnd, 1)});
+}
+
+BOOST_AUTO_TEST_CASE(kept_count_beyond_parameter_count_is_rejected) {
+  CCCommand command = Command(1, 0x1000, 0x1818, 2);
+  command.truncated = true;
+  command.kept_count = 3;
+  std::vector<uint8_t> encoded = Encode({command});
+
+  CCState state;
+  CCInit(&state);
+  CCCommand decoded;
+  const uint8_t *parameters;
+  BOOST_TEST(CCDecode(&state, encoded.data(), encoded.size(), &decoded,
+                      &parameters) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(truncated_record_is_not_decoded) {
+  std::vector<uint8_t> encoded = Encode({Command(1, 0x1000, kSetBeginEnd, 2)});
+
+  for (uint32_t size = 0; size < encoded.size(); ++size) {
+    CCState state;
+    CCInit(&state);
+    CCCommand command;
+    const uint8_t *parameters;
+    BOOST_TEST(CCDecode(&state, encoded.data(), size, &command, &parameters) ==
+               0);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(same_method_without_previous_is_rejected) {
+  uint8_t record[] = {CCF_SAME_METHOD};
+  CCState state;
+  CCInit(&state);
+  CCCommand command;
+  const uint8_t *parameters;
+  BOOST_TEST(CCDecode(&state, record, sizeof(record), &command, &parameters) ==
+             0);
+}
@@ -0,0 +1,242 @@
+#define BOOST_TEST_MODULE DrainSchedulerTests
+
+#include <algorithm>
+#include <boost/test/unit_test.hpp>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "util/drain_scheduler.h"
+
+static constexpr uint32_t kLaneCount = 2;
+static constexpr uint32_t kHeaderSize = sizeof(uint32_t);
+
+struct Lane {
+  std::vector<uint8_t> bytes;
+  uint32_t consumed = 0;
+};
+
+struct DrainSchedulerFixture {
+  DrainSchedulerFixture() : lanes(kLaneCount) { Init(); }
+
+  void Init(uint32_t capacity = 1024) {
+    DrainSchedulerConfig config = {};
+    config.lane_count = kLaneCount;
+    config.quantum = 128;
+    config.header_size = kHeaderSize;
+    config.entry_size = EntrySize;
+    config.peek = Peek;
+    config.user_data = this;
+    for (uint32_t i = 0; i < kLaneCount; ++i) {
+      config.weights[i] = 1;
+      config.capacities[i] = capacity;
+    }
+    DSInit(&scheduler, &config);
+  }
+
+  static uint32_t EntrySize(const void *header) {
+    uint32_t len;
+    memcpy(&len, header, sizeof(len));
+    return kHeaderSize + len;
+  }
+
+  static uint32_t Peek(uint32_t lane, CBSpans *spans, uint32_t size,
+                       uint32_t *read_offset, void *user_data) {
+    auto fixture = static_cast<DrainSchedulerFixture *>(user_data);
+    Lane &target = fixture->lanes[lane];
+    *read_offset = target.consumed;
+    uint32_t ret = std::min(size, static_cast<uint32_t>(target.bytes.size()));
+    spans->first = target.bytes.data();
+    spans->first_size = ret;
+    spans->second = nullptr;
+    spans->second_size = 0;
+    return ret;
+  }
+
+  void PushRaw(uint32_t lane, const void *data, uint32_t size) {
+    auto bytes = static_cast<const uint8_t *>(data);
+    lanes[lane].bytes.insert(lanes[lane].bytes.end(), bytes, bytes + size);
+  }
+
+  // Appends an entry with a payload of `len` bytes.
+  void Push(uint32_t lane, uint32_t len) {
+    PushRaw(lane, &len, sizeof(len));
+    lanes[lane].bytes.resize(lanes[lane].bytes.size() + len);
+  }
+
+  void Consume(uint32_t lane, uint32_t size) {
+    lanes[lane].bytes.erase(lanes[lane].bytes.begin(),
+                            lanes[lane].bytes.begin() + size);
+    lanes[lane].consumed += size;
+  }
+
+  // Empties every lane as the tracer does when it is detached or reset.
+  void Reset() {
+    for (auto &lane : lanes) {
+      lane.bytes.clear();
+      lane.consumed = 0;
+    }
+  }
+
+  uint32_t Plan(uint32_t max_size, uint32_t *lane) {
+    CBSpans spans;
+    uint32_t ret = DSPlan(&scheduler, max_size, lane, &spans);
+    if (ret) {
+      BOOST_TEST(spans.first == lanes[*lane].bytes.data());
+      BOOST_TEST(spans.first_size + spans.second_size == ret);
+    }
+    return ret;
+  }
+
+  std::vector<Lane> lanes;
+  DrainScheduler scheduler;
+};
+
+BOOST_FIXTURE_TEST_SUITE(drain_scheduler_suite, DrainSchedulerFixture)
+
+BOOST_AUTO_TEST_CASE(empty_lanes_plan_nothing) {
+  uint32_t lane;
+  BOOST_TEST(Plan(128, &lane) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(complete_entries_are_batched_within_deficit) {
+  scheduler.config.quantum = 24;
+  Push(0, 8);
+  Push(0, 8);
+  Push(0, 8);
+
+  uint32_t lane;
+  BOOST_TEST(Plan(128, &lane) == 24);
+  BOOST_TEST(lane == 0);
+}
+
+BOOST_AUTO_TEST_CASE(partial_entries_are_excluded_from_batch) {
+  Push(0, 8);
+  Push(0, 8);
+  Push(0, 8);
+
+  uint32_t lane;
+  BOOST_TEST(Plan(30, &lane) == 24);
+  BOOST_TEST(lane == 0);
+}
+
+BOOST_AUTO_TEST_CASE(lanes_alternate_with_equal_weights) {
+  scheduler.config.quantum = 12;
+  Push(0, 8);
+  Push(0, 8);
+  Push(1, 8);
+  Push(1, 8);
+
+  uint32_t expected_lanes[] = {0, 1, 0, 1};
+  for (uint32_t expected : expected_lanes) {
+    uint32_t lane;
+    BOOST_TEST(Plan(128, &lane) == 12);
+    BOOST_TEST(lane == expected);
+    Consume(lane, 12);
+  }
+  uint32_t lane;
+  BOOST_TEST(Plan(128, &lane) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(large_entry_is_finished_before_other_lanes) {
+  Push(0, 96);
+  Push(1, 8);
+
+  uint32_t expected_sizes[] = {40, 40, 20};
+  for (uint32_t expected : expected_sizes) {
+    uint32_t lane;
+    BOOST_TEST(Plan(40, &lane) == expected);
+    BOOST_TEST(lane == 0);
+    Consume(lane, expected);
+  }
+
+  uint32_t lane;
+  BOOST_TEST(Plan(40, &lane) == 12);
+  BOOST_TEST(lane == 1);
+}
+
+BOOST_AUTO_TEST_CASE(unsent_bytes_are_planned_again) {
+  Push(0, 8);
+  Push(0, 8);
+  Push(0, 8);
+  Push(1, 8);
+
+  uint32_t lane;
+  BOOST_TEST(Plan(128, &lane) == 36);
+  BOOST_TEST(lane == 0);
+
+  // Only part of the response was sent before it was abandoned.
+  Consume(0, 6);
+  BOOST_TEST(Plan(128, &lane) == 30);
+  BOOST_TEST(lane == 0);
+  Consume(0, 30);
+
+  BOOST_TEST(Plan(128, &lane) == 12);
+  BOOST_TEST(lane == 1);
+}
+
+BOOST_AUTO_TEST_CASE(detach_mid_entry_drops_started_entry) {
+  Push(0, 96);
+  Push(1, 8);
+
+  uint32_t lane;
+  BOOST_TEST(Plan(40, &lane) == 40);
+  Consume(0, 40);
+
+  // The lanes are emptied before the rest of the entry is sent.
+  Reset();
+  BOOST_TEST(Plan(40, &lane) == 0);
+
+  Push(1, 8);
+  BOOST_TEST(Plan(40, &lane) == 12);
+  BOOST_TEST(lane == 1);
+}
+
+BOOST_AUTO_TEST_CASE(reattach_mid_entry_restarts_at_entry_boundaries) {
+  Push(0, 96);
+
+  uint32_t lane;
+  BOOST_TEST(Plan(40, &lane) == 40);
+  Consume(0, 40);
+
+  // New entries are written before the scheduler is next used, so it must be
+  // reinitialized rather than continuing the abandoned entry.
+  Reset();
+  Push(0, 96);
+  Push(1, 8);
+  Init();
+
+  BOOST_TEST(Plan(40, &lane) == 40);
+  BOOST_TEST(lane == 0);
+  Consume(0, 40);
+  BOOST_TEST(Plan(128, &lane) == 60);
+  BOOST_TEST(lane == 0);
+  Consume(0, 60);
+  BOOST_TEST(Plan(128, &lane) == 12);
+  BOOST_TEST(lane == 1);
+}
+
+BOOST_AUTO_TEST_CASE(streamed_entry_waits_for_producer) {
+  Init(64);
+  uint32_t len = 96;
+  PushRaw(0, &len, sizeof(len));
+  lanes[0].bytes.resize(40);
+
+  uint32_t lane;
+  BOOST_TEST(Plan(128, &lane) == 40);
+  Consume(0, 40);
+
+  // The rest of the entry has not been written yet.
+  Push(1, 8);
+  BOOST_TEST(Plan(128, &lane) == 0);
+
+  lanes[0].bytes.resize(60);
+  BOOST_TEST(Plan(128, &lane) == 60);
+  BOOST_TEST(lane == 0);
+  Consume(0, 60);
+
+  BOOST_TEST(Plan(128, &lane) == 12);
+  BOOST_TEST(lane == 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
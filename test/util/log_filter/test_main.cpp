@@ -0,0 +1,88 @@
+#define BOOST_TEST_MODULE LogFilterTests
+
+#include <boost/test/unit_test.hpp>
+#include <cstdint>
+
+#include "util/log_filter.h"
+
+static constexpr uint32_t kKelvin = 0x97;
+static constexpr uint32_t kSurface2D = 0x62;
+static constexpr uint32_t kNoOperation = 0x100;
+static constexpr uint32_t kSetTextureOffset = 0x1B00;
+static constexpr uint32_t kSetTextureFormat = 0x1B04;
+static constexpr uint32_t kSetVertexData4UB = 0x1940;
+
+struct LogFilterFixture {
+  LogFilterFixture() { LFReset(&filter); }
+
+  LogFilter filter;
+};
+
+BOOST_FIXTURE_TEST_SUITE(log_filter_suite, LogFilterFixture)
+
+BOOST_AUTO_TEST_CASE(reset_allows_everything) {
+  BOOST_TEST(LFAllows(&filter, kKelvin, kNoOperation));
+  BOOST_TEST(LFAllows(&filter, kSurface2D, 0));
+  BOOST_TEST(LFAllows(&filter, 0x1000, 0x1FFC));
+}
+
+BOOST_AUTO_TEST_CASE(empty_rules_allow_everything) {
+  BOOST_TEST(LFApplyRules(&filter, ""));
+  BOOST_TEST(LFAllows(&filter, kKelvin, kNoOperation));
+}
+
+BOOST_AUTO_TEST_CASE(deny_single_method) {
+  BOOST_TEST(LFApplyRules(&filter, "-97:1940"));
+
+  BOOST_TEST(!LFAllows(&filter, kKelvin, kSetVertexData4UB));
+  BOOST_TEST(LFAllows(&filter, kKelvin, kNoOperation));
+  BOOST_TEST(LFAllows(&filter, kSurface2D, kSetVertexData4UB));
+}
+
+BOOST_AUTO_TEST_CASE(deny_all_then_allow_range) {
+  BOOST_TEST(LFApplyRules(&filter, "-*,+97:1B00-1B04"));
+
+  BOOST_TEST(LFAllows(&filter, kKelvin, kSetTextureOffset));
+  BOOST_TEST(LFAllows(&filter, kKelvin, kSetTextureFormat));
+  BOOST_TEST(!LFAllows(&filter, kKelvin, 0x1B08));
+  BOOST_TEST(!LFAllows(&filter, kKelvin, kNoOperation));
+  BOOST_TEST(!LFAllows(&filter, kSurface2D, kSetTextureOffset));
+}
+
+BOOST_AUTO_TEST_CASE(wildcard_rules_apply_to_existing_class_rules) {
+  BOOST_TEST(LFApplyRules(&filter, "-97:1B00,-*:100"));
+
+  BOOST_TEST(!LFAllows(&filter, kKelvin, kSetTextureOffset));
+  BOOST_TEST(!LFAllows(&filter, kKelvin, kNoOperation));
+  BOOST_TEST(!LFAllows(&filter, kSurface2D, kNoOperation));
+  BOOST_TEST(LFAllows(&filter, kSurface2D, kSetTextureOffset));
+}
+
+BOOST_AUTO_TEST_CASE(later_rules_override_earlier_rules) {
+  BOOST_TEST(LFApplyRules(&filter, "-97,+97:100"));
+
+  BOOST_TEST(LFAllows(&filter, kKelvin, kNoOperation));
+  BOOST_TEST(!LFAllows(&filter, kKelvin, kSetTextureOffset));
+}
+
+BOOST_AUTO_TEST_CASE(classes_out_of_range_use_wildcard_rules) {
+  BOOST_TEST(LFApplyRules(&filter, "-*:100"));
+
+  BOOST_TEST(!LFAllows(&filter, 0x1000, kNoOperation));
+  BOOST_TEST(LFAllows(&filter, 0x1000, kSetTextureOffset));
+}
+
+BOOST_AUTO_TEST_CASE(too_many_classes_fails) {
+  BOOST_TEST(LFApplyRules(&filter, "-1,-2,-3,-4,-5,-6,-7"));
+  BOOST_TEST(!LFApplyRules(&filter, "-8"));
+}
+
+// The selectors themselves are covered by the method_selector tests.
+BOOST_AUTO_TEST_CASE(malformed_rules_fail) {
+  BOOST_TEST(!LFApplyRules(&filter, "97"));
+  BOOST_TEST(!LFApplyRules(&filter, "+"));
+  BOOST_TEST(!LFApplyRules(&filter, "+97x"));
+  BOOST_TEST(!LFApplyRules(&filter, "+97,,-62"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,239 @@
+#define BOOST_TEST_MODULE MemoryBudgetTests
+
+#include <boost/test/unit_test.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "util/memory_budget.h"
+
+static std::map<void*, uint32_t> allocations;
+static bool fail_allocations = false;
+
+static void* AllocProc(size_t sz, uint32_t tag) {
+  if (fail_allocations) {
+    return nullptr;
+  }
+  void* ret = malloc(sz);
+  allocations[ret] = tag;
+  return ret;
+}
+
+static void FreeProc(void* buf) {
+  auto it = allocations.find(buf);
+  BOOST_REQUIRE(it != allocations.end());
+  allocations.erase(it);
+  free(buf);
+}
+
+static void* ThreadSafeAllocProc(size_t sz, uint32_t) { return malloc(sz); }
+
+static void ThreadSafeFreeProc(void* buf) { free(buf); }
+
+static const uint32_t kTagA = 0x41414141;
+static const uint32_t kTagB = 0x42424242;
+
+static const MemoryBudgetPoolStats* FindPool(const MemoryBudgetStats& stats,
+                                             uint32_t tag) {
+  for (auto& pool : stats.pools) {
+    if (pool.tag == tag) {
+      return &pool;
+    }
+  }
+  return nullptr;
+}
+
+struct Fixture {
+  Fixture() {
+    allocations.clear();
+    fail_allocations = false;
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(memory_budget_suite, Fixture)
+
+BOOST_AUTO_TEST_CASE(alloc_passes_tag_and_free_releases) {
+  MemoryBudget sut;
+  MBInit(&sut, 0, AllocProc, FreeProc);
+
+  void* block = MBAlloc(&sut, 16, kTagA);
+
+  BOOST_TEST(block != nullptr);
+  BOOST_TEST(allocations.size() == 1);
+  BOOST_TEST(allocations.begin()->second == kTagA);
+
+  MBFree(&sut, block);
+  BOOST_TEST(allocations.empty());
+}
+
+BOOST_AUTO_TEST_CASE(unbounded_budget_tracks_usage) {
+  MemoryBudget sut;
+  MBInit(&sut, 0, AllocProc, FreeProc);
+
+  void* a = MBAlloc(&sut, 100, kTagA);
+  void* b = MBAlloc(&sut, 50, kTagB);
+
+  MemoryBudgetStats stats;
+  MBGetStats(&sut, &stats);
+  BOOST_TEST(stats.ceiling == 0);
+  BOOST_TEST(stats.in_use == 150);
+  BOOST_TEST(stats.high_water == 150);
+  BOOST_TEST(MBHasHeadroom(&sut, 0xFFFFFFFF));
+
+  MBFree(&sut, a);
+  MBFree(&sut, b);
+  MBGetStats(&sut, &stats);
+  BOOST_TEST(stats.in_use == 0);
+  BOOST_TEST(stats.high_water == 150);
+}
+
+BOOST_AUTO_TEST_CASE(ceiling_refuses_without_allocating) {
+  MemoryBudget sut;
+  MBInit(&sut, 100, AllocProc, FreeProc);
+
+  void* a = MBAlloc(&sut, 60, kTagA);
+  BOOST_TEST(a != nullptr);
+  BOOST_TEST(!MBHasHeadroom(&sut, 41));
+  BOOST_TEST(MBHasHeadroom(&sut, 40));
+
+  void* b = MBAlloc(&sut, 41, kTagB);
+  BOOST_TEST(b == nullptr);
+  BOOST_TEST(allocations.size() == 1);
+
+  MemoryBudgetStats stats;
+  MBGetStats(&sut, &stats);
+  auto pool = FindPool(stats, kTagB);
+  BOOST_REQUIRE(pool != nullptr);
+  BOOST_TEST(pool->over_budget == 1);
+  BOOST_TEST(pool->failures == 0);
+  BOOST_TEST(pool->in_use == 0);
+  BOOST_TEST(stats.in_use == 60);
+
+  void* c = MBAlloc(&sut, 40, kTagB);
+  BOOST_TEST(c != nullptr);
+
+  MBFree(&sut, a);
+  MBFree(&sut, c);
+}
+
+BOOST_AUTO_TEST_CASE(allocator_failure_is_uncharged) {
+  MemoryBudget sut;
+  MBInit(&sut, 100, AllocProc, FreeProc);
+  fail_allocations = true;
+
+  BOOST_TEST(MBAlloc(&sut, 10, kTagA) == nullptr);
+
+  MemoryBudgetStats stats;
+  MBGetStats(&sut, &stats);
+  auto pool = FindPool(stats, kTagA);
+  BOOST_REQUIRE(pool != nullptr);
+  BOOST_TEST(pool->failures == 1);
+  BOOST_TEST(pool->over_budget == 0);
+  BOOST_TEST(stats.in_use == 0);
+  BOOST_TEST(stats.high_water == 10);
+}
+
+BOOST_AUTO_TEST_CASE(high_water_is_tracked_per_pool) {
+  MemoryBudget sut;
+  MBInit(&sut, 0, AllocProc, FreeProc);
+
+  void* a1 = MBAlloc(&sut, 30, kTagA);
+  void* a2 = MBAlloc(&sut, 20, kTagA);
+  MBFree(&sut, a1);
+  void* b = MBAlloc(&sut, 10, kTagB);
+
+  MemoryBudgetStats stats;
+  MBGetStats(&sut, &stats);
+  auto pool_a = FindPool(stats, kTagA);
+  auto pool_b = FindPool(stats, kTagB);
+  BOOST_REQUIRE(pool_a != nullptr);
+  BOOST_REQUIRE(pool_b != nullptr);
+  BOOST_TEST(pool_a->in_use == 20);
+  BOOST_TEST(pool_a->high_water == 50);
+  BOOST_TEST(pool_b->in_use == 10);
+  BOOST_TEST(pool_b->high_water == 10);
+  BOOST_TEST(stats.high_water == 50);
+
+  MBFree(&sut, a2);
+  MBFree(&sut, b);
+}
+
+BOOST_AUTO_TEST_CASE(lowering_ceiling_keeps_existing_allocations) {
+  MemoryBudget sut;
+  MBInit(&sut, 0, AllocProc, FreeProc);
+  void* a = MBAlloc(&sut, 64, kTagA);
+
+  MBSetCeiling(&sut, 32);
+
+  BOOST_TEST(!MBHasHeadroom(&sut, 0));
+  BOOST_TEST(MBAlloc(&sut, 1, kTagA) == nullptr);
+  MBFree(&sut, a);
+  BOOST_TEST(MBHasHeadroom(&sut, 32));
+}
+
+BOOST_AUTO_TEST_CASE(excess_tags_share_last_pool) {
+  MemoryBudget sut;
+  MBInit(&sut, 0, AllocProc, FreeProc);
+  std::vector<void*> blocks;
+  for (uint32_t i = 1; i <= MB_MAX_POOLS + 2; ++i) {
+    blocks.push_back(MBAlloc(&sut, 1, i));
+  }
+
+  MemoryBudgetStats stats;
+  MBGetStats(&sut, &stats);
+  BOOST_TEST(stats.pools[MB_MAX_POOLS - 1].in_use == 3);
+  BOOST_TEST(stats.in_use == MB_MAX_POOLS + 2);
+
+  for (auto block : blocks) {
+    MBFree(&sut, block);
+  }
+  MBGetStats(&sut, &stats);
+  BOOST_TEST(stats.in_use == 0);
+}
+
+BOOST_AUTO_TEST_CASE(static_initializer_is_unbounded) {
+  static MemoryBudget sut = MB_INITIALIZER(AllocProc, FreeProc);
+
+  void* block = MBAlloc(&sut, 1024, kTagA);
+  BOOST_TEST(block != nullptr);
+  MBFree(&sut, block);
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_allocations_respect_ceiling) {
+  static constexpr uint32_t kThreads = 4;
+  static constexpr uint32_t kIterations = 10000;
+  static constexpr uint32_t kBlockSize = 64;
+  static constexpr uint32_t kCeiling = kBlockSize * 6;
+
+  MemoryBudget sut;
+  MBInit(&sut, kCeiling, ThreadSafeAllocProc, ThreadSafeFreeProc);
+
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&sut, t]() {
+      for (uint32_t i = 0; i < kIterations; ++i) {
+        void* a = MBAlloc(&sut, kBlockSize, kTagA + t);
+        void* b = MBAlloc(&sut, kBlockSize, kTagA + t);
+        MBFree(&sut, a);
+        MBFree(&sut, b);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  MemoryBudgetStats stats;
+  MBGetStats(&sut, &stats);
+  BOOST_TEST(stats.in_use == 0);
+  BOOST_TEST(stats.high_water <= kCeiling);
+  for (uint32_t t = 0; t < kThreads; ++t) {
+    auto pool = FindPool(stats, kTagA + t);
+    BOOST_REQUIRE(pool != nullptr);
+    BOOST_TEST(pool->in_use == 0);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
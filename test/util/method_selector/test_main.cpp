@@ -0,0 +1,78 @@
+#define BOOST_TEST_MODULE MethodSelectorTests
+
+#include <boost/test/unit_test.hpp>
+#include <cstdint>
+#include <cstring>
+
+#include "util/method_selector.h"
+
+// Parses `text`, requiring the whole string to be consumed.
+static bool Parse(const char *text, MethodSelector *selector) {
+  const char *cursor = text;
+  return MSParse(&cursor, selector) && !*cursor;
+}
+
+BOOST_AUTO_TEST_CASE(class_matches_every_method) {
+  MethodSelector selector;
+  BOOST_TEST_REQUIRE(Parse("97", &selector));
+
+  BOOST_TEST(!selector.all_classes);
+  BOOST_TEST(selector.graphics_class == 0x97);
+  BOOST_TEST(MSMatches(&selector, 0x97, 0));
+  BOOST_TEST(MSMatches(&selector, 0x97, MS_MAX_METHOD));
+  BOOST_TEST(!MSMatches(&selector, 0x62, 0));
+}
+
+BOOST_AUTO_TEST_CASE(wildcard_matches_every_class) {
+  MethodSelector selector;
+  BOOST_TEST_REQUIRE(Parse("*:100", &selector));
+
+  BOOST_TEST(selector.all_classes);
+  BOOST_TEST(MSMatches(&selector, 0x62, 0x100));
+  BOOST_TEST(MSMatches(&selector, 0x1000, 0x100));
+  BOOST_TEST(!MSMatches(&selector, 0x62, 0x104));
+}
+
+BOOST_AUTO_TEST_CASE(method_range_is_inclusive) {
+  MethodSelector selector;
+  BOOST_TEST_REQUIRE(Parse("97:1b00-1B04", &selector));
+
+  BOOST_TEST(selector.first_method == 0x1B00);
+  BOOST_TEST(selector.last_method == 0x1B04);
+  BOOST_TEST(!MSMatches(&selector, 0x97, 0x1AFC));
+  BOOST_TEST(MSMatches(&selector, 0x97, 0x1B04));
+  BOOST_TEST(!MSMatches(&selector, 0x97, 0x1B08));
+}
+
+BOOST_AUTO_TEST_CASE(parsing_stops_after_selector) {
+  const char *text = "97:100=all";
+  const char *cursor = text;
+  MethodSelector selector;
+  BOOST_TEST_REQUIRE(MSParse(&cursor, &selector));
+  BOOST_TEST(cursor == text + strlen("97:100"));
+}
+
+BOOST_AUTO_TEST_CASE(malformed_selectors_are_rejected) {
+  const char *selectors[] = {
+      "",       ":100",      "97:",      "97:1B04-1B00", "97:2000",
+      "100",    "+97",       " 97",      "97:+100",      "97:100-",
+      "97:-100", "97:100- 104",
+  };
+  for (auto text : selectors) {
+    const char *cursor = text;
+    MethodSelector selector;
+    BOOST_TEST(!MSParse(&cursor, &selector), text);
+    BOOST_TEST(cursor == text, text);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(hex_values_are_bounded) {
+  const char *text = "7FF";
+  const char *cursor = text;
+  uint32_t value;
+  BOOST_TEST(!MSParseHex(&cursor, 0x7FE, &value));
+  BOOST_TEST(cursor == text);
+  BOOST_TEST(MSParseHex(&cursor, 0x7FF, &value));
+  BOOST_TEST(value == 0x7FF);
+  BOOST_TEST(!*cursor);
+}
@@ -0,0 +1,84 @@
+#define BOOST_TEST_MODULE ParameterPolicyTests
+
+#include <boost/test/unit_test.hpp>
+#include <cstdint>
+
+#include "util/parameter_policy.h"
+
+static constexpr uint32_t kKelvin = 0x97;
+static constexpr uint32_t kSurface2D = 0x62;
+static constexpr uint32_t kNoOperation = 0x100;
+static constexpr uint32_t kArrayElement16 = 0x1800;
+static constexpr uint32_t kArrayElement32 = 0x1808;
+static constexpr uint32_t kInlineArray = 0x1818;
+
+struct ParameterPolicyFixture {
+  ParameterPolicyFixture() { PPReset(&policy); }
+
+  ParameterPolicy policy;
+};
+
+BOOST_FIXTURE_TEST_SUITE(parameter_policy_suite, ParameterPolicyFixture)
+
+BOOST_AUTO_TEST_CASE(empty_policy_keeps_every_parameter) {
+  BOOST_TEST(PPApplyRules(&policy, ""));
+
+  BOOST_TEST(PPIsEmpty(&policy));
+  BOOST_TEST(PPGetKeepCount(&policy, kKelvin, kInlineArray) == PP_KEEP_ALL);
+  BOOST_TEST(PPGetKeepCount(&policy, kSurface2D, 0) == PP_KEEP_ALL);
+}
+
+BOOST_AUTO_TEST_CASE(truncate_single_method) {
+  BOOST_TEST(PPApplyRules(&policy, "97:1818=10"));
+
+  BOOST_TEST(!PPIsEmpty(&policy));
+  BOOST_TEST(PPGetKeepCount(&policy, kKelvin, kInlineArray) == 0x10);
+  BOOST_TEST(PPGetKeepCount(&policy, kKelvin, kNoOperation) == PP_KEEP_ALL);
+  BOOST_TEST(PPGetKeepCount(&policy, kSurface2D, kInlineArray) ==
+             PP_KEEP_ALL);
+}
+
+BOOST_AUTO_TEST_CASE(hash_method_range) {
+  BOOST_TEST(PPApplyRules(&policy, "97:1800-1808=hash"));
+
+  BOOST_TEST(PPGetKeepCount(&policy, kKelvin, kArrayElement16) == 0);
+  BOOST_TEST(PPGetKeepCount(&policy, kKelvin, kArrayElement32) == 0);
+  BOOST_TEST(PPGetKeepCount(&policy, kKelvin, kInlineArray) == PP_KEEP_ALL);
+}
+
+BOOST_AUTO_TEST_CASE(later_rules_take_precedence) {
+  BOOST_TEST(PPApplyRules(&policy, "*=hash,97=4,97:1818=all"));
+
+  BOOST_TEST(PPGetKeepCount(&policy, kSurface2D, kNoOperation) == 0);
+  BOOST_TEST(PPGetKeepCount(&policy, kKelvin, kNoOperation) == 4);
+  BOOST_TEST(PPGetKeepCount(&policy, kKelvin, kInlineArray) == PP_KEEP_ALL);
+}
+
+BOOST_AUTO_TEST_CASE(rules_accumulate_across_calls) {
+  BOOST_TEST(PPApplyRules(&policy, "97=hash"));
+  BOOST_TEST(PPApplyRules(&policy, "97:1818=8"));
+
+  BOOST_TEST(PPGetKeepCount(&policy, kKelvin, kNoOperation) == 0);
+  BOOST_TEST(PPGetKeepCount(&policy, kKelvin, kInlineArray) == 8);
+}
+
+BOOST_AUTO_TEST_CASE(too_many_rules_are_rejected) {
+  for (uint32_t i = 0; i < PP_MAX_RULES; ++i) {
+    BOOST_TEST(PPApplyRules(&policy, "97=1"));
+  }
+  BOOST_TEST(!PPApplyRules(&policy, "97=1"));
+}
+
+// The selectors themselves are covered by the method_selector tests.
+BOOST_AUTO_TEST_CASE(malformed_keep_counts_are_rejected) {
+  const char *rules[] = {
+      "97", "97:1818", "97=", "97=7FFF", "97=+1", "97=allx", "97=1;",
+  };
+  for (auto rule : rules) {
+    ParameterPolicy fresh;
+    PPReset(&fresh);
+    BOOST_TEST(!PPApplyRules(&fresh, rule), rule);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,203 @@
+#define BOOST_TEST_MODULE PushBufferScannerTests
+
+#include <boost/test/unit_test.hpp>
+#include <cstdint>
+#include <vector>
+
+#include "util/pushbuffer_scanner.h"
+
+static constexpr uint32_t kFlipStall = 0x130;
+static constexpr uint32_t kFlipIncrement = 0x12C;
+static constexpr uint32_t kSetBeginEnd = 0x17FC;
+
+static uint32_t Method(uint32_t subchannel, uint32_t method, uint32_t count) {
+  return (count << 18) | (subchannel << 13) | method;
+}
+
+static uint32_t NonIncreasingMethod(uint32_t subchannel, uint32_t method,
+                                    uint32_t count) {
+  return 0x40000000 | Method(subchannel, method, count);
+}
+
+static void Append(std::vector<uint32_t>& buffer, uint32_t header,
+                   uint32_t parameter_value = 0) {
+  buffer.push_back(header);
+  uint32_t count = (header >> 18) & 0x7FF;
+  for (uint32_t i = 0; i < count; ++i) {
+    buffer.push_back(parameter_value);
+  }
+}
+
+static const PBSMethod kFlipMethods[] = {
+    {PBS_ANY_SUBCHANNEL, kFlipStall},
+    {PBS_ANY_SUBCHANNEL, kFlipIncrement},
+};
+
+static PBSQuery FlipQuery() {
+  return {kFlipMethods, sizeof(kFlipMethods) / sizeof(kFlipMethods[0]), 0, 0};
+}
+
+static PBSResult Scan(const std::vector<uint32_t>& buffer,
+                      const PBSQuery& query) {
+  PBSResult result;
+  PBSScan(buffer.data(), buffer.size() * 4, &query, &result);
+  return result;
+}
+
+BOOST_AUTO_TEST_SUITE(pushbuffer_scanner_suite)
+
+BOOST_AUTO_TEST_CASE(empty_window_ends) {
+  std::vector<uint32_t> buffer;
+  auto query = FlipQuery();
+
+  auto result = Scan(buffer, query);
+
+  BOOST_TEST(result.reason == PBSSR_END);
+  BOOST_TEST(result.offset == 0);
+  BOOST_TEST(result.headers_skipped == 0);
+}
+
+BOOST_AUTO_TEST_CASE(finds_match_after_skipping_methods) {
+  std::vector<uint32_t> buffer;
+  Append(buffer, Method(0, kSetBeginEnd, 1), 5);
+  Append(buffer, Method(0, 0x1800, 3), 7);
+  Append(buffer, Method(0, kFlipStall, 1));
+  auto query = FlipQuery();
+
+  auto result = Scan(buffer, query);
+
+  BOOST_TEST(result.reason == PBSSR_MATCH);
+  BOOST_TEST(result.offset == 6 * 4);
+  BOOST_TEST(result.headers_skipped == 2);
+}
+
+BOOST_AUTO_TEST_CASE(parameters_are_never_treated_as_headers) {
+  std::vector<uint32_t> buffer;
+  // Parameters that are themselves valid FLIP_STALL headers.
+  Append(buffer, Method(0, 0x1818, 4), Method(0, kFlipStall, 0));
+  Append(buffer, Method(0, kSetBeginEnd, 1), 0);
+  auto query = FlipQuery();
+
+  auto result = Scan(buffer, query);
+
+  BOOST_TEST(result.reason == PBSSR_END);
+  BOOST_TEST(result.offset == buffer.size() * 4);
+  BOOST_TEST(result.headers_skipped == 2);
+}
+
+BOOST_AUTO_TEST_CASE(non_increasing_methods_are_matched_and_skipped) {
+  std::vector<uint32_t> buffer;
+  Append(buffer, NonIncreasingMethod(1, 0x1818, 2), Method(0, kFlipStall, 0));
+  Append(buffer, NonIncreasingMethod(2, kFlipIncrement, 1));
+  auto query = FlipQuery();
+
+  auto result = Scan(buffer, query);
+
+  BOOST_TEST(result.reason == PBSSR_MATCH);
+  BOOST_TEST(result.offset == 3 * 4);
+}
+
+BOOST_AUTO_TEST_CASE(subchannel_must_match_unless_wildcard) {
+  std::vector<uint32_t> buffer;
+  Append(buffer, Method(1, kFlipStall, 0));
+  Append(buffer, Method(3, kFlipStall, 0));
+  const PBSMethod methods[] = {{3, kFlipStall}};
+  PBSQuery query = {methods, 1, 0, 0};
+
+  auto result = Scan(buffer, query);
+
+  BOOST_TEST(result.reason == PBSSR_MATCH);
+  BOOST_TEST(result.offset == 4);
+}
+
+BOOST_AUTO_TEST_CASE(stops_at_control_flow) {
+  const uint32_t kControlFlow[] = {
+      0x20001000,  // Old jump.
+      0x00001001,  // Jump.
+      0x00001002,  // Call.
+      0x00020000,  // Return.
+  };
+  for (auto command : kControlFlow) {
+    std::vector<uint32_t> buffer;
+    Append(buffer, Method(0, kSetBeginEnd, 1));
+    buffer.push_back(command);
+    Append(buffer, Method(0, kFlipStall, 0));
+    auto query = FlipQuery();
+
+    auto result = Scan(buffer, query);
+
+    BOOST_TEST(result.reason == PBSSR_CONTROL_FLOW);
+    BOOST_TEST(result.offset == 2 * 4);
+    BOOST_TEST(result.headers_skipped == 1);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(stops_at_unknown_command) {
+  std::vector<uint32_t> buffer = {0x80000000, Method(0, kFlipStall, 0)};
+  auto query = FlipQuery();
+
+  auto result = Scan(buffer, query);
+
+  BOOST_TEST(result.reason == PBSSR_UNKNOWN);
+  BOOST_TEST(result.offset == 0);
+}
+
+BOOST_AUTO_TEST_CASE(stops_before_truncated_method) {
+  std::vector<uint32_t> buffer;
+  Append(buffer, Method(0, kSetBeginEnd, 1));
+  Append(buffer, Method(0, 0x1818, 4));
+  buffer.resize(buffer.size() - 1);
+  auto query = FlipQuery();
+
+  auto result = Scan(buffer, query);
+
+  BOOST_TEST(result.reason == PBSSR_INCOMPLETE);
+  BOOST_TEST(result.offset == 2 * 4);
+}
+
+BOOST_AUTO_TEST_CASE(max_headers_limits_scan) {
+  std::vector<uint32_t> buffer;
+  for (auto i = 0; i < 8; ++i) {
+    Append(buffer, Method(0, kSetBeginEnd, 1));
+  }
+  Append(buffer, Method(0, kFlipStall, 0));
+  auto query = FlipQuery();
+  query.max_headers = 5;
+
+  auto result = Scan(buffer, query);
+
+  BOOST_TEST(result.reason == PBSSR_LIMIT);
+  BOOST_TEST(result.headers_skipped == 5);
+  BOOST_TEST(result.offset == 5 * 2 * 4);
+}
+
+BOOST_AUTO_TEST_CASE(max_bytes_stops_at_next_header) {
+  std::vector<uint32_t> buffer;
+  Append(buffer, Method(0, 0x1818, 3));
+  Append(buffer, Method(0, 0x1818, 3));
+  Append(buffer, Method(0, kFlipStall, 0));
+  auto query = FlipQuery();
+  query.max_bytes = 6;
+
+  auto result = Scan(buffer, query);
+
+  // The first command extends past the limit but is skipped in its entirety.
+  BOOST_TEST(result.reason == PBSSR_LIMIT);
+  BOOST_TEST(result.offset == 16);
+  BOOST_TEST(result.headers_skipped == 1);
+}
+
+BOOST_AUTO_TEST_CASE(match_at_limit_is_not_reported) {
+  std::vector<uint32_t> buffer;
+  Append(buffer, Method(0, kSetBeginEnd, 1));
+  Append(buffer, Method(0, kFlipStall, 0));
+  auto query = FlipQuery();
+  query.max_headers = 1;
+
+  auto result = Scan(buffer, query);
+
+  BOOST_TEST(result.reason == PBSSR_LIMIT);
+  BOOST_TEST(result.offset == 8);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,98 @@
+#define BOOST_TEST_MODULE SegmentCacheTests
+
+#include <boost/test/unit_test.hpp>
+#include <cstdint>
+#include <vector>
+
+#include "util/segment_cache.h"
+
+struct SegmentCacheFixture {
+  explicit SegmentCacheFixture(uint32_t capacity = 16) : storage(capacity) {
+    SCInit(&cache, storage.data(), capacity);
+  }
+
+  std::vector<SegmentCacheEntry> storage;
+  SegmentCache cache;
+};
+
+BOOST_AUTO_TEST_CASE(hash_matches_fnv1a) {
+  BOOST_TEST(SCHash(SC_HASH_INIT, "", 0) == SC_HASH_INIT);
+  BOOST_TEST(SCHash(SC_HASH_INIT, "a", 1) == 0xAF63DC4C8601EC8CULL);
+  BOOST_TEST(SCHash(SC_HASH_INIT, "foobar", 6) == 0x85944171F73967E8ULL);
+}
+
+BOOST_AUTO_TEST_CASE(hash_is_incremental) {
+  uint64_t hash = SCHash(SC_HASH_INIT, "foo", 3);
+  hash = SCHash(hash, "bar", 3);
+  BOOST_TEST(hash == SCHash(SC_HASH_INIT, "foobar", 6));
+}
+
+BOOST_FIXTURE_TEST_SUITE(segment_cache_suite, SegmentCacheFixture)
+
+BOOST_AUTO_TEST_CASE(empty_cache_finds_nothing) {
+  BOOST_TEST(SCFind(&cache, 0x1000, 64, 1234) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(insert_assigns_sequential_ids) {
+  BOOST_TEST(SCInsert(&cache, 0x1000, 64, 1234) == 1);
+  BOOST_TEST(SCInsert(&cache, 0x2000, 64, 1234) == 2);
+
+  BOOST_TEST(SCFind(&cache, 0x1000, 64, 1234) == 1);
+  BOOST_TEST(SCFind(&cache, 0x2000, 64, 1234) == 2);
+}
+
+BOOST_AUTO_TEST_CASE(find_requires_all_key_fields) {
+  SCInsert(&cache, 0x1000, 64, 1234);
+
+  BOOST_TEST(SCFind(&cache, 0x1004, 64, 1234) == 0);
+  BOOST_TEST(SCFind(&cache, 0x1000, 68, 1234) == 0);
+  BOOST_TEST(SCFind(&cache, 0x1000, 64, 1235) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(colliding_slots_are_probed) {
+  // Both segments map to the same slot.
+  SCInsert(&cache, 0x1000, 64, 0);
+  SCInsert(&cache, 0x1000 + (16 << 2), 64, 0);
+
+  BOOST_TEST(SCFind(&cache, 0x1000, 64, 0) == 1);
+  BOOST_TEST(SCFind(&cache, 0x1000 + (16 << 2), 64, 0) == 2);
+}
+
+BOOST_AUTO_TEST_CASE(insert_fails_when_full) {
+  for (uint32_t i = 0; i < 12; ++i) {
+    BOOST_TEST(SCInsert(&cache, i * 4, 4, i) == i + 1);
+  }
+
+  BOOST_TEST(SCInsert(&cache, 0x1000, 4, 0) == 0);
+  BOOST_TEST(SCFind(&cache, 11 * 4, 4, 11) == 12);
+}
+
+BOOST_AUTO_TEST_CASE(reset_forgets_segments) {
+  SCInsert(&cache, 0x1000, 64, 1234);
+  SCReset(&cache);
+
+  BOOST_TEST(SCFind(&cache, 0x1000, 64, 1234) == 0);
+  BOOST_TEST(SCInsert(&cache, 0x2000, 64, 1234) == 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_CASE(capacity_is_rounded_down_to_power_of_two) {
+  std::vector<SegmentCacheEntry> storage(10);
+  SegmentCache cache;
+  SCInit(&cache, storage.data(), storage.size());
+
+  // 3/4 of 8 slots may be used.
+  for (uint32_t i = 0; i < 6; ++i) {
+    BOOST_TEST(SCInsert(&cache, i * 4, 4, i) != 0);
+  }
+  BOOST_TEST(SCInsert(&cache, 0x1000, 4, 0) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(zero_capacity_cache_is_inert) {
+  SegmentCache cache;
+  SCInit(&cache, nullptr, 0);
+
+  BOOST_TEST(SCInsert(&cache, 0x1000, 4, 0) == 0);
+  BOOST_TEST(SCFind(&cache, 0x1000, 4, 0) == 0);
+}
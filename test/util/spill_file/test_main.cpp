@@ -0,0 +1,263 @@
+#define BOOST_TEST_MODULE SpillFileTests
+
+#include <unistd.h>
+
+#include <boost/test/unit_test.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "util/spill_file.h"
+
+static std::set<void*> allocations;
+static std::vector<std::pair<uint32_t, uint32_t>> writes;
+static uint32_t reads = 0;
+static bool fail_writes = false;
+
+static void* AllocProc(size_t sz) {
+  void* ret = malloc(sz);
+  allocations.insert(ret);
+  return ret;
+}
+
+static void FreeProc(void* buf) {
+  auto it = allocations.find(buf);
+  BOOST_REQUIRE(it != allocations.end());
+  allocations.erase(it);
+  free(buf);
+}
+
+static void* StdioOpen(const char* path) { return fopen(path, "w+b"); }
+
+static void StdioClose(void* file) { fclose(static_cast<FILE*>(file)); }
+
+static bool StdioWrite(void* file, uint32_t offset, const void* data,
+                       uint32_t size) {
+  writes.emplace_back(offset, size);
+  if (fail_writes) {
+    return false;
+  }
+  auto fp = static_cast<FILE*>(file);
+  return !fseek(fp, offset, SEEK_SET) && fwrite(data, 1, size, fp) == size;
+}
+
+static bool StdioRead(void* file, uint32_t offset, void* buffer,
+                      uint32_t size) {
+  ++reads;
+  auto fp = static_cast<FILE*>(file);
+  return !fseek(fp, offset, SEEK_SET) && fread(buffer, 1, size, fp) == size;
+}
+
+static const SpillFileIO kStdioIO = {StdioOpen, StdioClose, StdioWrite,
+                                     StdioRead};
+
+static void PopulateBuffer(uint8_t* buf, size_t len, uint8_t seed = 0) {
+  for (size_t i = 0; i < len; ++i) {
+    buf[i] = (i + seed) & 0xFF;
+  }
+}
+
+struct Fixture {
+  Fixture() {
+    char path_template[] = "/tmp/spill_file_test_XXXXXX";
+    int fd = mkstemp(path_template);
+    BOOST_REQUIRE(fd >= 0);
+    close(fd);
+    path = path_template;
+
+    allocations.clear();
+    writes.clear();
+    reads = 0;
+    fail_writes = false;
+  }
+
+  ~Fixture() { unlink(path.c_str()); }
+
+  std::string path;
+};
+
+BOOST_FIXTURE_TEST_SUITE(spill_file_suite, Fixture)
+
+BOOST_AUTO_TEST_CASE(zero_size_returns_null) {
+  auto sut = SFCreate(path.c_str(), 0, &kStdioIO, AllocProc, FreeProc);
+
+  BOOST_TEST(sut == nullptr);
+  BOOST_TEST(allocations.empty());
+}
+
+BOOST_AUTO_TEST_CASE(open_failure_returns_null) {
+  auto sut =
+      SFCreate("/nonexistent/dir/spill", 16, &kStdioIO, AllocProc, FreeProc);
+
+  BOOST_TEST(sut == nullptr);
+  BOOST_TEST(allocations.empty());
+}
+
+BOOST_AUTO_TEST_CASE(destroy_frees_resources) {
+  auto sut = SFCreate(path.c_str(), 16, &kStdioIO, AllocProc, FreeProc);
+  BOOST_TEST(!allocations.empty());
+
+  SFDestroy(sut);
+
+  BOOST_TEST(allocations.empty());
+}
+
+BOOST_AUTO_TEST_CASE(write_v_then_peek_preserves_order) {
+  auto sut = SFCreate(path.c_str(), 64, &kStdioIO, AllocProc, FreeProc);
+  uint8_t first[10];
+  uint8_t second[6];
+  PopulateBuffer(first, sizeof(first));
+  PopulateBuffer(second, sizeof(second), 10);
+  CBIOVec vecs[] = {{first, sizeof(first)}, {second, sizeof(second)}};
+
+  BOOST_TEST(SFWriteV(sut, vecs, 2));
+  BOOST_TEST(SFAvailable(sut) == 16);
+
+  uint8_t expected[16];
+  PopulateBuffer(expected, sizeof(expected));
+  uint8_t output[16] = {0};
+  BOOST_TEST(SFPeek(sut, output, sizeof(output)) == 16);
+  BOOST_TEST(memcmp(expected, output, sizeof(expected)) == 0);
+  BOOST_TEST(SFAvailable(sut) == 16);
+  SFDestroy(sut);
+}
+
+BOOST_AUTO_TEST_CASE(peek_is_clamped_to_available) {
+  auto sut = SFCreate(path.c_str(), 64, &kStdioIO, AllocProc, FreeProc);
+  uint8_t input[4] = {1, 2, 3, 4};
+  CBIOVec vec = {input, sizeof(input)};
+  SFWriteV(sut, &vec, 1);
+
+  uint8_t output[16] = {0};
+  BOOST_TEST(SFPeek(sut, output, sizeof(output)) == 4);
+  BOOST_TEST(memcmp(input, output, sizeof(input)) == 0);
+  SFDestroy(sut);
+}
+
+BOOST_AUTO_TEST_CASE(peek_when_empty_does_not_touch_file) {
+  auto sut = SFCreate(path.c_str(), 64, &kStdioIO, AllocProc, FreeProc);
+
+  uint8_t output[16] = {0};
+  BOOST_TEST(SFPeek(sut, output, sizeof(output)) == 0);
+  BOOST_TEST(reads == 0);
+  SFDestroy(sut);
+}
+
+BOOST_AUTO_TEST_CASE(consume_advances_read_position) {
+  auto sut = SFCreate(path.c_str(), 64, &kStdioIO, AllocProc, FreeProc);
+  uint8_t input[16];
+  PopulateBuffer(input, sizeof(input));
+  CBIOVec vec = {input, sizeof(input)};
+  SFWriteV(sut, &vec, 1);
+
+  BOOST_TEST(SFConsume(sut, 10));
+
+  uint8_t output[6] = {0};
+  BOOST_TEST(SFPeek(sut, output, sizeof(output)) == 6);
+  BOOST_TEST(memcmp(input + 10, output, sizeof(output)) == 0);
+  SFDestroy(sut);
+}
+
+BOOST_AUTO_TEST_CASE(consume_more_than_available_returns_false) {
+  auto sut = SFCreate(path.c_str(), 64, &kStdioIO, AllocProc, FreeProc);
+  uint8_t input[4] = {1, 2, 3, 4};
+  CBIOVec vec = {input, sizeof(input)};
+  SFWriteV(sut, &vec, 1);
+
+  BOOST_TEST(SFConsume(sut, 5) == false);
+  BOOST_TEST(SFAvailable(sut) == 4);
+  SFDestroy(sut);
+}
+
+BOOST_AUTO_TEST_CASE(write_beyond_max_size_writes_nothing) {
+  auto sut = SFCreate(path.c_str(), 16, &kStdioIO, AllocProc, FreeProc);
+  uint8_t input[17] = {0};
+  CBIOVec vec = {input, sizeof(input)};
+
+  BOOST_TEST(SFWriteV(sut, &vec, 1) == false);
+  BOOST_TEST(SFAvailable(sut) == 0);
+  BOOST_TEST(writes.empty());
+  SFDestroy(sut);
+}
+
+BOOST_AUTO_TEST_CASE(failed_write_publishes_nothing) {
+  auto sut = SFCreate(path.c_str(), 64, &kStdioIO, AllocProc, FreeProc);
+  uint8_t input[4] = {1, 2, 3, 4};
+  CBIOVec vec = {input, sizeof(input)};
+  fail_writes = true;
+
+  BOOST_TEST(SFWriteV(sut, &vec, 1) == false);
+  BOOST_TEST(SFAvailable(sut) == 0);
+  BOOST_TEST(SFFreeSpace(sut) == 64);
+  SFDestroy(sut);
+}
+
+BOOST_AUTO_TEST_CASE(draining_rewinds_file) {
+  auto sut = SFCreate(path.c_str(), 16, &kStdioIO, AllocProc, FreeProc);
+  uint8_t input[12];
+  PopulateBuffer(input, sizeof(input));
+  CBIOVec vec = {input, sizeof(input)};
+  SFWriteV(sut, &vec, 1);
+  BOOST_TEST(SFFreeSpace(sut) == 4);
+
+  // Space is not recovered until the file is completely drained.
+  SFConsume(sut, 8);
+  BOOST_TEST(SFFreeSpace(sut) == 4);
+  SFConsume(sut, 4);
+  BOOST_TEST(SFFreeSpace(sut) == 16);
+
+  PopulateBuffer(input, sizeof(input), 100);
+  BOOST_TEST(SFWriteV(sut, &vec, 1));
+  BOOST_TEST(writes.back().first == 0);
+  uint8_t output[12] = {0};
+  BOOST_TEST(SFPeek(sut, output, sizeof(output)) == 12);
+  BOOST_TEST(memcmp(input, output, sizeof(output)) == 0);
+  SFDestroy(sut);
+}
+
+BOOST_AUTO_TEST_CASE(interleaved_stream_is_written_sequentially) {
+  static constexpr uint32_t kRecordSize = 4093;
+  static constexpr uint32_t kNumRecords = 512;
+  auto sut = SFCreate(path.c_str(), kRecordSize * kNumRecords, &kStdioIO,
+                      AllocProc, FreeProc);
+
+  std::vector<uint8_t> record(kRecordSize);
+  std::vector<uint8_t> output(kRecordSize * 3);
+  uint32_t next_to_read = 0;
+  bool in_order = true;
+  for (uint32_t i = 0; i < kNumRecords; ++i) {
+    PopulateBuffer(record.data(), record.size(), i);
+    CBIOVec vec = {record.data(), kRecordSize};
+    BOOST_REQUIRE(SFWriteV(sut, &vec, 1));
+
+    // Drain roughly two records for every three written.
+    if (i % 3 == 2) {
+      uint32_t len = SFPeek(sut, output.data(), kRecordSize * 2);
+      for (uint32_t offset = 0; offset < len; offset += kRecordSize) {
+        std::vector<uint8_t> expected(kRecordSize);
+        PopulateBuffer(expected.data(), expected.size(), next_to_read++);
+        in_order = in_order && !memcmp(expected.data(), output.data() + offset,
+                                       kRecordSize);
+      }
+      SFConsume(sut, len);
+    }
+  }
+  BOOST_TEST(in_order);
+
+  // Appends never seek backwards, so the console only pays for sequential
+  // writes.
+  bool sequential = true;
+  for (size_t i = 1; i < writes.size(); ++i) {
+    sequential = sequential &&
+                 writes[i].first == writes[i - 1].first + writes[i - 1].second;
+  }
+  BOOST_TEST(sequential);
+  BOOST_TEST(SFAvailable(sut) == (kNumRecords - next_to_read) * kRecordSize);
+  SFDestroy(sut);
+}
+
+BOOST_AUTO_TEST_SUITE_END()